@@ -33,6 +33,13 @@ int main()
   red_led.on();
   sleep_ms(1000);
 
+  // Each pattern keeps running while we sleep
+  green_led.breathe( 2000 );
+  yellow_led.blink( 500 );
+  red_led.blink( 250 );
+  sleep_ms( 6000 );
+  red_led.off();
+
   while (true) {
     debug( "trying led test2\n" );
     test_button.update();
@@ -4,6 +4,8 @@
 // The top-level application for gathering and sending blood pressure
 // data
 
+#include "ble/hci_latency.h"
+#include "pico/cyw43_arch.h"
 #include "ui/state_machine.h"
 #include "utils/pt_cornell_rp2040_v1.h"
 #include <stdio.h>
@@ -19,10 +21,56 @@ static PT_THREAD( update_fsm( struct pt *pt ) )
 {
   PT_BEGIN( pt );
 
+#ifdef DEBUG
+  uint32_t last_latency_print = to_ms_since_boot( get_absolute_time() );
+  uint32_t wakes              = 0;
+  uint64_t awake_us           = 0;
+#endif
+
   // Wait until discovered
   while ( 1 ) {
+#ifdef DEBUG
+    uint64_t wake_us = time_us_64();
+#endif
+#if PICO_CYW43_ARCH_POLL
+    // BTstack only handles events when polled in this configuration
+    cyw43_arch_poll();
+#endif
+    // The MAC first, so update() sees what it's done
+    top.process_lorawan();
     top.update();
-    lorawan_process_timeout_ms( 10 );
+
+    // Sleep until the MAC's next timer, a button press counting, or the
+    // FSM's next deadline. Button edges, BTstack and the radio wake us
+    // sooner by interrupt, and the LEDs keep their patterns on their own
+    uint32_t next_ms  = MIN( top.process_lorawan(), top.update_due_ms() );
+    uint32_t input_ms = top.input_pending_ms();
+    if ( input_ms > 0 ) {
+      next_ms = MIN( next_ms, input_ms );
+    }
+#ifdef DEBUG
+    wakes++;
+    awake_us += time_us_64() - wake_us;
+#endif
+    if ( next_ms > 0 ) {
+      best_effort_wfe_or_timeout( make_timeout_time_ms( next_ms ) );
+    }
+
+#ifdef DEBUG
+    uint32_t curr_time = to_ms_since_boot( get_absolute_time() );
+    if ( curr_time - last_latency_print > 60000 ) {
+      hci_latency_print();
+      top.print_stats();
+
+      // How often we wake, and how long we stay awake
+      uint32_t period_ms = curr_time - last_latency_print;
+      printf( "[Main] %lu wakes in %lu ms, awake %.3f%%\n", wakes,
+              period_ms, awake_us / ( period_ms * 10.0 ) );
+      wakes              = 0;
+      awake_us           = 0;
+      last_latency_print = curr_time;
+    }
+#endif
   }
 
   PT_END( pt )
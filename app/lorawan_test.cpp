@@ -1,13 +1,32 @@
 // =======================================================================
 // lorawan_test.cpp
 // =======================================================================
-// A test for transmitting data with our LoRaWAN utilities
+// A test for transmitting data with our LoRaWAN utilities, driven by
+// events, and sleeping whenever the MAC doesn't need to run
 
 #include "lorawan/lorawan.h"
 #include <stdio.h>
 
 LoRaWAN my_lorawan;
 
+const char* event_names[NUM_LORAWAN_EVENTS] = {
+    "init done", "init failed", "joined", "tx done", "ack", "rx",
+};
+
+void on_event( lorawan_event_t event, void* arg )
+{
+  (void) arg;
+  printf( "Event: %s\n", event_names[event] );
+}
+
+// Run the MAC, then sleep until it next needs to run (or max_ms)
+void process( uint32_t max_ms )
+{
+  uint32_t next_ms = my_lorawan.process();
+  best_effort_wfe_or_timeout(
+      make_timeout_time_ms( MIN( next_ms, max_ms ) ) );
+}
+
 int main()
 {
   stdio_init_all();
@@ -15,17 +34,26 @@ int main()
   sleep_ms( 10000 );
 
   lorawan_debug( true );
+  my_lorawan.set_callback( on_event, nullptr );
 
   printf( "Trying to join...\n" );
   while ( !my_lorawan.try_join() ) {
-    lorawan_process_timeout_ms( 1000 );
+    process( 1000 );
   }
 
   uint8_t data[5] = { 0x69, 0x42, 0x00, 0x17, 0x38 };
 
   printf( "Trying to send...\n" );
   while ( !my_lorawan.try_send( data, 5 ) ) {
-    lorawan_process_timeout_ms( 1000 );
+    process( 1000 );
   }
   printf( "Data sent!\n" );
-}
\ No newline at end of file
+
+  // Idle for a minute to see what the MAC costs while there's nothing to
+  // do
+  absolute_time_t idle_end = make_timeout_time_ms( 60000 );
+  while ( !time_reached( idle_end ) ) {
+    process( 1000 );
+  }
+  my_lorawan.print_stats();
+}
@@ -0,0 +1,74 @@
+// =======================================================================
+// server_bench.cpp
+// =======================================================================
+// A benchmark of the local sync path - fills the reading history, then
+// reports records per second each time a phone subscribes to the pending
+// readings, stepping through different MTU caps
+
+#include "ble/omron.h"
+#include "ble/server.h"
+#include "utils/pt_cornell_rp2040_v1.h"
+#include <stdio.h>
+
+// The Omron client sets up the BTstack layers the server relies on
+Omron         blood_pressure;
+ReadingServer server;
+
+const uint16_t mtu_caps[]   = { 23, 64, 128, 185, SERVER_MAX_MTU };
+const int      num_mtu_caps = sizeof( mtu_caps ) / sizeof( mtu_caps[0] );
+int            curr_mtu_cap = 0;
+
+// -----------------------------------------------------------------------
+// report_syncs
+// -----------------------------------------------------------------------
+// A thread to print the statistics of each completed sync
+
+static PT_THREAD( report_syncs( struct pt *pt ) )
+{
+  PT_BEGIN( pt );
+
+  while ( 1 ) {
+    PT_YIELD_UNTIL( pt, server.sync_done );
+    server.sync_done = false;
+    server.print_sync_stats();
+
+    // Next subscription uses the next MTU cap
+    curr_mtu_cap = ( curr_mtu_cap + 1 ) % num_mtu_caps;
+    server.set_mtu_cap( mtu_caps[curr_mtu_cap] );
+    printf( "Resubscribe to benchmark MTU %d...\n",
+            mtu_caps[curr_mtu_cap] );
+  }
+  PT_END( pt );
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main()
+{
+  stdio_init_all();
+  printf( "GATT Server Sync Benchmark\n" );
+
+  // Delay a bit to set up printf connection
+  sleep_ms( 10000 );
+
+  // Fill the history with synthetic readings
+  omron_data_t reading;
+  for ( int i = 0; i < SERVER_HISTORY_LENGTH; i++ ) {
+    reading.sys_pressure = 110 + ( i % 40 );
+    reading.dia_pressure = 70 + ( i % 20 );
+    reading.art_pressure = 85 + ( i % 25 );
+    reading.bpm          = 60 + ( i % 30 );
+    reading.timestamp    = 0;
+    server.add_reading( reading );
+  }
+
+  server.set_mtu_cap( mtu_caps[curr_mtu_cap] );
+  server.start();
+  printf( "Subscribe to pending readings to benchmark MTU %d...\n",
+          mtu_caps[curr_mtu_cap] );
+
+  pt_add_thread( report_syncs );
+  pt_schedule_start;
+}
@@ -0,0 +1,32 @@
+// =======================================================================
+// ble_lock.h
+// =======================================================================
+// A scoped lock for calling into BTstack from outside its handlers
+//
+// BTstack runs from the CYW43 async context (in the background, from a
+// low-priority IRQ), so any call into it from the main loop must hold
+// the context's lock. The lock is recursive, so it's also safe to take
+// from inside a handler.
+
+#ifndef BLE_BLE_LOCK_H
+#define BLE_BLE_LOCK_H
+
+#include "pico/async_context.h"
+#include "pico/cyw43_arch.h"
+
+class BleLock {
+ public:
+  BleLock()
+  {
+    async_context_acquire_lock_blocking( cyw43_arch_async_context() );
+  }
+  ~BleLock()
+  {
+    async_context_release_lock( cyw43_arch_async_context() );
+  }
+
+  BleLock( const BleLock& )            = delete;
+  BleLock& operator=( const BleLock& ) = delete;
+};
+
+#endif  // BLE_BLE_LOCK_H
@@ -33,7 +33,8 @@
 #define HCI_OUTGOING_PRE_BUFFER_SIZE 4
 #define HCI_ACL_PAYLOAD_SIZE ( 255 + 4 )
 #define HCI_ACL_CHUNK_SIZE_ALIGNMENT 4
-#define MAX_NR_HCI_CONNECTIONS 1
+// One connection to the cuff (central), one from a phone (peripheral)
+#define MAX_NR_HCI_CONNECTIONS 2
 #define MAX_NR_SM_LOOKUP_ENTRIES 3
 #define MAX_NR_WHITELIST_ENTRIES 16
 #define MAX_NR_LE_DEVICE_DB_ENTRIES 16
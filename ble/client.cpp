@@ -4,7 +4,9 @@
 // Definitions of our BLE client functions
 
 #include "ble/client.h"
+#include "ble/hci_latency.h"
 #include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
 #include "utils/debug.h"
 #include <stdio.h>
 
@@ -32,6 +34,14 @@ void global_hci_event_handler( uint8_t packet_type, uint16_t channel,
   }
 }
 
+void global_background_timer_handler( btstack_timer_source_t* ts )
+{
+  (void) ts;
+  if ( curr_client ) {
+    curr_client->background_timer_handler();
+  }
+}
+
 // -----------------------------------------------------------------------
 // RAII Management (Constructor, Destructor)
 // -----------------------------------------------------------------------
@@ -44,15 +54,27 @@ void Client::reset()
   curr_char_descr_idx              = 0;
   curr_total_char_idx              = 0;
   total_characteristics_discovered = 0;
+  att_retries                      = 0;
 }
 
 Client::Client()
     : state( TC_OFF ),
+      scan_requested( false ),
+      radio_kept_on( false ),
+      background_enabled( false ),
+      background_scan( false ),
+      whitelist_populated( false ),
+      background_tier( SCAN_TIER_STALE ),
+      last_seen_ms( 0 ),
+      ever_seen( false ),
+      connection_handle( HCI_CON_HANDLE_INVALID ),
       hci_event_callback( global_hci_event_handler ),
       gatt_client_event_callback( global_gatt_client_event_handler )
 {
   curr_client = this;
   reset();
+  checkpoint.valid   = false;
+  checkpoint.resumes = 0;
   for ( int i = 0; i < MAX_SERVICES; i++ ) {
     num_characteristics_discovered[i] = 0;
   }
@@ -60,6 +82,7 @@ Client::Client()
   // Initialize CYW43 Architecture (should check if non-zero, but avoid in
   // constructor)
   cyw43_arch_init();
+  hci_latency_init();
 
   // Initialize L2CAP and Security Manager
   l2cap_init();
@@ -89,14 +112,30 @@ Client::~Client()
 // -----------------------------------------------------------------------
 // Connecting and disconnecting from server
 // -----------------------------------------------------------------------
-// Just change the power on the interface
+// Just change the power on the interface (scanning starts once it's up)
 
 void Client::connect_to_server()
 {
-  hci_power_control( HCI_POWER_ON );
+  // Already picked up by the background scan
+  if ( discovered() ) {
+    return;
+  }
+
+  scan_requested  = true;
+  background_scan = false;
+  if ( hci_get_state() == HCI_STATE_WORKING ) {
+    // Swap a running background scan for a full-duty one
+    if ( state == TC_W4_SCAN_RESULT ) {
+      gap_stop_scan();
+    }
+    start();
+  }
+  else {
+    hci_power_control( HCI_POWER_ON );
+  }
 }
 
-void Client::disconnect_from_server()
+void Client::release_connection()
 {
   connection_handle = HCI_CON_HANDLE_INVALID;
   if ( listener_registered ) {
@@ -105,8 +144,112 @@ void Client::disconnect_from_server()
         &notification_listener );
   }
   reset();
-  state = TC_OFF;
-  hci_power_control( HCI_POWER_SLEEP );
+}
+
+void Client::disconnect_from_server()
+{
+  release_connection();
+  state          = TC_OFF;
+  scan_requested = false;
+  if ( !radio_kept_on ) {
+    hci_power_control( HCI_POWER_SLEEP );
+  }
+}
+
+void Client::keep_radio_on( bool keep_on )
+{
+  radio_kept_on = keep_on;
+}
+
+// -----------------------------------------------------------------------
+// Background sync
+// -----------------------------------------------------------------------
+// Keep a low duty-cycle whitelist scan running whenever we're not
+// connected, so a bonded cuff is picked up as soon as it advertises
+
+void Client::start_background_sync()
+{
+  background_enabled = true;
+  radio_kept_on      = true;
+
+  btstack_run_loop_set_timer_handler( &background_timer,
+                                      global_background_timer_handler );
+  btstack_run_loop_set_timer( &background_timer, BACKGROUND_TIER_CHECK_MS );
+  btstack_run_loop_add_timer( &background_timer );
+
+  if ( state == TC_OFF ) {
+    scan_requested  = true;
+    background_scan = true;
+    if ( hci_get_state() == HCI_STATE_WORKING ) {
+      start();
+    }
+    else {
+      hci_power_control( HCI_POWER_ON );
+    }
+  }
+}
+
+void Client::stop_background_sync()
+{
+  background_enabled = false;
+  btstack_run_loop_remove_timer( &background_timer );
+  if ( background_scan && ( state == TC_W4_SCAN_RESULT ) ) {
+    gap_stop_scan();
+    state          = TC_OFF;
+    scan_requested = false;
+  }
+}
+
+background_scan_tier_t Client::current_background_tier()
+{
+  if ( !ever_seen ) {
+    return SCAN_TIER_STALE;
+  }
+  uint32_t since_seen =
+      to_ms_since_boot( get_absolute_time() ) - last_seen_ms;
+  if ( since_seen < BACKGROUND_RECENT_MS ) {
+    return SCAN_TIER_RECENT;
+  }
+  if ( since_seen < BACKGROUND_ACTIVE_MS ) {
+    return SCAN_TIER_ACTIVE;
+  }
+  return SCAN_TIER_STALE;
+}
+
+void Client::populate_whitelist()
+{
+  // Add every bonded device; the controller then only reports those
+  bd_addr_t addr;
+  sm_key_t  irk;
+  int       addr_type;
+
+  gap_whitelist_clear();
+  whitelist_populated = false;
+  for ( int i = 0; i < le_device_db_max_count(); i++ ) {
+    le_device_db_info( i, &addr_type, addr, irk );
+    if ( addr_type == BD_ADDR_TYPE_UNKNOWN ) {
+      continue;
+    }
+    gap_whitelist_add( (bd_addr_type_t) addr_type, addr );
+    whitelist_populated = true;
+  }
+}
+
+void Client::background_timer_handler()
+{
+  if ( !background_enabled ) {
+    return;
+  }
+
+  // Restart the scan if the cuff's recency moved us to another tier
+  if ( background_scan && ( state == TC_W4_SCAN_RESULT ) &&
+       ( current_background_tier() != background_tier ) ) {
+    gap_stop_scan();
+    start_background_scan();
+  }
+
+  btstack_run_loop_set_timer( &background_timer, BACKGROUND_TIER_CHECK_MS );
+  btstack_run_loop_add_timer( &background_timer );
 }
 
 bool Client::ready()
@@ -140,8 +283,25 @@ void Client::off()
 #define GAP_SCAN_INTERVAL 0x0030  // 0x30 * 6.25ms = 300ms
 #define GAP_SCAN_WINDOW 0x0030
 
+// Background scan parameters for each tier (units of 0.625ms)
+const uint16_t background_scan_interval[NUM_SCAN_TIERS] = {
+    0x01E0,  // 300ms
+    0x0400,  // 640ms
+    0x1000,  // 2.56s
+};
+const uint16_t background_scan_window[NUM_SCAN_TIERS] = {
+    0x0060,  // 60ms (20%)
+    0x0030,  // 30ms (~5%)
+    0x0030,  // 30ms (~1%)
+};
+
 void Client::start()
 {
+  if ( background_scan ) {
+    start_background_scan();
+    return;
+  }
+
   state = TC_W4_SCAN_RESULT;
 
   // Start GAP scan
@@ -151,6 +311,23 @@ void Client::start()
   gap_start_scan();
 }
 
+void Client::start_background_scan()
+{
+  state           = TC_W4_SCAN_RESULT;
+  background_tier = current_background_tier();
+  populate_whitelist();
+
+  // Without a bond, fall back to filtering advertisements ourselves
+  debug( "[BLE] Starting background scan (tier %d, %s)...\n",
+         background_tier, whitelist_populated ? "whitelist" : "all" );
+  gap_set_scan_params( GAP_SCAN_PASSIVE,
+                       background_scan_interval[background_tier],
+                       background_scan_window[background_tier],
+                       whitelist_populated ? GAP_SCAN_WHITELIST
+                                           : GAP_SCAN_ALL );
+  gap_start_scan();
+}
+
 void Client::connect()
 {
   debug( "[BLE] Connecting to address %s...\n",
@@ -309,12 +486,15 @@ void Client::read_characteristic_config()
   curr_total_char_idx += num_characteristics_discovered[curr_service_idx];
   curr_service_idx++;
   if ( curr_service_idx < num_services_discovered ) {
+    save_checkpoint();
     characteristic_discovery();
     return;
   }
 
   // If none left to get, move to notifications
   debug( "[BLE] All characteristics discovered!\n" );
+  checkpoint.valid   = false;
+  checkpoint.resumes = 0;
   state               = TC_W4_READY;
   listener_registered = true;
   gatt_client_listen_for_characteristic_value_updates(
@@ -323,6 +503,97 @@ void Client::read_characteristic_config()
   after_discovery();
 }
 
+// -----------------------------------------------------------------------
+// Discovery recovery
+// -----------------------------------------------------------------------
+
+void Client::save_checkpoint()
+{
+  checkpoint.valid = true;
+  memcpy( checkpoint.addr, server_addr, sizeof( bd_addr_t ) );
+  checkpoint.num_services         = num_services_discovered;
+  checkpoint.services_done        = curr_service_idx;
+  checkpoint.characteristics_done = curr_total_char_idx;
+}
+
+bool Client::resume_discovery()
+{
+  if ( !checkpoint.valid ) {
+    return false;
+  }
+
+  // Progress from another server is no use to us
+  if ( bd_addr_cmp( checkpoint.addr, server_addr ) != 0 ) {
+    checkpoint.valid = false;
+    return false;
+  }
+
+  // Restore the completed services, and redo the one we were in
+  debug( "[BLE] Resuming discovery at service %d of %d...\n",
+         checkpoint.services_done, checkpoint.num_services );
+  num_services_discovered          = checkpoint.num_services;
+  curr_service_idx                 = checkpoint.services_done;
+  curr_total_char_idx              = checkpoint.characteristics_done;
+  total_characteristics_discovered = checkpoint.characteristics_done;
+  characteristic_discovery();
+  return true;
+}
+
+void Client::retry_query()
+{
+  switch ( state ) {
+    case TC_W4_SERVICE_RESULT:
+      curr_service_idx = 0;
+      service_discovery();
+      break;
+    case TC_W4_CHARACTERISTIC_RESULT:
+      characteristic_discovery();
+      break;
+    case TC_W4_CHARACTERISTIC_DESCRIPTOR:
+      curr_char_descr_idx = 0;
+      characteristic_descriptor_discovery();
+      break;
+    case TC_W4_CHARACTERISTIC_DESCRIPTION:
+      characteristic_description_discovery();
+      break;
+    case TC_W4_CHARACTERISTIC_VALUE:
+      read_characteristic_value();
+      break;
+    case TC_W4_CHARACTERISTIC_CONFIG:
+      read_characteristic_config();
+      break;
+    default:
+      break;
+  }
+}
+
+// Check the status of a completed query. Returns true if it failed, in
+// which case the query has been retried or the link is being dropped
+bool Client::query_failed( uint8_t* packet )
+{
+  uint8_t att_status = gatt_event_query_complete_get_att_status( packet );
+  if ( att_status == ATT_ERROR_SUCCESS ) {
+    att_retries = 0;
+    return false;
+  }
+  printf( "[BLE] ATT Error 0x%02x in state %d (attempt %d of %d)\n",
+          att_status, state, att_retries + 1,
+          DISCOVERY_MAX_ATT_RETRIES + 1 );
+
+  // Nothing more can be sent after a timeout or disconnect
+  bool link_lost = ( att_status == ATT_ERROR_TIMEOUT ) ||
+                   ( att_status == ATT_ERROR_HCI_DISCONNECT_RECEIVED );
+  if ( !link_lost && ( att_retries < DISCOVERY_MAX_ATT_RETRIES ) ) {
+    att_retries++;
+    retry_query();
+    return true;
+  }
+
+  // Drop the link; the disconnection resumes from the checkpoint
+  gap_disconnect( connection_handle );
+  return true;
+}
+
 // -----------------------------------------------------------------------
 // gatt_client_event_handler
 // -----------------------------------------------------------------------
@@ -336,6 +607,7 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
   (void) packet_type;
   (void) channel;
   (void) size;
+  hci_latency_record();
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Check if it's a notification or indication
@@ -356,7 +628,6 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // First called when in TC_W4_SERVICE_RESULT from hci_event_handler
 
-  uint8_t        att_status;
   uint32_t       description_length;
   const uint8_t* description;
   uint32_t       value_length;
@@ -382,18 +653,13 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
         // Finished with service result (discover characteristics)
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
         case GATT_EVENT_QUERY_COMPLETE:
-          num_services_discovered = curr_service_idx;
-          curr_service_idx        = 0;
-
           // Make sure no errors
-          att_status = gatt_event_query_complete_get_att_status( packet );
-          if ( att_status != ATT_ERROR_SUCCESS ) {
-            printf( "SERVICE_QUERY_RESULT, ATT Error 0x%02x (%s:%d).\n",
-                    att_status, __FILE__, __LINE__ );
-            gap_disconnect( connection_handle );
-            disconnect_from_server();
+          if ( query_failed( packet ) ) {
             break;
           }
+          num_services_discovered = curr_service_idx;
+          curr_service_idx        = 0;
+          save_checkpoint();
           characteristic_discovery();
 
         default:
@@ -432,22 +698,16 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
         // Done with characteristics (move to descriptors)
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
         case GATT_EVENT_QUERY_COMPLETE:
+          // Make sure no errors
+          if ( query_failed( packet ) ) {
+            break;
+          }
           num_characteristics_discovered[curr_service_idx] =
               curr_char_idx;
           total_characteristics_discovered += curr_char_idx;
 
           curr_char_idx       = 0;
           curr_char_descr_idx = 0;
-
-          // Make sure no errors
-          att_status = gatt_event_query_complete_get_att_status( packet );
-          if ( att_status != ATT_ERROR_SUCCESS ) {
-            printf( "SERVICE_QUERY_RESULT, ATT Error 0x%02x (%s:%d).\n",
-                    att_status, __FILE__, __LINE__ );
-            gap_disconnect( connection_handle );
-            disconnect_from_server();
-            break;
-          }
           characteristic_descriptor_discovery();
           break;
 
@@ -476,17 +736,11 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
         // Done with descriptors
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
         case GATT_EVENT_QUERY_COMPLETE:
-          curr_char_idx++;
-          curr_char_descr_idx = 0;
-
-          att_status = gatt_event_query_complete_get_att_status( packet );
-          if ( att_status != ATT_ERROR_SUCCESS ) {
-            printf( "SERVICE_QUERY_RESULT, ATT Error 0x%02x (%s:%d).\n",
-                    att_status, __FILE__, __LINE__ );
-            gap_disconnect( connection_handle );
-            disconnect_from_server();
+          if ( query_failed( packet ) ) {
             break;
           }
+          curr_char_idx++;
+          curr_char_descr_idx = 0;
 
           // Discover next characteristic, if any remaining
           if ( curr_char_idx <
@@ -537,12 +791,7 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
         // Done with description
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
         case GATT_EVENT_QUERY_COMPLETE:
-          att_status = gatt_event_query_complete_get_att_status( packet );
-          if ( att_status != ATT_ERROR_SUCCESS ) {
-            printf( "SERVICE_QUERY_RESULT, ATT Error 0x%02x (%s:%d).\n",
-                    att_status, __FILE__, __LINE__ );
-            gap_disconnect( connection_handle );
-            disconnect_from_server();
+          if ( query_failed( packet ) ) {
             break;
           }
           curr_char_idx++;
@@ -597,12 +846,7 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
         // Done with value
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
         case GATT_EVENT_QUERY_COMPLETE:
-          att_status = gatt_event_query_complete_get_att_status( packet );
-          if ( att_status != ATT_ERROR_SUCCESS ) {
-            printf( "SERVICE_QUERY_RESULT, ATT Error 0x%02x (%s:%d).\n",
-                    att_status, __FILE__, __LINE__ );
-            gap_disconnect( connection_handle );
-            disconnect_from_server();
+          if ( query_failed( packet ) ) {
             break;
           }
           curr_char_idx++;
@@ -651,12 +895,7 @@ void Client::gatt_client_event_handler( uint8_t  packet_type,
         // Done with configuration
         // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
         case GATT_EVENT_QUERY_COMPLETE:
-          att_status = gatt_event_query_complete_get_att_status( packet );
-          if ( att_status != ATT_ERROR_SUCCESS ) {
-            printf( "SERVICE_QUERY_RESULT, ATT Error 0x%02x (%s:%d).\n",
-                    att_status, __FILE__, __LINE__ );
-            gap_disconnect( connection_handle );
-            disconnect_from_server();
+          if ( query_failed( packet ) ) {
             break;
           }
           curr_char_idx++;
@@ -964,6 +1203,7 @@ void Client::hci_event_handler( uint8_t packet_type, uint16_t channel,
   // Confirm that it's an event packet
   if ( packet_type != HCI_EVENT_PACKET )
     return;
+  hci_latency_record();
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Handle different event types
@@ -977,13 +1217,15 @@ void Client::hci_event_handler( uint8_t packet_type, uint16_t channel,
     // Startup
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     case BTSTACK_EVENT_STATE:
-      // Start listening if the chip is working
+      // Start listening if the chip is working (and we asked to)
       if ( btstack_event_state_get_state( packet ) ==
            HCI_STATE_WORKING ) {
         gap_local_bd_addr( local_addr );
         debug( "[BLE] Up and running on %s...\n",
                bd_addr_to_str( local_addr ) );
-        start();
+        if ( scan_requested ) {
+          start();
+        }
       }
       else {
         off();
@@ -1001,6 +1243,8 @@ void Client::hci_event_handler( uint8_t packet_type, uint16_t channel,
       // Confirm it's the service we want
       if ( !correct_service( packet ) )
         return;
+      last_seen_ms = to_ms_since_boot( get_absolute_time() );
+      ever_seen    = true;
 
       // Get the address of the server we're connecting to
       gap_event_advertising_report_get_address( packet, server_addr );
@@ -1010,6 +1254,7 @@ void Client::hci_event_handler( uint8_t packet_type, uint16_t channel,
 
       // Stop scanning and connect
       gap_stop_scan();
+      checkpoint.resumes = 0;
       connect();
       break;
 
@@ -1022,30 +1267,61 @@ void Client::hci_event_handler( uint8_t packet_type, uint16_t channel,
            HCI_SUBEVENT_LE_CONNECTION_COMPLETE )
         return;
 
-      // Only handle if we were connecting
+      // Only handle if we were connecting, and ignore peers connecting
+      // to our own GATT server
       if ( state != TC_W4_CONNECT )
         return;
+      if ( hci_subevent_le_connection_complete_get_role( packet ) !=
+           HCI_ROLE_MASTER )
+        return;
 
-      // Initiate pairing
+      // Initiate pairing, picking up any interrupted discovery
       connection_handle =
           hci_subevent_le_connection_complete_get_connection_handle(
               packet );
-      service_discovery();
+      att_retries = 0;
+      if ( !resume_discovery() ) {
+        service_discovery();
+      }
       break;
 
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     // Disconnect
     // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
     case HCI_EVENT_DISCONNECTION_COMPLETE:
+      // Only handle our own connection
+      if ( hci_event_disconnection_complete_get_connection_handle(
+               packet ) != connection_handle )
+        return;
+
       // Unregister listener, if necessary
       debug( "[BLE] Disconnecting from %s...\n",
              bd_addr_to_str( server_addr ) );
+
+      // If we lost the link mid-discovery, reconnect straight away and
+      // resume (a bounded number of times)
+      if ( discovered() && !ready() && checkpoint.valid &&
+           ( checkpoint.resumes < DISCOVERY_MAX_RESUMES ) ) {
+        checkpoint.resumes++;
+        debug( "[BLE] Reconnecting to resume discovery (%d of %d)...\n",
+               checkpoint.resumes, DISCOVERY_MAX_RESUMES );
+        release_connection();
+        connect();
+        break;
+      }
       disconnect_from_server();
 
       // If we're not off, start listening again
       if ( state != TC_OFF & should_reconnect() ) {
         start();
       }
+
+      // Otherwise, go back to waiting for the server in the background
+      else if ( background_enabled ) {
+        scan_requested  = true;
+        background_scan = true;
+        start();
+      }
       break;
 
     default:
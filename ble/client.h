@@ -51,6 +51,50 @@ enum gc_state_t {
 enum gap_scan_type_t { GAP_SCAN_PASSIVE = 0, GAP_SCAN_ACTIVE = 1 };
 enum gap_scan_policy_t { GAP_SCAN_ALL = 0, GAP_SCAN_WHITELIST = 1 };
 
+// -----------------------------------------------------------------------
+// Background scan duty cycle
+// -----------------------------------------------------------------------
+// Background scans for a bonded cuff get cheaper the longer it's been
+// since the cuff was last seen
+
+enum background_scan_tier_t {
+  SCAN_TIER_RECENT = 0,  // Seen within BACKGROUND_RECENT_MS
+  SCAN_TIER_ACTIVE,      // Seen within BACKGROUND_ACTIVE_MS
+  SCAN_TIER_STALE,       // Not seen for longer (or never)
+  NUM_SCAN_TIERS
+};
+
+// Age thresholds for the tiers
+#define BACKGROUND_RECENT_MS ( 10 * 60 * 1000 )
+#define BACKGROUND_ACTIVE_MS ( 2 * 60 * 60 * 1000 )
+
+// How often to re-evaluate the tier while scanning
+#define BACKGROUND_TIER_CHECK_MS 30000
+
+// -----------------------------------------------------------------------
+// Discovery recovery
+// -----------------------------------------------------------------------
+// Failed ATT queries are retried on the same connection a few times
+// before we drop the link. Progress is checkpointed after each service,
+// so a reconnect to the same (bonded) server resumes from there instead
+// of starting over - the attribute handles don't change between
+// connections to a bonded device
+
+// Retries of a failed ATT query before dropping the link
+#define DISCOVERY_MAX_ATT_RETRIES 3
+
+// Immediate reconnects to resume an interrupted discovery
+#define DISCOVERY_MAX_RESUMES 3
+
+typedef struct {
+  bool      valid;
+  bd_addr_t addr;                  // Server the progress belongs to
+  int       num_services;          // Services found by service discovery
+  int       services_done;         // Services fully discovered
+  int       characteristics_done;  // Characteristics in those services
+  int       resumes;               // Reconnects made to resume
+} discovery_checkpoint_t;
+
 // -----------------------------------------------------------------------
 // Two descriptors per characteristic
 // -----------------------------------------------------------------------
@@ -111,6 +155,15 @@ class Client {
   void connect_to_server();
   void disconnect_from_server();
 
+  // Keep the radio powered after disconnecting (e.g. when also acting
+  // as a GATT server)
+  void keep_radio_on( bool keep_on );
+
+  // Continuously scan (at a low duty cycle) for bonded servers, and
+  // connect as soon as one advertises
+  void start_background_sync();
+  void stop_background_sync();
+
   bool discovered();
 
   // Check whether we're done discovery
@@ -127,6 +180,19 @@ class Client {
   gc_state_t                             state;
   btstack_packet_callback_registration_t hci_event_callback_registration;
 
+  // Whether a scan was requested, and whether to leave the radio on
+  bool scan_requested;
+  bool radio_kept_on;
+
+  // Background scanning
+  bool                   background_enabled;  // Scan when disconnected
+  bool                   background_scan;     // Current scan is background
+  bool                   whitelist_populated;
+  background_scan_tier_t background_tier;
+  uint32_t               last_seen_ms;  // Last time our server advertised
+  bool                   ever_seen;
+  btstack_timer_source_t background_timer;
+
   // Address of server we're connected to
   bd_addr_t      server_addr;
   bd_addr_type_t server_addr_type;
@@ -163,6 +229,10 @@ class Client {
   int curr_total_char_idx;
   int curr_char_descr_idx;
 
+  // Discovery recovery
+  discovery_checkpoint_t checkpoint;
+  int                    att_retries;  // Retries of the current query
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Protected functions
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -171,6 +241,9 @@ class Client {
   void reset();
   void off();
   void start();
+  void start_background_scan();
+  background_scan_tier_t current_background_tier();
+  void                   populate_whitelist();
   void connect();
   void service_discovery();
   void characteristic_discovery();
@@ -179,6 +252,13 @@ class Client {
   void read_characteristic_value();
   void read_characteristic_config();
 
+  // Helper functions for discovery recovery
+  void release_connection();
+  void save_checkpoint();
+  bool resume_discovery();
+  void retry_query();
+  bool query_failed( uint8_t* packet );
+
   void ( *hci_event_callback )( uint8_t packet_type, uint16_t channel,
                                 uint8_t* packet, uint16_t size );
   void ( *gatt_client_event_callback )( uint8_t  packet_type,
@@ -189,6 +269,7 @@ class Client {
   // Event handlers
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  public:
+  void background_timer_handler();
   void gatt_client_event_handler( uint8_t packet_type, uint16_t channel,
                                   uint8_t* packet, uint16_t size );
   void gatt_client_notification_handler( uint8_t* packet );
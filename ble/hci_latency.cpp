@@ -0,0 +1,148 @@
+// =======================================================================
+// hci_latency.cpp
+// =======================================================================
+// Definitions of our HCI event latency instrumentation
+
+#include "ble/hci_latency.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+
+#ifndef CYW43_PIN_WL_HOST_WAKE
+#define CYW43_PIN_WL_HOST_WAKE 24
+#endif
+
+// -----------------------------------------------------------------------
+// Global state
+// -----------------------------------------------------------------------
+
+static volatile uint32_t   pending_wake_us = 0;
+static volatile bool       wake_pending    = false;
+static hci_latency_stats_t stats;
+
+// -----------------------------------------------------------------------
+// Host-wake interrupt
+// -----------------------------------------------------------------------
+// The CYW43 driver owns the host-wake pin through its own raw GPIO
+// handler, so ours is a plain shared handler on the bank's interrupt,
+// which claims no pins (a second raw handler on the pin would trip the
+// SDK's assert). It runs ahead of the driver's, and only timestamps the
+// wake, leaving acknowledging it to the driver
+
+static void host_wake_irq_handler()
+{
+  if ( ( gpio_get_irq_event_mask( CYW43_PIN_WL_HOST_WAKE ) &
+         GPIO_IRQ_LEVEL_HIGH ) == 0 ) {
+    return;
+  }
+
+  // Only keep the first wake until a handler consumes it, unless it's
+  // gone stale
+  uint32_t now = time_us_32();
+  if ( !wake_pending || ( now - pending_wake_us > HCI_LATENCY_EXPIRE_US ) ) {
+    pending_wake_us = now;
+    wake_pending    = true;
+  }
+}
+
+void hci_latency_init()
+{
+  hci_latency_reset();
+  irq_add_shared_handler( IO_IRQ_BANK0, host_wake_irq_handler,
+                          PICO_SHARED_IRQ_HANDLER_HIGHEST_ORDER_PRIORITY );
+  irq_set_enabled( IO_IRQ_BANK0, true );
+}
+
+// -----------------------------------------------------------------------
+// Recording
+// -----------------------------------------------------------------------
+
+void hci_latency_record()
+{
+  uint32_t now = time_us_32();
+
+  uint32_t irq_state = save_and_disable_interrupts();
+  bool     pending   = wake_pending;
+  uint32_t wake_us   = pending_wake_us;
+  wake_pending       = false;
+  restore_interrupts( irq_state );
+
+  // Events without a new wake were delivered in the same batch
+  if ( !pending ) {
+    return;
+  }
+
+  // A wake whose packets never reached our handlers (ACL data BTstack
+  // answers itself, say) isn't this event's
+  uint32_t latency = now - wake_us;
+  if ( latency > HCI_LATENCY_EXPIRE_US ) {
+    stats.stale++;
+    return;
+  }
+  stats.count++;
+  stats.total_us += latency;
+  if ( latency < stats.min_us ) {
+    stats.min_us = latency;
+  }
+  if ( latency > stats.max_us ) {
+    stats.max_us = latency;
+  }
+
+  int bucket = 0;
+  while ( ( bucket < HCI_LATENCY_BUCKETS - 1 ) &&
+          ( latency >= ( 2u << bucket ) ) ) {
+    bucket++;
+  }
+  stats.histogram[bucket]++;
+}
+
+// -----------------------------------------------------------------------
+// Reporting
+// -----------------------------------------------------------------------
+
+const hci_latency_stats_t* hci_latency_stats()
+{
+  return &stats;
+}
+
+void hci_latency_reset()
+{
+  stats.count    = 0;
+  stats.stale    = 0;
+  stats.min_us   = UINT32_MAX;
+  stats.max_us   = 0;
+  stats.total_us = 0;
+  for ( int i = 0; i < HCI_LATENCY_BUCKETS; i++ ) {
+    stats.histogram[i] = 0;
+  }
+}
+
+void hci_latency_print()
+{
+#if PICO_CYW43_ARCH_POLL
+  const char* mode = "polled";
+#else
+  const char* mode = "background";
+#endif
+
+  if ( stats.count == 0 ) {
+    printf( "[BLE] HCI latency (%s): no events (%lu stale wakes)\n", mode,
+            (unsigned long) stats.stale );
+    return;
+  }
+
+  printf( "[BLE] HCI latency (%s): %lu events, min %lu us, avg %lu us, "
+          "max %lu us, %lu stale wakes\n",
+          mode, (unsigned long) stats.count, (unsigned long) stats.min_us,
+          (unsigned long) ( stats.total_us / stats.count ),
+          (unsigned long) stats.max_us, (unsigned long) stats.stale );
+  for ( int i = 0; i < HCI_LATENCY_BUCKETS; i++ ) {
+    if ( stats.histogram[i] != 0 ) {
+      printf( "  < %6u us: %lu\n", 2u << i,
+              (unsigned long) stats.histogram[i] );
+    }
+  }
+}
@@ -0,0 +1,41 @@
+// =======================================================================
+// hci_latency.h
+// =======================================================================
+// Instrumentation of the latency from the CYW43 signalling an event (its
+// host-wake interrupt) to our BTstack handlers running
+//
+// This works for both the background (IRQ-driven) and polled BTstack
+// integrations, so the two can be compared directly
+
+#ifndef BLE_HCI_LATENCY_H
+#define BLE_HCI_LATENCY_H
+
+#include <cstdint>
+
+// Number of power-of-two latency histogram buckets (1us to 2^N us)
+#define HCI_LATENCY_BUCKETS 16
+
+// A wake this old with no event to show for it is dropped, not counted
+#define HCI_LATENCY_EXPIRE_US 100000
+
+typedef struct {
+  uint32_t count;
+  uint32_t stale;  // Wakes dropped for being older than the expiry
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t histogram[HCI_LATENCY_BUCKETS];
+} hci_latency_stats_t;
+
+// Start timestamping host-wake interrupts (call after cyw43_arch_init)
+void hci_latency_init();
+
+// Call at the start of an event handler to record its latency
+void hci_latency_record();
+
+// Get, print, or clear the collected statistics
+const hci_latency_stats_t* hci_latency_stats();
+void                       hci_latency_print();
+void                       hci_latency_reset();
+
+#endif  // BLE_HCI_LATENCY_H
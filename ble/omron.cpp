@@ -9,6 +9,9 @@
 
 #define FIXED_PASSKEY 123456U
 
+// Blood Pressure Measurement flag for a time stamp being present
+#define BP_FLAG_TIMESTAMP 0x02
+
 // -----------------------------------------------------------------------
 // Service identifiers
 // -----------------------------------------------------------------------
@@ -112,12 +115,16 @@ void Omron::after_discovery()
 
 Omron* curr_omron = nullptr;
 
-int64_t global_omron_poll( alarm_id_t id, __unused void* user_data )
+// Run from the BTstack run loop (not a timer IRQ), so the handler can
+// safely call back into BTstack
+btstack_timer_source_t omron_poll_timer;
+
+void global_omron_poll( btstack_timer_source_t* ts )
 {
+  (void) ts;
   if ( curr_omron ) {
     curr_omron->poll();
   }
-  return 0;
 }
 
 void Omron::poll()
@@ -126,14 +133,20 @@ void Omron::poll()
   poll_event                   = NONE;
 
   switch ( old_event ) {
-  PAIR_WRITE_KEY:
-    pair_write_key();
+    case PAIR_WRITE_KEY:
+      pair_write_key();
+      break;
+    default:
+      break;
   }
 }
 
 void omron_schedule_poll()
 {
-  add_alarm_in_ms( 2000, global_omron_poll, NULL, false );
+  btstack_run_loop_set_timer_handler( &omron_poll_timer,
+                                      global_omron_poll );
+  btstack_run_loop_set_timer( &omron_poll_timer, 2000 );
+  btstack_run_loop_add_timer( &omron_poll_timer );
 }
 
 // -----------------------------------------------------------------------
@@ -156,7 +169,10 @@ Omron::Omron()
     : Client(),
       omron_state( OM_IDLE ),
       poll_event( NONE ),
-      curr_data_valid( false )
+      curr_data_valid( false ),
+      records_head( 0 ),
+      num_records( 0 ),
+      records_dropped( 0 )
 {
   curr_omron = this;
 
@@ -164,10 +180,14 @@ Omron::Omron()
   sm_add_event_handler( &sm_event_callback_registration );
 }
 
+// The disconnection event releases the connection, and the background
+// scan picks the cuff up again when it next advertises
 void Omron::omron_reset()
 {
-  reset();
   omron_state = OM_IDLE;
+  if ( connection_handle != HCI_CON_HANDLE_INVALID ) {
+    gap_disconnect( connection_handle );
+  }
 }
 
 // -----------------------------------------------------------------------
@@ -290,6 +310,35 @@ bool Omron::omron_ready()
   return ( omron_state == OM_READY ) & ready();
 }
 
+// -----------------------------------------------------------------------
+// Held records
+// -----------------------------------------------------------------------
+// The cuff has its confirmation for a record as soon as it's here, and
+// won't send it again, so each one is held until it's taken
+
+void Omron::hold_record( const omron_data_t& data )
+{
+  if ( num_records == OMRON_MAX_RECORDS ) {
+    records_dropped++;
+    debug( "[Omron] No room for a record (%lu dropped)\n",
+           (unsigned long) records_dropped );
+    return;
+  }
+  records[( records_head + num_records ) % OMRON_MAX_RECORDS] = data;
+  num_records++;
+}
+
+bool Omron::omron_take_record( omron_data_t* data )
+{
+  if ( num_records == 0 ) {
+    return false;
+  }
+  *data        = records[records_head];
+  records_head = ( records_head + 1 ) % OMRON_MAX_RECORDS;
+  num_records--;
+  return true;
+}
+
 // -----------------------------------------------------------------------
 // child_gatt_event_handler
 // -----------------------------------------------------------------------
@@ -475,7 +524,9 @@ void Omron::indication_handler( uint16_t       value_handle,
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
   switch ( omron_state ) {
+    // The rest of a burst of stored records comes after the first
     case OM_DATA_INDICATION:
+    case OM_READY:
       if ( value_handle_from_uuid( blood_pressure_measurement ) !=
            value_handle ) {
         debug( "[Omron] Wrong value handle...\n" );
@@ -493,7 +544,10 @@ void Omron::indication_handler( uint16_t       value_handle,
       curr_data.dia_pressure = little_endian_read_16( value, 3 );
       curr_data.art_pressure = little_endian_read_16( value, 5 );
       curr_data.bpm          = little_endian_read_16( value, 14 );
-      curr_data_valid        = true;
+      curr_data.timestamp =
+          ( value[0] & BP_FLAG_TIMESTAMP ) ? unix_time( &value[7] ) : 0;
+      curr_data_valid = true;
+      hold_record( curr_data );
       blood_pressure_ready();
       break;
 
@@ -502,6 +556,37 @@ void Omron::indication_handler( uint16_t       value_handle,
   }
 }
 
+// -----------------------------------------------------------------------
+// unix_time
+// -----------------------------------------------------------------------
+// Convert a Bluetooth date-time (treating the cuff's clock as UTC) to
+// Unix time, using the days-from-civil algorithm
+
+uint32_t unix_time( const uint8_t* date_time )
+{
+  int32_t  year   = little_endian_read_16( date_time, 0 );
+  uint32_t month  = date_time[2];
+  uint32_t day    = date_time[3];
+  uint32_t hour   = date_time[4];
+  uint32_t minute = date_time[5];
+  uint32_t second = date_time[6];
+
+  // Year 0 / month 0 / day 0 mean "unknown"
+  if ( ( year < 1970 ) || ( month == 0 ) || ( day == 0 ) ) {
+    return 0;
+  }
+
+  year -= ( month <= 2 );
+  int32_t  era  = year / 400;
+  uint32_t yoe  = year - era * 400;
+  uint32_t doy  = ( 153 * ( month + ( month > 2 ? -3 : 9 ) ) + 2 ) / 5 +
+                 day - 1;
+  uint32_t doe  = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int32_t  days = era * 146097 + (int32_t) doe - 719468;
+
+  return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
 // -----------------------------------------------------------------------
 // sm_event_handler
 // -----------------------------------------------------------------------
@@ -28,8 +28,13 @@ typedef struct {
   uint16_t dia_pressure;
   uint16_t art_pressure;
   uint16_t bpm;
+  uint32_t timestamp;  // Unix time from the cuff's clock (0 if not sent)
 } omron_data_t;
 
+// Records held until they're taken (a cuff sends the ones it stored in a
+// burst as soon as it connects)
+#define OMRON_MAX_RECORDS 32
+
 enum omron_poll_event_t {
   NONE,
   PAIR_WRITE_KEY,
@@ -60,6 +65,7 @@ class Omron : public Client {
 
   void data_indications();
   void blood_pressure_ready();
+  void hold_record( const omron_data_t& data );
 
   // Helper for polling asynchronous tasks (public scope, but shouldn't
   // be used publicly)
@@ -72,9 +78,13 @@ class Omron : public Client {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  public:
   Omron();
-  void omron_reset();
+  void omron_reset();  // Drops the link; records held are kept
   bool omron_ready();  // Ready for more commands
 
+  // Take the oldest record received and not yet taken. Returns false if
+  // there are none
+  bool omron_take_record( omron_data_t* data );
+
   // Writes the pairing key in pairing mode (currently unneeded)
   void pair();
 
@@ -91,6 +101,13 @@ class Omron : public Client {
   bool correct_service_name( const uint8_t* service_name );
   bool correct_service( uint8_t* advertisement_report ) override;
 
+  // Records received but not yet taken, oldest first, and the ones that
+  // arrived with no room left
+  omron_data_t records[OMRON_MAX_RECORDS];
+  int          records_head;
+  int          num_records;
+  uint32_t     records_dropped;
+
  public:
   void sm_event_handler( uint8_t packet_type, uint16_t channel,
                          uint8_t* packet, uint16_t size );
@@ -0,0 +1,500 @@
+// =======================================================================
+// server.cpp
+// =======================================================================
+// Definitions of our on-device GATT server
+
+#include "ble/server.h"
+#include "ble/hci_latency.h"
+#include "pico/stdlib.h"
+#include "utils/debug.h"
+#include <stdio.h>
+
+// -----------------------------------------------------------------------
+// Service identifiers
+// -----------------------------------------------------------------------
+// Custom 128-bit UUIDs for the reading service and its characteristics
+
+const uint8_t reading_service_uuid[16] = {
+    0x5A, 0x22, 0x00, 0x01, 0x7E, 0x1E, 0x4A, 0x1B,
+    0x9B, 0x6F, 0x2D, 0x3E, 0x52, 0x20, 0xB1, 0x00 };
+
+const uint8_t pending_readings_uuid[16] = {
+    0x5A, 0x22, 0x00, 0x02, 0x7E, 0x1E, 0x4A, 0x1B,
+    0x9B, 0x6F, 0x2D, 0x3E, 0x52, 0x20, 0xB1, 0x00 };
+
+const uint8_t bulk_readings_uuid[16] = {
+    0x5A, 0x22, 0x00, 0x03, 0x7E, 0x1E, 0x4A, 0x1B,
+    0x9B, 0x6F, 0x2D, 0x3E, 0x52, 0x20, 0xB1, 0x00 };
+
+const uint8_t sync_control_uuid[16] = {
+    0x5A, 0x22, 0x00, 0x04, 0x7E, 0x1E, 0x4A, 0x1B,
+    0x9B, 0x6F, 0x2D, 0x3E, 0x52, 0x20, 0xB1, 0x00 };
+
+const char server_device_name[] = "Telehealth BP";
+
+// -----------------------------------------------------------------------
+// Global state for handling callbacks
+// -----------------------------------------------------------------------
+
+ReadingServer* curr_server = nullptr;
+
+void global_server_packet_handler( uint8_t packet_type, uint16_t channel,
+                                   uint8_t* packet, uint16_t size )
+{
+  if ( curr_server ) {
+    curr_server->packet_handler( packet_type, channel, packet, size );
+  }
+}
+
+uint16_t global_att_read_callback( hci_con_handle_t connection_handle,
+                                   uint16_t att_handle, uint16_t offset,
+                                   uint8_t* buffer, uint16_t buffer_size )
+{
+  if ( curr_server ) {
+    return curr_server->att_read_callback( connection_handle, att_handle,
+                                           offset, buffer, buffer_size );
+  }
+  return 0;
+}
+
+int global_att_write_callback( hci_con_handle_t connection_handle,
+                               uint16_t att_handle, uint16_t transaction_mode,
+                               uint16_t offset, uint8_t* buffer,
+                               uint16_t buffer_size )
+{
+  if ( curr_server ) {
+    return curr_server->att_write_callback( connection_handle, att_handle,
+                                            transaction_mode, offset,
+                                            buffer, buffer_size );
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------
+// RAII Management (Constructor, Destructor)
+// -----------------------------------------------------------------------
+
+ReadingServer::ReadingServer()
+    : sync_done( false ),
+      num_stored( 0 ),
+      next_seq( 0 ),
+      acked_seq( 0 ),
+      connection_handle( HCI_CON_HANDLE_INVALID ),
+      mtu( ATT_DEFAULT_MTU ),
+      mtu_cap( SERVER_MAX_MTU ),
+      notifications_enabled( false ),
+      stream_seq( 0 ),
+      bulk_seq( 0 ),
+      sync_start_us( 0 )
+{
+  curr_server = this;
+
+  setup_att_db();
+  setup_advertising();
+
+  // Replace the empty ATT server set up by the client with our database
+  l2cap_set_max_le_mtu( SERVER_MAX_MTU );
+  att_server_init( att_db_util_get_address(), global_att_read_callback,
+                   global_att_write_callback );
+  att_server_register_packet_handler( global_server_packet_handler );
+}
+
+ReadingServer::~ReadingServer()
+{
+  curr_server = nullptr;
+}
+
+// -----------------------------------------------------------------------
+// Setup
+// -----------------------------------------------------------------------
+
+void ReadingServer::setup_att_db()
+{
+  att_db_util_init();
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // GAP service (so phones can show a name)
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  att_db_util_add_service_uuid16( ORG_BLUETOOTH_SERVICE_GENERIC_ACCESS );
+  att_db_util_add_characteristic_uuid16(
+      ORG_BLUETOOTH_CHARACTERISTIC_GAP_DEVICE_NAME, ATT_PROPERTY_READ,
+      ATT_SECURITY_NONE, ATT_SECURITY_NONE,
+      (uint8_t*) server_device_name, sizeof( server_device_name ) - 1 );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Reading service
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // All values are dynamic (served from the callbacks), and readings
+  // require an encrypted (bonded) link
+  att_db_util_add_service_uuid128( reading_service_uuid );
+
+  pending_value_handle = att_db_util_add_characteristic_uuid128(
+      pending_readings_uuid, ATT_PROPERTY_NOTIFY | ATT_PROPERTY_DYNAMIC,
+      ATT_SECURITY_ENCRYPTED, ATT_SECURITY_ENCRYPTED, NULL, 0 );
+  pending_config_handle = pending_value_handle + 1;
+
+  bulk_value_handle = att_db_util_add_characteristic_uuid128(
+      bulk_readings_uuid, ATT_PROPERTY_READ | ATT_PROPERTY_DYNAMIC,
+      ATT_SECURITY_ENCRYPTED, ATT_SECURITY_ENCRYPTED, NULL, 0 );
+
+  control_value_handle = att_db_util_add_characteristic_uuid128(
+      sync_control_uuid, ATT_PROPERTY_WRITE | ATT_PROPERTY_DYNAMIC,
+      ATT_SECURITY_ENCRYPTED, ATT_SECURITY_ENCRYPTED, NULL, 0 );
+}
+
+// Advertise every INTERVAL - slow, as a sync is started by clinic staff
+#define GAP_ADV_INTERVAL_MIN 0x0320  // 0x320 * 0.625ms = 500ms
+#define GAP_ADV_INTERVAL_MAX 0x0640  // 0x640 * 0.625ms = 1s
+
+// Advertising data holds the flags and service UUID; the name goes in
+// the scan response, as both don't fit in 31 bytes
+static uint8_t adv_data[3 + 18];
+static uint8_t scan_response_data[2 + sizeof( server_device_name ) - 1];
+
+void ReadingServer::setup_advertising()
+{
+  uint8_t pos = 0;
+
+  adv_data[pos++] = 2;
+  adv_data[pos++] = BLUETOOTH_DATA_TYPE_FLAGS;
+  adv_data[pos++] = 0x06;  // General discoverable, BR/EDR not supported
+
+  adv_data[pos++] = 17;
+  adv_data[pos++] =
+      BLUETOOTH_DATA_TYPE_COMPLETE_LIST_OF_128_BIT_SERVICE_CLASS_UUIDS;
+  reverse_128( reading_service_uuid, &adv_data[pos] );
+
+  scan_response_data[0] = sizeof( server_device_name );
+  scan_response_data[1] = BLUETOOTH_DATA_TYPE_COMPLETE_LOCAL_NAME;
+  memcpy( &scan_response_data[2], server_device_name,
+          sizeof( server_device_name ) - 1 );
+
+  // Connectable, undirected advertising on all channels
+  bd_addr_t null_addr;
+  memset( null_addr, 0, sizeof( null_addr ) );
+  gap_advertisements_set_params( GAP_ADV_INTERVAL_MIN,
+                                 GAP_ADV_INTERVAL_MAX, 0, 0, null_addr,
+                                 0x07, 0x00 );
+  gap_advertisements_set_data( sizeof( adv_data ), adv_data );
+  gap_scan_response_set_data( sizeof( scan_response_data ),
+                              scan_response_data );
+}
+
+void ReadingServer::start()
+{
+  debug( "[Server] Starting to advertise...\n" );
+  gap_advertisements_enable( 1 );
+  hci_power_control( HCI_POWER_ON );
+}
+
+// -----------------------------------------------------------------------
+// History management
+// -----------------------------------------------------------------------
+
+void ReadingServer::add_reading( const omron_data_t& reading )
+{
+  history[next_seq % SERVER_HISTORY_LENGTH] = reading;
+  next_seq++;
+  if ( num_stored < SERVER_HISTORY_LENGTH ) {
+    num_stored++;
+  }
+
+  // Drop acknowledgements for readings that fell out of the history
+  if ( !in_history( acked_seq ) ) {
+    acked_seq = oldest_seq();
+  }
+
+  // Push to a subscribed peer right away
+  if ( notifications_enabled ) {
+    att_server_request_can_send_now_event( connection_handle );
+  }
+}
+
+uint16_t ReadingServer::oldest_seq()
+{
+  return (uint16_t) ( next_seq - num_stored );
+}
+
+bool ReadingServer::in_history( uint16_t seq )
+{
+  return (uint16_t) ( seq - oldest_seq() ) < num_stored;
+}
+
+uint16_t ReadingServer::num_pending()
+{
+  return (uint16_t) ( next_seq - acked_seq );
+}
+
+void ReadingServer::serialize( uint16_t seq, uint8_t* buffer )
+{
+  const omron_data_t& reading = history[seq % SERVER_HISTORY_LENGTH];
+  little_endian_store_16( buffer, 0, seq );
+  little_endian_store_16( buffer, 2, reading.sys_pressure );
+  little_endian_store_16( buffer, 4, reading.dia_pressure );
+  little_endian_store_16( buffer, 6, reading.art_pressure );
+  little_endian_store_16( buffer, 8, reading.bpm );
+}
+
+// No lower than the default ATT MTU, which every peer supports and which
+// fits two records
+void ReadingServer::set_mtu_cap( uint16_t mtu )
+{
+  mtu_cap = ( mtu < ATT_DEFAULT_MTU ) ? ATT_DEFAULT_MTU : mtu;
+}
+
+bool ReadingServer::connected()
+{
+  return connection_handle != HCI_CON_HANDLE_INVALID;
+}
+
+// -----------------------------------------------------------------------
+// Streaming pending readings
+// -----------------------------------------------------------------------
+// Pack as many records as fit into each notification, and only send when
+// the stack has room, so the link stays saturated
+
+uint16_t ReadingServer::records_per_notification()
+{
+  uint16_t effective_mtu = ( mtu < mtu_cap ) ? mtu : mtu_cap;
+  uint16_t num_records   = ( effective_mtu - 3 ) / SERVER_RECORD_SIZE;
+  return ( num_records > 0 ) ? num_records : 1;
+}
+
+void ReadingServer::start_stream()
+{
+  stream_seq    = acked_seq;
+  sync_done     = false;
+  sync_start_us = time_us_32();
+
+  last_sync.mtu           = ( mtu < mtu_cap ) ? mtu : mtu_cap;
+  last_sync.records_sent  = 0;
+  last_sync.bytes_sent    = 0;
+  last_sync.notifications = 0;
+  last_sync.duration_us   = 0;
+
+  // Already in sync, so there's nothing to stream
+  if ( stream_seq == next_seq ) {
+    sync_done = true;
+    debug( "[Server] No pending readings to stream\n" );
+    return;
+  }
+
+  debug( "[Server] Streaming %d pending readings (MTU %d)...\n",
+         num_pending(), last_sync.mtu );
+  att_server_request_can_send_now_event( connection_handle );
+}
+
+void ReadingServer::stream_next()
+{
+  if ( !notifications_enabled || ( stream_seq == next_seq ) ) {
+    return;
+  }
+
+  // Skip readings that were overwritten while streaming
+  if ( !in_history( stream_seq ) ) {
+    stream_seq = oldest_seq();
+  }
+
+  uint8_t  buffer[SERVER_MAX_MTU - 3];
+  uint16_t num_records = 0;
+  uint16_t max_records = records_per_notification();
+  while ( ( num_records < max_records ) && ( stream_seq != next_seq ) ) {
+    serialize( stream_seq, &buffer[num_records * SERVER_RECORD_SIZE] );
+    stream_seq++;
+    num_records++;
+  }
+
+  uint16_t length = num_records * SERVER_RECORD_SIZE;
+  att_server_notify( connection_handle, pending_value_handle, buffer,
+                     length );
+
+  last_sync.records_sent += num_records;
+  last_sync.bytes_sent += length;
+  last_sync.notifications++;
+  last_sync.duration_us = time_us_32() - sync_start_us;
+
+  if ( stream_seq != next_seq ) {
+    att_server_request_can_send_now_event( connection_handle );
+  }
+  else {
+    sync_done = true;
+    debug( "[Server] Streamed all pending readings\n" );
+  }
+}
+
+void ReadingServer::print_sync_stats()
+{
+  uint32_t records_per_s =
+      ( last_sync.duration_us == 0 )
+          ? 0
+          : (uint32_t) ( (uint64_t) last_sync.records_sent * 1000000 /
+                         last_sync.duration_us );
+  printf( "[Server] MTU %3d: %lu records in %lu notifications, %lu us "
+          "(%lu records/s)\n",
+          last_sync.mtu, (unsigned long) last_sync.records_sent,
+          (unsigned long) last_sync.notifications,
+          (unsigned long) last_sync.duration_us,
+          (unsigned long) records_per_s );
+}
+
+// -----------------------------------------------------------------------
+// ATT callbacks
+// -----------------------------------------------------------------------
+
+uint16_t ReadingServer::att_read_callback(
+    hci_con_handle_t connection_handle, uint16_t att_handle,
+    uint16_t offset, uint8_t* buffer, uint16_t buffer_size )
+{
+  (void) connection_handle;
+
+  if ( att_handle != bulk_value_handle ) {
+    return 0;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Determine the window of records to return
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  uint16_t start = in_history( bulk_seq ) ? bulk_seq : oldest_seq();
+  uint16_t available =
+      in_history( start ) ? (uint16_t) ( next_seq - start ) : 0;
+  if ( available > SERVER_BULK_READ_RECORDS ) {
+    available = SERVER_BULK_READ_RECORDS;
+  }
+  uint16_t total_length = available * SERVER_RECORD_SIZE;
+
+  // A NULL buffer only asks for the length
+  if ( buffer == NULL ) {
+    return total_length;
+  }
+  if ( offset >= total_length ) {
+    return 0;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Serialize the requested part of the window (long reads use offsets)
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  uint16_t length = total_length - offset;
+  if ( length > buffer_size ) {
+    length = buffer_size;
+  }
+
+  uint8_t  record[SERVER_RECORD_SIZE];
+  uint16_t copied = 0;
+  while ( copied < length ) {
+    uint16_t pos        = offset + copied;
+    uint16_t record_idx = pos / SERVER_RECORD_SIZE;
+    uint16_t record_pos = pos % SERVER_RECORD_SIZE;
+    serialize( (uint16_t) ( start + record_idx ), record );
+
+    uint16_t chunk = SERVER_RECORD_SIZE - record_pos;
+    if ( chunk > length - copied ) {
+      chunk = length - copied;
+    }
+    memcpy( &buffer[copied], &record[record_pos], chunk );
+    copied += chunk;
+  }
+  return length;
+}
+
+int ReadingServer::att_write_callback( hci_con_handle_t connection_handle,
+                                       uint16_t         att_handle,
+                                       uint16_t         transaction_mode,
+                                       uint16_t offset, uint8_t* buffer,
+                                       uint16_t buffer_size )
+{
+  (void) transaction_mode;
+  (void) offset;
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Subscribing to pending readings
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  if ( att_handle == pending_config_handle ) {
+    if ( buffer_size != 2 ) {
+      return ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+    }
+    uint16_t config       = little_endian_read_16( buffer, 0 );
+    notifications_enabled = ( config ==
+                              GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION );
+    this->connection_handle = connection_handle;
+    if ( notifications_enabled ) {
+      start_stream();
+    }
+    return 0;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Sync control
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  if ( att_handle == control_value_handle ) {
+    if ( buffer_size != 3 ) {
+      return ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH;
+    }
+    uint16_t seq = little_endian_read_16( buffer, 1 );
+    switch ( buffer[0] ) {
+      case SERVER_OP_ACK:
+        // Acknowledge everything up to and including seq. Only a pending
+        // reading moves it on, so a stale or replayed ACK can't move it
+        // back (this is modulo 2^16, like the sequence numbers)
+        if ( in_history( seq ) &&
+             ( (uint16_t) ( seq - acked_seq ) < num_pending() ) ) {
+          acked_seq = (uint16_t) ( seq + 1 );
+          debug( "[Server] Peer synced up to reading %d\n", seq );
+        }
+        break;
+      case SERVER_OP_READ_FROM:
+        bulk_seq = seq;
+        break;
+      default:
+        return ATT_ERROR_REQUEST_NOT_SUPPORTED;
+    }
+    return 0;
+  }
+
+  return 0;
+}
+
+// -----------------------------------------------------------------------
+// packet_handler
+// -----------------------------------------------------------------------
+// Handle connection and ATT events
+
+void ReadingServer::packet_handler( uint8_t packet_type, uint16_t channel,
+                                    uint8_t* packet, uint16_t size )
+{
+  // We don't use the size and channel
+  (void) size;
+  (void) channel;
+
+  if ( packet_type != HCI_EVENT_PACKET )
+    return;
+  hci_latency_record();
+
+  switch ( hci_event_packet_get_type( packet ) ) {
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // A peer connected to us (we are the peripheral)
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    case ATT_EVENT_CONNECTED:
+      connection_handle = att_event_connected_get_handle( packet );
+      mtu               = ATT_DEFAULT_MTU;
+      debug( "[Server] Peer connected\n" );
+      break;
+
+    case ATT_EVENT_MTU_EXCHANGE_COMPLETE:
+      mtu = att_event_mtu_exchange_complete_get_MTU( packet );
+      debug( "[Server] MTU negotiated to %d\n", mtu );
+      break;
+
+    case ATT_EVENT_CAN_SEND_NOW:
+      stream_next();
+      break;
+
+    case ATT_EVENT_DISCONNECTED:
+      debug( "[Server] Peer disconnected\n" );
+      connection_handle     = HCI_CON_HANDLE_INVALID;
+      notifications_enabled = false;
+      break;
+
+    default:
+      break;
+  }
+}
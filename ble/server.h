@@ -0,0 +1,142 @@
+// =======================================================================
+// server.h
+// =======================================================================
+// Declarations of our on-device GATT server, which exposes pending and
+// historical readings to a phone or tablet for a fast local sync
+//
+// The server relies on the BTstack setup done by Client (L2CAP, SM), so
+// it should be constructed after the client. As with the client, users
+// should only ever construct ONE server, due to the global callbacks.
+
+#ifndef BLE_SERVER_H
+#define BLE_SERVER_H
+
+#include "ble/omron.h"
+#include "btstack.h"
+#include <cstdint>
+
+// Number of readings kept in the history ring
+#define SERVER_HISTORY_LENGTH 256
+
+// Size of one serialized reading record (seq, sys, dia, art, bpm)
+#define SERVER_RECORD_SIZE 10
+
+// The ATT specification caps an attribute value at 512 bytes, so the
+// bulk read characteristic returns a window of at most this many records
+#define SERVER_BULK_READ_RECORDS ( 512 / SERVER_RECORD_SIZE )
+
+// Largest ATT MTU we accept (LE Data Length Extension payload - L2CAP)
+#define SERVER_MAX_MTU 247
+
+// -----------------------------------------------------------------------
+// Control characteristic opcodes
+// -----------------------------------------------------------------------
+// Written by the peer as [opcode, seq (little-endian 16-bit)]
+
+enum server_control_op_t {
+  SERVER_OP_ACK       = 0x01,  // All readings up to seq are synced
+  SERVER_OP_READ_FROM = 0x02,  // Start the bulk read window at seq
+};
+
+// -----------------------------------------------------------------------
+// Sync statistics (for benchmarking the local sync path)
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint16_t mtu;               // Effective MTU of the last sync
+  uint32_t records_sent;      // Records sent in the last sync
+  uint32_t bytes_sent;        // Payload bytes sent in the last sync
+  uint32_t notifications;     // Notifications sent in the last sync
+  uint32_t duration_us;       // Time from subscription to last record
+} server_sync_stats_t;
+
+// -----------------------------------------------------------------------
+// ReadingServer
+// -----------------------------------------------------------------------
+
+class ReadingServer {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public accessor functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  ReadingServer();
+  ~ReadingServer();
+
+  // Start advertising the reading service
+  void start();
+
+  // Add a new (pending) reading to the history
+  void add_reading( const omron_data_t& reading );
+
+  // Number of readings not yet acknowledged by a peer
+  uint16_t num_pending();
+
+  // Limit the MTU used for notifications (for benchmarking)
+  void set_mtu_cap( uint16_t mtu );
+
+  // Whether a peer is currently connected
+  bool connected();
+
+  // Statistics from the most recent notification sync
+  server_sync_stats_t last_sync;
+  bool                sync_done;
+
+  // Print the statistics of the last sync
+  void print_sync_stats();
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  // History ring (indexed by seq % SERVER_HISTORY_LENGTH)
+  omron_data_t history[SERVER_HISTORY_LENGTH];
+  uint16_t     num_stored;  // Readings currently in the history
+  uint16_t     next_seq;    // Sequence number of the next reading
+  uint16_t     acked_seq;   // All readings before this one are synced
+
+  // Attribute handles
+  uint16_t pending_value_handle;
+  uint16_t pending_config_handle;
+  uint16_t bulk_value_handle;
+  uint16_t control_value_handle;
+
+  // Connection state
+  hci_con_handle_t connection_handle;
+  uint16_t         mtu;
+  uint16_t         mtu_cap;
+  bool             notifications_enabled;
+
+  // Streaming state
+  uint16_t stream_seq;  // Next reading to notify
+  uint16_t bulk_seq;    // First reading of the bulk read window
+  uint32_t sync_start_us;
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  void     setup_att_db();
+  void     setup_advertising();
+  bool     in_history( uint16_t seq );
+  uint16_t oldest_seq();
+  void     serialize( uint16_t seq, uint8_t* buffer );
+  uint16_t records_per_notification();
+  void     start_stream();
+  void     stream_next();
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Event handlers
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  void     packet_handler( uint8_t packet_type, uint16_t channel,
+                           uint8_t* packet, uint16_t size );
+  uint16_t att_read_callback( hci_con_handle_t connection_handle,
+                              uint16_t att_handle, uint16_t offset,
+                              uint8_t* buffer, uint16_t buffer_size );
+  int      att_write_callback( hci_con_handle_t connection_handle,
+                               uint16_t att_handle, uint16_t transaction_mode,
+                               uint16_t offset, uint8_t* buffer,
+                               uint16_t buffer_size );
+};
+
+#endif  // BLE_SERVER_H
@@ -0,0 +1,446 @@
+// =======================================================================
+// aes_bitsliced.c
+// =======================================================================
+// A bitsliced AES engine (see aes_engine.h). The block is held as eight
+// 16-bit planes, plane p holding bit p of each of its bytes, so the
+// S-box is a circuit of ANDs and XORs over the planes (Boyar and
+// Peralta's, 113 gates) and ShiftRows and MixColumns are shifts and
+// masks. Nothing is looked up by key or data, so its timing doesn't
+// depend on them, and it has no tables at all. It's the slowest engine
+// for one block, since the planes only fill half of each word
+//
+// The round keys are kept as planes too, four words each, so they fit
+// the same RKLENGTH( 128 ) words as rijndael.c's. Decryption runs the
+// inverse cipher on the same round keys
+
+#include "aes_engine.h"
+#include "rijndael.h"
+
+#define NUM_ROUNDS 10
+
+// -----------------------------------------------------------------------
+// Planes
+// -----------------------------------------------------------------------
+
+// Transposes an 8x8 bit matrix, bit j of byte i to bit i of byte j
+static uint64_t transpose8( uint64_t x )
+{
+  uint64_t t;
+  t = ( x ^ ( x >> 7 ) ) & 0x00aa00aa00aa00aaull;
+  x = x ^ t ^ ( t << 7 );
+  t = ( x ^ ( x >> 14 ) ) & 0x0000cccc0000ccccull;
+  x = x ^ t ^ ( t << 14 );
+  t = ( x ^ ( x >> 28 ) ) & 0x00000000f0f0f0f0ull;
+  x = x ^ t ^ ( t << 28 );
+  return x;
+}
+
+// Bit p of byte n of the block to bit n of q[p]
+static void to_planes( const uint8_t in[16], uint32_t q[8] )
+{
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+  for ( int n = 0; n < 8; n++ ) {
+    lo |= (uint64_t) in[n] << ( 8 * n );
+    hi |= (uint64_t) in[n + 8] << ( 8 * n );
+  }
+  lo = transpose8( lo );
+  hi = transpose8( hi );
+  for ( int p = 0; p < 8; p++ ) {
+    q[p] = ( ( lo >> ( 8 * p ) ) & 0xff ) |
+           ( ( ( hi >> ( 8 * p ) ) & 0xff ) << 8 );
+  }
+}
+
+static void from_planes( const uint32_t q[8], uint8_t out[16] )
+{
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+  for ( int p = 0; p < 8; p++ ) {
+    lo |= (uint64_t) ( q[p] & 0xff ) << ( 8 * p );
+    hi |= (uint64_t) ( ( q[p] >> 8 ) & 0xff ) << ( 8 * p );
+  }
+  lo = transpose8( lo );
+  hi = transpose8( hi );
+  for ( int n = 0; n < 8; n++ ) {
+    out[n]     = lo >> ( 8 * n );
+    out[n + 8] = hi >> ( 8 * n );
+  }
+}
+
+// Round keys are two planes to a word
+static void add_round_key( uint32_t q[8], const uint32_t* rk )
+{
+  for ( int k = 0; k < 4; k++ ) {
+    q[2 * k] ^= rk[k] & 0xffff;
+    q[2 * k + 1] ^= rk[k] >> 16;
+  }
+}
+
+// -----------------------------------------------------------------------
+// SubBytes
+// -----------------------------------------------------------------------
+
+static void sub_bytes( uint32_t q[8] )
+{
+  uint32_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+  uint32_t x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+  // Top linear transformation
+  uint32_t y14 = x3 ^ x5;
+  uint32_t y13 = x0 ^ x6;
+  uint32_t y9  = x0 ^ x3;
+  uint32_t y8  = x0 ^ x5;
+  uint32_t t0  = x1 ^ x2;
+  uint32_t y1  = t0 ^ x7;
+  uint32_t y4  = y1 ^ x3;
+  uint32_t y12 = y13 ^ y14;
+  uint32_t y2  = y1 ^ x0;
+  uint32_t y5  = y1 ^ x6;
+  uint32_t y3  = y5 ^ y8;
+  uint32_t t1  = x4 ^ y12;
+  uint32_t y15 = t1 ^ x5;
+  uint32_t y20 = t1 ^ x1;
+  uint32_t y6  = y15 ^ x7;
+  uint32_t y10 = y15 ^ t0;
+  uint32_t y11 = y20 ^ y9;
+  uint32_t y7  = x7 ^ y11;
+  uint32_t y17 = y10 ^ y11;
+  uint32_t y19 = y10 ^ y8;
+  uint32_t y16 = t0 ^ y11;
+  uint32_t y21 = y13 ^ y16;
+  uint32_t y18 = x0 ^ y16;
+
+  // Inversion in GF(2^8), through GF(2^4)
+  uint32_t t2  = y12 & y15;
+  uint32_t t3  = y3 & y6;
+  uint32_t t4  = t3 ^ t2;
+  uint32_t t5  = y4 & x7;
+  uint32_t t6  = t5 ^ t2;
+  uint32_t t7  = y13 & y16;
+  uint32_t t8  = y5 & y1;
+  uint32_t t9  = t8 ^ t7;
+  uint32_t t10 = y2 & y7;
+  uint32_t t11 = t10 ^ t7;
+  uint32_t t12 = y9 & y11;
+  uint32_t t13 = y14 & y17;
+  uint32_t t14 = t13 ^ t12;
+  uint32_t t15 = y8 & y10;
+  uint32_t t16 = t15 ^ t12;
+  uint32_t t17 = t4 ^ t14;
+  uint32_t t18 = t6 ^ t16;
+  uint32_t t19 = t9 ^ t14;
+  uint32_t t20 = t11 ^ t16;
+  uint32_t t21 = t17 ^ y20;
+  uint32_t t22 = t18 ^ y19;
+  uint32_t t23 = t19 ^ y21;
+  uint32_t t24 = t20 ^ y18;
+
+  uint32_t t25 = t21 ^ t22;
+  uint32_t t26 = t21 & t23;
+  uint32_t t27 = t24 ^ t26;
+  uint32_t t28 = t25 & t27;
+  uint32_t t29 = t28 ^ t22;
+  uint32_t t30 = t23 ^ t24;
+  uint32_t t31 = t22 ^ t26;
+  uint32_t t32 = t31 & t30;
+  uint32_t t33 = t32 ^ t24;
+  uint32_t t34 = t23 ^ t33;
+  uint32_t t35 = t27 ^ t33;
+  uint32_t t36 = t24 & t35;
+  uint32_t t37 = t36 ^ t34;
+  uint32_t t38 = t27 ^ t36;
+  uint32_t t39 = t29 & t38;
+  uint32_t t40 = t25 ^ t39;
+
+  uint32_t t41 = t40 ^ t37;
+  uint32_t t42 = t29 ^ t33;
+  uint32_t t43 = t29 ^ t40;
+  uint32_t t44 = t33 ^ t37;
+  uint32_t t45 = t42 ^ t41;
+  uint32_t z0  = t44 & y15;
+  uint32_t z1  = t37 & y6;
+  uint32_t z2  = t33 & x7;
+  uint32_t z3  = t43 & y16;
+  uint32_t z4  = t40 & y1;
+  uint32_t z5  = t29 & y7;
+  uint32_t z6  = t42 & y11;
+  uint32_t z7  = t45 & y17;
+  uint32_t z8  = t41 & y10;
+  uint32_t z9  = t44 & y12;
+  uint32_t z10 = t37 & y3;
+  uint32_t z11 = t33 & y4;
+  uint32_t z12 = t43 & y13;
+  uint32_t z13 = t40 & y5;
+  uint32_t z14 = t29 & y2;
+  uint32_t z15 = t42 & y9;
+  uint32_t z16 = t45 & y14;
+  uint32_t z17 = t41 & y8;
+
+  // Bottom linear transformation, with the affine constant
+  uint32_t t46 = z15 ^ z16;
+  uint32_t t47 = z10 ^ z11;
+  uint32_t t48 = z5 ^ z13;
+  uint32_t t49 = z9 ^ z10;
+  uint32_t t50 = z2 ^ z12;
+  uint32_t t51 = z2 ^ z5;
+  uint32_t t52 = z7 ^ z8;
+  uint32_t t53 = z0 ^ z3;
+  uint32_t t54 = z6 ^ z7;
+  uint32_t t55 = z16 ^ z17;
+  uint32_t t56 = z12 ^ t48;
+  uint32_t t57 = t50 ^ t53;
+  uint32_t t58 = z4 ^ t46;
+  uint32_t t59 = z3 ^ t54;
+  uint32_t t60 = t46 ^ t57;
+  uint32_t t61 = z14 ^ t57;
+  uint32_t t62 = t52 ^ t58;
+  uint32_t t63 = t49 ^ t58;
+  uint32_t t64 = z4 ^ t59;
+  uint32_t t65 = t61 ^ t62;
+  uint32_t t66 = z1 ^ t63;
+  uint32_t s0  = t59 ^ t63;
+  uint32_t s6  = t56 ^ t62 ^ 0xffff;
+  uint32_t s7  = t48 ^ t60 ^ 0xffff;
+  uint32_t t67 = t64 ^ t65;
+  uint32_t s3  = t53 ^ t66;
+  uint32_t s4  = t51 ^ t66;
+  uint32_t s5  = t47 ^ t65;
+  uint32_t s1  = t64 ^ s3 ^ 0xffff;
+  uint32_t s2  = t55 ^ t67 ^ 0xffff;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+#ifdef ENABLE_RIJNDAEL_DECRYPT
+// The inverse S-box is inv( A'( y ) ), where A' undoes the S-box's affine
+// map; since inv( z ) = A'( S( z ) ), that's A'( S( A'( y ) ) )
+static void inv_affine( uint32_t q[8] )
+{
+  uint32_t x[8];
+  for ( int i = 0; i < 8; i++ ) {
+    x[i] = q[i];
+  }
+  for ( int i = 0; i < 8; i++ ) {
+    q[i] = x[( i + 2 ) % 8] ^ x[( i + 5 ) % 8] ^ x[( i + 7 ) % 8];
+  }
+  q[0] ^= 0xffff;  // 0x05
+  q[2] ^= 0xffff;
+}
+
+static void inv_sub_bytes( uint32_t q[8] )
+{
+  inv_affine( q );
+  sub_bytes( q );
+  inv_affine( q );
+}
+#endif
+
+// -----------------------------------------------------------------------
+// ShiftRows and MixColumns
+// -----------------------------------------------------------------------
+// Byte n of the block is row n % 4 of column n / 4, so row r is the bits
+// ( 0x1111 << r ) of a plane
+
+static uint32_t rotr16( uint32_t x, int n )
+{
+  return ( ( x >> n ) | ( x << ( 16 - n ) ) ) & 0xffff;
+}
+
+// Row r moves r columns left
+static void shift_rows( uint32_t q[8] )
+{
+  for ( int p = 0; p < 8; p++ ) {
+    uint32_t x = q[p];
+    q[p]       = ( x & 0x1111 ) | rotr16( x & 0x2222, 4 ) |
+           rotr16( x & 0x4444, 8 ) | rotr16( x & 0x8888, 12 );
+  }
+}
+
+// Each byte of a column replaced by the one 1, 2 or 3 rows below it
+static uint32_t rotate_rows1( uint32_t x )
+{
+  return ( ( x >> 1 ) & 0x7777 ) | ( ( x << 3 ) & 0x8888 );
+}
+
+static uint32_t rotate_rows2( uint32_t x )
+{
+  return ( ( x >> 2 ) & 0x3333 ) | ( ( x << 2 ) & 0xcccc );
+}
+
+static uint32_t rotate_rows3( uint32_t x )
+{
+  return ( ( x >> 3 ) & 0x1111 ) | ( ( x << 1 ) & 0xeeee );
+}
+
+// Multiply each byte by x in GF(2^8)
+static void xtime( uint32_t q[8] )
+{
+  uint32_t top = q[7];
+  q[7]         = q[6];
+  q[6]         = q[5];
+  q[5]         = q[4];
+  q[4]         = q[3] ^ top;
+  q[3]         = q[2] ^ top;
+  q[2]         = q[1];
+  q[1]         = q[0] ^ top;
+  q[0]         = top;
+}
+
+// 2 a0 + 3 a1 + a2 + a3 = 2 ( a0 + a1 ) + a1 + a2 + a3
+static void mix_columns( uint32_t q[8] )
+{
+  uint32_t sum[8];
+  uint32_t rest[8];
+  for ( int p = 0; p < 8; p++ ) {
+    uint32_t a1 = rotate_rows1( q[p] );
+    sum[p]      = q[p] ^ a1;
+    rest[p]     = a1 ^ rotate_rows2( q[p] ) ^ rotate_rows3( q[p] );
+  }
+  xtime( sum );
+  for ( int p = 0; p < 8; p++ ) {
+    q[p] = sum[p] ^ rest[p];
+  }
+}
+
+#ifdef ENABLE_RIJNDAEL_DECRYPT
+// Row r moves r columns right
+static void inv_shift_rows( uint32_t q[8] )
+{
+  for ( int p = 0; p < 8; p++ ) {
+    uint32_t x = q[p];
+    q[p]       = ( x & 0x1111 ) | rotr16( x & 0x2222, 12 ) |
+           rotr16( x & 0x4444, 8 ) | rotr16( x & 0x8888, 4 );
+  }
+}
+
+// InvMixColumns is MixColumns after adding 4 ( a0 + a2 ) to rows 0 and 2,
+// and 4 ( a1 + a3 ) to rows 1 and 3
+static void inv_mix_columns( uint32_t q[8] )
+{
+  uint32_t sum[8];
+  for ( int p = 0; p < 8; p++ ) {
+    sum[p] = q[p] ^ rotate_rows2( q[p] );
+  }
+  xtime( sum );
+  xtime( sum );
+  for ( int p = 0; p < 8; p++ ) {
+    q[p] ^= sum[p];
+  }
+  mix_columns( q );
+}
+#endif
+
+// -----------------------------------------------------------------------
+// Key schedule
+// -----------------------------------------------------------------------
+
+static void sub_word( uint8_t word[4] )
+{
+  uint8_t  block[16] = { word[0], word[1], word[2], word[3] };
+  uint32_t q[8];
+  to_planes( block, q );
+  sub_bytes( q );
+  from_planes( q, block );
+  for ( int i = 0; i < 4; i++ ) {
+    word[i] = block[i];
+  }
+}
+
+int rijndaelSetupEncrypt( uint32_t* rk, const uint8_t* key, int keybits )
+{
+  static const uint8_t rcon[NUM_ROUNDS] = { 0x01, 0x02, 0x04, 0x08, 0x10,
+                                            0x20, 0x40, 0x80, 0x1b, 0x36 };
+  if ( keybits != 128 ) {
+    return 0;
+  }
+
+  uint8_t round_key[16];
+  for ( int i = 0; i < 16; i++ ) {
+    round_key[i] = key[i];
+  }
+  for ( int round = 0;; round++ ) {
+    uint32_t q[8];
+    to_planes( round_key, q );
+    for ( int k = 0; k < 4; k++ ) {
+      rk[4 * round + k] = q[2 * k] | ( q[2 * k + 1] << 16 );
+    }
+    if ( round == NUM_ROUNDS ) {
+      break;
+    }
+
+    // RotWord, SubWord and the round constant, then the running XOR
+    uint8_t temp[4] = { round_key[13], round_key[14], round_key[15],
+                        round_key[12] };
+    sub_word( temp );
+    temp[0] ^= rcon[round];
+    for ( int i = 0; i < 16; i++ ) {
+      round_key[i] ^= ( i < 4 ) ? temp[i] : round_key[i - 4];
+    }
+  }
+  return NUM_ROUNDS;
+}
+
+// -----------------------------------------------------------------------
+// Encryption
+// -----------------------------------------------------------------------
+
+void rijndaelEncrypt( const uint32_t* rk, int nrounds,
+                      const uint8_t plaintext[16], uint8_t ciphertext[16] )
+{
+  uint32_t q[8];
+  to_planes( plaintext, q );
+  add_round_key( q, rk );
+  for ( int round = 1; round < nrounds; round++ ) {
+    sub_bytes( q );
+    shift_rows( q );
+    mix_columns( q );
+    add_round_key( q, rk + 4 * round );
+  }
+  sub_bytes( q );
+  shift_rows( q );
+  add_round_key( q, rk + 4 * nrounds );
+  from_planes( q, ciphertext );
+}
+
+// -----------------------------------------------------------------------
+// Decryption
+// -----------------------------------------------------------------------
+
+#ifdef ENABLE_RIJNDAEL_DECRYPT
+int rijndaelSetupDecrypt( uint32_t* rk, const uint8_t* key, int keybits )
+{
+  return rijndaelSetupEncrypt( rk, key, keybits );
+}
+
+void rijndaelDecrypt( const uint32_t* rk, int nrounds,
+                      const uint8_t ciphertext[16], uint8_t plaintext[16] )
+{
+  uint32_t q[8];
+  to_planes( ciphertext, q );
+  add_round_key( q, rk + 4 * nrounds );
+  for ( int round = nrounds - 1; round > 0; round-- ) {
+    inv_shift_rows( q );
+    inv_sub_bytes( q );
+    add_round_key( q, rk + 4 * round );
+    inv_mix_columns( q );
+  }
+  inv_shift_rows( q );
+  inv_sub_bytes( q );
+  add_round_key( q, rk );
+  from_planes( q, plaintext );
+}
+#endif
+
+// -----------------------------------------------------------------------
+// Engine
+// -----------------------------------------------------------------------
+
+const aes_engine_t aes_engine = { "bitsliced", 0, false };
@@ -0,0 +1,18 @@
+// =======================================================================
+// aes_btstack.c
+// =======================================================================
+// Describes BTstack's own rijndael.c as the AES engine, when it's built
+// in instead of ours (AES_ENGINE_FOR_BTSTACK off in CMake). It's the
+// same code as our ttables engine, with its tables in flash
+
+#include "aes_engine.h"
+
+const aes_engine_t aes_engine = {
+  "btstack",
+#ifdef ENABLE_RIJNDAEL_DECRYPT
+  10 * 256 * sizeof( uint32_t ),
+#else
+  5 * 256 * sizeof( uint32_t ),
+#endif
+  false,
+};
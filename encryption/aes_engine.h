@@ -0,0 +1,53 @@
+// =======================================================================
+// aes_engine.h
+// =======================================================================
+// Declarations for the AES engine behind rijndael.h, which both our
+// encryption and BTstack's (ENABLE_SOFTWARE_AES128, for LE pairing) use.
+// The firmware builds one in, chosen with AES_ENGINE in CMake:
+//
+//  - ttables:   rijndael.c, four 1 KB T-tables each way, fully unrolled
+//  - compact:   aes_compact.c, one T-table each way and rotations
+//  - bitsliced: aes_bitsliced.c, with no table lookups at all, so its
+//               timing doesn't depend on the key or the data
+//
+// With AES_ENGINE_FOR_BTSTACK off, BTstack's own rijndael.c is built in
+// instead, the same code as ttables (aes_btstack.c describes it)
+//
+// With AES_TABLES_IN_SRAM, the tables are copied to SRAM at boot (like
+// the SDK's __not_in_flash), rather than read from flash through the
+// XIP cache, where a miss stalls for the QSPI read
+//
+// The compact and bitsliced engines only take 128-bit keys
+//
+// This has no Pico dependencies, so the host tools use the same code
+
+#ifndef ENCRYPTION_AES_ENGINE_H
+#define ENCRYPTION_AES_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef AES_TABLES_IN_SRAM
+#define AES_TABLE __attribute__( ( section( ".time_critical.aes" ) ) )
+#else
+#define AES_TABLE
+#endif
+
+typedef struct {
+  const char* name;
+  uint32_t    table_bytes;  // Lookup tables, encrypting and decrypting
+  bool        tables_in_sram;
+} aes_engine_t;
+
+// The engine built in
+extern const aes_engine_t aes_engine;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ENCRYPTION_AES_ENGINE_H
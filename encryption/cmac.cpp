@@ -0,0 +1,60 @@
+// =======================================================================
+// cmac.cpp
+// =======================================================================
+// Definitions for AES-CMAC (RFC 4493)
+
+#include "cmac.h"
+#include "rijndael.h"
+#include <string.h>
+
+// Doubling in GF(2^128), for the subkeys
+static void double_block( const uint8_t in[16], uint8_t out[16] )
+{
+  uint8_t carry = in[0] >> 7;
+  for ( int i = 0; i < 15; i++ ) {
+    out[i] = ( in[i] << 1 ) | ( in[i + 1] >> 7 );
+  }
+  out[15] = ( in[15] << 1 ) ^ ( carry ? 0x87 : 0x00 );
+}
+
+void aes_cmac( const uint8_t key[16], const uint8_t* msg, size_t len,
+               uint8_t mac[CMAC_LEN] )
+{
+  uint32_t round_keys[RKLENGTH( KEYBITS )];
+  rijndaelSetupEncrypt( round_keys, key, KEYBITS );
+
+  // Subkeys K1 (for a whole last block) and K2 (for a padded one)
+  uint8_t l[16] = { 0 };
+  uint8_t k1[16];
+  uint8_t k2[16];
+  rijndaelEncrypt( round_keys, NROUNDS( KEYBITS ), l, l );
+  double_block( l, k1 );
+  double_block( k1, k2 );
+
+  size_t num_blocks = ( len + 15 ) / 16;
+  bool   whole_last = ( len > 0 ) && ( len % 16 == 0 );
+  if ( num_blocks == 0 ) {
+    num_blocks = 1;
+  }
+
+  uint8_t state[16] = { 0 };
+  for ( size_t block = 0; block + 1 < num_blocks; block++ ) {
+    for ( int i = 0; i < 16; i++ ) {
+      state[i] ^= msg[16 * block + i];
+    }
+    rijndaelEncrypt( round_keys, NROUNDS( KEYBITS ), state, state );
+  }
+
+  // The last block, padded with 0x80 then zeros if it's short
+  uint8_t last[16] = { 0 };
+  size_t  last_len = len - 16 * ( num_blocks - 1 );
+  memcpy( last, msg + 16 * ( num_blocks - 1 ), last_len );
+  if ( !whole_last ) {
+    last[last_len] = 0x80;
+  }
+  const uint8_t* subkey = whole_last ? k1 : k2;
+  for ( int i = 0; i < 16; i++ ) {
+    state[i] ^= last[i] ^ subkey[i];
+  }
+  rijndaelEncrypt( round_keys, NROUNDS( KEYBITS ), state, mac );
+}
@@ -0,0 +1,21 @@
+// =======================================================================
+// cmac.h
+// =======================================================================
+// Declarations for AES-CMAC (RFC 4493), as LoRaWAN uses for its message
+// integrity codes and key derivation
+//
+// This has no Pico dependencies, so the host tools use the same code
+
+#ifndef ENCRYPTION_CMAC_H
+#define ENCRYPTION_CMAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CMAC_LEN 16
+
+// The CMAC of len bytes of msg under key
+void aes_cmac( const uint8_t key[16], const uint8_t* msg, size_t len,
+               uint8_t mac[CMAC_LEN] );
+
+#endif  // ENCRYPTION_CMAC_H
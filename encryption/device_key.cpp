@@ -0,0 +1,28 @@
+// =======================================================================
+// device_key.cpp
+// =======================================================================
+// Definitions for device_key.h
+
+#include "device_key.h"
+#include "cmac.h"
+#include <string.h>
+
+void derive_device_key( const uint8_t root_key[16], uint64_t dev_eui,
+                        uint8_t key[16] )
+{
+  const size_t label_len = sizeof( DEVICE_KEY_LABEL ) - 1;
+  uint8_t      input[1 + label_len + 1 + 8 + 2];
+  size_t       pos = 0;
+
+  input[pos++] = 0x01;  // The counter, i: we only need one block
+  memcpy( input + pos, DEVICE_KEY_LABEL, label_len );
+  pos += label_len;
+  input[pos++] = 0x00;
+  for ( int i = 7; i >= 0; i-- ) {
+    input[pos++] = dev_eui >> ( 8 * i );
+  }
+  input[pos++] = 0x00;  // L, the bits of key material, 128
+  input[pos++] = 0x80;
+
+  aes_cmac( root_key, input, pos, key );
+}
@@ -0,0 +1,29 @@
+// =======================================================================
+// device_key.h
+// =======================================================================
+// Declarations for deriving each device's key from the fleet's root key
+// and its DevEUI, so every device has its own key. The root key never
+// goes on a device: host/provision_keys derives each device's key for
+// its build (key.h), and the application server derives them on demand
+// (host/archive_decrypt -r)
+//
+// The derivation is NIST SP 800-108's KDF in counter mode, with AES-CMAC
+// (cmac.h) as the PRF, for one 128-bit block:
+//
+//   key = CMAC( root, 0x01 || "readings" || 0x00 || DevEUI || 0x0080 )
+//
+// with the DevEUI big-endian, as it's written. This has no Pico
+// dependencies, so the host tools use the same code
+
+#ifndef ENCRYPTION_DEVICE_KEY_H
+#define ENCRYPTION_DEVICE_KEY_H
+
+#include <stdint.h>
+
+#define DEVICE_KEY_LABEL "readings"
+
+// The key of the device with dev_eui, under root_key
+void derive_device_key( const uint8_t root_key[16], uint64_t dev_eui,
+                        uint8_t key[16] );
+
+#endif  // ENCRYPTION_DEVICE_KEY_H
@@ -17,4 +17,173 @@ void aes128_encrypt_6byte_msg(const uint8_t key[16], const uint8_t msg[6], uint8
    
    // Encrypt the padded message
    rijndaelEncrypt(round_keys, NROUNDS(KEYBITS), padded_plaintext, ciphertext);
-}
\ No newline at end of file
+}
+// -----------------------------------------------------------------------
+// AesContext
+// -----------------------------------------------------------------------
+
+AesContext::AesContext( const uint8_t key[16] )
+{
+  set_key( key );
+}
+
+void AesContext::set_key( const uint8_t key[16] )
+{
+  rijndaelSetupEncrypt( round_keys, key, KEYBITS );
+}
+
+void AesContext::encrypt_block( const uint8_t in[AES_BLOCK_LEN],
+                                uint8_t out[AES_BLOCK_LEN] ) const
+{
+  rijndaelEncrypt( round_keys, NROUNDS( KEYBITS ), in, out );
+}
+
+int AesContext::padded_len( int len )
+{
+  return ( len + AES_BLOCK_LEN - 1 ) / AES_BLOCK_LEN * AES_BLOCK_LEN;
+}
+
+int AesContext::encrypt( uint8_t* data, int len ) const
+{
+  int padded = padded_len( len );
+  memset( data + len, 0, padded - len );
+  for ( int i = 0; i < padded; i += AES_BLOCK_LEN ) {
+    encrypt_block( data + i, data + i );
+  }
+  return padded;
+}
+
+// -----------------------------------------------------------------------
+// CCM*
+// -----------------------------------------------------------------------
+
+// B0 and each A_i: flags, the nonce, and the message length or counter
+static void ccm_block( uint8_t flags, const uint8_t nonce[AES_CCM_NONCE_LEN],
+                       uint16_t tail, uint8_t block[AES_BLOCK_LEN] )
+{
+  block[0] = flags;
+  memcpy( block + 1, nonce, AES_CCM_NONCE_LEN );
+  block[14] = tail >> 8;
+  block[15] = tail & 0xFF;
+}
+
+// CBC-MAC over B0, the length-prefixed associated data and the message,
+// each zero-padded to whole blocks
+void AesContext::ccm_mac( const uint8_t nonce[AES_CCM_NONCE_LEN],
+                          const uint8_t* aad, int aad_len,
+                          const uint8_t* data, int len, int mic_len,
+                          uint8_t mac[AES_BLOCK_LEN] ) const
+{
+  uint8_t flags = ( ( aad_len > 0 ) ? 0x40 : 0 ) |
+                  ( ( ( mic_len - 2 ) / 2 ) << 3 ) | 0x01;
+  ccm_block( flags, nonce, len, mac );
+  encrypt_block( mac, mac );
+
+  if ( aad_len > 0 ) {
+    mac[0] ^= aad_len >> 8;
+    mac[1] ^= aad_len & 0xFF;
+    int pos = 2;
+    for ( int i = 0; i < aad_len; i++ ) {
+      mac[pos++] ^= aad[i];
+      if ( pos == AES_BLOCK_LEN ) {
+        encrypt_block( mac, mac );
+        pos = 0;
+      }
+    }
+    if ( pos > 0 ) {
+      encrypt_block( mac, mac );
+    }
+  }
+
+  for ( int i = 0; i < len; i += AES_BLOCK_LEN ) {
+    for ( int j = 0; ( j < AES_BLOCK_LEN ) && ( i + j < len ); j++ ) {
+      mac[j] ^= data[i + j];
+    }
+    encrypt_block( mac, mac );
+  }
+}
+
+// CTR: A_0 encrypts the MIC, and A_1 on the message
+void AesContext::ccm_ctr( const uint8_t nonce[AES_CCM_NONCE_LEN],
+                          uint8_t* data, int len, uint8_t* mic,
+                          int mic_len ) const
+{
+  uint8_t a[AES_BLOCK_LEN];
+  uint8_t s[AES_BLOCK_LEN];
+  ccm_block( 0x01, nonce, 0, a );
+  encrypt_block( a, s );
+  for ( int i = 0; i < mic_len; i++ ) {
+    mic[i] ^= s[i];
+  }
+
+  for ( int i = 0; i < len; i += AES_BLOCK_LEN ) {
+    ccm_block( 0x01, nonce, i / AES_BLOCK_LEN + 1, a );
+    encrypt_block( a, s );
+    for ( int j = 0; ( j < AES_BLOCK_LEN ) && ( i + j < len ); j++ ) {
+      data[i + j] ^= s[j];
+    }
+  }
+}
+
+int AesContext::ccm_seal( const uint8_t nonce[AES_CCM_NONCE_LEN],
+                          const uint8_t* aad, int aad_len, uint8_t* data,
+                          int len, int mic_len ) const
+{
+  uint8_t mac[AES_BLOCK_LEN];
+  ccm_mac( nonce, aad, aad_len, data, len, mic_len, mac );
+  memcpy( data + len, mac, mic_len );
+  ccm_ctr( nonce, data, len, data + len, mic_len );
+  return len + mic_len;
+}
+
+int AesContext::ccm_open( const uint8_t nonce[AES_CCM_NONCE_LEN],
+                          const uint8_t* aad, int aad_len, uint8_t* data,
+                          int len, int mic_len ) const
+{
+  if ( len < mic_len ) {
+    return -1;
+  }
+  len -= mic_len;
+  uint8_t mic[AES_BLOCK_LEN];
+  memcpy( mic, data + len, mic_len );
+  ccm_ctr( nonce, data, len, mic, mic_len );
+
+  // Compare all of it, so the time taken doesn't say where it differs
+  uint8_t mac[AES_BLOCK_LEN];
+  uint8_t diff = 0;
+  ccm_mac( nonce, aad, aad_len, data, len, mic_len, mac );
+  for ( int i = 0; i < mic_len; i++ ) {
+    diff |= mac[i] ^ mic[i];
+  }
+  return diff ? -1 : len;
+}
+
+// The uplink nonce: DevAddr and frame counter (little-endian, as in
+// LoRaWAN's own blocks), then the direction (0 for uplink)
+static void uplink_nonce( uint32_t dev_addr, uint32_t fcnt_up,
+                          uint8_t nonce[AES_CCM_NONCE_LEN] )
+{
+  memset( nonce, 0, AES_CCM_NONCE_LEN );
+  for ( int i = 0; i < 4; i++ ) {
+    nonce[i]     = dev_addr >> ( 8 * i );
+    nonce[4 + i] = fcnt_up >> ( 8 * i );
+  }
+}
+
+int AesContext::seal( uint32_t dev_addr, uint32_t fcnt_up,
+                      const uint8_t* aad, int aad_len, uint8_t* data,
+                      int len ) const
+{
+  uint8_t nonce[AES_CCM_NONCE_LEN];
+  uplink_nonce( dev_addr, fcnt_up, nonce );
+  return ccm_seal( nonce, aad, aad_len, data, len, AES_CCM_MIC_LEN );
+}
+
+int AesContext::open( uint32_t dev_addr, uint32_t fcnt_up,
+                      const uint8_t* aad, int aad_len, uint8_t* data,
+                      int len ) const
+{
+  uint8_t nonce[AES_CCM_NONCE_LEN];
+  uplink_nonce( dev_addr, fcnt_up, nonce );
+  return ccm_open( nonce, aad, aad_len, data, len, AES_CCM_MIC_LEN );
+}
@@ -10,9 +10,88 @@
 #include <stdint.h>
 #include <string.h>
 
+// How readings are encrypted (with the key in key.h) before they go out
+// over LoRaWAN. The TTN payload formatter can't read encrypted frames;
+// decode them with the key on the application server. If a reading
+// doesn't fit DR0 with the overhead, our own data rate selection
+// (CUSTOM_LORAWAN_LINK_DATARATE) moves up a data rate to carry it
+#define ENCRYPT_NONE 0
+#define ENCRYPT_ECB 1  // Zero-padded to whole blocks
+#define ENCRYPT_CCM 2  // CCM*: the same length, plus a MIC
+
+#define ENCRYPT_READINGS ENCRYPT_CCM
+
+#define AES_BLOCK_LEN 16
+
+// CCM* with a 2-byte length field, and a truncated MIC for uplinks
+#define AES_CCM_NONCE_LEN 13
+#define AES_CCM_MIC_LEN 4
+
 // -----------------------------------------------------------------------
 // Encryption function
 // -----------------------------------------------------------------------
+// Expands the key on every call; use an AesContext to encrypt more than
+// once with the same key
 void aes128_encrypt_6byte_msg(const uint8_t key[16], const uint8_t msg[6], uint8_t ciphertext[16]);
 
+// -----------------------------------------------------------------------
+// AesContext
+// -----------------------------------------------------------------------
+// AES-128 with the round keys expanded once, when the key is set
+
+class AesContext {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public Accessor Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  AesContext( const uint8_t key[16] );
+  void set_key( const uint8_t key[16] );
+
+  void encrypt_block( const uint8_t in[AES_BLOCK_LEN],
+                      uint8_t out[AES_BLOCK_LEN] ) const;
+
+  // Zero-pad len bytes of data to whole blocks and encrypt them in place
+  // (ECB). The buffer must have room for padded_len( len ) bytes.
+  // Returns the padded length
+  int encrypt( uint8_t* data, int len ) const;
+
+  static int padded_len( int len );
+
+  // AES-CCM* (RFC 3610): encrypt len bytes of data in place, and append a
+  // mic_len-byte MIC over them and aad_len bytes of associated data (which
+  // go in the clear). Returns len + mic_len
+  int ccm_seal( const uint8_t nonce[AES_CCM_NONCE_LEN], const uint8_t* aad,
+                int aad_len, uint8_t* data, int len, int mic_len ) const;
+
+  // Check the MIC at the end of len bytes of data and decrypt the rest in
+  // place. Returns the plaintext length, or -1 if the MIC doesn't match
+  int ccm_open( const uint8_t nonce[AES_CCM_NONCE_LEN], const uint8_t* aad,
+                int aad_len, uint8_t* data, int len, int mic_len ) const;
+
+  // The same for an uplink payload, with an AES_CCM_MIC_LEN-byte MIC. The
+  // nonce is the DevAddr and frame counter of the uplink it goes out in,
+  // which the server has too, so nothing extra goes on the air. A rejoin
+  // resets the counter, but the network assigns a new DevAddr
+  int seal( uint32_t dev_addr, uint32_t fcnt_up, const uint8_t* aad,
+            int aad_len, uint8_t* data, int len ) const;
+  int open( uint32_t dev_addr, uint32_t fcnt_up, const uint8_t* aad,
+            int aad_len, uint8_t* data, int len ) const;
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Private Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ private:
+  void ccm_mac( const uint8_t nonce[AES_CCM_NONCE_LEN], const uint8_t* aad,
+                int aad_len, const uint8_t* data, int len, int mic_len,
+                uint8_t mac[AES_BLOCK_LEN] ) const;
+  void ccm_ctr( const uint8_t nonce[AES_CCM_NONCE_LEN], uint8_t* data,
+                int len, uint8_t* mic, int mic_len ) const;
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected Attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  uint32_t round_keys[RKLENGTH( KEYBITS )];
+};
+
 #endif
@@ -6,11 +6,12 @@
 #define FULL_UNROLL
 
 #include "rijndael.h"
+#include "aes_engine.h"
 
 typedef uint32_t u32;
 typedef uint8_t   u8;
 
-static const u32 Te0[256] =
+static const u32 Te0[256] AES_TABLE =
 {
   0xc66363a5U, 0xf87c7c84U, 0xee777799U, 0xf67b7b8dU,
   0xfff2f20dU, 0xd66b6bbdU, 0xde6f6fb1U, 0x91c5c554U,
@@ -78,7 +79,7 @@ static const u32 Te0[256] =
   0x7bb0b0cbU, 0xa85454fcU, 0x6dbbbbd6U, 0x2c16163aU,
 };
 
-static const u32 Te1[256] =
+static const u32 Te1[256] AES_TABLE =
 {
   0xa5c66363U, 0x84f87c7cU, 0x99ee7777U, 0x8df67b7bU,
   0x0dfff2f2U, 0xbdd66b6bU, 0xb1de6f6fU, 0x5491c5c5U,
@@ -146,7 +147,7 @@ static const u32 Te1[256] =
   0xcb7bb0b0U, 0xfca85454U, 0xd66dbbbbU, 0x3a2c1616U,
 };
 
-static const u32 Te2[256] =
+static const u32 Te2[256] AES_TABLE =
 {
   0x63a5c663U, 0x7c84f87cU, 0x7799ee77U, 0x7b8df67bU,
   0xf20dfff2U, 0x6bbdd66bU, 0x6fb1de6fU, 0xc55491c5U,
@@ -214,7 +215,7 @@ static const u32 Te2[256] =
   0xb0cb7bb0U, 0x54fca854U, 0xbbd66dbbU, 0x163a2c16U,
 };
 
-static const u32 Te3[256] =
+static const u32 Te3[256] AES_TABLE =
 {
   0x6363a5c6U, 0x7c7c84f8U, 0x777799eeU, 0x7b7b8df6U,
   0xf2f20dffU, 0x6b6bbdd6U, 0x6f6fb1deU, 0xc5c55491U,
@@ -282,7 +283,7 @@ static const u32 Te3[256] =
   0xb0b0cb7bU, 0x5454fca8U, 0xbbbbd66dU, 0x16163a2cU,
 };
 
-static const u32 Te4[256] =
+static const u32 Te4[256] AES_TABLE =
 {
   0x63636363U, 0x7c7c7c7cU, 0x77777777U, 0x7b7b7b7bU,
   0xf2f2f2f2U, 0x6b6b6b6bU, 0x6f6f6f6fU, 0xc5c5c5c5U,
@@ -351,7 +352,7 @@ static const u32 Te4[256] =
 };
 
 #ifdef ENABLE_RIJNDAEL_DECRYPT
-static const u32 Td0[256] =
+static const u32 Td0[256] AES_TABLE =
 {
   0x51f4a750U, 0x7e416553U, 0x1a17a4c3U, 0x3a275e96U,
   0x3bab6bcbU, 0x1f9d45f1U, 0xacfa58abU, 0x4be30393U,
@@ -419,7 +420,7 @@ static const u32 Td0[256] =
   0x7bcb8461U, 0xd532b670U, 0x486c5c74U, 0xd0b85742U,
 };
 
-static const u32 Td1[256] =
+static const u32 Td1[256] AES_TABLE =
 {
   0x5051f4a7U, 0x537e4165U, 0xc31a17a4U, 0x963a275eU,
   0xcb3bab6bU, 0xf11f9d45U, 0xabacfa58U, 0x934be303U,
@@ -487,7 +488,7 @@ static const u32 Td1[256] =
   0x617bcb84U, 0x70d532b6U, 0x74486c5cU, 0x42d0b857U,
 };
 
-static const u32 Td2[256] =
+static const u32 Td2[256] AES_TABLE =
 {
   0xa75051f4U, 0x65537e41U, 0xa4c31a17U, 0x5e963a27U,
   0x6bcb3babU, 0x45f11f9dU, 0x58abacfaU, 0x03934be3U,
@@ -555,7 +556,7 @@ static const u32 Td2[256] =
   0x84617bcbU, 0xb670d532U, 0x5c74486cU, 0x5742d0b8U,
 };
 
-static const u32 Td3[256] =
+static const u32 Td3[256] AES_TABLE =
 {
   0xf4a75051U, 0x4165537eU, 0x17a4c31aU, 0x275e963aU,
   0xab6bcb3bU, 0x9d45f11fU, 0xfa58abacU, 0xe303934bU,
@@ -623,7 +624,7 @@ static const u32 Td3[256] =
   0xcb84617bU, 0x32b670d5U, 0x6c5c7448U, 0xb85742d0U,
 };
 
-static const u32 Td4[256] =
+static const u32 Td4[256] AES_TABLE =
 {
   0x52525252U, 0x09090909U, 0x6a6a6a6aU, 0xd5d5d5d5U,
   0x30303030U, 0x36363636U, 0xa5a5a5a5U, 0x38383838U,
@@ -1256,3 +1257,17 @@ void rijndaelDecrypt(const uint32_t *rk, int nrounds, const uint8_t ciphertext[1
 
 }
 #endif
+
+const aes_engine_t aes_engine = {
+  "ttables",
+#ifdef ENABLE_RIJNDAEL_DECRYPT
+  10 * 256 * sizeof(u32),
+#else
+  5 * 256 * sizeof(u32),
+#endif
+#ifdef AES_TABLES_IN_SRAM
+  true,
+#else
+  false,
+#endif
+};
@@ -0,0 +1,317 @@
+// =======================================================================
+// ack_sim.cpp
+// =======================================================================
+// Simulates a month of readings over a lossy link, sent as confirmed
+// uplinks (one downlink per frame) and as unconfirmed uplinks with
+// cumulative ACKs (see lorawan/seq_ack.h), and compares the downlinks
+// spent per delivered reading
+//
+// The device side mirrors FSM::drain_confirmed and FSM::drain_unconfirmed
+// (with the queue in RAM). The server side is a reference for the
+// application server: it ACKs when it sees a gap or a duplicate, and
+// after every ACK_EVERY new readings
+
+#include "lorawan/codec.h"
+#include "lorawan/scheduler.h"
+#include "lorawan/seq_ack.h"
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+#include <stdio.h>
+
+#define SIM_DAYS 30
+#define STEP_MS 1000
+#define DATARATE 0
+
+// Losses on the uplink and downlink
+#define UPLINK_LOSS 0.1
+#define DOWNLINK_LOSS 0.05
+
+// Device policy (as in ui/state_machine.cpp)
+#define ACK_TIMEOUT_MS ( 6 * 60 * 60 * 1000ull )
+
+// Server policy
+#define ACK_EVERY 8
+
+const int readings_per_day[] = { 2, 8, 24, 96 };
+
+// Frame length for each number of readings
+int frame_lens[CODEC_MAX_READINGS + 1];
+
+// -----------------------------------------------------------------------
+// Server
+// -----------------------------------------------------------------------
+
+class AckServer {
+ public:
+  // Returns whether to reply with an ACK
+  bool on_uplink( uint32_t first, int count )
+  {
+    bool duplicate = false;
+    for ( int i = 0; i < count; i++ ) {
+      duplicate |= !received.insert( first + i ).second;
+    }
+    while ( received.count( next_expected ) ) {
+      next_expected++;
+    }
+    bool gap = !received.empty() && ( *received.rbegin() >= next_expected );
+
+    unacked += count;
+    if ( duplicate || gap || ( unacked >= ACK_EVERY ) ) {
+      unacked = 0;
+      return true;
+    }
+    return false;
+  }
+
+  seq_ack_t ack()
+  {
+    seq_ack_t ack = {};
+    ack.next_expected = next_expected;
+    for ( uint32_t seq : received ) {
+      int bit = (int) ( seq - next_expected ) - 1;
+      if ( ( bit >= 0 ) && ( bit < SEQ_ACK_MAX_BITMAP * 8 ) ) {
+        ack.bitmap[bit / 8] |= 0x80 >> ( bit % 8 );
+        ack.bitmap_len =
+            std::max( ack.bitmap_len, (uint8_t) ( bit / 8 + 1 ) );
+      }
+    }
+    return ack;
+  }
+
+  size_t delivered() { return received.size(); }
+
+ private:
+  std::set<uint32_t> received;
+  uint32_t           next_expected = 0;
+  int                unacked       = 0;
+};
+
+// -----------------------------------------------------------------------
+// Results
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint32_t readings;
+  uint32_t uplinks;
+  uint32_t downlinks;
+  uint32_t delivered;   // Readings the server has
+  uint32_t acked;       // Readings the device knows were delivered
+  uint64_t airtime_ms;
+} sim_result_t;
+
+// -----------------------------------------------------------------------
+// simulate
+// -----------------------------------------------------------------------
+
+sim_result_t simulate( bool cumulative, int per_day, int frame_capacity )
+{
+  sim_result_t                result = {};
+  std::mt19937                rng( 5220 );
+  std::bernoulli_distribution uplink_lost( UPLINK_LOSS );
+  std::bernoulli_distribution downlink_lost( DOWNLINK_LOSS );
+
+  UplinkScheduler scheduler( 5220 );
+  AckServer       server;
+
+  std::set<uint32_t> pending;  // Readings not yet acknowledged
+  uint32_t           next_seq = 0;
+
+  // Device state (as in FSM)
+  uint32_t next_unsent    = 0;
+  uint32_t resend_from    = 0;
+  uint32_t resend_end     = 0;
+  uint64_t ack_wait_start = 0;
+
+  uint64_t interval_ms = 86400000ull / per_day;
+  uint64_t end_ms      = SIM_DAYS * 86400000ull;
+
+  for ( uint64_t now = 0; now < end_ms; now += STEP_MS ) {
+    if ( now % interval_ms == 0 ) {
+      pending.insert( next_seq++ );
+      result.readings++;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Pick the readings for the next frame
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    // Consecutive pending readings from min_seq, before end_seq
+    auto pack = [&]( uint32_t min_seq, uint32_t end_seq,
+                     bool consecutive ) {
+      std::vector<uint32_t> frame;
+      for ( auto it = pending.lower_bound( min_seq );
+            ( it != pending.end() ) && ( *it < end_seq ) &&
+            ( (int) frame.size() < frame_capacity );
+            ++it ) {
+        if ( consecutive && !frame.empty() &&
+             ( *it != frame.back() + 1 ) ) {
+          break;
+        }
+        frame.push_back( *it );
+      }
+      return frame;
+    };
+
+    std::vector<uint32_t> frame;
+    bool                  resend = false;
+    if ( !cumulative ) {
+      frame = pack( 0, UINT32_MAX, false );
+    }
+    else {
+      resend = true;
+      frame  = pack( resend_from, resend_end, true );
+      if ( frame.empty() ) {
+        resend = false;
+        frame  = pack( next_unsent, UINT32_MAX, true );
+      }
+      if ( frame.empty() && !pending.empty() &&
+           ( now - ack_wait_start >= ACK_TIMEOUT_MS ) ) {
+        resend         = true;
+        ack_wait_start = now;
+        frame          = pack( 0, next_unsent, true );
+      }
+    }
+    if ( frame.empty() ) {
+      continue;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Send it
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    int len = frame_lens[frame.size()] +
+              ( cumulative ? SEQ_ACK_HEADER_LEN : 0 );
+    if ( scheduler.check( now, DATARATE, len, !cumulative ) !=
+         SCHED_SEND ) {
+      continue;
+    }
+    scheduler.on_uplink( now, DATARATE, len );
+    result.uplinks++;
+    result.airtime_ms +=
+        ( UplinkScheduler::time_on_air_us( DATARATE, len ) + 999 ) / 1000;
+
+    bool arrived = !uplink_lost( rng );
+
+    if ( !cumulative ) {
+      // The MAC ACKs every confirmed uplink that arrives
+      if ( arrived ) {
+        for ( uint32_t seq : frame ) {
+          server.on_uplink( seq, 1 );
+        }
+        result.downlinks++;
+        if ( !downlink_lost( rng ) ) {
+          scheduler.on_downlink( now );
+          scheduler.on_delivered();
+          for ( uint32_t seq : frame ) {
+            pending.erase( seq );
+            result.acked++;
+          }
+        }
+      }
+      continue;
+    }
+
+    uint32_t after = frame.back() + 1;
+    if ( resend ) {
+      resend_from = after;
+    }
+    else {
+      next_unsent    = after;
+      ack_wait_start = now;
+      scheduler.on_delivered();
+    }
+
+    if ( !arrived || !server.on_uplink( frame.front(), frame.size() ) ) {
+      continue;
+    }
+    result.downlinks++;
+    if ( downlink_lost( rng ) ) {
+      continue;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Apply the ACK (as in FSM::apply_ack)
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    uint8_t   downlink[SEQ_ACK_HEADER_LEN + SEQ_ACK_MAX_BITMAP];
+    seq_ack_t sent = server.ack();
+    seq_ack_t ack;
+    seq_ack_decode( downlink, seq_ack_encode( &sent, downlink ), &ack );
+    scheduler.on_downlink( now );
+
+    int num_acked = 0;
+    for ( auto it = pending.begin(); it != pending.end(); ) {
+      if ( seq_ack_covers( &ack, *it ) ) {
+        it = pending.erase( it );
+        num_acked++;
+      }
+      else {
+        ++it;
+      }
+    }
+    result.acked += num_acked;
+    resend_from = 0;
+    resend_end =
+        std::min( seq_ack_expand( seq_ack_horizon( &ack ), next_unsent ),
+                  next_unsent );
+    if ( num_acked > 0 ) {
+      scheduler.on_delivered();
+    }
+    ack_wait_start = now;
+  }
+
+  result.delivered = server.delivered();
+  return result;
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( void )
+{
+  // Readings per frame at our data rate, with and without the header
+  codec_reading_t readings[CODEC_MAX_READINGS] = {};
+  uint8_t         frame[CODEC_MAX_FRAME];
+  int             len;
+  for ( int i = 0; i < CODEC_MAX_READINGS; i++ ) {
+    readings[i] = { 128, 82, 72, 1735689600u + i * 3600 };
+  }
+  for ( int n = 1; n <= CODEC_MAX_READINGS; n++ ) {
+    codec_encode( readings, n, frame, CODEC_MAX_FRAME, &frame_lens[n] );
+  }
+  int max_payload = UplinkScheduler::max_payload( DATARATE );
+  int confirmed_capacity =
+      codec_encode( readings, CODEC_MAX_READINGS, frame, max_payload, &len );
+  int cumulative_capacity =
+      codec_encode( readings, CODEC_MAX_READINGS, frame,
+                    max_payload - SEQ_ACK_HEADER_LEN, &len );
+
+  printf( "%d days at DR%d (%d B payload: %d readings per confirmed "
+          "frame, %d with a header), %.0f%% uplinks and %.0f%% downlinks "
+          "lost\n\n",
+          SIM_DAYS, DATARATE, max_payload, confirmed_capacity,
+          cumulative_capacity, UPLINK_LOSS * 100, DOWNLINK_LOSS * 100 );
+  printf( " per day | mode       | uplinks | downlinks | delivered | "
+          "acked  | airtime s | downlinks/reading\n" );
+  printf( "---------+------------+---------+-----------+-----------+"
+          "--------+-----------+------------------\n" );
+
+  for ( int per_day : readings_per_day ) {
+    for ( int cumulative = 0; cumulative < 2; cumulative++ ) {
+      sim_result_t r =
+          simulate( cumulative, per_day,
+                    cumulative ? cumulative_capacity : confirmed_capacity );
+      printf( " %7d | %-10s | %7lu | %9lu | %4lu/%-4lu | %6lu | %9.1f | "
+              "%17.2f\n",
+              per_day, cumulative ? "cumulative" : "confirmed",
+              (unsigned long) r.uplinks, (unsigned long) r.downlinks,
+              (unsigned long) r.delivered, (unsigned long) r.readings,
+              (unsigned long) r.acked, r.airtime_ms / 1000.0,
+              r.delivered ? (double) r.downlinks / r.delivered : 0.0 );
+    }
+  }
+  return 0;
+}
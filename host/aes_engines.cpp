@@ -0,0 +1,184 @@
+// =======================================================================
+// aes_engines.cpp
+// =======================================================================
+// Compares the AES engines the firmware can build in (see
+// encryption/aes_engine.h): checks each against FIPS-197's example and
+// against rijndael.c on random keys and blocks, then reports cycles to
+// set up a key and to encrypt and decrypt a block, and their tables
+//
+// Cycles come from the time-stamp counter on x86, and are nanoseconds
+// elsewhere. Here every table sits in L1, so this shows what each costs
+// in instructions; on the Pico the T-tables also miss the XIP cache
+// unless they're in SRAM (see app/aes_engine_bench.cpp)
+//
+//   aes_engines [blocks to check]
+
+#include "encryption/aes_engine.h"
+#include "encryption/rijndael.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#define CYCLES "cycles"
+#else
+#define CYCLES "ns"
+#endif
+
+#define DEFAULT_CHECKS 100000
+#define REPEATS 20000
+
+// Each engine, built with its functions renamed (see CMakeLists.txt)
+#define ENGINE( name )                                                   \
+  extern "C" int  name##_setup_encrypt( uint32_t*, const uint8_t*, int ); \
+  extern "C" int  name##_setup_decrypt( uint32_t*, const uint8_t*, int ); \
+  extern "C" void name##_encrypt( const uint32_t*, int, const uint8_t*,   \
+                                  uint8_t* );                             \
+  extern "C" void name##_decrypt( const uint32_t*, int, const uint8_t*,   \
+                                  uint8_t* );                             \
+  extern "C" const aes_engine_t name##_engine;
+
+ENGINE( ttables )
+ENGINE( compact )
+ENGINE( bitsliced )
+
+typedef struct {
+  const aes_engine_t* info;
+  int ( *setup_encrypt )( uint32_t*, const uint8_t*, int );
+  int ( *setup_decrypt )( uint32_t*, const uint8_t*, int );
+  void ( *encrypt )( const uint32_t*, int, const uint8_t*, uint8_t* );
+  void ( *decrypt )( const uint32_t*, int, const uint8_t*, uint8_t* );
+} engine_t;
+
+#define ENGINE_ENTRY( name )                                             \
+  {                                                                      \
+    &name##_engine, name##_setup_encrypt, name##_setup_decrypt,          \
+        name##_encrypt, name##_decrypt                                   \
+  }
+
+const engine_t engines[] = { ENGINE_ENTRY( ttables ),
+                             ENGINE_ENTRY( compact ),
+                             ENGINE_ENTRY( bitsliced ) };
+
+// FIPS-197 Appendix C.1
+const uint8_t fips_key[16]    = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                  0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+                                  0x0c, 0x0d, 0x0e, 0x0f };
+const uint8_t fips_plain[16]  = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+                                  0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+                                  0xcc, 0xdd, 0xee, 0xff };
+const uint8_t fips_cipher[16] = { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b,
+                                  0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80,
+                                  0x70, 0xb4, 0xc5, 0x5a };
+
+static uint64_t cycles()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch() )
+      .count();
+#endif
+}
+
+// Least cycles per call of f over REPEATS calls, in batches of 100
+template <typename F>
+static double measure( F f )
+{
+  double best = 1e30;
+  for ( int batch = 0; batch < REPEATS / 100; batch++ ) {
+    uint64_t start = cycles();
+    for ( int i = 0; i < 100; i++ ) {
+      f();
+    }
+    best = std::min( best, ( cycles() - start ) / 100.0 );
+  }
+  return best;
+}
+
+// The engine has to give FIPS-197's ciphertext, and the same as
+// rijndael.c (as the host tools build it) for random keys and blocks
+static bool check( const engine_t& engine, int num_checks )
+{
+  uint32_t rk[RKLENGTH( KEYBITS )];
+  uint32_t ref_rk[RKLENGTH( KEYBITS )];
+  uint8_t  out[16];
+  uint8_t  ref[16];
+
+  int nrounds = engine.setup_encrypt( rk, fips_key, KEYBITS );
+  engine.encrypt( rk, nrounds, fips_plain, out );
+  bool ok = ( nrounds == NROUNDS( KEYBITS ) ) &&
+            ( memcmp( out, fips_cipher, 16 ) == 0 );
+  engine.setup_decrypt( rk, fips_key, KEYBITS );
+  engine.decrypt( rk, nrounds, fips_cipher, out );
+  ok &= ( memcmp( out, fips_plain, 16 ) == 0 );
+
+  std::mt19937 rng( 1 );
+  for ( int i = 0; ( i < num_checks ) && ok; i++ ) {
+    uint8_t key[16];
+    uint8_t block[16];
+    for ( int j = 0; j < 16; j++ ) {
+      key[j]   = rng();
+      block[j] = rng();
+    }
+    engine.setup_encrypt( rk, key, KEYBITS );
+    rijndaelSetupEncrypt( ref_rk, key, KEYBITS );
+    engine.encrypt( rk, nrounds, block, out );
+    rijndaelEncrypt( ref_rk, nrounds, block, ref );
+    ok &= ( memcmp( out, ref, 16 ) == 0 );
+
+    engine.setup_decrypt( rk, key, KEYBITS );
+    rijndaelSetupDecrypt( ref_rk, key, KEYBITS );
+    engine.decrypt( rk, nrounds, block, out );
+    rijndaelDecrypt( ref_rk, nrounds, block, ref );
+    ok &= ( memcmp( out, ref, 16 ) == 0 );
+  }
+  return ok;
+}
+
+int main( int argc, char** argv )
+{
+  int  num_checks = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_CHECKS;
+  bool ok         = true;
+
+  printf( " engine    | tables B | key setup | encrypt | decrypt key | "
+          "decrypt | checks\n" );
+  printf( "-----------+----------+-----------+---------+-------------+"
+          "---------+-------\n" );
+  for ( const engine_t& engine : engines ) {
+    bool engine_ok = check( engine, num_checks );
+    ok &= engine_ok;
+
+    uint32_t         rk[RKLENGTH( KEYBITS )];
+    uint8_t          block[16] = { 0 };
+    volatile uint8_t sink      = 0;
+    double           setup     = measure( [&]() {
+      engine.setup_encrypt( rk, fips_key, KEYBITS );
+      sink = sink + rk[0];
+    } );
+    double           encrypt   = measure( [&]() {
+      engine.encrypt( rk, NROUNDS( KEYBITS ), block, block );
+      sink = sink + block[0];
+    } );
+    double           setup_dec = measure( [&]() {
+      engine.setup_decrypt( rk, fips_key, KEYBITS );
+      sink = sink + rk[0];
+    } );
+    double           decrypt   = measure( [&]() {
+      engine.decrypt( rk, NROUNDS( KEYBITS ), block, block );
+      sink = sink + block[0];
+    } );
+
+    printf( " %-9s | %8lu | %9.0f | %7.0f | %11.0f | %7.0f | %s\n",
+            engine.info->name, (unsigned long) engine.info->table_bytes,
+            setup, encrypt, setup_dec, decrypt, engine_ok ? "ok" : "FAILED" );
+  }
+  printf( "\n" CYCLES ", with %d random keys and blocks checked against "
+          "rijndael.c: %s\n",
+          num_checks, ok ? "OK" : "FAILED" );
+  return ok ? 0 : 1;
+}
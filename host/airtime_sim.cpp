@@ -0,0 +1,230 @@
+// =======================================================================
+// airtime_sim.cpp
+// =======================================================================
+// Prints LoRa time-on-air for each US915 data rate, then simulates a week
+// of twice-daily readings (with a day-long gateway outage and some lost
+// frames) to compare the original fixed 5 s resend against our uplink
+// scheduler, in airtime and downlinks per rolling 24 hours
+
+#include "lorawan/scheduler.h"
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+
+// Simulated week, in 1 s steps
+#define SIM_DAYS 7
+#define SIM_HOURS ( SIM_DAYS * 24 )
+#define STEP_MS 1000
+
+// Gateway outage, and loss of frames otherwise
+#define OUTAGE_START_H 48
+#define OUTAGE_END_H 72
+#define LOSS_RATE 0.1
+
+// Confirmations arrive in RX1, a second after the uplink
+#define ACK_DELAY_MS 1000
+
+// One encoded reading, at the default data rate
+#define PAYLOAD_LEN 5
+#define DATARATE 0
+
+// Original firmware's resend interval
+#define LEGACY_RESEND_MS 5000
+
+const int payload_lens[] = { 5, 11, 53, 125, 242 };
+
+// -----------------------------------------------------------------------
+// Results
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint32_t uplinks;
+  uint32_t downlinks;
+  uint32_t delivered;
+  uint64_t total_airtime_ms;
+  uint64_t total_delay_ms;
+  uint32_t hour_airtime_ms[SIM_HOURS];
+  uint32_t hour_downlinks[SIM_HOURS];
+} sim_result_t;
+
+// Most airtime (or downlinks) in any 24 hours
+uint32_t peak_24h( const uint32_t* hours )
+{
+  uint32_t peak = 0;
+  for ( int start = 0; start + 24 <= SIM_HOURS; start++ ) {
+    uint32_t sum = 0;
+    for ( int h = start; h < start + 24; h++ ) {
+      sum += hours[h];
+    }
+    peak = std::max( peak, sum );
+  }
+  return peak;
+}
+
+// Days where the rolling 24 hours went over a budget
+int days_over( const uint32_t* hours, uint32_t budget )
+{
+  int days = 0;
+  for ( int day = 1; day <= SIM_DAYS; day++ ) {
+    uint32_t sum = 0;
+    for ( int h = ( day - 1 ) * 24; h < day * 24; h++ ) {
+      sum += hours[h];
+    }
+    days += ( sum > budget );
+  }
+  return days;
+}
+
+// -----------------------------------------------------------------------
+// simulate
+// -----------------------------------------------------------------------
+
+sim_result_t simulate( bool use_scheduler )
+{
+  sim_result_t result = {};
+  std::mt19937 rng( 5220 );
+  std::bernoulli_distribution lost( LOSS_RATE );
+
+  UplinkScheduler scheduler( 5220 );
+  uint32_t toa_ms =
+      ( UplinkScheduler::time_on_air_us( DATARATE, PAYLOAD_LEN ) + 999 ) /
+      1000;
+
+  uint64_t queued[SIM_DAYS * 2 + 1];  // Times readings were taken
+  int      num_queued = 0;
+  int      next_sent  = 0;
+
+  bool     sent      = false;
+  uint64_t send_time = 0;
+  uint64_t ack_time  = UINT64_MAX;
+
+  for ( uint64_t now = 0; now < SIM_HOURS * 3600000ull; now += STEP_MS ) {
+    int hour = now / 3600000;
+
+    // Readings at 07:00 and 19:00
+    if ( now % ( 12 * 3600000ull ) == 7 * 3600000ull ) {
+      queued[num_queued++] = now;
+    }
+    if ( next_sent == num_queued ) {
+      continue;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Confirmation
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    if ( now >= ack_time ) {
+      result.hour_downlinks[hour]++;
+      result.downlinks++;
+      result.delivered++;
+      result.total_delay_ms += now - queued[next_sent];
+      next_sent++;
+      sent     = false;
+      ack_time = UINT64_MAX;
+      if ( use_scheduler ) {
+        scheduler.on_downlink( now );
+        scheduler.on_delivered();
+      }
+      continue;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Send (or resend)
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    bool send;
+    if ( use_scheduler ) {
+      send = scheduler.check( now, DATARATE, PAYLOAD_LEN, true ) ==
+             SCHED_SEND;
+    }
+    else {
+      send = !sent || ( now - send_time > LEGACY_RESEND_MS );
+    }
+    if ( !send ) {
+      continue;
+    }
+
+    sent      = true;
+    send_time = now;
+    result.uplinks++;
+    result.total_airtime_ms += toa_ms;
+    result.hour_airtime_ms[hour] += toa_ms;
+    if ( use_scheduler ) {
+      scheduler.on_uplink( now, DATARATE, PAYLOAD_LEN );
+    }
+
+    bool outage = ( hour >= OUTAGE_START_H ) && ( hour < OUTAGE_END_H );
+    if ( !outage && !lost( rng ) && ( ack_time == UINT64_MAX ) ) {
+      ack_time = now + ACK_DELAY_MS;
+    }
+  }
+
+  if ( use_scheduler ) {
+    scheduler.print_stats( SIM_HOURS * 3600000ull );
+    printf( "\n" );
+  }
+  return result;
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+void print_result( const char* name, const sim_result_t& r )
+{
+  printf( " %-9s | %7lu | %8.1f | %10.1f | %12lu | %9d | %9d | %7.1f\n",
+          name, (unsigned long) r.uplinks,
+          r.total_airtime_ms / 1000.0,
+          peak_24h( r.hour_airtime_ms ) / 1000.0,
+          (unsigned long) peak_24h( r.hour_downlinks ),
+          days_over( r.hour_airtime_ms, SCHED_AIRTIME_BUDGET_MS ),
+          days_over( r.hour_downlinks, SCHED_DOWNLINK_BUDGET ),
+          r.delivered ? r.total_delay_ms / 60000.0 / r.delivered : 0.0 );
+}
+
+int main( void )
+{
+  printf( "Time-on-air (ms) by application payload:\n\n" );
+  printf( " DR | max B |" );
+  for ( int len : payload_lens ) {
+    printf( " %5d B |", len );
+  }
+  printf( "\n----+-------+" );
+  for ( size_t i = 0; i < sizeof( payload_lens ) / sizeof( int ); i++ ) {
+    printf( "---------+" );
+  }
+  printf( "\n" );
+  for ( int dr = 0; dr < SCHED_NUM_DATARATES; dr++ ) {
+    printf( " %2d | %5d |", dr, UplinkScheduler::max_payload( dr ) );
+    for ( int len : payload_lens ) {
+      if ( len > UplinkScheduler::max_payload( dr ) ) {
+        printf( "       - |" );
+      }
+      else {
+        printf( " %7.1f |",
+                UplinkScheduler::time_on_air_us( dr, len ) / 1000.0 );
+      }
+    }
+    printf( "\n" );
+  }
+
+  printf( "\n%d days, %d B readings at DR%d, gateway down from hour %d to "
+          "%d, %.0f%% frames lost\n\n",
+          SIM_DAYS, PAYLOAD_LEN, DATARATE, OUTAGE_START_H, OUTAGE_END_H,
+          LOSS_RATE * 100 );
+
+  sim_result_t legacy    = simulate( false );
+  sim_result_t scheduled = simulate( true );
+
+  printf( " strategy  | uplinks | airtime  | peak 24 h  | peak 24 h    | "
+          "days over | days over | delay\n" );
+  printf( "           |         | total s  | airtime s  | downlinks    | "
+          "airtime   | downlinks | min\n" );
+  printf( "-----------+---------+----------+------------+--------------+---"
+          "--------+-----------+--------\n" );
+  print_result( "fixed 5 s", legacy );
+  print_result( "scheduler", scheduled );
+  printf( "\nBudgets: %d s airtime, %d downlinks per day\n",
+          SCHED_AIRTIME_BUDGET_MS / 1000, SCHED_DOWNLINK_BUDGET );
+  return 0;
+}
@@ -0,0 +1,460 @@
+// =======================================================================
+// archive_decrypt.cpp
+// =======================================================================
+// Decrypts an archive of uplink payloads in bulk (see bulk_decrypt.h),
+// one uplink per line, as the network server's metadata gives them:
+//
+//   <DevEUI hex> <DevAddr hex> <FCnt> <payload hex>
+//
+// printing each as "<DevEUI> <FCnt> <plaintext hex>", or "-" where it
+// doesn't decrypt, ready for decode. Each device's key is derived from
+// the fleet's root key given with -r (see encryption/device_key.h), or
+// is the one given with -k, unless -K names a file of "<DevEUI hex> <key
+// hex>" lines. -e ecb reads the older padded payloads, and -a payloads
+// with a cumulative-ACK header. -c sets how many key schedules to cache
+//
+//   archive_decrypt -r $ROOT_KEY [-K keys] [-e ecb] [-a] [-c 16384]
+//                   [archive]
+//
+// With -b, benchmarks records per second on a synthetic archive, whose
+// devices' keys are derived as they're needed, with rijndael.c and with
+// AES-NI, and checks they're bit-exact
+//
+//   archive_decrypt -b [records] [devices] [-e ecb] [-c 16384]
+
+#include "bulk_decrypt.h"
+#include "encryption/device_key.h"
+#include "lorawan/codec.h"
+#include "lorawan/seq_ack.h"
+#include <chrono>
+#include <ctype.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DEFAULT_CACHE 16384
+#define DEFAULT_RECORDS 1000000
+#define DEFAULT_DEVICES 10000
+#define MAX_PAYLOAD 242
+
+// -----------------------------------------------------------------------
+// Archives
+// -----------------------------------------------------------------------
+
+typedef struct {
+  std::vector<archive_record_t> records;
+  std::vector<uint8_t>          bytes;
+} archive_t;
+
+// Returns the number of bytes, or -1 if the string isn't valid hex
+static int parse_hex( const char* hex, uint8_t* bytes, int max_len )
+{
+  int len = 0;
+  for ( ; isxdigit( (unsigned char) hex[0] ); hex += 2 ) {
+    unsigned int byte;
+    if ( ( len >= max_len ) || !isxdigit( (unsigned char) hex[1] ) ||
+         ( sscanf( hex, "%2x", &byte ) != 1 ) ) {
+      return -1;
+    }
+    bytes[len++] = byte;
+  }
+  return len;
+}
+
+static bool read_archive( FILE* file, bool with_header, archive_t* archive )
+{
+  char line[1024];
+  int  line_num = 0;
+  while ( fgets( line, sizeof( line ), file ) ) {
+    line_num++;
+    unsigned long long dev_eui;
+    unsigned int       dev_addr;
+    unsigned int       fcnt_up;
+    int                skip = 0;
+    if ( sscanf( line, "%llx %x %u %n", &dev_eui, &dev_addr, &fcnt_up,
+                 &skip ) != 3 ) {
+      if ( line[strspn( line, " \t\r\n" )] == '\0' ) {
+        continue;
+      }
+      fprintf( stderr, "line %d: expected DevEUI DevAddr FCnt payload\n",
+               line_num );
+      return false;
+    }
+    uint8_t payload[MAX_PAYLOAD];
+    int     len = parse_hex( line + skip, payload, sizeof( payload ) );
+    if ( len < 0 ) {
+      fprintf( stderr, "line %d: payload isn't hex\n", line_num );
+      return false;
+    }
+    archive_record_t record = {};
+    record.dev_eui          = dev_eui;
+    record.dev_addr         = dev_addr;
+    record.fcnt_up          = fcnt_up;
+    record.offset           = archive->bytes.size();
+    record.header_len       = with_header ? SEQ_ACK_HEADER_LEN : 0;
+    record.len              = len;
+    archive->records.push_back( record );
+    archive->bytes.insert( archive->bytes.end(), payload, payload + len );
+  }
+  return true;
+}
+
+static bool read_keys( const char* path,
+                       std::unordered_map<uint64_t, std::string>* keys )
+{
+  FILE* file = fopen( path, "r" );
+  if ( file == nullptr ) {
+    perror( path );
+    return false;
+  }
+  char line[256];
+  while ( fgets( line, sizeof( line ), file ) ) {
+    unsigned long long dev_eui;
+    char               hex[64];
+    uint8_t            key[16];
+    if ( ( sscanf( line, "%llx %63s", &dev_eui, hex ) == 2 ) &&
+         ( parse_hex( hex, key, sizeof( key ) ) == 16 ) ) {
+      ( *keys )[dev_eui] = std::string( (char*) key, 16 );
+    }
+  }
+  fclose( file );
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------
+
+typedef struct {
+  const char* name;
+  int         in_flight;  // 0 for rijndael.c
+  bool        cached;
+} method_t;
+
+
+const method_t methods[] = {
+    { "rijndael.c, key expanded per record", 0, false },
+    { "rijndael.c, cached keys", 0, true },
+    { "AES-NI, 1 block in flight", 1, true },
+    { "AES-NI, 8 blocks in flight, key expanded per record", 8, false },
+    { "AES-NI, 8 blocks in flight", 8, true },
+};
+
+// Devices report in bursts (a queue draining), so the same device often
+// sends a few uplinks in a row
+static void make_archive( int mode, size_t num_records, int num_devices,
+                          const uint8_t root_key[16], archive_t* archive,
+                          archive_t* plaintext )
+{
+  std::mt19937_64                 rng( 1 );
+  std::vector<uint64_t>           dev_euis( num_devices );
+  std::vector<uint32_t>           dev_addrs( num_devices );
+  std::vector<uint32_t>           fcnts( num_devices, 0 );
+  std::vector<AesContext>         storage;
+  storage.reserve( num_devices );
+  for ( int d = 0; d < num_devices; d++ ) {
+    uint8_t key[16];
+    dev_euis[d]  = 0x70B3D57ED0000000ull + d;
+    dev_addrs[d] = 0x260B0000 + ( rng() & 0xFFFF );
+    derive_device_key( root_key, dev_euis[d], key );
+    storage.emplace_back( key );
+  }
+
+  codec_reading_t readings[CODEC_MAX_READINGS];
+  while ( archive->records.size() < num_records ) {
+    int d     = rng() % num_devices;
+    int burst = 1 + rng() % 3;
+    for ( int b = 0; ( b < burst ) && ( archive->records.size() <
+                                        num_records ); b++ ) {
+      int num_readings = 1 + rng() % 8;
+      for ( int i = 0; i < num_readings; i++ ) {
+        readings[i] = { (uint16_t) ( 100 + rng() % 60 ),
+                        (uint16_t) ( 60 + rng() % 40 ),
+                        (uint16_t) ( 50 + rng() % 50 ),
+                        (uint32_t) ( 1735689600u + rng() % 31536000 ) };
+      }
+      uint8_t frame[CODEC_MAX_FRAME + AES_BLOCK_LEN + SEQ_ACK_HEADER_LEN];
+      int     len;
+      seq_ack_write_header( frame, fcnts[d] );
+      codec_encode( readings, num_readings, frame + SEQ_ACK_HEADER_LEN,
+                    CODEC_MAX_FRAME, &len );
+
+      archive_record_t record = {};
+      record.dev_eui          = dev_euis[d];
+      record.dev_addr         = dev_addrs[d];
+      record.fcnt_up          = fcnts[d]++;
+      record.header_len       = SEQ_ACK_HEADER_LEN;
+      record.ok               = true;
+
+      record.offset = plaintext->bytes.size();
+      record.len    = SEQ_ACK_HEADER_LEN + len;
+      plaintext->records.push_back( record );
+      plaintext->bytes.insert( plaintext->bytes.end(), frame,
+                               frame + record.len );
+
+      uint8_t* data = frame + SEQ_ACK_HEADER_LEN;
+      if ( mode == ENCRYPT_CCM ) {
+        len = storage[d].seal( record.dev_addr, record.fcnt_up, frame,
+                               SEQ_ACK_HEADER_LEN, data, len );
+      }
+      else {
+        len = storage[d].encrypt( data, len );
+      }
+      record.offset = archive->bytes.size();
+      record.len    = SEQ_ACK_HEADER_LEN + len;
+      record.ok     = false;
+      archive->records.push_back( record );
+      archive->bytes.insert( archive->bytes.end(), frame,
+                             frame + record.len );
+    }
+  }
+}
+
+// Whether two decrypted archives agree, record for record and byte for
+// byte, and in length unless one is still padded (ECB's, which the
+// plaintext doesn't have)
+static bool same_plaintext( const archive_t& a, const archive_t& b,
+                            bool padded )
+{
+  for ( size_t i = 0; i < a.records.size(); i++ ) {
+    const archive_record_t& x = a.records[i];
+    const archive_record_t& y = b.records[i];
+    int                     len = std::min( x.len, y.len );
+    if ( ( x.ok != y.ok ) || ( x.ok && !padded && ( x.len != y.len ) ) ||
+         ( memcmp( &a.bytes[x.offset], &b.bytes[y.offset], len ) != 0 ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int benchmark( int mode, size_t num_records, int num_devices,
+                      size_t cache_size )
+{
+  const uint8_t root_key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae,
+                                 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88,
+                                 0x09, 0xcf, 0x4f, 0x3c };
+  archive_t     archive;
+  archive_t     plaintext;
+  make_archive( mode, num_records, num_devices, root_key, &archive,
+                &plaintext );
+  auto lookup = [&]( uint64_t dev_eui, uint8_t key[16] ) {
+    derive_device_key( root_key, dev_eui, key );
+    return true;
+  };
+
+  printf( "%lu %s records from %d devices (%lu bytes), %lu cached key "
+          "schedules, AES-NI %s\n\n",
+          (unsigned long) num_records,
+          ( mode == ENCRYPT_CCM ) ? "CCM*" : "ECB", num_devices,
+          (unsigned long) archive.bytes.size(), (unsigned long) cache_size,
+          BulkDecryptor::has_aesni() ? "available" : "not available" );
+  printf( " %-52s | records/s | MB/s  | cache hits | bit-exact\n",
+          "method" );
+  printf( "-%s-+-----------+-------+------------+----------\n",
+          std::string( 52, '-' ).c_str() );
+
+  bool      ok = true;
+  archive_t reference;
+  for ( const method_t& method : methods ) {
+    if ( ( method.in_flight > 0 ) && !BulkDecryptor::has_aesni() ) {
+      continue;
+    }
+    KeyScheduleCache cache( method.cached ? cache_size : 1, lookup,
+                            method.in_flight > 0 );
+    BulkDecryptor    decryptor( cache );
+    archive_t        work = archive;
+
+    auto   start = std::chrono::steady_clock::now();
+    size_t num_ok =
+        decryptor.decrypt( mode, work.records.data(), work.records.size(),
+                           work.bytes.data(), method.in_flight );
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start )
+                         .count();
+
+    // rijndael.c's results are the reference, and have to match what
+    // was encrypted
+    bool exact;
+    if ( reference.records.empty() ) {
+      reference = work;
+      exact = ( num_ok == num_records ) &&
+              same_plaintext( work, plaintext, mode == ENCRYPT_ECB );
+    }
+    else {
+      exact = same_plaintext( work, reference, false );
+    }
+    ok &= exact;
+    printf( " %-52s | %9.0f | %5.1f | %9.1f%% | %s\n", method.name,
+            num_records / seconds, archive.bytes.size() / seconds / 1e6,
+            100.0 * cache.hits / ( cache.hits + cache.misses ),
+            exact ? "yes" : "NO" );
+  }
+
+  // A tampered record has to fail, in every method
+  if ( mode == ENCRYPT_CCM ) {
+    archive_t tampered = archive;
+    tampered.bytes[tampered.records[0].offset + SEQ_ACK_HEADER_LEN] ^= 1;
+    for ( int in_flight : { 0, 1, 8 } ) {
+      KeyScheduleCache cache( cache_size, lookup, in_flight > 0 );
+      BulkDecryptor    decryptor( cache );
+      archive_t        work = tampered;
+      decryptor.decrypt( mode, work.records.data(), 1, work.bytes.data(),
+                         in_flight );
+      ok &= !work.records[0].ok;
+    }
+  }
+
+  // What a cache miss costs before the schedule's expanded
+  uint8_t key[16];
+  auto    start = std::chrono::steady_clock::now();
+  for ( int d = 0; d < num_devices; d++ ) {
+    derive_device_key( root_key, 0x70B3D57ED0000000ull + d, key );
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start )
+                       .count();
+  printf( "\nDeriving a device's key: %.0f ns\n", 1e9 * seconds /
+                                                   num_devices );
+
+  printf( "\nCheck: %s\n", ok ? "OK" : "FAILED" );
+  return ok ? 0 : 1;
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+  int         mode        = ENCRYPT_CCM;
+  bool        with_header = false;
+  bool        bench       = false;
+  size_t      cache_size  = DEFAULT_CACHE;
+  const char* key_hex     = nullptr;
+  const char* root_hex    = nullptr;
+  const char* keys_path   = nullptr;
+  const char* path        = nullptr;
+  size_t      num_records = DEFAULT_RECORDS;
+  int         num_devices = DEFAULT_DEVICES;
+  int         arg         = 0;
+
+  for ( int i = 1; i < argc; i++ ) {
+    bool has_value = ( i + 1 < argc );
+    if ( strcmp( argv[i], "-a" ) == 0 ) {
+      with_header = true;
+    }
+    else if ( strcmp( argv[i], "-b" ) == 0 ) {
+      bench = true;
+    }
+    else if ( ( strcmp( argv[i], "-e" ) == 0 ) && has_value ) {
+      mode = ( strcmp( argv[++i], "ecb" ) == 0 ) ? ENCRYPT_ECB
+                                                 : ENCRYPT_CCM;
+    }
+    else if ( ( strcmp( argv[i], "-c" ) == 0 ) && has_value ) {
+      cache_size = atoi( argv[++i] );
+    }
+    else if ( ( strcmp( argv[i], "-k" ) == 0 ) && has_value ) {
+      key_hex = argv[++i];
+    }
+    else if ( ( strcmp( argv[i], "-r" ) == 0 ) && has_value ) {
+      root_hex = argv[++i];
+    }
+    else if ( ( strcmp( argv[i], "-K" ) == 0 ) && has_value ) {
+      keys_path = argv[++i];
+    }
+    else if ( bench ) {
+      if ( arg++ == 0 ) {
+        num_records = atol( argv[i] );
+      }
+      else {
+        num_devices = atoi( argv[i] );
+      }
+    }
+    else {
+      path = argv[i];
+    }
+  }
+  if ( bench ) {
+    return benchmark( mode, num_records, num_devices, cache_size );
+  }
+
+  // Keys by device, or derived from the root key, or one for all of them
+  uint8_t                                   key[16];
+  uint8_t                                   root_key[16];
+  std::unordered_map<uint64_t, std::string> keys;
+  if ( ( key_hex != nullptr ) && ( parse_hex( key_hex, key, 16 ) != 16 ) ) {
+    fprintf( stderr, "-k takes a 16-byte key in hex\n" );
+    return 1;
+  }
+  if ( ( root_hex != nullptr ) &&
+       ( parse_hex( root_hex, root_key, 16 ) != 16 ) ) {
+    fprintf( stderr, "-r takes a 16-byte root key in hex\n" );
+    return 1;
+  }
+  if ( ( keys_path != nullptr ) && !read_keys( keys_path, &keys ) ) {
+    return 1;
+  }
+  if ( ( key_hex == nullptr ) && ( root_hex == nullptr ) &&
+       ( keys_path == nullptr ) ) {
+    fprintf( stderr, "usage: archive_decrypt -r <root key hex> | "
+                     "-k <key hex> | -K <keys>\n"
+                     "                       [-e ecb] [-a] [-c cache] "
+                     "[archive]\n"
+                     "       archive_decrypt -b [records] [devices] "
+                     "[-e ecb] [-c cache]\n" );
+    return 1;
+  }
+  auto lookup = [&]( uint64_t dev_eui, uint8_t device_key[16] ) {
+    auto found = keys.find( dev_eui );
+    if ( found != keys.end() ) {
+      memcpy( device_key, found->second.data(), 16 );
+      return true;
+    }
+    if ( root_hex != nullptr ) {
+      derive_device_key( root_key, dev_eui, device_key );
+      return true;
+    }
+    memcpy( device_key, key, 16 );
+    return key_hex != nullptr;
+  };
+
+  FILE* file = ( path != nullptr ) ? fopen( path, "r" ) : stdin;
+  if ( file == nullptr ) {
+    perror( path );
+    return 1;
+  }
+  archive_t archive;
+  bool      read_ok = read_archive( file, with_header, &archive );
+  if ( file != stdin ) {
+    fclose( file );
+  }
+  if ( !read_ok ) {
+    return 1;
+  }
+
+  KeyScheduleCache cache( cache_size, lookup );
+  BulkDecryptor    decryptor( cache );
+  size_t           num_ok =
+      decryptor.decrypt( mode, archive.records.data(), archive.records.size(),
+                         archive.bytes.data() );
+  for ( const archive_record_t& record : archive.records ) {
+    printf( "%016llx %lu ", (unsigned long long) record.dev_eui,
+            (unsigned long) record.fcnt_up );
+    if ( !record.ok ) {
+      printf( "-\n" );
+      continue;
+    }
+    for ( int i = 0; i < record.len; i++ ) {
+      printf( "%02x", archive.bytes[record.offset + i] );
+    }
+    printf( "\n" );
+  }
+  fprintf( stderr, "%lu of %lu records decrypted\n", (unsigned long) num_ok,
+           (unsigned long) archive.records.size() );
+  return 0;
+}
@@ -0,0 +1,283 @@
+// =======================================================================
+// bounce_sim.cpp
+// =======================================================================
+// Checks the button's debouncing (ui/debounce.h) against patterns of
+// contact bounce, glitches, short taps and long bursts of bounce, with
+// the main loop updating it every 1 to 100 ms, and compares
+// it with the original debouncing, which sampled the pin on every update
+// and took two pressed samples in a row as a press
+//
+// Edges reach the debouncer as the GPIO interrupt would push them:
+// stamped when the handler runs, a few microseconds late, with the pin's
+// level then, so edges closer together than that arrive as one. The
+// clock is the Pico's 32-bit microsecond counter, started just before it
+// wraps
+//
+//   bounce_sim [presses per pattern]
+
+#include "ui/debounce.h"
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define DEFAULT_PRESSES 200
+#define IRQ_LATENCY_US 3
+#define CLOCK_START 0xFFF00000u  // Wraps after about a second
+
+const int loop_periods_ms[] = { 1, 10, 50, 100 };
+
+// -----------------------------------------------------------------------
+// Patterns
+// -----------------------------------------------------------------------
+// The pin idles high (pulled up), and a press pulls it low
+
+typedef struct {
+  uint64_t time_us;
+  bool     level;
+} pin_edge_t;
+
+typedef struct {
+  std::vector<pin_edge_t> edges;
+  std::vector<uint64_t>   presses;  // When each press began
+  uint64_t                end_us;
+} pin_trace_t;
+
+typedef struct {
+  const char* name;
+  int         min_bounces;  // Extra edges at each transition
+  int         max_bounces;
+  int         bounce_gap_us;  // Longest between them
+  int         min_hold_ms;    // Of a press
+  int         max_hold_ms;
+  bool        glitches;  // Short low spikes between presses
+} pattern_t;
+
+const pattern_t patterns[] = {
+    { "clean", 0, 0, 0, 100, 400, false },
+    { "bouncy", 2, 10, 1000, 100, 400, false },
+    { "glitches", 0, 4, 500, 100, 400, true },
+    { "short taps", 2, 10, 500, 30, 60, false },
+    { "bursts", 40, 60, 20, 100, 400, false },
+};
+
+// level at time_us, toggling through bounces first
+static void transition( pin_trace_t* trace, uint64_t time_us, bool level,
+                        int bounces, int bounce_gap_us, std::mt19937& rng )
+{
+  bool curr = level;
+  for ( int i = 0; i < bounces * 2 + 1; i++ ) {
+    trace->edges.push_back( { time_us, curr } );
+    curr = !curr;
+    time_us += 1 + rng() % std::max( 1, bounce_gap_us );
+  }
+}
+
+static pin_trace_t make_trace( const pattern_t& pattern, int num_presses,
+                               std::mt19937& rng )
+{
+  pin_trace_t trace;
+  uint64_t    time_us = 500000;
+  auto bounces = [&]() {
+    return pattern.min_bounces +
+           rng() % ( pattern.max_bounces - pattern.min_bounces + 1 );
+  };
+  for ( int i = 0; i < num_presses; i++ ) {
+    if ( pattern.glitches ) {
+      // Spikes shorter than the debounce time, well clear of presses
+      uint64_t spike_us = time_us + 100000 + rng() % 100000;
+      int      width_us = 5 + rng() % ( DEBOUNCE_DEFAULT_US / 4 );
+      transition( &trace, spike_us, false, 0, 0, rng );
+      transition( &trace, spike_us + width_us, true, 0, 0, rng );
+      time_us = spike_us + 100000;
+    }
+    int hold_ms = pattern.min_hold_ms +
+                  rng() % ( pattern.max_hold_ms - pattern.min_hold_ms + 1 );
+    trace.presses.push_back( time_us );
+    transition( &trace, time_us, false, bounces(), pattern.bounce_gap_us,
+                rng );
+    time_us += hold_ms * 1000;
+    transition( &trace, time_us, true, bounces(), pattern.bounce_gap_us,
+                rng );
+    time_us += 300000 + rng() % 1200000;
+  }
+  trace.end_us = time_us;
+  return trace;
+}
+
+static bool level_at( const pin_trace_t& trace, uint64_t time_us )
+{
+  auto after = std::upper_bound(
+      trace.edges.begin(), trace.edges.end(), time_us,
+      []( uint64_t t, const pin_edge_t& edge ) { return t < edge.time_us; } );
+  return ( after == trace.edges.begin() ) ? true : ( after - 1 )->level;
+}
+
+// -----------------------------------------------------------------------
+// Debouncers
+// -----------------------------------------------------------------------
+
+#define NO_STAMP UINT64_MAX
+
+typedef struct {
+  int      found;     // Presses reported
+  double   delay_ms;  // Mean from a press beginning to its report
+  double   max_delay_ms;
+  int      stamped;   // Reports still pressed, so stamped with the press
+  double   stamp_ms;  // Mean error in when they say it began
+  uint32_t drops;
+} result_t;
+
+// The press each report belongs to: the latest to begin before it
+static void count( const pin_trace_t& trace, uint64_t time_us,
+                   uint64_t stamp_us, result_t* result )
+{
+  auto press = std::upper_bound( trace.presses.begin(),
+                                 trace.presses.end(), time_us ) - 1;
+  double delay_ms = ( time_us - *press ) / 1000.0;
+  result->found++;
+  result->delay_ms += delay_ms;
+  result->max_delay_ms = std::max( result->max_delay_ms, delay_ms );
+  if ( stamp_us != NO_STAMP ) {
+    result->stamped++;
+    result->stamp_ms += ( stamp_us - *press ) / 1000.0;
+  }
+}
+
+static void average( result_t* result )
+{
+  if ( result->found > 0 ) {
+    result->delay_ms /= result->found;
+  }
+  if ( result->stamped > 0 ) {
+    result->stamp_ms /= result->stamped;
+  }
+}
+
+static uint32_t clock_us( uint64_t time_us )
+{
+  return (uint32_t) ( CLOCK_START + time_us );
+}
+
+// Edges by interrupt, into the debouncer
+static result_t run_edges( const pin_trace_t& trace, int loop_ms )
+{
+  result_t                         result = {};
+  Debouncer<DEBOUNCE_RING_LEN>     debouncer;
+  debouncer.reset( true, clock_us( 0 ) );
+
+  size_t next_edge = 0;
+  for ( uint64_t now_us = 0; now_us < trace.end_us;
+        now_us += loop_ms * 1000 ) {
+    // The interrupts since the last update
+    while ( ( next_edge < trace.edges.size() ) &&
+            ( trace.edges[next_edge].time_us + IRQ_LATENCY_US <= now_us ) ) {
+      uint64_t irq_us = trace.edges[next_edge].time_us + IRQ_LATENCY_US;
+      while ( ( next_edge < trace.edges.size() ) &&
+              ( trace.edges[next_edge].time_us <= irq_us ) ) {
+        next_edge++;
+      }
+      debouncer.push( clock_us( irq_us ), level_at( trace, irq_us ) );
+    }
+
+    debouncer.update( clock_us( now_us ) );
+    if ( debouncer.fell() ) {
+      // Pressed and released since the last update, it's stamped with
+      // the release
+      uint64_t stamp_us = NO_STAMP;
+      if ( !debouncer.level() ) {
+        stamp_us = now_us - (uint32_t) ( clock_us( now_us ) -
+                                         debouncer.last_change_us() );
+      }
+      count( trace, now_us, stamp_us, &result );
+    }
+  }
+  result.drops = debouncer.dropped();
+  average( &result );
+  return result;
+}
+
+// The original Button::update, sampling the pin every update
+static result_t run_polled( const pin_trace_t& trace, int loop_ms )
+{
+  enum { NotPressed, MaybePressed, Pressed, MaybeNotPressed } state =
+      NotPressed;
+  result_t result = {};
+  for ( uint64_t now_us = 0; now_us < trace.end_us;
+        now_us += loop_ms * 1000 ) {
+    bool pressed = !level_at( trace, now_us );
+    auto next    = state;
+    switch ( state ) {
+      case NotPressed:
+        next = pressed ? MaybePressed : NotPressed;
+        break;
+      case MaybePressed:
+        next = pressed ? Pressed : NotPressed;
+        break;
+      case Pressed:
+        next = pressed ? Pressed : MaybeNotPressed;
+        break;
+      case MaybeNotPressed:
+        next = pressed ? Pressed : NotPressed;
+        break;
+    }
+    if ( ( state == MaybePressed ) && ( next == Pressed ) ) {
+      count( trace, now_us, NO_STAMP, &result );
+    }
+    state = next;
+  }
+  average( &result );
+  return result;
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+  int  num_presses = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_PRESSES;
+  bool ok          = true;
+
+  printf( "%d presses per pattern, %d ms debounce, %d-entry ring\n\n",
+          num_presses, DEBOUNCE_DEFAULT_US / 1000, DEBOUNCE_RING_LEN );
+  printf( "            |      |        polled         |"
+          "              edges by interrupt\n" );
+  printf( " pattern    | loop | found | delay (max) |"
+          " found | delay (max) | stamp | drops | ok\n" );
+  printf( "------------+------+-------+-------------+"
+          "-------+-------------+-------+-------+----\n" );
+
+  std::mt19937 rng( 1 );
+  for ( const pattern_t& pattern : patterns ) {
+    pin_trace_t trace = make_trace( pattern, num_presses, rng );
+    for ( int loop_ms : loop_periods_ms ) {
+      result_t polled = run_polled( trace, loop_ms );
+      result_t edges  = run_edges( trace, loop_ms );
+
+      // Every press, once, and reported within the debounce time (plus
+      // the bounce) of the update after it settles
+      int  max_bounce_ms = ( pattern.max_bounces * 2 *
+                             pattern.bounce_gap_us ) / 1000 + 1;
+      bool edges_ok =
+          ( edges.found == num_presses ) &&
+          ( edges.max_delay_ms <=
+            DEBOUNCE_DEFAULT_US / 1000 + max_bounce_ms + loop_ms ) &&
+          ( edges.stamp_ms <= max_bounce_ms );
+      ok &= edges_ok;
+
+      printf( " %-10s | %4d | %5d | %5.1f (%3.0f) |"
+              " %5d | %5.1f (%3.0f) | %5.2f | %5lu | %s\n",
+              pattern.name, loop_ms, polled.found, polled.delay_ms,
+              polled.max_delay_ms, edges.found, edges.delay_ms,
+              edges.max_delay_ms, edges.stamp_ms,
+              (unsigned long) edges.drops, edges_ok ? "ok" : "NO" );
+    }
+  }
+
+  printf( "\ndelay and stamp in ms: from a press beginning to its report, "
+          "and the error in\nwhen the debouncer says it began\n" );
+  printf( "\nCheck: %s\n", ok ? "OK" : "FAILED" );
+  return ok ? 0 : 1;
+}
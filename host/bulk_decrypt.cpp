@@ -0,0 +1,530 @@
+// =======================================================================
+// bulk_decrypt.cpp
+// =======================================================================
+// Definitions of our bulk decryptor
+
+#include "bulk_decrypt.h"
+#include <algorithm>
+#include <string.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define HAVE_AESNI 1
+#define AESNI __attribute__( ( target( "aes,sse4.1" ) ) )
+#endif
+
+#define CCM_MAX_BLOCKS 18  // B0, the AAD and the largest US915 payload
+
+// The CCM* nonce of an uplink, as AesContext::seal makes it
+static void uplink_nonce( uint32_t dev_addr, uint32_t fcnt_up,
+                          uint8_t nonce[AES_CCM_NONCE_LEN] )
+{
+  memset( nonce, 0, AES_CCM_NONCE_LEN );
+  for ( int i = 0; i < 4; i++ ) {
+    nonce[i]     = dev_addr >> ( 8 * i );
+    nonce[4 + i] = fcnt_up >> ( 8 * i );
+  }
+}
+
+// -----------------------------------------------------------------------
+// KeySchedule
+// -----------------------------------------------------------------------
+
+#ifdef HAVE_AESNI
+static inline AESNI __m128i expand_step( __m128i key, __m128i assist )
+{
+  assist = _mm_shuffle_epi32( assist, 0xff );
+  key    = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+  key    = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+  key    = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+  return _mm_xor_si128( key, assist );
+}
+
+#define EXPAND( i, rcon ) \
+  k[i] = expand_step( k[i - 1], _mm_aeskeygenassist_si128( k[i - 1], rcon ) )
+
+// The decryption schedule is the encryption one reversed, with
+// InvMixColumns on all but its ends, for AESDEC
+static AESNI void expand_aesni( const uint8_t key[16], uint8_t enc[11][16],
+                                uint8_t dec[11][16] )
+{
+  __m128i k[11];
+  k[0] = _mm_loadu_si128( (const __m128i*) key );
+  EXPAND( 1, 0x01 );
+  EXPAND( 2, 0x02 );
+  EXPAND( 3, 0x04 );
+  EXPAND( 4, 0x08 );
+  EXPAND( 5, 0x10 );
+  EXPAND( 6, 0x20 );
+  EXPAND( 7, 0x40 );
+  EXPAND( 8, 0x80 );
+  EXPAND( 9, 0x1b );
+  EXPAND( 10, 0x36 );
+  for ( int i = 0; i < 11; i++ ) {
+    _mm_store_si128( (__m128i*) enc[i], k[i] );
+    __m128i d = ( ( i == 0 ) || ( i == 10 ) )
+                    ? k[10 - i]
+                    : _mm_aesimc_si128( k[10 - i] );
+    _mm_store_si128( (__m128i*) dec[i], d );
+  }
+}
+#endif
+
+KeySchedule::KeySchedule( const uint8_t key[16], bool aesni )
+{
+#ifdef HAVE_AESNI
+  if ( aesni ) {
+    expand_aesni( key, enc, dec );
+    return;
+  }
+#else
+  (void) aesni;
+#endif
+  rijndaelSetupDecrypt( rk_dec, key, KEYBITS );
+  context.emplace( key );
+}
+
+// -----------------------------------------------------------------------
+// KeyScheduleCache
+// -----------------------------------------------------------------------
+
+KeyScheduleCache::KeyScheduleCache( size_t capacity, key_lookup_t lookup,
+                                    bool aesni )
+    : hits( 0 ),
+      misses( 0 ),
+      max_entries( ( capacity > 0 ) ? capacity : 1 ),
+      for_aesni( aesni && BulkDecryptor::has_aesni() ),
+      lookup( lookup )
+{
+}
+
+const KeySchedule* KeyScheduleCache::get( uint64_t dev_eui )
+{
+  auto found = index.find( dev_eui );
+  if ( found != index.end() ) {
+    hits++;
+    lru.splice( lru.begin(), lru, found->second );
+    return &found->second->second;
+  }
+
+  misses++;
+  uint8_t key[16];
+  if ( !lookup( dev_eui, key ) ) {
+    return nullptr;
+  }
+  if ( lru.size() >= max_entries ) {
+    index.erase( lru.back().first );
+    lru.pop_back();
+  }
+  lru.emplace_front( std::piecewise_construct,
+                     std::forward_as_tuple( dev_eui ),
+                     std::forward_as_tuple( key, for_aesni ) );
+  index[dev_eui] = lru.begin();
+  return &lru.front().second;
+}
+
+void KeyScheduleCache::clear()
+{
+  lru.clear();
+  index.clear();
+  hits   = 0;
+  misses = 0;
+}
+
+size_t KeyScheduleCache::capacity() const
+{
+  return max_entries;
+}
+
+bool KeyScheduleCache::aesni() const
+{
+  return for_aesni;
+}
+
+// -----------------------------------------------------------------------
+// BulkDecryptor
+// -----------------------------------------------------------------------
+
+BulkDecryptor::BulkDecryptor( KeyScheduleCache& keys ) : keys( keys ) {}
+
+bool BulkDecryptor::has_aesni()
+{
+#ifdef HAVE_AESNI
+  return __builtin_cpu_supports( "aes" ) &&
+         __builtin_cpu_supports( "sse4.1" );
+#else
+  return false;
+#endif
+}
+
+size_t BulkDecryptor::decrypt( int mode, archive_record_t* records,
+                               size_t num_records, uint8_t* bytes,
+                               int in_flight )
+{
+  if ( keys.aesni() ) {
+    return decrypt_aesni( mode, records, num_records, bytes, in_flight );
+  }
+  return decrypt_scalar( mode, records, num_records, bytes );
+}
+
+// One record at a time, as decode does
+size_t BulkDecryptor::decrypt_scalar( int mode, archive_record_t* records,
+                                      size_t num_records, uint8_t* bytes )
+{
+  size_t num_ok = 0;
+  for ( size_t i = 0; i < num_records; i++ ) {
+    archive_record_t&  record   = records[i];
+    const KeySchedule* schedule = keys.get( record.dev_eui );
+    uint8_t*           header   = bytes + record.offset;
+    uint8_t*           data     = header + record.header_len;
+    int                len      = record.len - record.header_len;
+    record.ok                   = false;
+    if ( ( schedule == nullptr ) || ( len < 0 ) ) {
+      continue;
+    }
+    if ( mode == ENCRYPT_CCM ) {
+      len = schedule->context->open( record.dev_addr, record.fcnt_up, header,
+                                    record.header_len, data, len );
+    }
+    else if ( len % AES_BLOCK_LEN == 0 ) {
+      for ( int j = 0; j < len; j += AES_BLOCK_LEN ) {
+        rijndaelDecrypt( schedule->rk_dec, NROUNDS( KEYBITS ), data + j,
+                         data + j );
+      }
+    }
+    else {
+      len = -1;
+    }
+    if ( len >= 0 ) {
+      record.len = record.header_len + len;
+      record.ok  = true;
+      num_ok++;
+    }
+  }
+  return num_ok;
+}
+
+#ifdef HAVE_AESNI
+
+// -----------------------------------------------------------------------
+// Lanes
+// -----------------------------------------------------------------------
+// N blocks in flight, each with its own key schedule. The rounds of all
+// N go out before any comes back, so they overlap in the AES unit
+
+static inline AESNI __m128i round_key( const uint8_t key[16] )
+{
+  return _mm_load_si128( (const __m128i*) key );
+}
+
+template <int N>
+static inline AESNI void decrypt_lanes( const KeySchedule* const* schedule,
+                                        __m128i* s )
+{
+  for ( int i = 0; i < N; i++ ) {
+    s[i] = _mm_xor_si128( s[i],
+                          round_key( schedule[i]->dec[0] ) );
+  }
+  for ( int round = 1; round < 10; round++ ) {
+    for ( int i = 0; i < N; i++ ) {
+      s[i] = _mm_aesdec_si128(
+          s[i], round_key( schedule[i]->dec[round] ) );
+    }
+  }
+  for ( int i = 0; i < N; i++ ) {
+    s[i] = _mm_aesdeclast_si128(
+        s[i], round_key( schedule[i]->dec[10] ) );
+  }
+}
+
+template <int N>
+static inline AESNI void encrypt_lanes( const KeySchedule* const* schedule,
+                                        __m128i* s )
+{
+  for ( int i = 0; i < N; i++ ) {
+    s[i] = _mm_xor_si128( s[i],
+                          round_key( schedule[i]->enc[0] ) );
+  }
+  for ( int round = 1; round < 10; round++ ) {
+    for ( int i = 0; i < N; i++ ) {
+      s[i] = _mm_aesenc_si128(
+          s[i], round_key( schedule[i]->enc[round] ) );
+    }
+  }
+  for ( int i = 0; i < N; i++ ) {
+    s[i] = _mm_aesenclast_si128(
+        s[i], round_key( schedule[i]->enc[10] ) );
+  }
+}
+
+// -----------------------------------------------------------------------
+// ECB
+// -----------------------------------------------------------------------
+
+template <int N>
+static AESNI void ecb_decrypt( const KeySchedule* const* keys,
+                               archive_record_t* records,
+                               size_t num_records, uint8_t* bytes )
+{
+  const KeySchedule* schedule[N];
+  uint8_t*           block[N];
+  __m128i            s[N];
+  int                lanes = 0;
+
+  for ( size_t i = 0; i < num_records; i++ ) {
+    archive_record_t& record = records[i];
+    int               len    = record.len - record.header_len;
+    record.ok = ( keys[i] != nullptr ) && ( len >= 0 ) &&
+                ( len % AES_BLOCK_LEN == 0 );
+    if ( !record.ok ) {
+      continue;
+    }
+    uint8_t* data = bytes + record.offset + record.header_len;
+    for ( int j = 0; j < len; j += AES_BLOCK_LEN ) {
+      schedule[lanes] = keys[i];
+      block[lanes]    = data + j;
+      s[lanes]        = _mm_loadu_si128( (const __m128i*) ( data + j ) );
+      if ( ++lanes == N ) {
+        decrypt_lanes<N>( schedule, s );
+        for ( int k = 0; k < N; k++ ) {
+          _mm_storeu_si128( (__m128i*) block[k], s[k] );
+        }
+        lanes = 0;
+      }
+    }
+  }
+
+  // What's left goes one at a time
+  for ( int k = 0; k < lanes; k++ ) {
+    decrypt_lanes<1>( &schedule[k], &s[k] );
+    _mm_storeu_si128( (__m128i*) block[k], s[k] );
+  }
+}
+
+// -----------------------------------------------------------------------
+// CCM*
+// -----------------------------------------------------------------------
+
+// The keystream: A_0 decrypts the MIC, and A_1 on the payload. Every
+// block is independent, so they go N at a time, across records
+template <int N>
+static AESNI void ccm_ctr( const KeySchedule* const* keys,
+                           archive_record_t* records, size_t num_records,
+                           uint8_t* bytes )
+{
+  const KeySchedule* schedule[N];
+  __m128i            s[N];
+  uint8_t*           target[N];
+  int                target_len[N];
+  int                lanes = 0;
+
+  auto xor_keystream = [&]( int k ) {
+    uint8_t keystream[AES_BLOCK_LEN];
+    _mm_storeu_si128( (__m128i*) keystream, s[k] );
+    for ( int j = 0; j < target_len[k]; j++ ) {
+      target[k][j] ^= keystream[j];
+    }
+  };
+
+  for ( size_t i = 0; i < num_records; i++ ) {
+    archive_record_t& record = records[i];
+    int len = record.len - record.header_len - AES_CCM_MIC_LEN;
+    record.ok = ( keys[i] != nullptr ) && ( len >= 0 ) &&
+                ( len <= ( CCM_MAX_BLOCKS - 2 ) * AES_BLOCK_LEN );
+    if ( !record.ok ) {
+      continue;
+    }
+
+    uint8_t* data = bytes + record.offset + record.header_len;
+    uint8_t  a[AES_BLOCK_LEN] = { 0x01 };
+    int      num_blocks = ( len + AES_BLOCK_LEN - 1 ) / AES_BLOCK_LEN;
+    uplink_nonce( record.dev_addr, record.fcnt_up, a + 1 );
+    for ( int counter = 0; counter <= num_blocks; counter++ ) {
+      int pos           = ( counter - 1 ) * AES_BLOCK_LEN;
+      a[15]             = counter;
+      schedule[lanes]   = keys[i];
+      s[lanes]          = _mm_loadu_si128( (const __m128i*) a );
+      target[lanes]     = ( counter == 0 ) ? data + len : data + pos;
+      target_len[lanes] = ( counter == 0 )
+                              ? AES_CCM_MIC_LEN
+                              : std::min( AES_BLOCK_LEN, len - pos );
+      if ( ++lanes == N ) {
+        encrypt_lanes<N>( schedule, s );
+        for ( int k = 0; k < N; k++ ) {
+          xor_keystream( k );
+        }
+        lanes = 0;
+      }
+    }
+  }
+
+  for ( int k = 0; k < lanes; k++ ) {
+    encrypt_lanes<1>( &schedule[k], &s[k] );
+    xor_keystream( k );
+  }
+}
+
+// A record's CBC-MAC input: B0, the length-prefixed AAD, then the
+// plaintext, each zero-padded to whole blocks (as AesContext::ccm_mac)
+static int ccm_mac_blocks( const archive_record_t& record,
+                           const uint8_t* header, int len,
+                           uint8_t blocks[CCM_MAX_BLOCKS][AES_BLOCK_LEN] )
+{
+  int aad_len = record.header_len;
+  int num     = 1;
+  memset( blocks, 0, CCM_MAX_BLOCKS * AES_BLOCK_LEN );
+  blocks[0][0] = ( ( aad_len > 0 ) ? 0x40 : 0 ) |
+                 ( ( ( AES_CCM_MIC_LEN - 2 ) / 2 ) << 3 ) | 0x01;
+  uplink_nonce( record.dev_addr, record.fcnt_up, blocks[0] + 1 );
+  blocks[0][14] = len >> 8;
+  blocks[0][15] = len & 0xFF;
+
+  if ( aad_len > 0 ) {
+    blocks[1][0] = aad_len >> 8;
+    blocks[1][1] = aad_len & 0xFF;
+    memcpy( blocks[1] + 2, header, aad_len );
+    num += ( 2 + aad_len + AES_BLOCK_LEN - 1 ) / AES_BLOCK_LEN;
+  }
+  memcpy( blocks[num], header + aad_len, len );
+  return num + ( len + AES_BLOCK_LEN - 1 ) / AES_BLOCK_LEN;
+}
+
+// The CBC-MAC is a chain within a record, so the N in flight are N
+// records' chains. A lane takes the next record when its chain ends
+template <int N>
+static AESNI void ccm_check( const KeySchedule* const* keys,
+                             archive_record_t* records, size_t num_records,
+                             uint8_t* bytes )
+{
+  typedef struct {
+    size_t  record;
+    int     num_blocks;
+    int     next;
+    uint8_t blocks[CCM_MAX_BLOCKS][AES_BLOCK_LEN];
+  } lane_t;
+
+  lane_t             lane[N];
+  const KeySchedule* schedule[N];
+  __m128i            s[N];
+  bool               busy[N]     = { false };
+  size_t             next_record = 0;
+
+  while ( true ) {
+    int num_busy = 0;
+    for ( int k = 0; k < N; k++ ) {
+      while ( !busy[k] && ( next_record < num_records ) ) {
+        size_t            i      = next_record++;
+        archive_record_t& record = records[i];
+        if ( !record.ok ) {
+          continue;
+        }
+        int len = record.len - record.header_len - AES_CCM_MIC_LEN;
+        lane[k].record     = i;
+        lane[k].next       = 0;
+        lane[k].num_blocks = ccm_mac_blocks(
+            record, bytes + record.offset, len, lane[k].blocks );
+        schedule[k] = keys[i];
+        s[k]        = _mm_setzero_si128();
+        busy[k]     = true;
+      }
+      num_busy += busy[k];
+    }
+    if ( num_busy == 0 ) {
+      return;
+    }
+
+    // Idle lanes run along with a busy one's key, and are ignored
+    const KeySchedule* any = nullptr;
+    for ( int k = 0; k < N; k++ ) {
+      if ( busy[k] ) {
+        any = schedule[k];
+      }
+    }
+    for ( int k = 0; k < N; k++ ) {
+      if ( busy[k] ) {
+        const uint8_t* block = lane[k].blocks[lane[k].next];
+        s[k] = _mm_xor_si128( s[k],
+                              _mm_loadu_si128( (const __m128i*) block ) );
+      }
+      else {
+        schedule[k] = any;
+      }
+    }
+    encrypt_lanes<N>( schedule, s );
+
+    for ( int k = 0; k < N; k++ ) {
+      if ( !busy[k] || ( ++lane[k].next < lane[k].num_blocks ) ) {
+        continue;
+      }
+      archive_record_t& record = records[lane[k].record];
+      uint8_t*          data   = bytes + record.offset + record.header_len;
+      int     len = record.len - record.header_len - AES_CCM_MIC_LEN;
+      uint8_t tag[AES_BLOCK_LEN];
+      uint8_t diff = 0;
+      _mm_storeu_si128( (__m128i*) tag, s[k] );
+      for ( int j = 0; j < AES_CCM_MIC_LEN; j++ ) {
+        diff |= tag[j] ^ data[len + j];
+      }
+      record.ok  = ( diff == 0 );
+      record.len = record.header_len + len;
+      busy[k]    = false;
+    }
+  }
+}
+
+template <int N>
+static void decrypt_chunk( int mode, const KeySchedule* const* keys,
+                           archive_record_t* records, size_t num_records,
+                           uint8_t* bytes )
+{
+  if ( mode == ENCRYPT_CCM ) {
+    ccm_ctr<N>( keys, records, num_records, bytes );
+    ccm_check<N>( keys, records, num_records, bytes );
+  }
+  else {
+    ecb_decrypt<N>( keys, records, num_records, bytes );
+  }
+}
+
+#endif
+
+size_t BulkDecryptor::decrypt_aesni( int mode, archive_record_t* records,
+                                     size_t num_records, uint8_t* bytes,
+                                     int in_flight )
+{
+  size_t num_ok = 0;
+#ifdef HAVE_AESNI
+  size_t chunk = keys.capacity();
+  for ( size_t start = 0; start < num_records; start += chunk ) {
+    archive_record_t* chunk_records = records + start;
+    size_t            num = std::min( chunk, num_records - start );
+    chunk_keys.resize( num );
+    for ( size_t i = 0; i < num; i++ ) {
+      chunk_keys[i] = keys.get( chunk_records[i].dev_eui );
+    }
+
+    const KeySchedule* const* k = chunk_keys.data();
+    if ( in_flight >= 8 ) {
+      decrypt_chunk<8>( mode, k, chunk_records, num, bytes );
+    }
+    else if ( in_flight >= 4 ) {
+      decrypt_chunk<4>( mode, k, chunk_records, num, bytes );
+    }
+    else if ( in_flight >= 2 ) {
+      decrypt_chunk<2>( mode, k, chunk_records, num, bytes );
+    }
+    else {
+      decrypt_chunk<1>( mode, k, chunk_records, num, bytes );
+    }
+    for ( size_t i = 0; i < num; i++ ) {
+      num_ok += chunk_records[i].ok;
+    }
+  }
+#else
+  (void) mode;
+  (void) records;
+  (void) num_records;
+  (void) bytes;
+  (void) in_flight;
+#endif
+  return num_ok;
+}
@@ -0,0 +1,128 @@
+// =======================================================================
+// bulk_decrypt.h
+// =======================================================================
+// Declarations of our bulk decryptor, for archives of uplink payloads on
+// the application server's side (see encryption/encryption.h)
+//
+// Payloads are decrypted a batch at a time with AES-NI, eight blocks in
+// flight, since an AES round takes several cycles to come out but the
+// unit starts a new one every cycle. The blocks in flight can be from
+// different records and devices: each carries its own key schedule. ECB
+// payloads are decrypted block by block. CCM* payloads are two passes,
+// the counter-mode keystream (whose blocks are all independent), then
+// the CBC-MAC to check them, whose blocks are a chain, so the eight in
+// flight are eight records' chains.
+//
+// Keys come from a lookup (by DevEUI), and their expanded schedules are
+// kept in an LRU cache, since expanding a key costs as much as
+// decrypting a few blocks. Without AES-NI (or with a cache of
+// rijndael.c's schedules), the same runs on rijndael.c and AesContext,
+// one block at a time
+
+#ifndef HOST_BULK_DECRYPT_H
+#define HOST_BULK_DECRYPT_H
+
+#include "encryption/encryption.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#define BULK_MAX_IN_FLIGHT 8
+
+// An archived uplink, whose payload is at offset in the archive's bytes
+typedef struct {
+  uint64_t dev_eui;
+  uint32_t dev_addr;  // For the CCM* nonce
+  uint32_t fcnt_up;
+  uint32_t offset;
+  uint8_t  header_len;  // A cumulative-ACK header, in the clear
+  uint8_t  len;         // Set to the plaintext length (header included)
+  bool     ok;          // Set if it decrypted (and its MIC matched)
+} archive_record_t;
+
+// A device's expanded keys, for AES-NI or for rijndael.c
+class KeySchedule {
+ public:
+  KeySchedule( const uint8_t key[16], bool aesni );
+
+  alignas( 16 ) uint8_t enc[11][16];
+  alignas( 16 ) uint8_t dec[11][16];
+  uint32_t                  rk_dec[RKLENGTH( KEYBITS )];
+  std::optional<AesContext> context;
+};
+
+// -----------------------------------------------------------------------
+// KeyScheduleCache
+// -----------------------------------------------------------------------
+
+class KeyScheduleCache {
+ public:
+  // Looks up a device's key, returning false if it's not known
+  typedef std::function<bool( uint64_t dev_eui, uint8_t key[16] )>
+      key_lookup_t;
+
+  // Schedules are for AES-NI if the processor has it, unless aesni is
+  // false
+  KeyScheduleCache( size_t capacity, key_lookup_t lookup,
+                    bool aesni = true );
+
+  // The device's schedule, expanded on a miss (evicting the least
+  // recently used), or nullptr if its key isn't known. Stays valid
+  // until capacity() other devices have been looked up
+  const KeySchedule* get( uint64_t dev_eui );
+
+  void clear();
+
+  size_t capacity() const;
+  bool   aesni() const;
+
+  uint64_t hits;
+  uint64_t misses;
+
+ private:
+  typedef std::list<std::pair<uint64_t, KeySchedule>> lru_t;
+
+  size_t                                        max_entries;
+  bool                                          for_aesni;
+  key_lookup_t                                  lookup;
+  lru_t                                         lru;  // Most recent first
+  std::unordered_map<uint64_t, lru_t::iterator> index;
+};
+
+// -----------------------------------------------------------------------
+// BulkDecryptor
+// -----------------------------------------------------------------------
+
+class BulkDecryptor {
+ public:
+  BulkDecryptor( KeyScheduleCache& keys );
+
+  // Whether this processor has AES-NI
+  static bool has_aesni();
+
+  // Decrypt the records' payloads in bytes, in place, with mode
+  // (ENCRYPT_ECB or ENCRYPT_CCM), and with AES-NI, in_flight blocks at a
+  // time (1, 2, 4 or BULK_MAX_IN_FLIGHT). Returns the number that
+  // decrypted
+  size_t decrypt( int mode, archive_record_t* records, size_t num_records,
+                  uint8_t* bytes, int in_flight = BULK_MAX_IN_FLIGHT );
+
+ private:
+  KeyScheduleCache& keys;
+
+  // The keys of the chunk of records being decrypted. A chunk is at most
+  // the cache's capacity, so none is evicted before the chunk's done
+  std::vector<const KeySchedule*> chunk_keys;
+
+  size_t decrypt_scalar( int mode, archive_record_t* records,
+                         size_t num_records, uint8_t* bytes );
+  size_t decrypt_aesni( int mode, archive_record_t* records,
+                        size_t num_records, uint8_t* bytes,
+                        int in_flight );
+};
+
+#endif  // HOST_BULK_DECRYPT_H
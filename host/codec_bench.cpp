@@ -0,0 +1,147 @@
+// =======================================================================
+// codec_bench.cpp
+// =======================================================================
+// Compares our multi-reading codec against the original 6-byte
+// one-reading-per-frame payload, for realistic batches of readings at
+// each US915 data rate
+
+#include "lorawan/codec.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+// LoRaWAN overhead per frame (MHDR, FHDR without options, FPort, MIC)
+#define LORAWAN_OVERHEAD 13
+
+// Original payload (sys, dia, bpm as 16-bit fields)
+#define LEGACY_READING_SIZE 6
+
+// Max application payload for US915 DR0-DR3 (125 kHz, dwell time on)
+const int max_payload[] = { 11, 53, 125, 242 };
+
+// Readings sent, and the batch sizes we might have queued when sending
+const int num_readings  = 1000;
+const int batch_sizes[] = { 1, 2, 4, 8, 16, 31 };
+
+// -----------------------------------------------------------------------
+// make_readings
+// -----------------------------------------------------------------------
+// Twice-daily readings (morning and evening, with some jitter), within
+// what the cuff can measure
+
+void make_readings( codec_reading_t* readings, int n )
+{
+  std::mt19937                       rng( 5220 );
+  std::normal_distribution<double>   sys( 128, 15 );
+  std::normal_distribution<double>   dia( 82, 10 );
+  std::normal_distribution<double>   bpm( 72, 9 );
+  std::uniform_int_distribution<int> jitter( -1800, 1800 );
+  const uint32_t                     start = 1735689600;  // 2025-01-01
+
+  for ( int i = 0; i < n; i++ ) {
+    readings[i].sys_pressure = std::clamp( (int) sys( rng ), 60, 260 );
+    readings[i].dia_pressure = std::clamp( (int) dia( rng ), 40, 215 );
+    readings[i].bpm          = std::clamp( (int) bpm( rng ), 40, 180 );
+    readings[i].timestamp    = start + ( i / 2 ) * 86400 +
+                            ( i % 2 ) * 12 * 3600 + 7 * 3600 +
+                            jitter( rng );
+  }
+}
+
+// -----------------------------------------------------------------------
+// check_round_trip
+// -----------------------------------------------------------------------
+
+bool same_reading( const codec_reading_t& a, const codec_reading_t& b )
+{
+  uint32_t a_time = a.timestamp - a.timestamp % CODEC_TIME_UNIT_S;
+  return ( a_time == b.timestamp )
+#define SAME_FIELD( name, min, bits ) &&( a.name == b.name )
+      CODEC_READING_FIELDS( SAME_FIELD )
+#undef SAME_FIELD
+          ;
+}
+
+bool check_round_trip( const codec_reading_t* readings, int n,
+                       const uint8_t* frame, int len )
+{
+  codec_reading_t decoded[CODEC_MAX_READINGS];
+  if ( codec_decode( frame, len, decoded, CODEC_MAX_READINGS ) != n ) {
+    return false;
+  }
+  // Decoded readings are in time order; ours are already sorted
+  for ( int i = 0; i < n; i++ ) {
+    if ( !same_reading( readings[i], decoded[i] ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( void )
+{
+  static codec_reading_t readings[num_readings];
+  make_readings( readings, num_readings );
+
+  printf( "%d readings, legacy payload: %d B/reading, %d B/reading on "
+          "air, %d frames\n\n",
+          num_readings, LEGACY_READING_SIZE,
+          LEGACY_READING_SIZE + LORAWAN_OVERHEAD, num_readings );
+  printf( " DR | batch | frames | saved  | payload B/rd | on-air B/rd | "
+          "encode ns/frame\n" );
+  printf( "----+-------+--------+--------+--------------+-------------+"
+          "----------------\n" );
+
+  bool all_ok = true;
+  for ( int dr = 0; dr < 4; dr++ ) {
+    for ( int batch : batch_sizes ) {
+      uint8_t frame[256];
+      int     frames        = 0;
+      long    payload_bytes = 0;
+      double  encode_ns     = 0;
+
+      // Send each batch as it fills, in as many frames as it takes
+      for ( int start = 0; start < num_readings; start += batch ) {
+        int in_batch = std::min( batch, num_readings - start );
+        int sent     = 0;
+        while ( sent < in_batch ) {
+          int  len;
+          auto t0 = std::chrono::steady_clock::now();
+          int  n  = codec_encode( &readings[start + sent], in_batch - sent,
+                                  frame, max_payload[dr], &len );
+          auto t1 = std::chrono::steady_clock::now();
+          encode_ns +=
+              std::chrono::duration<double, std::nano>( t1 - t0 ).count();
+
+          if ( ( n == 0 ) ||
+               !check_round_trip( &readings[start + sent], n, frame,
+                                  len ) ) {
+            all_ok = false;
+            break;
+          }
+          sent += n;
+          frames++;
+          payload_bytes += len;
+        }
+      }
+
+      double per_reading = (double) payload_bytes / num_readings;
+      double on_air =
+          (double) ( payload_bytes + frames * LORAWAN_OVERHEAD ) /
+          num_readings;
+      printf( " %2d | %5d | %6d | %5.1f%% | %12.2f | %11.2f | %15.0f\n",
+              dr, batch, frames,
+              100.0 * ( num_readings - frames ) / num_readings,
+              per_reading, on_air, encode_ns / frames );
+    }
+  }
+
+  printf( "\nRound trip: %s\n", all_ok ? "OK" : "FAILED" );
+  return all_ok ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+// =======================================================================
+// decode.cpp
+// =======================================================================
+// Decodes uplink payloads given as hex on the command line (or one per
+// line on stdin), printing the readings in each, or with -t, telemetry
+// frames (from TELEMETRY_PORT). With -k, readings are decrypted with the
+// given key first (see encryption/encryption.h). CCM* payloads need the
+// DevAddr and frame counter of their uplink (from the network server's
+// metadata), and -e ecb reads the older padded ones. -r derives the
+// device's key from the fleet's root key and its DevEUI (see
+// encryption/device_key.h). With -a, frames start with a cumulative ACK
+// header (port 3)
+//
+//   ./decode 2a1c8a40...
+//   ./decode -k $KEY 260b1a2f:42:5f03b1c2...
+//   ./decode -r $ROOT_KEY 70b3d57ed006fe82 260b1a2f:42:5f03b1c2...
+//   ./decode -k $KEY -e ecb 5f03b1c2...
+//   ./decode -t 1007000003...
+
+#include "encryption/device_key.h"
+#include "encryption/encryption.h"
+#include "lorawan/codec.h"
+#include "lorawan/seq_ack.h"
+#include "lorawan/telemetry.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// -----------------------------------------------------------------------
+// parse_hex
+// -----------------------------------------------------------------------
+// Returns the number of bytes, or -1 if the string isn't valid hex
+
+int parse_hex( const char* hex, uint8_t* bytes, int max_len )
+{
+  int len = 0;
+  while ( *hex ) {
+    if ( isspace( (unsigned char) *hex ) ) {
+      hex++;
+      continue;
+    }
+    unsigned int byte;
+    if ( ( len >= max_len ) || ( sscanf( hex, "%2x", &byte ) != 1 ) ||
+         !isxdigit( (unsigned char) hex[1] ) ) {
+      return -1;
+    }
+    bytes[len++] = byte;
+    hex += 2;
+  }
+  return len;
+}
+
+// -----------------------------------------------------------------------
+// print_frame
+// -----------------------------------------------------------------------
+
+// How readings are encrypted, and the keys to decrypt them with
+int        mode        = ENCRYPT_NONE;
+bool       with_header = false;
+uint8_t    key[16]     = { 0 };
+AesContext cipher( key );
+uint32_t   round_keys[RKLENGTH( KEYBITS )];
+
+// Decrypts readings with key from now on
+void use_key()
+{
+  cipher.set_key( key );
+  rijndaelSetupDecrypt( round_keys, key, KEYBITS );
+  if ( mode == ENCRYPT_NONE ) {
+    mode = ENCRYPT_CCM;
+  }
+}
+
+// Decrypts len bytes in place, returning the plaintext length (or -1)
+int decrypt( uint32_t dev_addr, uint32_t fcnt_up, const uint8_t* header,
+             int header_len, uint8_t* data, int len )
+{
+  if ( mode == ENCRYPT_CCM ) {
+    return cipher.open( dev_addr, fcnt_up, header, header_len, data, len );
+  }
+  if ( len % AES_BLOCK_LEN != 0 ) {
+    return -1;
+  }
+  for ( int i = 0; i < len; i += AES_BLOCK_LEN ) {
+    rijndaelDecrypt( round_keys, NROUNDS( KEYBITS ), data + i, data + i );
+  }
+  return len;
+}
+
+// An out-of-range field shows as the bound it passed
+void print_field( const char* name, uint16_t value, int min, int bits )
+{
+  if ( value == CODEC_BELOW_RANGE ) {
+    printf( " %s=<%d", name, min );
+  }
+  else if ( value == CODEC_ABOVE_RANGE ) {
+    printf( " %s=>%d", name, CODEC_FIELD_MAX( min, bits ) );
+  }
+  else {
+    printf( " %s=%u", name, value );
+  }
+}
+
+void print_frame( const char* hex )
+{
+  uint8_t         bytes[256];
+  codec_reading_t readings[CODEC_MAX_READINGS];
+
+  // CCM* payloads come as DevAddr:FCnt:payload
+  const char*  payload  = hex;
+  unsigned int dev_addr = 0;
+  unsigned int fcnt_up  = 0;
+  int          skip     = 0;
+  if ( mode == ENCRYPT_CCM ) {
+    if ( sscanf( hex, "%x:%u:%n", &dev_addr, &fcnt_up, &skip ) != 2 ) {
+      printf( "%s: expected DevAddr:FCnt:payload\n", hex );
+      return;
+    }
+    payload = hex + skip;
+  }
+
+  int len = parse_hex( payload, bytes, sizeof( bytes ) );
+  int header_len = with_header ? SEQ_ACK_HEADER_LEN : 0;
+  if ( len < header_len ) {
+    printf( "%s: not a hex payload\n", hex );
+    return;
+  }
+  uint8_t* data     = bytes + header_len;
+  int      data_len = len - header_len;
+  if ( mode != ENCRYPT_NONE ) {
+    data_len = decrypt( dev_addr, fcnt_up, bytes, header_len, data,
+                        data_len );
+    if ( data_len < 0 ) {
+      printf( "%s: doesn't decrypt with this key (%s)\n", hex,
+              ( mode == ENCRYPT_CCM ) ? "MIC mismatch"
+                                      : "not whole AES blocks" );
+      return;
+    }
+  }
+  if ( with_header ) {
+    printf( "%s: from reading %u\n", hex, seq_ack_read_header( bytes ) );
+  }
+  int num_readings =
+      codec_decode( data, data_len, readings, CODEC_MAX_READINGS );
+  if ( num_readings < 0 ) {
+    printf( "%s: invalid frame\n", hex );
+    return;
+  }
+
+  printf( "%s: %d reading(s)\n", hex, num_readings );
+  for ( int i = 0; i < num_readings; i++ ) {
+    char time_str[32] = "unknown time";
+    if ( readings[i].timestamp != 0 ) {
+      time_t    t = readings[i].timestamp;
+      struct tm utc;
+      gmtime_r( &t, &utc );
+      strftime( time_str, sizeof( time_str ), "%Y-%m-%dT%H:%M:%SZ", &utc );
+    }
+    printf( "  %s:", time_str );
+#define PRINT_FIELD( name, min, bits ) \
+  print_field( #name, readings[i].name, min, bits );
+    CODEC_READING_FIELDS( PRINT_FIELD )
+#undef PRINT_FIELD
+    printf( "\n" );
+  }
+}
+
+// -----------------------------------------------------------------------
+// print_telemetry
+// -----------------------------------------------------------------------
+
+void print_telemetry( const char* hex )
+{
+  uint8_t           bytes[256];
+  telemetry_frame_t frame;
+
+  int len = parse_hex( hex, bytes, sizeof( bytes ) );
+  if ( len < 0 ) {
+    printf( "%s: not a hex payload\n", hex );
+    return;
+  }
+  if ( telemetry_decode( bytes, len, &frame ) < 0 ) {
+    printf( "%s: invalid telemetry frame\n", hex );
+    return;
+  }
+
+  printf( "%s: telemetry v%d, frame %d\n", hex, frame.version,
+          frame.sequence );
+  for ( int field = 0; field < TELEMETRY_NUM_FIELDS; field++ ) {
+    if ( ( frame.present >> field ) & 1 ) {
+      printf( "  %s: %u\n", telemetry_labels[field],
+              (unsigned) frame.values[field] );
+    }
+  }
+}
+
+int main( int argc, char** argv )
+{
+  void ( *print )( const char* ) = print_frame;
+  int first                      = 1;
+  while ( argc > first ) {
+    if ( strcmp( argv[first], "-t" ) == 0 ) {
+      print = print_telemetry;
+      first++;
+    }
+    else if ( strcmp( argv[first], "-a" ) == 0 ) {
+      with_header = true;
+      first++;
+    }
+    else if ( ( strcmp( argv[first], "-k" ) == 0 ) &&
+              ( argc > first + 1 ) ) {
+      if ( parse_hex( argv[first + 1], key, sizeof( key ) ) != 16 ) {
+        fprintf( stderr, "-k takes a 16-byte key in hex\n" );
+        return 1;
+      }
+      use_key();
+      first += 2;
+    }
+    else if ( ( strcmp( argv[first], "-r" ) == 0 ) &&
+              ( argc > first + 2 ) ) {
+      uint8_t root_key[16];
+      if ( parse_hex( argv[first + 1], root_key, sizeof( root_key ) ) !=
+           16 ) {
+        fprintf( stderr, "-r takes a 16-byte root key in hex\n" );
+        return 1;
+      }
+      derive_device_key( root_key,
+                         strtoull( argv[first + 2], nullptr, 16 ), key );
+      use_key();
+      first += 3;
+    }
+    else if ( ( strcmp( argv[first], "-e" ) == 0 ) &&
+              ( argc > first + 1 ) ) {
+      mode = ( strcmp( argv[first + 1], "ecb" ) == 0 ) ? ENCRYPT_ECB
+                                                         : ENCRYPT_CCM;
+      first += 2;
+    }
+    else {
+      break;
+    }
+  }
+
+  if ( argc > first ) {
+    for ( int i = first; i < argc; i++ ) {
+      print( argv[i] );
+    }
+    return 0;
+  }
+
+  char line[1024];
+  while ( fgets( line, sizeof( line ), stdin ) ) {
+    line[strcspn( line, "\r\n" )] = '\0';
+    if ( line[0] ) {
+      print( line );
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,750 @@
+// =======================================================================
+// fleet_sim.cpp
+// =======================================================================
+// Discrete-event simulation of a fleet of monitors sharing one gateway,
+// to see how our uplink policy holds up before it goes into hundreds of
+// homes. Each virtual device runs the firmware's own UplinkScheduler and
+// DatarateSelector, as LoRaWAN::try_send and FSM::drain_confirmed use
+// them: readings are packed into a confirmed frame, which is resent with
+// backoff until it's acknowledged
+//
+// The channel model:
+//   - Pure ALOHA: devices send whenever their policy says so, on a
+//     random channel of the gateway's sub-band
+//   - Spreading factors are quasi-orthogonal: a frame survives an
+//     overlapping one if its signal-to-interference ratio clears the
+//     threshold for the pair of spreading factors (same-SF capture
+//     included)
+//   - The gateway has GATEWAY_DEMODULATORS demodulators; frames that
+//     arrive while they're all locked on to others are lost
+//   - The gateway is half-duplex: while it sends an ACK it hears nothing,
+//     and it only sends one downlink at a time (RX1, else RX2, else none)
+//   - Duty cycle: US915 has none, so by default the only limits are the
+//     dwell time and TTN's fair-use budgets the scheduler enforces. With
+//     -d, the MAC also enforces a per-device duty cycle (as in EU868),
+//     refusing sends until it's served
+//
+// Fleet sizes from a quarter of the given number up to it are each run
+// under the scheduler and the original firmware's fixed 5 s resend, one
+// simulation per thread, and compared by delivery ratio, latency from
+// reading to server, and airtime per delivered reading
+//
+//   fleet_sim [devices] [days] [-d duty_percent] [-j threads]
+
+#include "lorawan/codec.h"
+#include "lorawan/datarate.h"
+#include "lorawan/scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_DEVICES 16000
+#define DEFAULT_DAYS 30
+
+// Readings come in at random, and after the last day the queues get
+// DRAIN_DAYS to empty
+#define READINGS_PER_DAY 4
+#define DRAIN_DAYS 1
+
+// Devices are spread evenly over a disc around the gateway, with a
+// log-distance path loss (Okumura-Hata, suburban) and log-normal
+// shadowing, plus per-frame fading
+#define CELL_RADIUS_M 3000
+#define TX_POWER_DBM 20
+#define PATH_LOSS_1KM_DB 128.1
+#define PATH_LOSS_EXPONENT 3.76
+#define SHADOWING_DB 6.0
+#define FADING_DB 2.0
+#define NOISE_FLOOR_DBM -117.0  // 125 kHz, 6 dB noise figure
+
+// Gateway (an SX1301: 8 multi-SF demodulators) on one sub-band
+#define GATEWAY_CHANNELS 8
+#define GATEWAY_DEMODULATORS 8
+#define BACKHAUL_MS 100
+
+// RX windows (US915), from the end of the uplink
+#define RX1_DELAY_MS 1000
+#define RX2_DELAY_MS 2000
+#define RX2_SF 12
+
+// Downlink PHYPayload for an ACK, and a LinkCheckAns in its FOpts
+#define ACK_LEN 12
+#define LINK_CHECK_ANS_LEN 3
+
+// How often the application polls when the scheduler defers for a budget
+#define DEFER_POLL_MS 60000
+
+// Original firmware's resend interval
+#define LEGACY_RESEND_MS 5000
+
+enum policy_t { POLICY_SCHEDULER = 0, POLICY_LEGACY, NUM_POLICIES };
+
+const char* policy_names[NUM_POLICIES] = { "scheduler", "fixed 5 s" };
+
+// Spreading factor of each data rate we use (DR0-DR3, 125 kHz)
+const int datarate_sfs[DR_MAX + 1] = { 10, 9, 8, 7 };
+
+// Lowest SNR (dB) to demodulate each spreading factor (SF7-SF12)
+const double sf_floor_db[6] = { -7.5, -10, -12.5, -15, -17.5, -20 };
+
+// Signal-to-interference ratio (dB) a frame needs to survive an
+// overlapping one, by its spreading factor (rows, SF7-SF12) and the
+// interferer's (columns), from Croce et al., "Impact of LoRa Imperfect
+// Orthogonality", IEEE Comm. Letters, 2018
+const double sir_threshold_db[6][6] = {
+    { 1, -8, -9, -9, -9, -9 },         { -11, 1, -11, -12, -13, -13 },
+    { -15, -13, 1, -13, -14, -15 },    { -19, -18, -17, 1, -17, -18 },
+    { -22, -22, -21, -20, 1, -20 },    { -25, -25, -25, -24, -23, 1 },
+};
+
+// Frame length for each number of readings, and readings per frame at
+// each data rate
+int frame_lens[CODEC_MAX_READINGS + 1];
+int frame_capacity[DR_MAX + 1];
+
+// -----------------------------------------------------------------------
+// Configuration and results
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint32_t devices;
+  uint32_t days;
+  double   duty_cycle;  // Per device, 0 for none
+  policy_t policy;
+  uint32_t seed;
+} fleet_config_t;
+
+// Why the gateway didn't get a frame
+enum loss_t {
+  LOSS_NONE = 0,
+  LOSS_WEAK,        // Below the demodulation floor
+  LOSS_GATEWAY_TX,  // The gateway was sending a downlink
+  LOSS_DEMODULATOR, // Every demodulator was busy
+  LOSS_COLLISION,   // Interference from an overlapping frame
+  NUM_LOSSES
+};
+
+typedef struct {
+  uint32_t           readings;
+  uint32_t           delivered;  // At the server
+  uint32_t           acked;      // ... and known to the device
+  uint32_t           uplinks;
+  uint32_t           losses[NUM_LOSSES];
+  uint32_t           acks_sent[3];  // None free, in RX1, in RX2
+  uint32_t           acks_lost;     // Sent, but the device missed it
+  uint32_t           mac_busy;      // Sends refused for the duty cycle
+  uint64_t           airtime_us;
+  uint64_t           events;
+  std::vector<float> latencies_s;
+  double             wall_s;
+} fleet_result_t;
+
+// -----------------------------------------------------------------------
+// Fleet
+// -----------------------------------------------------------------------
+
+class Fleet {
+ public:
+  Fleet( const fleet_config_t& config );
+  fleet_result_t run();
+
+ private:
+  enum event_type_t { EV_READING, EV_POLL, EV_TX_END, EV_CYCLE_END };
+
+  typedef struct {
+    uint64_t     time_us;
+    uint64_t     order;  // Keeps ties in the order they were scheduled
+    uint32_t     device;
+    event_type_t type;
+  } event_t;
+
+  struct later {
+    bool operator()( const event_t& a, const event_t& b ) const
+    {
+      return ( a.time_us != b.time_us ) ? ( a.time_us > b.time_us )
+                                        : ( a.order > b.order );
+    }
+  };
+
+  // A frame on the air
+  typedef struct {
+    uint32_t device;
+    int      sf;
+    double   rssi_dbm;
+    uint64_t start_us;
+    uint64_t end_us;
+    bool     locked;  // Has a demodulator
+    loss_t   loss;
+  } transmission_t;
+
+  typedef struct {
+    UplinkScheduler  scheduler;
+    DatarateSelector datarates;
+    double           rssi_dbm;  // Mean, at the gateway
+    uint8_t          datarate;
+
+    std::deque<uint64_t> readings;  // When each waiting one was taken
+    int                  frame_readings;  // Packed into the current frame
+    uint8_t              frame_len;
+    bool                 frame_delivered;
+    bool                 msg_sent;
+    uint64_t             last_send_ms;
+    bool                 link_check;       // Goes with the next uplink
+    bool                 link_check_sent;  // Went with this one
+
+    bool     busy;      // Between an uplink and the end of RX2
+    int      channel;   // Of the uplink in flight
+    uint64_t poll_us;   // Pending poll (stale ones are ignored)
+    uint64_t ready_us;  // Duty cycle served
+
+    bool    acked;  // Got an ACK in this cycle
+    int8_t  ack_rssi;
+    int8_t  ack_snr;
+    int     link_margin;  // LinkCheckAns margin, or -1
+  } device_t;
+
+  void schedule( uint64_t time_us, uint32_t device, event_type_t type );
+  void schedule_poll( uint32_t id, uint64_t time_us );
+
+  void on_reading( uint32_t id );
+  void poll( uint32_t id );
+  void transmit( uint32_t id );
+  void on_tx_end( uint32_t id );
+  void on_cycle_end( uint32_t id );
+
+  bool   gateway_sending( uint64_t start_us, uint64_t end_us );
+  int    send_ack( uint32_t id, const transmission_t& tx );
+  double fading() { return fading_db( rng ); }
+
+  fleet_config_t          config;
+  std::mt19937_64         rng;
+  std::normal_distribution<double> fading_db;
+  std::exponential_distribution<double> reading_gap_s;
+
+  std::vector<device_t> devices;
+  std::priority_queue<event_t, std::vector<event_t>, later> events;
+  uint64_t now_us;
+  uint64_t next_order;
+  uint64_t readings_end_us;
+
+  std::vector<transmission_t> on_air[GATEWAY_CHANNELS];
+  int                         demodulators_busy;
+  std::vector<std::pair<uint64_t, uint64_t>> downlinks;  // Gateway TX
+
+  fleet_result_t result;
+};
+
+Fleet::Fleet( const fleet_config_t& config )
+    : config( config ),
+      rng( config.seed ),
+      fading_db( 0, FADING_DB ),
+      reading_gap_s( READINGS_PER_DAY / 86400.0 ),
+      now_us( 0 ),
+      next_order( 0 ),
+      readings_end_us( config.days * 86400000000ull ),
+      demodulators_busy( 0 ),
+      result()
+{
+  std::uniform_real_distribution<double> unit( 0, 1 );
+  std::normal_distribution<double>       shadowing( 0, SHADOWING_DB );
+
+  devices.reserve( config.devices );
+  for ( uint32_t id = 0; id < config.devices; id++ ) {
+    double distance_km =
+        std::max( 0.05, CELL_RADIUS_M / 1000.0 * sqrt( unit( rng ) ) );
+    double path_loss = PATH_LOSS_1KM_DB +
+                       10 * PATH_LOSS_EXPONENT * log10( distance_km ) +
+                       shadowing( rng );
+    devices.push_back( { UplinkScheduler( config.seed * 65537 + id ),
+                         DatarateSelector(), TX_POWER_DBM - path_loss,
+                         DR_MIN, {}, 0, 0, false, false, 0, false, false,
+                         false, 0, 0, 0, false, 0, 0, -1 } );
+    schedule( reading_gap_s( rng ) * 1e6, id, EV_READING );
+  }
+}
+
+// -----------------------------------------------------------------------
+// Events
+// -----------------------------------------------------------------------
+
+void Fleet::schedule( uint64_t time_us, uint32_t device, event_type_t type )
+{
+  events.push( { time_us, next_order++, device, type } );
+}
+
+// Only the earliest pending poll counts
+void Fleet::schedule_poll( uint32_t id, uint64_t time_us )
+{
+  device_t& dev = devices[id];
+  if ( ( dev.poll_us > now_us ) && ( dev.poll_us <= time_us ) ) {
+    return;
+  }
+  dev.poll_us = time_us;
+  schedule( time_us, id, EV_POLL );
+}
+
+fleet_result_t Fleet::run()
+{
+  auto     start  = std::chrono::steady_clock::now();
+  uint64_t end_us = readings_end_us + DRAIN_DAYS * 86400000000ull;
+
+  while ( !events.empty() && ( events.top().time_us < end_us ) ) {
+    event_t event = events.top();
+    events.pop();
+    now_us = event.time_us;
+    result.events++;
+
+    switch ( event.type ) {
+      case EV_READING:
+        on_reading( event.device );
+        break;
+      case EV_POLL:
+        if ( devices[event.device].poll_us == now_us ) {
+          poll( event.device );
+        }
+        break;
+      case EV_TX_END:
+        on_tx_end( event.device );
+        break;
+      case EV_CYCLE_END:
+        on_cycle_end( event.device );
+        break;
+    }
+  }
+
+  result.wall_s = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start )
+                      .count();
+  return result;
+}
+
+// -----------------------------------------------------------------------
+// Device
+// -----------------------------------------------------------------------
+
+void Fleet::on_reading( uint32_t id )
+{
+  device_t& dev = devices[id];
+  dev.readings.push_back( now_us );
+  result.readings++;
+
+  uint64_t next_us = now_us + reading_gap_s( rng ) * 1e6;
+  if ( next_us < readings_end_us ) {
+    schedule( next_us, id, EV_READING );
+  }
+  if ( !dev.busy && ( dev.frame_readings == 0 ) ) {
+    poll( id );
+  }
+}
+
+// As FSM::drain_confirmed, LoRaWAN::try_send and pick_datarate
+void Fleet::poll( uint32_t id )
+{
+  device_t& dev    = devices[id];
+  uint64_t  now_ms = now_us / 1000;
+  if ( dev.busy || dev.readings.empty() ) {
+    return;
+  }
+
+  // Pack as many readings as fit at the current data rate
+  if ( dev.frame_readings == 0 ) {
+    dev.frame_readings  = std::min( (int) dev.readings.size(),
+                                    frame_capacity[dev.datarate] );
+    dev.frame_len       = frame_lens[dev.frame_readings];
+    dev.frame_delivered = false;
+  }
+
+  dev.datarate = dev.datarates.choose( now_ms, dev.frame_len );
+  if ( dev.datarates.link_check_due() ) {
+    dev.datarates.on_link_check_requested();
+    dev.link_check = true;
+  }
+
+  if ( config.policy == POLICY_SCHEDULER ) {
+    sched_decision_t decision =
+        dev.scheduler.check( now_ms, dev.datarate, dev.frame_len, true );
+    if ( decision != SCHED_SEND ) {
+      uint64_t next_ms =
+          ( decision == SCHED_WAIT )
+              ? dev.scheduler.stats( now_ms ).next_attempt_ms
+              : now_ms + DEFER_POLL_MS;
+      schedule_poll( id, std::max( next_ms, now_ms + 1 ) * 1000 );
+      return;
+    }
+  }
+  else if ( dev.msg_sent &&
+            ( now_ms < dev.last_send_ms + LEGACY_RESEND_MS ) ) {
+    schedule_poll( id, ( dev.last_send_ms + LEGACY_RESEND_MS ) * 1000 );
+    return;
+  }
+
+  // The MAC refuses frames until the duty cycle is served
+  if ( now_us < dev.ready_us ) {
+    dev.scheduler.on_mac_busy( now_ms );
+    result.mac_busy++;
+    schedule_poll( id, now_us + SCHED_MAC_BUSY_MS * 1000 );
+    return;
+  }
+
+  if ( dev.msg_sent ) {
+    dev.datarates.on_uplink_lost();
+  }
+  dev.msg_sent     = true;
+  dev.last_send_ms = now_ms;
+  dev.scheduler.on_uplink( now_ms, dev.datarate, dev.frame_len );
+  dev.datarates.on_uplink( now_ms, dev.datarate, dev.frame_len );
+  transmit( id );
+}
+
+// -----------------------------------------------------------------------
+// Channel
+// -----------------------------------------------------------------------
+
+void Fleet::transmit( uint32_t id )
+{
+  device_t& dev = devices[id];
+  dev.busy            = true;
+  dev.link_check_sent = dev.link_check;
+  dev.link_check      = false;
+  dev.channel         = rng() % GATEWAY_CHANNELS;
+
+  // A LinkCheckReq is one more byte of FOpts
+  uint32_t airtime_us = UplinkScheduler::time_on_air_us(
+      dev.datarate, dev.frame_len + ( dev.link_check_sent ? 1 : 0 ) );
+  result.uplinks++;
+  result.airtime_us += airtime_us;
+  if ( config.duty_cycle > 0 ) {
+    dev.ready_us =
+        now_us + airtime_us * ( 100 / config.duty_cycle );
+  }
+
+  transmission_t tx = { id, datarate_sfs[dev.datarate],
+                        dev.rssi_dbm + fading(), now_us,
+                        now_us + airtime_us, false, LOSS_NONE };
+  int sf_index      = tx.sf - 7;
+
+  // Too weak to lock on to, or the gateway isn't listening
+  if ( tx.rssi_dbm - NOISE_FLOOR_DBM < sf_floor_db[sf_index] ) {
+    tx.loss = LOSS_WEAK;
+  }
+  else if ( gateway_sending( tx.start_us, tx.start_us ) ) {
+    tx.loss = LOSS_GATEWAY_TX;
+  }
+  else if ( demodulators_busy >= GATEWAY_DEMODULATORS ) {
+    tx.loss = LOSS_DEMODULATOR;
+  }
+  else {
+    tx.locked = true;
+    demodulators_busy++;
+  }
+
+  // Frames already on the channel and this one interfere both ways
+  for ( transmission_t& other : on_air[dev.channel] ) {
+    int other_index = other.sf - 7;
+    if ( ( tx.loss == LOSS_NONE ) &&
+         ( tx.rssi_dbm - other.rssi_dbm <
+           sir_threshold_db[sf_index][other_index] ) ) {
+      tx.loss = LOSS_COLLISION;
+    }
+    if ( ( other.loss == LOSS_NONE ) &&
+         ( other.rssi_dbm - tx.rssi_dbm <
+           sir_threshold_db[other_index][sf_index] ) ) {
+      other.loss = LOSS_COLLISION;
+    }
+  }
+  on_air[dev.channel].push_back( tx );
+  schedule( tx.end_us, id, EV_TX_END );
+}
+
+bool Fleet::gateway_sending( uint64_t start_us, uint64_t end_us )
+{
+  for ( const auto& downlink : downlinks ) {
+    if ( ( downlink.first <= end_us ) && ( downlink.second >= start_us ) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Time-on-air of a downlink: 500 kHz, so no low data rate optimization,
+// and no CRC
+static uint32_t downlink_time_on_air_us( int sf, int phy_len )
+{
+  uint32_t sym_us = ( 1000u << sf ) / 500;
+  int      num    = 8 * phy_len - 4 * sf + 28;
+  int      blocks = ( num > 0 ) ? ( num + 4 * sf - 1 ) / ( 4 * sf ) : 0;
+  return ( 8 * 4 + 17 ) * sym_us / 4 + ( 8 + blocks * 5 ) * sym_us;
+}
+
+void Fleet::on_tx_end( uint32_t id )
+{
+  device_t&                    dev    = devices[id];
+  std::vector<transmission_t>& active = on_air[dev.channel];
+  auto                         it     = std::find_if(
+      active.begin(), active.end(),
+      [id]( const transmission_t& tx ) { return tx.device == id; } );
+  transmission_t tx = *it;
+  *it               = active.back();
+  active.pop_back();
+  if ( tx.locked ) {
+    demodulators_busy--;
+  }
+
+  // Downlinks that started after it did drown it out too
+  if ( ( tx.loss == LOSS_NONE ) &&
+       gateway_sending( tx.start_us, tx.end_us ) ) {
+    tx.loss = LOSS_GATEWAY_TX;
+  }
+  result.losses[tx.loss]++;
+
+  int      window = 0;
+  uint64_t cycle_end_us =
+      now_us + RX2_DELAY_MS * 1000 + downlink_time_on_air_us( RX2_SF, 0 );
+  if ( tx.loss == LOSS_NONE ) {
+    if ( !dev.frame_delivered ) {
+      dev.frame_delivered = true;
+      result.delivered += dev.frame_readings;
+      for ( int i = 0; i < dev.frame_readings; i++ ) {
+        result.latencies_s.push_back( ( now_us - dev.readings[i] ) / 1e6 );
+      }
+    }
+    window = send_ack( id, tx );
+  }
+
+  // The MAC stops listening once RX1 brings the ACK
+  if ( dev.acked && ( window == 1 ) ) {
+    cycle_end_us = now_us + RX1_DELAY_MS * 1000 +
+                   downlink_time_on_air_us( tx.sf, ACK_LEN );
+  }
+  schedule( cycle_end_us, id, EV_CYCLE_END );
+}
+
+// Returns the window the ACK went out in (0 for neither). Downlinks are
+// about as strong at the device as uplinks at the gateway: the gateway
+// sends at more power, but at 500 kHz the noise is 6 dB higher
+int Fleet::send_ack( uint32_t id, const transmission_t& tx )
+{
+  device_t& dev = devices[id];
+  int       len = ACK_LEN + ( dev.link_check_sent ? LINK_CHECK_ANS_LEN : 0 );
+
+  // Drop downlinks that are long gone
+  downlinks.erase(
+      std::remove_if( downlinks.begin(), downlinks.end(),
+                      [this]( const std::pair<uint64_t, uint64_t>& d ) {
+                        return d.second + 1000000 < now_us;
+                      } ),
+      downlinks.end() );
+
+  int window = 0;
+  int sf     = 0;
+  for ( int w = 1; ( w <= 2 ) && ( window == 0 ); w++ ) {
+    uint64_t delay_ms = ( w == 1 ) ? RX1_DELAY_MS : RX2_DELAY_MS;
+    sf                = ( w == 1 ) ? tx.sf : RX2_SF;
+    uint64_t start_us = now_us + delay_ms * 1000;
+    uint64_t end_us   = start_us + downlink_time_on_air_us( sf, len );
+    if ( ( BACKHAUL_MS <= delay_ms ) &&
+         !gateway_sending( start_us, end_us ) ) {
+      downlinks.push_back( { start_us, end_us } );
+      window = w;
+    }
+  }
+  result.acks_sent[window]++;
+  if ( window == 0 ) {
+    return 0;
+  }
+
+  double rssi_dbm = dev.rssi_dbm + fading();
+  double snr_db   = rssi_dbm - NOISE_FLOOR_DBM;
+  if ( snr_db < sf_floor_db[sf - 7] ) {
+    result.acks_lost++;
+    return window;
+  }
+  dev.acked    = true;
+  dev.ack_rssi = (int8_t) std::max( -128.0, rssi_dbm );
+  dev.ack_snr  = (int8_t) std::max( -128.0, std::min( 127.0, snr_db ) );
+  dev.link_margin = -1;
+  if ( dev.link_check_sent ) {
+    double margin   = tx.rssi_dbm - NOISE_FLOOR_DBM -
+                    DatarateSelector::snr_floor_qdb( dev.datarate ) / 4.0;
+    dev.link_margin = std::max( 0, (int) margin );
+  }
+  return window;
+}
+
+// As LoRaWAN::try_send once the confirmation is in, and the hooks the
+// library calls with the downlink
+void Fleet::on_cycle_end( uint32_t id )
+{
+  device_t& dev    = devices[id];
+  uint64_t  now_ms = now_us / 1000;
+  dev.busy         = false;
+
+  if ( dev.acked ) {
+    dev.datarates.on_downlink( now_ms, dev.ack_rssi, dev.ack_snr );
+    if ( dev.link_margin >= 0 ) {
+      dev.datarates.on_link_check( now_ms, dev.link_margin, 1 );
+    }
+    dev.scheduler.on_downlink( now_ms );
+    dev.scheduler.on_delivered();
+    dev.datarates.on_uplink_delivered();
+    dev.readings.erase( dev.readings.begin(),
+                        dev.readings.begin() + dev.frame_readings );
+    result.acked += dev.frame_readings;
+    dev.frame_readings = 0;
+    dev.msg_sent       = false;
+    dev.acked          = false;
+  }
+  poll( id );
+}
+
+// -----------------------------------------------------------------------
+// Results
+// -----------------------------------------------------------------------
+
+static double percentile( std::vector<float>& values, double fraction )
+{
+  if ( values.empty() ) {
+    return 0;
+  }
+  size_t index =
+      std::min( values.size() - 1, (size_t) ( fraction * values.size() ) );
+  std::nth_element( values.begin(), values.begin() + index, values.end() );
+  return values[index];
+}
+
+static void print_result( const fleet_config_t& config,
+                          fleet_result_t& r )
+{
+  uint32_t lost = 0;
+  for ( int i = LOSS_WEAK; i < NUM_LOSSES; i++ ) {
+    lost += r.losses[i];
+  }
+  auto share = [&r]( uint32_t count ) {
+    return r.uplinks ? 100.0 * count / r.uplinks : 0.0;
+  };
+  printf( " %7lu | %-9s | %8.2f%% | %7.2f %8.2f %8.2f | %8.0f | %6.2f | "
+          "%4.1f%% %4.1f%% %4.1f%% %4.1f%% | %4.1f%%\n",
+          (unsigned long) config.devices, policy_names[config.policy],
+          r.readings ? 100.0 * r.delivered / r.readings : 0.0,
+          percentile( r.latencies_s, 0.5 ),
+          percentile( r.latencies_s, 0.95 ),
+          percentile( r.latencies_s, 0.99 ),
+          r.delivered ? r.airtime_us / 1000.0 / r.delivered : 0.0,
+          r.readings ? (double) r.uplinks / r.readings : 0.0,
+          share( r.losses[LOSS_WEAK] ), share( r.losses[LOSS_COLLISION] ),
+          share( r.losses[LOSS_DEMODULATOR] ),
+          share( r.losses[LOSS_GATEWAY_TX] ),
+          ( r.uplinks - lost )
+              ? 100.0 * ( r.acks_sent[0] + r.acks_lost ) /
+                    ( r.uplinks - lost )
+              : 0.0 );
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+  uint32_t devices    = DEFAULT_DEVICES;
+  uint32_t days       = DEFAULT_DAYS;
+  double   duty_cycle = 0;
+  int      threads    = std::max( 1u, std::thread::hardware_concurrency() );
+  int      arg        = 0;
+  for ( int i = 1; i < argc; i++ ) {
+    if ( ( strcmp( argv[i], "-d" ) == 0 ) && ( i + 1 < argc ) ) {
+      duty_cycle = atof( argv[++i] );
+    }
+    else if ( ( strcmp( argv[i], "-j" ) == 0 ) && ( i + 1 < argc ) ) {
+      threads = std::max( 1, atoi( argv[++i] ) );
+    }
+    else if ( arg++ == 0 ) {
+      devices = atoi( argv[i] );
+    }
+    else {
+      days = atoi( argv[i] );
+    }
+  }
+
+  codec_reading_t readings[CODEC_MAX_READINGS] = {};
+  uint8_t         frame[CODEC_MAX_FRAME];
+  int             len;
+  for ( int i = 0; i < CODEC_MAX_READINGS; i++ ) {
+    readings[i] = { 128, 82, 72, 1735689600u + i * 3600 };
+  }
+  for ( int n = 1; n <= CODEC_MAX_READINGS; n++ ) {
+    codec_encode( readings, n, frame, CODEC_MAX_FRAME, &frame_lens[n] );
+  }
+  for ( int dr = DR_MIN; dr <= DR_MAX; dr++ ) {
+    frame_capacity[dr] =
+        codec_encode( readings, CODEC_MAX_READINGS, frame,
+                      UplinkScheduler::max_payload( dr ), &len );
+  }
+
+  // Each fleet size under each policy is an independent simulation
+  std::vector<fleet_config_t> configs;
+  for ( uint32_t divisor = 4; divisor >= 1; divisor /= 2 ) {
+    uint32_t n = std::max( 1u, devices / divisor );
+    for ( int policy = 0; policy < NUM_POLICIES; policy++ ) {
+      configs.push_back( { n, days, duty_cycle, (policy_t) policy, 1 } );
+    }
+  }
+  std::vector<fleet_result_t> results( configs.size() );
+  std::atomic<size_t>         next_config( 0 );
+
+  printf( "%lu days, %d readings a day per device, %d m cell, %d "
+          "channels and %d demodulators, %s; %d threads\n\n",
+          (unsigned long) days, READINGS_PER_DAY, CELL_RADIUS_M,
+          GATEWAY_CHANNELS, GATEWAY_DEMODULATORS,
+          duty_cycle > 0 ? "duty cycle limited" : "no duty cycle",
+          threads );
+  if ( duty_cycle > 0 ) {
+    printf( "Duty cycle: %.1f%% per device\n\n", duty_cycle );
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for ( int t = 0; t < threads; t++ ) {
+    workers.emplace_back( [&]() {
+      for ( size_t i = next_config++; i < configs.size();
+            i = next_config++ ) {
+        results[i] = Fleet( configs[i] ).run();
+      }
+    } );
+  }
+  for ( std::thread& worker : workers ) {
+    worker.join();
+  }
+  double wall_s = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start )
+                      .count();
+
+  printf( "         |           |           |    latency to se"
+          "rver (s)    | airtime  |        |     uplinks lost to     | "
+          "ACKs\n" );
+  printf( " devices | policy    | delivered |     p50      p95 "
+          "     p99 | ms/read. | up/rd  |  weak  coll demod gw-tx | "
+          "lost\n" );
+  printf( "---------+-----------+-----------+------------------"
+          "---------+----------+--------+-------------------------+-"
+          "-----\n" );
+  uint64_t events = 0;
+  double   cpu_s  = 0;
+  for ( size_t i = 0; i < configs.size(); i++ ) {
+    print_result( configs[i], results[i] );
+    events += results[i].events;
+    cpu_s += results[i].wall_s;
+  }
+  printf( "\n%zu simulations (%.1f M events) in %.1f s (%.1f s of CPU)\n",
+          configs.size(), events / 1e6, wall_s, cpu_s );
+  return 0;
+}
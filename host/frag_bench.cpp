@@ -0,0 +1,133 @@
+// =======================================================================
+// frag_bench.cpp
+// =======================================================================
+// Benchmarks our fragmented bulk uplinks (see lorawan/frag.h) over lossy
+// links: frames sent until the reassembler has the whole block, against
+// resending the whole block whenever a frame is lost
+//
+//   frag_bench [block bytes] [trials]
+
+#include "host/frag_reassembler.h"
+#include "lorawan/frag.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_BLOCK_LEN 1024
+#define DEFAULT_TRIALS 1000
+
+// Frame lengths (the smallest US915 payload, and one that fits DR1)
+const int frame_lens[] = { 11, 50 };
+
+const double losses[] = { 0.05, 0.10, 0.20 };
+
+typedef struct {
+  int              num_frags;
+  int              failures;  // Blocks rebuilt wrong, or never
+  std::vector<int> frames;    // Sent until rebuilt, per trial
+} bench_result_t;
+
+// -----------------------------------------------------------------------
+// Trials
+// -----------------------------------------------------------------------
+
+bench_result_t bench( int block_len, int frame_len, double loss,
+                      int trials, std::mt19937& rng )
+{
+  std::bernoulli_distribution     lost( loss );
+  std::uniform_int_distribution<> byte( 0, 255 );
+  std::vector<uint8_t>            block( block_len );
+  uint8_t                         frame[256];
+  bench_result_t                  result = {};
+
+  for ( int trial = 0; trial < trials; trial++ ) {
+    for ( uint8_t& b : block ) {
+      b = byte( rng );
+    }
+    FragSender      sender( trial % ( FRAG_MAX_SESSION + 1 ), block.data(),
+                            block_len, frame_len, 0 );
+    FragReassembler reassembler;
+    result.num_frags = sender.num_fragments();
+
+    // Keep asking for parity until the receiver has the block
+    bool done = false;
+    while ( !done ) {
+      int len = sender.next( frame );
+      if ( len == 0 ) {
+        sender.more( 1 );
+        len = sender.next( frame );
+        if ( len == 0 ) {
+          break;  // Out of parity fragments
+        }
+      }
+      if ( !lost( rng ) ) {
+        done = reassembler.add( frame, len );
+      }
+    }
+    if ( !done || ( reassembler.data() != block ) ) {
+      result.failures++;
+      continue;
+    }
+    result.frames.push_back( sender.frames_sent() );
+  }
+  std::sort( result.frames.begin(), result.frames.end() );
+  return result;
+}
+
+int percentile( const std::vector<int>& sorted, double pct )
+{
+  if ( sorted.empty() ) {
+    return 0;
+  }
+  size_t i = (size_t) ceil( pct / 100 * sorted.size() );
+  return sorted[std::min( std::max( i, (size_t) 1 ), sorted.size() ) - 1];
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+  int block_len = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_BLOCK_LEN;
+  int trials    = ( argc > 2 ) ? atoi( argv[2] ) : DEFAULT_TRIALS;
+  std::mt19937 rng( 1 );
+
+  printf( "%d B block, %d trials each\n\n", block_len, trials );
+  printf( " frame | loss |   M | resend all | fec mean |  p95 |  p99 | "
+          "overhead | redundancy for 99%% | failed\n" );
+  printf( "-------+------+-----+------------+----------+------+------+"
+          "----------+--------------------+-------\n" );
+
+  for ( int frame_len : frame_lens ) {
+    for ( double loss : losses ) {
+      bench_result_t r = bench( block_len, frame_len, loss, trials, rng );
+
+      // Whole block resent until one gets through with nothing lost
+      double resend_all = r.num_frags / pow( 1 - loss, r.num_frags );
+
+      double mean = 0;
+      for ( int frames : r.frames ) {
+        mean += frames;
+      }
+      mean /= std::max( (size_t) 1, r.frames.size() );
+      int p95 = percentile( r.frames, 95 );
+      int p99 = percentile( r.frames, 99 );
+
+      // Parity fragments to send up front for 99% of blocks to arrive
+      // without asking for more
+      int redundancy_pct = ( 100 * ( p99 - r.num_frags ) + r.num_frags - 1 )
+                           / r.num_frags;
+
+      printf( " %5d | %3.0f%% | %3d | %10.3g | %8.1f | %4d | %4d | "
+              "%7.1f%% | %17d%% | %6d\n",
+              frame_len, loss * 100, r.num_frags, resend_all, mean, p95,
+              p99, 100 * ( mean / r.num_frags - 1 ), redundancy_pct,
+              r.failures );
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,181 @@
+// =======================================================================
+// frag_reassembler.h
+// =======================================================================
+// A reassembler for our fragmented bulk uplinks (see lorawan/frag.h), for
+// the application server's side
+//
+// Each fragment is a row of a system of equations over GF(2): a data
+// fragment covers only itself, a parity fragment covers its row of the
+// parity matrix. Rows are reduced against the ones before as they arrive
+// (Gaussian elimination), and the block is rebuilt once there are M
+// independent ones, whichever fragments were lost.
+
+#ifndef HOST_FRAG_REASSEMBLER_H
+#define HOST_FRAG_REASSEMBLER_H
+
+#include "lorawan/frag.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class FragReassembler {
+ public:
+  // Add a frame (header included). Returns whether the block is complete
+  bool add( const uint8_t* frame, int len )
+  {
+    if ( len <= FRAG_HEADER_LEN ) {
+      return is_complete;
+    }
+    frag_header_t header;
+    frag_read_header( frame, &header );
+    int frag_size = len - FRAG_HEADER_LEN;
+    if ( ( header.session != session ) ||
+         ( header.num_fragments != num_frags ) ||
+         ( frag_size != size ) ) {
+      reset( header.session, header.num_fragments, frag_size );
+    }
+    num_received++;
+    if ( is_complete ) {
+      return true;
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Its row of coefficients
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    row_t row;
+    row.coeffs.assign( words, 0 );
+    row.payload.assign( frame + FRAG_HEADER_LEN, frame + len );
+    if ( header.index < num_frags ) {
+      set_bit( row, header.index );
+    }
+    else {
+      uint8_t covered[FRAG_ROW_BYTES];
+      frag_parity_row( header.index - num_frags + 1, num_frags, covered );
+      for ( int n = 0; n < num_frags; n++ ) {
+        if ( ( covered[n / 8] >> ( n % 8 ) ) & 1 ) {
+          set_bit( row, n );
+        }
+      }
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // Reduce it; if anything's left, its lowest fragment is a new pivot
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+    int lowest = -1;
+    for ( int col = 0; col < num_frags; col++ ) {
+      if ( !bit( row, col ) ) {
+        continue;
+      }
+      if ( pivots[col] < 0 ) {
+        lowest = ( lowest < 0 ) ? col : lowest;
+        continue;
+      }
+      if ( lowest < 0 ) {
+        xor_row( row, rows[pivots[col]] );
+      }
+    }
+    if ( lowest < 0 ) {
+      return false;  // Nothing new
+    }
+    // Finish clearing the columns past the new pivot with pivots
+    for ( int col = lowest + 1; col < num_frags; col++ ) {
+      if ( bit( row, col ) && ( pivots[col] >= 0 ) ) {
+        xor_row( row, rows[pivots[col]] );
+      }
+    }
+    pivots[lowest] = rows.size();
+    rows.push_back( row );
+    if ( (int) rows.size() == num_frags ) {
+      solve();
+    }
+    return is_complete;
+  }
+
+  bool complete() { return is_complete; }
+
+  // Frames added to the current block
+  int received() { return num_received; }
+
+  // The data (without its length prefix or padding), once complete
+  std::vector<uint8_t> data() { return block; }
+
+ private:
+  typedef struct {
+    std::vector<uint64_t> coeffs;
+    std::vector<uint8_t>  payload;
+  } row_t;
+
+  void reset( int new_session, int new_num_frags, int new_size )
+  {
+    session      = new_session;
+    num_frags    = new_num_frags;
+    size         = new_size;
+    words        = ( num_frags + 63 ) / 64;
+    num_received = 0;
+    is_complete  = false;
+    rows.clear();
+    pivots.assign( num_frags, -1 );
+    block.clear();
+  }
+
+  static bool bit( const row_t& row, int n )
+  {
+    return ( row.coeffs[n / 64] >> ( n % 64 ) ) & 1;
+  }
+
+  static void set_bit( row_t& row, int n )
+  {
+    row.coeffs[n / 64] |= 1ull << ( n % 64 );
+  }
+
+  static void xor_row( row_t& row, const row_t& other )
+  {
+    for ( size_t i = 0; i < row.coeffs.size(); i++ ) {
+      row.coeffs[i] ^= other.coeffs[i];
+    }
+    for ( size_t i = 0; i < row.payload.size(); i++ ) {
+      row.payload[i] ^= other.payload[i];
+    }
+  }
+
+  // Back-substitute from the last fragment, so each pivot row ends up
+  // covering only its own fragment
+  void solve()
+  {
+    for ( int col = num_frags - 1; col >= 0; col-- ) {
+      row_t& row = rows[pivots[col]];
+      for ( int other = col + 1; other < num_frags; other++ ) {
+        if ( bit( row, other ) ) {
+          xor_row( row, rows[pivots[other]] );
+        }
+      }
+    }
+
+    std::vector<uint8_t> whole;
+    for ( int col = 0; col < num_frags; col++ ) {
+      const row_t& row = rows[pivots[col]];
+      whole.insert( whole.end(), row.payload.begin(), row.payload.end() );
+    }
+    size_t len = ( whole[0] << 8 ) | whole[1];
+    if ( len + FRAG_LENGTH_LEN > whole.size() ) {
+      return;  // Corrupt
+    }
+    block.assign( whole.begin() + FRAG_LENGTH_LEN,
+                  whole.begin() + FRAG_LENGTH_LEN + len );
+    is_complete = true;
+  }
+
+  int                  session      = -1;
+  int                  num_frags    = 0;
+  int                  size         = 0;
+  int                  words        = 0;
+  int                  num_received = 0;
+  bool                 is_complete  = false;
+  std::vector<row_t>   rows;
+  std::vector<int>     pivots;  // Row with each fragment as its pivot
+  std::vector<uint8_t> block;
+};
+
+#endif  // HOST_FRAG_REASSEMBLER_H
@@ -0,0 +1,159 @@
+// =======================================================================
+// gen_formatter.cpp
+// =======================================================================
+// Generates the TTN uplink payload formatter (JavaScript) for our codec
+// from its schema. Writes to stdout
+//
+// With ENCRYPT_READINGS set, TTN only ever sees ciphertext, and the key
+// mustn't go there, so the formatter is a stub that passes the payload
+// on in hex, saying so in its comments and in TTN's warnings (the build
+// stays quiet). Decrypt and decode readings on the application server
+// instead (see host/README.md)
+
+#include "encryption/encryption.h"
+#include "lorawan/codec_schema.h"
+#include "lorawan/frag.h"
+#include "lorawan/seq_ack.h"
+#include "lorawan/telemetry.h"
+#include <stdio.h>
+
+static void print_encrypted_stub()
+{
+  printf(
+      "// Readings are encrypted (ENCRYPT_READINGS in "
+      "encryption/encryption.h),\n"
+      "// so they can't be decoded here. Decrypt and decode them on the\n"
+      "// application server (see host/README.md)\n\n"
+      "function decodeUplink(input) {\n"
+      "  var hex = \"\";\n"
+      "  for (var i = 0; i < input.bytes.length; i++) {\n"
+      "    hex += (input.bytes[i] < 16 ? \"0\" : \"\") +\n"
+      "      input.bytes[i].toString(16);\n"
+      "  }\n"
+      "  return {\n"
+      "    data: { encrypted: hex },\n"
+      "    warnings: [\"encrypted payload; decode on the application "
+      "server\"]\n"
+      "  };\n"
+      "}\n" );
+}
+
+int main( void )
+{
+  printf( "// Generated by host/gen_formatter from lorawan/codec_schema.h"
+          " - do not edit\n\n" );
+
+  if ( ENCRYPT_READINGS != ENCRYPT_NONE ) {
+    print_encrypted_stub();
+    return 0;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Schema
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  printf( "var VERSION = %d;\n", CODEC_VERSION );
+  printf( "var VERSION_BITS = %d;\n", CODEC_VERSION_BITS );
+  printf( "var COUNT_BITS = %d;\n", CODEC_COUNT_BITS );
+  printf( "var VARINT_GROUP_BITS = %d;\n", CODEC_VARINT_GROUP_BITS );
+  printf( "var EPOCH = %u;\n", CODEC_EPOCH );
+  printf( "var TIME_UNIT_S = %d;\n", CODEC_TIME_UNIT_S );
+  printf( "var CONFIRMED_PORT = %d;\n", CONFIRMED_PORT );
+  printf( "var SEQ_ACK_PORT = %d;\n", SEQ_ACK_PORT );
+  printf( "var SEQ_ACK_HEADER_LEN = %d;\n", SEQ_ACK_HEADER_LEN );
+  printf( "var FRAG_PORT = %d;\n", FRAG_PORT );
+  printf( "var TELEMETRY_PORT = %d;\n", TELEMETRY_PORT );
+  printf( "var FIELDS = [\n" );
+#define CODEC_PRINT_FIELD( name, min, bits ) \
+  printf( "  { name: \"%s\", min: %d, bits: %d },\n", #name, min, bits );
+  CODEC_READING_FIELDS( CODEC_PRINT_FIELD )
+#undef CODEC_PRINT_FIELD
+  printf( "];\n\n" );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Decoder (mirrors codec_decode)
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Readings come on CONFIRMED_PORT as they are, and on SEQ_ACK_PORT
+  // after a header with the sequence number of the first. Fragments and
+  // telemetry are for the application server
+
+  printf(
+      "function decodeUplink(input) {\n"
+      "  var bytes = input.bytes;\n"
+      "  var pos = 0;\n"
+      "  var data = {};\n"
+      "  if (input.fPort === SEQ_ACK_PORT) {\n"
+      "    if (bytes.length < SEQ_ACK_HEADER_LEN) {\n"
+      "      return { errors: [\"truncated header\"] };\n"
+      "    }\n"
+      "    data.seq = (bytes[0] << 8) | bytes[1];\n"
+      "    pos = SEQ_ACK_HEADER_LEN * 8;\n"
+      "  } else if (input.fPort === FRAG_PORT) {\n"
+      "    return { errors: [\"fragment; reassemble on the application "
+      "server\"] };\n"
+      "  } else if (input.fPort === TELEMETRY_PORT) {\n"
+      "    return { errors: [\"telemetry; decode with host/decode -t\"] };"
+      "\n"
+      "  } else if (input.fPort !== CONFIRMED_PORT) {\n"
+      "    return { errors: [\"unknown port \" + input.fPort] };\n"
+      "  }\n"
+      "  function read(bits) {\n"
+      "    var value = 0;\n"
+      "    for (var i = 0; i < bits; i++, pos++) {\n"
+      "      var bit = pos < bytes.length * 8\n"
+      "        ? (bytes[pos >> 3] >> (7 - (pos & 7))) & 1 : 0;\n"
+      "      value = value * 2 + bit;\n"
+      "    }\n"
+      "    return value;\n"
+      "  }\n"
+      "  function readVarint() {\n"
+      "    var value = 0, scale = 1, more = 1;\n"
+      "    while (more && scale < 4294967296) {\n"
+      "      more = read(1);\n"
+      "      value += read(VARINT_GROUP_BITS) * scale;\n"
+      "      scale *= 1 << VARINT_GROUP_BITS;\n"
+      "    }\n"
+      "    return value;\n"
+      "  }\n"
+      "\n"
+      "  var version = read(VERSION_BITS);\n"
+      "  if (version !== VERSION) {\n"
+      "    return { errors: [\"unknown payload version \" + version] };\n"
+      "  }\n"
+      "  var count = read(COUNT_BITS);\n"
+      "  var time = readVarint();\n"
+      "  var readings = [];\n"
+      "  var warnings = [];\n"
+      "  for (var i = 0; i < count; i++) {\n"
+      "    var reading = {};\n"
+      "    for (var f = 0; f < FIELDS.length; f++) {\n"
+      "      var field = FIELDS[f];\n"
+      "      var top = Math.pow(2, field.bits) - 1;\n"
+      "      var code = read(field.bits);\n"
+      "      if (code === 0 || code === top) {\n"
+      "        // Out of range: no value, rather than a wrong one\n"
+      "        reading[field.name] = null;\n"
+      "        warnings.push(\"reading \" + i + \": \" + field.name +\n"
+      "          (code === 0 ? \" below \" + field.min\n"
+      "                      : \" above \" + (field.min + top - 2)));\n"
+      "      } else {\n"
+      "        reading[field.name] = code - 1 + field.min;\n"
+      "      }\n"
+      "    }\n"
+      "    if (i > 0) {\n"
+      "      time += readVarint();\n"
+      "    }\n"
+      "    reading.time = time === 0 ? null\n"
+      "      : new Date((time * TIME_UNIT_S + EPOCH) * 1000)"
+      ".toISOString();\n"
+      "    readings.push(reading);\n"
+      "  }\n"
+      "  if (pos > bytes.length * 8) {\n"
+      "    return { errors: [\"truncated payload\"] };\n"
+      "  }\n"
+      "  data.version = version;\n"
+      "  data.readings = readings;\n"
+      "  return { data: data, warnings: warnings };\n"
+      "}\n" );
+  return 0;
+}
@@ -0,0 +1,300 @@
+// =======================================================================
+// lorawan_sim.cpp
+// =======================================================================
+// Runs our LoRaWAN class (lorawan/lorawan.cpp, unchanged) against the
+// simulated MAC and radio and a local network server (see sim/sim.h),
+// over days of simulated time, in scenarios a bench can't easily set up:
+// loss, a slow backhaul, a gateway on another sub-band, a weak link and
+// corrupted frames
+//
+// The device side sends a reading every READING_PERIOD_MS as a confirmed
+// uplink, and retries it with try_send() until it's acknowledged, as
+// FSM::drain_confirmed does (with the queue in RAM), sending telemetry
+// when nothing's waiting. Everything the server received is checked
+// against what was sent
+//
+//   lorawan_sim [days] [seed] [-v]
+
+#include "lorawan/lorawan.h"
+#include "lorawan/telemetry.h"
+#include "sim/sim.h"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define READING_PERIOD_MS ( 4 * 60 * 60 * 1000ull )
+#define READING_LEN 10      // Fits DR0 with a LinkCheckReq alongside
+#define BUSY_TICK_MS 100    // How often the application polls, while
+#define IDLE_TICK_MS 60000  // it has readings waiting, and otherwise
+#define JOIN_TIMEOUT_MS ( 6 * 60 * 60 * 1000ull )
+
+#define DEFAULT_DAYS 7
+#define DEFAULT_SEED 1
+
+typedef struct {
+  const char* name;
+  sim_radio_t radio;
+  ns_config_t network;
+  bool        reboot;  // Keep the flash from the scenario before
+} scenario_t;
+
+const sim_radio_t clean_radio = { 0, 0, 0, 5, 2, -100 };
+
+const scenario_t scenarios[] = {
+    { "clean link", clean_radio, { 100, 1 }, false },
+    { "lossy link", { 0.2, 0.1, 0, 5, 2, -100 }, { 100, 1 }, false },
+    { "slow backhaul (RX2)", clean_radio, { 1500, 1 }, false },
+    { "backhaul too slow", clean_radio, { 2500, 1 }, false },
+    { "gateway on sub-band 5", clean_radio, { 100, 4 }, false },
+    { "... after a reboot", clean_radio, { 100, 4 }, true },
+    { "weak link", { 0, 0, 0, -10, 4, -120 }, { 100, 1 }, false },
+    { "5% corrupted", { 0, 0, 0.05, 5, 2, -100 }, { 100, 1 }, false },
+};
+
+bool verbose = false;
+
+typedef struct {
+  uint32_t            readings;
+  uint32_t            delivered;
+  double              join_s;
+  std::vector<double> latencies_s;
+  uint32_t            mismatched;  // Server payloads that weren't sent
+  uint32_t            missing;     // Acknowledged, but not at the server
+  uint32_t            telemetry;   // Frames the server decoded
+  uint32_t            bad_telemetry;
+} result_t;
+
+// -----------------------------------------------------------------------
+// Simulation
+// -----------------------------------------------------------------------
+
+static uint64_t now_ms()
+{
+  return sim_now_us() / 1000;
+}
+
+// Let the MAC run, then move time on to when it next needs to, the
+// application's next tick, or until
+static void step( LoRaWAN& lorawan, bool busy, uint64_t until_ms )
+{
+  uint64_t next_ms = now_ms() + lorawan.process();
+  next_ms = std::min( next_ms, now_ms() + ( busy ? BUSY_TICK_MS
+                                                  : IDLE_TICK_MS ) );
+  next_ms = std::max( std::min( next_ms, until_ms ), now_ms() + 1 );
+  sim_advance_us( next_ms * 1000 - sim_now_us() );
+}
+
+static void make_reading( uint32_t index, uint8_t* reading )
+{
+  for ( int i = 0; i < 4; i++ ) {
+    reading[i] = index >> ( 8 * i );
+  }
+  for ( int i = 4; i < READING_LEN; i++ ) {
+    reading[i] = index * 31 + i * 7;
+  }
+}
+
+static result_t simulate( const scenario_t& scenario, uint32_t days,
+                          uint32_t seed, NetworkServer& server )
+{
+  result_t result = {};
+  sim_seed( seed );
+  if ( !scenario.reboot ) {
+    sim_flash_reset();
+  }
+  sim_mac_reset( &scenario.radio, &server );
+
+  LoRaWAN lorawan;
+  lorawan_debug( verbose );
+
+  uint64_t start_ms = now_ms();
+  while ( !lorawan.try_join() &&
+          ( now_ms() - start_ms < JOIN_TIMEOUT_MS ) ) {
+    step( lorawan, true, UINT64_MAX );
+  }
+  result.join_s = ( now_ms() - start_ms ) / 1000.0;
+  if ( !lorawan.try_join() ) {
+    return result;
+  }
+
+  // Readings waiting to go, oldest first, with when they were taken
+  std::deque<std::pair<uint32_t, uint64_t>> queue;
+  std::map<uint32_t, bool>                 acked;
+  uint64_t end_ms       = now_ms() + days * 24 * 60 * 60 * 1000ull;
+  uint64_t next_read_ms = now_ms();
+
+  while ( now_ms() < end_ms ) {
+    if ( now_ms() >= next_read_ms ) {
+      queue.push_back( { result.readings++, now_ms() } );
+      next_read_ms += READING_PERIOD_MS;
+    }
+    if ( !queue.empty() ) {
+      uint8_t reading[READING_LEN];
+      make_reading( queue.front().first, reading );
+      if ( lorawan.try_send( reading, READING_LEN ) ) {
+        result.latencies_s.push_back(
+            ( now_ms() - queue.front().second ) / 1000.0 );
+        acked[queue.front().first] = true;
+        result.delivered++;
+        queue.pop_front();
+      }
+    }
+    else {
+      lorawan.try_send_telemetry();
+    }
+    step( lorawan, !queue.empty(), next_read_ms );
+  }
+  if ( verbose ) {
+    lorawan.print_stats();
+  }
+
+  // What the server got has to be what was sent
+  std::map<uint32_t, bool> received;
+  for ( const ns_uplink_t& uplink : server.uplinks() ) {
+    if ( uplink.port == TELEMETRY_PORT ) {
+      telemetry_frame_t frame;
+      if ( telemetry_decode( uplink.data.data(), uplink.data.size(),
+                             &frame ) == 0 ) {
+        result.telemetry++;
+      }
+      else {
+        result.bad_telemetry++;
+      }
+      continue;
+    }
+    uint8_t  expected[READING_LEN];
+    uint32_t index = 0;
+    for ( int i = 0; ( i < 4 ) && ( i < (int) uplink.data.size() ); i++ ) {
+      index |= uplink.data[i] << ( 8 * i );
+    }
+    make_reading( index, expected );
+    if ( ( uplink.data.size() != READING_LEN ) ||
+         ( memcmp( uplink.data.data(), expected, READING_LEN ) != 0 ) ) {
+      result.mismatched++;
+      continue;
+    }
+    received[index] = true;
+  }
+  for ( const auto& reading : acked ) {
+    if ( !received.count( reading.first ) ) {
+      result.missing++;
+    }
+  }
+  return result;
+}
+
+// -----------------------------------------------------------------------
+// Results
+// -----------------------------------------------------------------------
+
+static double percentile( std::vector<double> values, double fraction )
+{
+  if ( values.empty() ) {
+    return 0;
+  }
+  std::sort( values.begin(), values.end() );
+  return values[std::min( values.size() - 1,
+                          (size_t) ( fraction * values.size() ) )];
+}
+
+static void print_result( const scenario_t& scenario, const result_t& r,
+                          NetworkServer& server )
+{
+  sim_mac_stats_t mac = sim_mac_stats();
+  ns_stats_t      ns  = server.stats();
+  double          mean_s = 0;
+  for ( double latency_s : r.latencies_s ) {
+    mean_s += latency_s / r.latencies_s.size();
+  }
+
+  printf( "%s: %.0f%%/%.0f%% loss, %.0f dB SNR, %lu ms backhaul, "
+          "sub-band %d\n",
+          scenario.name, scenario.radio.uplink_loss * 100,
+          scenario.radio.downlink_loss * 100, scenario.radio.snr_db,
+          (unsigned long) scenario.network.latency_ms,
+          scenario.network.subband + 1 );
+  printf( "  join: %lu join requests, joined after %.1f s\n",
+          (unsigned long) mac.join_requests, r.join_s );
+  printf( "  readings: %lu/%lu acknowledged; per reading, %.2f uplinks "
+          "and %.0f ms airtime (with telemetry)\n",
+          (unsigned long) r.delivered, (unsigned long) r.readings,
+          r.delivered ? (double) mac.uplinks / r.delivered : 0.0,
+          r.delivered ? mac.airtime_us / 1000.0 / r.delivered : 0.0 );
+  printf( "  latency: %.1f s mean, %.1f s p50, %.1f s p95, %.1f s max\n",
+          mean_s, percentile( r.latencies_s, 0.5 ),
+          percentile( r.latencies_s, 0.95 ),
+          percentile( r.latencies_s, 1.0 ) );
+  printf( "  radio: %lu uplinks (%lu empty), %lu unheard, %.1f s airtime, "
+          "%lu downlinks, %lu lost\n",
+          (unsigned long) mac.uplinks, (unsigned long) mac.flushes,
+          (unsigned long) mac.unheard, mac.airtime_us / 1e6,
+          (unsigned long) mac.downlinks,
+          (unsigned long) mac.lost_downlinks );
+  printf( "  server: %lu uplinks, %lu duplicates, %lu bad MICs, %lu link "
+          "checks; replies %lu RX1, %lu RX2, %lu too late\n",
+          (unsigned long) ns.uplinks, (unsigned long) ns.duplicates,
+          (unsigned long) ns.bad_mics, (unsigned long) ns.link_checks,
+          (unsigned long) ns.replies[1], (unsigned long) ns.replies[2],
+          (unsigned long) ns.replies[0] );
+  printf( "  check: %lu telemetry frames decoded (%lu bad), %lu payloads "
+          "not as sent, %lu acknowledged but missing: %s\n\n",
+          (unsigned long) r.telemetry, (unsigned long) r.bad_telemetry,
+          (unsigned long) r.mismatched, (unsigned long) r.missing,
+          ( r.bad_telemetry || r.mismatched || r.missing ) ? "FAILED"
+                                                           : "ok" );
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+  uint32_t days = DEFAULT_DAYS;
+  uint32_t seed = DEFAULT_SEED;
+  int      arg  = 0;
+  for ( int i = 1; i < argc; i++ ) {
+    if ( strcmp( argv[i], "-v" ) == 0 ) {
+      verbose = true;
+    }
+    else if ( arg++ == 0 ) {
+      days = atoi( argv[i] );
+    }
+    else {
+      seed = atoi( argv[i] );
+    }
+  }
+
+  printf( "%lu days, a %d-byte confirmed reading every %llu h, seed "
+          "%lu\n\n",
+          (unsigned long) days, READING_LEN,
+          READING_PERIOD_MS / ( 60 * 60 * 1000 ), (unsigned long) seed );
+
+  bool     failed   = false;
+  uint64_t sim_ms   = 0;
+  uint32_t uplinks  = 0;
+  auto     start    = std::chrono::steady_clock::now();
+  for ( const scenario_t& scenario : scenarios ) {
+    NetworkServer server( scenario.network, otaa_settings.device_eui,
+                          otaa_settings.app_eui, otaa_settings.app_key );
+    uint64_t start_us = sim_now_us();
+    result_t result   = simulate( scenario, days, seed, server );
+    print_result( scenario, result, server );
+    failed |= result.bad_telemetry || result.mismatched || result.missing;
+    sim_ms += ( sim_now_us() - start_us ) / 1000;
+    uplinks += sim_mac_stats().uplinks + sim_mac_stats().join_requests;
+  }
+  double wall_s = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start )
+                      .count();
+  printf( "Simulated %.1f days and %lu uplinks in %.2f s (%.0fx real "
+          "time)\n",
+          sim_ms / 86400000.0, (unsigned long) uplinks, wall_s,
+          sim_ms / 1000.0 / wall_s );
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+// =======================================================================
+// provision_keys.cpp
+// =======================================================================
+// Provisions devices' readings keys. With -n, prints a new random root
+// key for the fleet. Otherwise derives each given device's key from the
+// root key (see encryption/device_key.h), printing "<DevEUI> <key>"
+// lines: one goes in a device's READINGS_KEY_FILE for its build, and all
+// of them make a key file for archive_decrypt -K. The root key itself
+// never goes on a device or in the repo
+//
+//   ./provision_keys -n
+//   ./provision_keys $ROOT_KEY 70b3d57ed006fe82 > ../../readings_key.txt
+
+#include "encryption/device_key.h"
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Returns whether hex is exactly len bytes
+static bool parse_hex( const char* hex, uint8_t* bytes, int len )
+{
+  if ( (int) strlen( hex ) != 2 * len ) {
+    return false;
+  }
+  for ( int i = 0; i < len; i++ ) {
+    unsigned int byte;
+    if ( !isxdigit( (unsigned char) hex[2 * i] ) ||
+         !isxdigit( (unsigned char) hex[2 * i + 1] ) ||
+         ( sscanf( hex + 2 * i, "%2x", &byte ) != 1 ) ) {
+      return false;
+    }
+    bytes[i] = byte;
+  }
+  return true;
+}
+
+static void print_hex( const uint8_t* bytes, int len )
+{
+  for ( int i = 0; i < len; i++ ) {
+    printf( "%02x", bytes[i] );
+  }
+}
+
+// A new root key, from the operating system's random source
+static int new_root_key()
+{
+  uint8_t root_key[16];
+  FILE*   random = fopen( "/dev/urandom", "rb" );
+  if ( ( random == nullptr ) ||
+       ( fread( root_key, 1, sizeof( root_key ), random ) !=
+         sizeof( root_key ) ) ) {
+    perror( "/dev/urandom" );
+    return 1;
+  }
+  fclose( random );
+  print_hex( root_key, sizeof( root_key ) );
+  printf( "\n" );
+  return 0;
+}
+
+int main( int argc, char** argv )
+{
+  if ( ( argc == 2 ) && ( strcmp( argv[1], "-n" ) == 0 ) ) {
+    return new_root_key();
+  }
+
+  uint8_t root_key[16];
+  if ( ( argc < 3 ) || !parse_hex( argv[1], root_key, 16 ) ) {
+    fprintf( stderr, "usage: provision_keys -n\n"
+                     "       provision_keys <root key hex> <DevEUI hex>"
+                     "...\n" );
+    return 1;
+  }
+
+  for ( int i = 2; i < argc; i++ ) {
+    uint8_t dev_eui_bytes[8];
+    if ( !parse_hex( argv[i], dev_eui_bytes, 8 ) ) {
+      fprintf( stderr, "%s: a DevEUI is 8 bytes in hex\n", argv[i] );
+      return 1;
+    }
+    uint64_t dev_eui = strtoull( argv[i], nullptr, 16 );
+    uint8_t  key[16];
+    derive_device_key( root_key, dev_eui, key );
+    printf( "%016" PRIx64 " ", dev_eui );
+    print_hex( key, sizeof( key ) );
+    printf( "\n" );
+  }
+  return 0;
+}
@@ -0,0 +1,245 @@
+// =======================================================================
+// rx_queue_stress.cpp
+// =======================================================================
+// Stress test of the downlink receive queue (lorawan/rx_queue.h), with
+// the producer and consumer on two threads as the MAC and main loop are
+// on the Pico. The producer pushes numbered frames and the consumer pops
+// them, each pausing a random while between frames: in some rounds the
+// consumer keeps up, and in others it falls behind, so the ring fills
+// and drops. Each frame's bytes follow from its number, so a torn read
+// shows. Checks that:
+//
+//  - every frame the producer got in arrives once, in order and intact,
+//    and no other frame does
+//  - the drop count is the pushes that returned false, and the truncated
+//    count the accepted frames longer than RX_QUEUE_MAX_LEN
+//  - the high-water mark never passes RX_QUEUE_SLOTS, and reaches it
+//    whenever a frame was dropped
+//
+// Exits non-zero if any check fails. Build with -fsanitize=thread to
+// have the accesses checked as well
+//
+//   ./rx_queue_stress [frames per round]
+
+#include "lorawan/rx_queue.h"
+#include <atomic>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_FRAMES 200000
+
+// Longest a frame from the producer gets (longer than the queue holds)
+#define MAX_PUSH_LEN 255
+
+// -----------------------------------------------------------------------
+// Frames
+// -----------------------------------------------------------------------
+
+static uint8_t frame_len( uint32_t seq )
+{
+  return 4 + seq % ( MAX_PUSH_LEN - 3 );
+}
+
+static uint8_t frame_byte( uint32_t seq, int i )
+{
+  return ( i < 4 ) ? seq >> ( 8 * i ) : seq * 31 + i;
+}
+
+// Spin for up to max_delay iterations, and now and then give up the
+// core, so the threads interleave on one core too
+static void pause( std::minstd_rand& rng, uint32_t max_delay )
+{
+  if ( max_delay == 0 ) {
+    return;
+  }
+  for ( volatile uint32_t spin = rng() % max_delay; spin > 0; spin-- ) {
+  }
+  if ( rng() % 8 == 0 ) {
+    std::this_thread::yield();
+  }
+}
+
+// -----------------------------------------------------------------------
+// Round
+// -----------------------------------------------------------------------
+// Each side pauses for up to its delay (in spins) between frames
+
+typedef struct {
+  uint32_t producer_delay;
+  uint32_t consumer_delay;
+} round_config_t;
+
+static const round_config_t rounds[] = {
+  { 0, 0 }, { 0, 256 }, { 256, 0 }, { 256, 256 }, { 64, 1024 }, { 1024, 64 },
+};
+
+typedef struct {
+  uint32_t pushed;
+  uint32_t dropped;
+  uint32_t received;
+  uint32_t high_water;
+  int      errors;
+} round_result_t;
+
+static round_result_t run_round( uint32_t frames, round_config_t config,
+                                 uint32_t seed )
+{
+  static rx_queue_t queue;
+  rx_queue_init( &queue );
+
+  std::vector<bool> accepted( frames, false );
+  std::vector<bool> received( frames, false );
+  std::atomic<bool> producer_done( false );
+  std::atomic<int>  ready( 0 );
+  uint32_t          expected_truncated = 0;
+  round_result_t    r                  = {};
+
+  // Both threads start together
+  auto start = [&ready]() {
+    ready++;
+    while ( ready.load() < 2 ) {
+    }
+  };
+
+  std::thread producer( [&]() {
+    std::minstd_rand rng( seed );
+    uint8_t          data[MAX_PUSH_LEN];
+    start();
+    for ( uint32_t seq = 0; seq < frames; seq++ ) {
+      uint8_t len = frame_len( seq );
+      for ( int i = 0; i < len; i++ ) {
+        data[i] = frame_byte( seq, i );
+      }
+      if ( rx_queue_push( &queue, seq & 0xff, data, len ) ) {
+        accepted[seq] = true;
+        expected_truncated += ( len > RX_QUEUE_MAX_LEN );
+      }
+      else {
+        r.dropped++;
+      }
+      r.pushed++;
+      pause( rng, config.producer_delay );
+    }
+    producer_done.store( true, std::memory_order_release );
+  } );
+
+  std::thread consumer( [&]() {
+    std::minstd_rand rng( seed + 1 );
+    int64_t          last_seq = -1;
+    start();
+    while ( true ) {
+      // Read done before peeking, so a frame pushed last isn't missed
+      bool done = producer_done.load( std::memory_order_acquire );
+      const rx_frame_t* frame = rx_queue_peek( &queue );
+      if ( frame == nullptr ) {
+        if ( done ) {
+          break;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+
+      uint32_t seq = frame->data[0] | ( frame->data[1] << 8 ) |
+                     ( frame->data[2] << 16 ) |
+                     ( (uint32_t) frame->data[3] << 24 );
+      uint8_t  len = frame_len( seq );
+      uint8_t  want_len =
+          ( len > RX_QUEUE_MAX_LEN ) ? RX_QUEUE_MAX_LEN : len;
+      bool intact = ( seq < frames ) && ( (int64_t) seq > last_seq ) &&
+                    ( frame->port == ( seq & 0xff ) ) &&
+                    ( frame->len == want_len );
+      for ( int i = 4; intact && ( i < frame->len ); i++ ) {
+        intact = ( frame->data[i] == frame_byte( seq, i ) );
+      }
+      if ( !intact ) {
+        if ( r.errors++ < 5 ) {
+          printf( "  frame %u after %lld is out of order or torn\n", seq,
+                  (long long) last_seq );
+        }
+      }
+      else {
+        received[seq] = true;
+        r.received++;
+        last_seq = seq;
+      }
+      rx_queue_pop( &queue );
+      pause( rng, config.consumer_delay );
+    }
+  } );
+
+  producer.join();
+  consumer.join();
+
+  // Frames received are exactly the ones accepted (received ones are in
+  // order, checked as they came)
+  for ( uint32_t seq = 0; seq < frames; seq++ ) {
+    if ( accepted[seq] != received[seq] ) {
+      if ( r.errors++ < 5 ) {
+        printf( "  frame %u was %s but %s\n", seq,
+                accepted[seq] ? "accepted" : "dropped",
+                received[seq] ? "received" : "never received" );
+      }
+    }
+  }
+
+  r.high_water = queue.high_water;
+  if ( queue.drops != r.dropped ) {
+    printf( "  queue counted %u drops, producer saw %u\n", queue.drops,
+            r.dropped );
+    r.errors++;
+  }
+  if ( queue.truncated != expected_truncated ) {
+    printf( "  queue counted %u truncated, expected %u\n", queue.truncated,
+            expected_truncated );
+    r.errors++;
+  }
+  if ( ( r.high_water > RX_QUEUE_SLOTS ) ||
+       ( ( r.received > 0 ) && ( r.high_water == 0 ) ) ||
+       ( ( r.dropped > 0 ) && ( r.high_water != RX_QUEUE_SLOTS ) ) ) {
+    printf( "  high-water mark %u with %u drops and %d slots\n",
+            r.high_water, r.dropped, RX_QUEUE_SLOTS );
+    r.errors++;
+  }
+  if ( r.received + r.dropped != r.pushed ) {
+    printf( "  %u received and %u dropped of %u pushed\n", r.received,
+            r.dropped, r.pushed );
+    r.errors++;
+  }
+  if ( rx_queue_depth( &queue ) != 0 ) {
+    printf( "  %u frames left in the queue\n", rx_queue_depth( &queue ) );
+    r.errors++;
+  }
+  return r;
+}
+
+// -----------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------
+
+int main( int argc, char** argv )
+{
+  uint32_t frames = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_FRAMES;
+
+  printf( "%d slots, %u frames per round\n\n", RX_QUEUE_SLOTS, frames );
+  printf( "    delay (spins)    |         |          |       |\n" );
+  printf( " producer | consumer | dropped | received | high  | result\n" );
+  printf( "----------+----------+---------+----------+-------+-------\n" );
+
+  int errors = 0;
+  int seed   = 1;
+  for ( const round_config_t& config : rounds ) {
+    round_result_t r = run_round( frames, config, seed );
+    seed += 2;
+    printf( " %8u | %8u | %6.2f%% | %8u | %5u | %s\n",
+            config.producer_delay, config.consumer_delay,
+            100.0 * r.dropped / r.pushed, r.received, r.high_water,
+            r.errors ? "FAILED" : "ok" );
+    errors += r.errors;
+  }
+
+  printf( "\n%s\n", errors ? "FAILED" : "All rounds passed" );
+  return errors ? 1 : 0;
+}
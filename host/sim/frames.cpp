@@ -0,0 +1,326 @@
+// =======================================================================
+// frames.cpp
+// =======================================================================
+// Definitions of LoRaWAN 1.0.x frames and their security
+
+#include "frames.h"
+#include "encryption/cmac.h"
+#include "encryption/rijndael.h"
+#include <string.h>
+
+// -----------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------
+
+static void write_le( uint8_t* buffer, uint32_t value, int len )
+{
+  for ( int i = 0; i < len; i++ ) {
+    buffer[i] = ( value >> ( 8 * i ) ) & 0xFF;
+  }
+}
+
+static uint32_t read_le( const uint8_t* buffer, int len )
+{
+  uint32_t value = 0;
+  for ( int i = 0; i < len; i++ ) {
+    value |= (uint32_t) buffer[i] << ( 8 * i );
+  }
+  return value;
+}
+
+// EUIs go over the air least significant byte first
+static void write_eui( uint8_t* buffer, const uint8_t eui[8] )
+{
+  for ( int i = 0; i < 8; i++ ) {
+    buffer[i] = eui[7 - i];
+  }
+}
+
+static void aes_encrypt( const uint8_t key[16], const uint8_t in[16],
+                         uint8_t out[16] )
+{
+  uint32_t round_keys[RKLENGTH( KEYBITS )];
+  rijndaelSetupEncrypt( round_keys, key, KEYBITS );
+  rijndaelEncrypt( round_keys, NROUNDS( KEYBITS ), in, out );
+}
+
+static void aes_decrypt( const uint8_t key[16], const uint8_t in[16],
+                         uint8_t out[16] )
+{
+  uint32_t round_keys[RKLENGTH( KEYBITS )];
+  rijndaelSetupDecrypt( round_keys, key, KEYBITS );
+  rijndaelDecrypt( round_keys, NROUNDS( KEYBITS ), in, out );
+}
+
+// The first FRAME_MIC_LEN bytes of the CMAC of a message under key,
+// optionally prefixed with a B0 block
+static void mic( const uint8_t key[16], const uint8_t* b0,
+                 const uint8_t* msg, int len, uint8_t* out )
+{
+  uint8_t buffer[16 + FRAME_MAX_LEN];
+  int     pos = 0;
+  if ( b0 ) {
+    memcpy( buffer, b0, 16 );
+    pos = 16;
+  }
+  memcpy( buffer + pos, msg, len );
+
+  uint8_t full[CMAC_LEN];
+  aes_cmac( key, buffer, pos + len, full );
+  memcpy( out, full, FRAME_MIC_LEN );
+}
+
+// The block that starts B0 (for MICs) and each A_i (for the payload)
+static void data_block( uint8_t first, frame_dir_t dir, uint32_t dev_addr,
+                        uint32_t fcnt, uint8_t last, uint8_t block[16] )
+{
+  memset( block, 0, 16 );
+  block[0] = first;
+  block[5] = dir;
+  write_le( block + 6, dev_addr, 4 );
+  write_le( block + 10, fcnt, 4 );
+  block[15] = last;
+}
+
+// AES-CTR over an FRMPayload, in place (it's its own inverse)
+static void crypt_payload( const uint8_t key[16], frame_dir_t dir,
+                           uint32_t dev_addr, uint32_t fcnt, uint8_t* data,
+                           int len )
+{
+  for ( int block = 0; 16 * block < len; block++ ) {
+    uint8_t a[16];
+    uint8_t s[16];
+    data_block( 0x01, dir, dev_addr, fcnt, block + 1, a );
+    aes_encrypt( key, a, s );
+    for ( int i = 0; ( i < 16 ) && ( 16 * block + i < len ); i++ ) {
+      data[16 * block + i] ^= s[i];
+    }
+  }
+}
+
+// -----------------------------------------------------------------------
+// Keys
+// -----------------------------------------------------------------------
+
+bool frame_parse_hex( const char* hex, uint8_t* bytes, int len )
+{
+  if ( ( hex == nullptr ) || ( (int) strlen( hex ) != 2 * len ) ) {
+    return false;
+  }
+  for ( int i = 0; i < 2 * len; i++ ) {
+    char    c = hex[i];
+    uint8_t nibble;
+    if ( ( c >= '0' ) && ( c <= '9' ) ) {
+      nibble = c - '0';
+    }
+    else if ( ( c >= 'a' ) && ( c <= 'f' ) ) {
+      nibble = c - 'a' + 10;
+    }
+    else if ( ( c >= 'A' ) && ( c <= 'F' ) ) {
+      nibble = c - 'A' + 10;
+    }
+    else {
+      return false;
+    }
+    bytes[i / 2] = ( i % 2 ) ? ( bytes[i / 2] | nibble ) : ( nibble << 4 );
+  }
+  return true;
+}
+
+void frame_session_keys( const uint8_t app_key[16], uint32_t app_nonce,
+                         uint32_t net_id, uint16_t dev_nonce,
+                         uint8_t nwk_skey[16], uint8_t app_skey[16] )
+{
+  uint8_t block[16] = { 0 };
+  write_le( block + 1, app_nonce, 3 );
+  write_le( block + 4, net_id, 3 );
+  write_le( block + 7, dev_nonce, 2 );
+
+  block[0] = 0x01;
+  aes_encrypt( app_key, block, nwk_skey );
+  block[0] = 0x02;
+  aes_encrypt( app_key, block, app_skey );
+}
+
+// -----------------------------------------------------------------------
+// Join
+// -----------------------------------------------------------------------
+
+int frame_join_request( const uint8_t app_key[16],
+                        const frame_join_request_t* request,
+                        uint8_t* frame )
+{
+  frame[0] = FRAME_JOIN_REQUEST;
+  write_eui( frame + 1, request->app_eui );
+  write_eui( frame + 9, request->dev_eui );
+  write_le( frame + 17, request->dev_nonce, 2 );
+  mic( app_key, nullptr, frame, 19, frame + 19 );
+  return FRAME_JOIN_REQUEST_LEN;
+}
+
+bool frame_open_join_request( const uint8_t app_key[16],
+                              const uint8_t* frame, int len,
+                              frame_join_request_t* request )
+{
+  if ( ( len != FRAME_JOIN_REQUEST_LEN ) ||
+       ( frame[0] != FRAME_JOIN_REQUEST ) ) {
+    return false;
+  }
+  uint8_t expected[FRAME_MIC_LEN];
+  mic( app_key, nullptr, frame, 19, expected );
+  if ( memcmp( expected, frame + 19, FRAME_MIC_LEN ) != 0 ) {
+    return false;
+  }
+  write_eui( request->app_eui, frame + 1 );
+  write_eui( request->dev_eui, frame + 9 );
+  request->dev_nonce = read_le( frame + 17, 2 );
+  return true;
+}
+
+// The network encrypts with AES decryption, so the device only needs
+// AES encryption to read it
+int frame_join_accept( const uint8_t app_key[16],
+                       const frame_join_accept_t* accept, uint8_t* frame )
+{
+  uint8_t plain[FRAME_JOIN_ACCEPT_LEN] = { 0 };
+  plain[0] = FRAME_JOIN_ACCEPT;
+  write_le( plain + 1, accept->app_nonce, 3 );
+  write_le( plain + 4, accept->net_id, 3 );
+  write_le( plain + 7, accept->dev_addr, 4 );
+  plain[11] = 0;  // DLSettings: RX1 DR offset 0, RX2 DR8
+  plain[12] = accept->rx_delay_s;
+  for ( int i = 0; i < FRAME_CFLIST_MASK_WORDS; i++ ) {
+    write_le( plain + 13 + 2 * i, accept->channel_mask[i], 2 );
+  }
+  plain[28] = 1;  // CFList type: channel mask
+  mic( app_key, nullptr, plain, 29, plain + 29 );
+
+  frame[0] = plain[0];
+  for ( int block = 0; block < 2; block++ ) {
+    aes_decrypt( app_key, plain + 1 + 16 * block, frame + 1 + 16 * block );
+  }
+  return FRAME_JOIN_ACCEPT_LEN;
+}
+
+bool frame_open_join_accept( const uint8_t app_key[16],
+                             const uint8_t* frame, int len,
+                             frame_join_accept_t* accept )
+{
+  if ( ( len != FRAME_JOIN_ACCEPT_LEN ) ||
+       ( frame[0] != FRAME_JOIN_ACCEPT ) ) {
+    return false;
+  }
+  uint8_t plain[FRAME_JOIN_ACCEPT_LEN];
+  plain[0] = frame[0];
+  for ( int block = 0; block < 2; block++ ) {
+    aes_encrypt( app_key, frame + 1 + 16 * block, plain + 1 + 16 * block );
+  }
+  uint8_t expected[FRAME_MIC_LEN];
+  mic( app_key, nullptr, plain, 29, expected );
+  if ( ( memcmp( expected, plain + 29, FRAME_MIC_LEN ) != 0 ) ||
+       ( plain[28] != 1 ) ) {
+    return false;
+  }
+  accept->app_nonce  = read_le( plain + 1, 3 );
+  accept->net_id     = read_le( plain + 4, 3 );
+  accept->dev_addr   = read_le( plain + 7, 4 );
+  accept->rx_delay_s = plain[12];
+  for ( int i = 0; i < FRAME_CFLIST_MASK_WORDS; i++ ) {
+    accept->channel_mask[i] = read_le( plain + 13 + 2 * i, 2 );
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// Data
+// -----------------------------------------------------------------------
+
+static frame_dir_t data_dir( uint8_t mhdr )
+{
+  return ( ( mhdr == FRAME_UNCONFIRMED_DOWN ) ||
+           ( mhdr == FRAME_CONFIRMED_DOWN ) )
+             ? FRAME_DOWN
+             : FRAME_UP;
+}
+
+int frame_data( const uint8_t nwk_skey[16], const uint8_t app_skey[16],
+                const frame_data_t* data, uint8_t* frame )
+{
+  frame_dir_t dir = data_dir( data->mhdr );
+  int         len = 0;
+  frame[len++]    = data->mhdr;
+  write_le( frame + len, data->dev_addr, 4 );
+  len += 4;
+  frame[len++] = ( data->fctrl & 0xF0 ) | data->fopts_len;
+  write_le( frame + len, data->fcnt, 2 );
+  len += 2;
+  memcpy( frame + len, data->fopts, data->fopts_len );
+  len += data->fopts_len;
+
+  if ( data->port >= 0 ) {
+    frame[len++] = data->port;
+    memcpy( frame + len, data->payload, data->payload_len );
+    crypt_payload( ( data->port == 0 ) ? nwk_skey : app_skey, dir,
+                   data->dev_addr, data->fcnt, frame + len,
+                   data->payload_len );
+    len += data->payload_len;
+  }
+
+  uint8_t b0[16];
+  data_block( 0x49, dir, data->dev_addr, data->fcnt, len, b0 );
+  mic( nwk_skey, b0, frame, len, frame + len );
+  return len + FRAME_MIC_LEN;
+}
+
+bool frame_peek_data( const uint8_t* frame, int len, uint32_t* dev_addr,
+                      uint16_t* fcnt )
+{
+  if ( len < 8 + FRAME_MIC_LEN ) {
+    return false;
+  }
+  *dev_addr = read_le( frame + 1, 4 );
+  *fcnt     = read_le( frame + 6, 2 );
+  return true;
+}
+
+bool frame_open_data( const uint8_t nwk_skey[16], const uint8_t app_skey[16],
+                      const uint8_t* frame, int len, uint32_t fcnt,
+                      frame_data_t* data )
+{
+  if ( len < 8 + FRAME_MIC_LEN ) {
+    return false;
+  }
+  int         body_len = len - FRAME_MIC_LEN;
+  frame_dir_t dir      = data_dir( frame[0] );
+  uint32_t    dev_addr = read_le( frame + 1, 4 );
+
+  uint8_t b0[16];
+  uint8_t expected[FRAME_MIC_LEN];
+  data_block( 0x49, dir, dev_addr, fcnt, body_len, b0 );
+  mic( nwk_skey, b0, frame, body_len, expected );
+  if ( memcmp( expected, frame + body_len, FRAME_MIC_LEN ) != 0 ) {
+    return false;
+  }
+
+  data->mhdr      = frame[0];
+  data->dev_addr  = dev_addr;
+  data->fctrl     = frame[5] & 0xF0;
+  data->fopts_len = frame[5] & 0x0F;
+  data->fcnt      = fcnt;
+  int pos         = 8 + data->fopts_len;
+  if ( pos > body_len ) {
+    return false;
+  }
+  memcpy( data->fopts, frame + 8, data->fopts_len );
+
+  data->port        = -1;
+  data->payload_len = 0;
+  if ( pos < body_len ) {
+    data->port        = frame[pos++];
+    data->payload_len = body_len - pos;
+    memcpy( data->payload, frame + pos, data->payload_len );
+    crypt_payload( ( data->port == 0 ) ? nwk_skey : app_skey, dir,
+                   dev_addr, fcnt, data->payload, data->payload_len );
+  }
+  return true;
+}
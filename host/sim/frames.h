@@ -0,0 +1,127 @@
+// =======================================================================
+// frames.h
+// =======================================================================
+// Declarations of LoRaWAN 1.0.x frames and their security, shared by the
+// simulated MAC (sim_mac.cpp) and network server (network_server.cpp)
+//
+// Frames are built and checked as on air: MICs are AES-CMAC under the
+// AppKey (join) or NwkSKey (data), the join accept is encrypted with AES
+// decryption under the AppKey, and FRMPayloads with AES-CTR under the
+// AppSKey (or the NwkSKey on port 0)
+
+#ifndef SIM_FRAMES_H
+#define SIM_FRAMES_H
+
+#include <cstdint>
+
+#define FRAME_MIC_LEN 4
+#define FRAME_MAX_LEN 256
+#define FRAME_MAX_FOPTS 15
+#define FRAME_MAX_PAYLOAD 242
+
+// MHDR: the message type, with LoRaWAN R1
+#define FRAME_JOIN_REQUEST 0x00
+#define FRAME_JOIN_ACCEPT 0x20
+#define FRAME_UNCONFIRMED_UP 0x40
+#define FRAME_UNCONFIRMED_DOWN 0x60
+#define FRAME_CONFIRMED_UP 0x80
+#define FRAME_CONFIRMED_DOWN 0xA0
+
+// FCtrl bits
+#define FRAME_FCTRL_ADR 0x80
+#define FRAME_FCTRL_ACK 0x20
+
+// MAC commands
+#define FRAME_CID_LINK_CHECK 0x02
+
+#define FRAME_JOIN_REQUEST_LEN 23
+#define FRAME_JOIN_ACCEPT_LEN 33  // With a CFList
+#define FRAME_CFLIST_MASK_WORDS 5  // US915 CFList: a 72-channel mask
+
+enum frame_dir_t { FRAME_UP = 0, FRAME_DOWN = 1 };
+
+// -----------------------------------------------------------------------
+// Keys
+// -----------------------------------------------------------------------
+
+// Parse a hex string (as in lorawan_config.h) of len bytes, most
+// significant first. Returns whether it was valid
+bool frame_parse_hex( const char* hex, uint8_t* bytes, int len );
+
+// The session keys from a join accept
+void frame_session_keys( const uint8_t app_key[16], uint32_t app_nonce,
+                         uint32_t net_id, uint16_t dev_nonce,
+                         uint8_t nwk_skey[16], uint8_t app_skey[16] );
+
+// -----------------------------------------------------------------------
+// Join
+// -----------------------------------------------------------------------
+// EUIs are as written (most significant byte first); frames carry them
+// the other way around
+
+typedef struct {
+  uint8_t  app_eui[8];
+  uint8_t  dev_eui[8];
+  uint16_t dev_nonce;
+} frame_join_request_t;
+
+typedef struct {
+  uint32_t app_nonce;
+  uint32_t net_id;
+  uint32_t dev_addr;
+  uint8_t  rx_delay_s;
+  uint16_t channel_mask[FRAME_CFLIST_MASK_WORDS];
+} frame_join_accept_t;
+
+// Write a join request, MIC'd under app_key. Returns its length
+int frame_join_request( const uint8_t app_key[16],
+                        const frame_join_request_t* request,
+                        uint8_t* frame );
+
+// Check and read a join request. Returns whether its MIC is good
+bool frame_open_join_request( const uint8_t app_key[16],
+                              const uint8_t* frame, int len,
+                              frame_join_request_t* request );
+
+// Write an encrypted join accept. Returns its length
+int frame_join_accept( const uint8_t app_key[16],
+                       const frame_join_accept_t* accept,
+                       uint8_t* frame );
+
+// Decrypt, check and read a join accept. Returns whether its MIC is good
+bool frame_open_join_accept( const uint8_t app_key[16],
+                             const uint8_t* frame, int len,
+                             frame_join_accept_t* accept );
+
+// -----------------------------------------------------------------------
+// Data
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint8_t  mhdr;
+  uint32_t dev_addr;
+  uint8_t  fctrl;     // FOpts length is filled in
+  uint32_t fcnt;      // Only the low 16 bits are sent
+  uint8_t  fopts[FRAME_MAX_FOPTS];
+  uint8_t  fopts_len;
+  int      port;      // -1 for none
+  uint8_t  payload[FRAME_MAX_PAYLOAD];
+  uint8_t  payload_len;
+} frame_data_t;
+
+// Write a data frame, encrypted and MIC'd. Returns its length
+int frame_data( const uint8_t nwk_skey[16], const uint8_t app_skey[16],
+                const frame_data_t* data, uint8_t* frame );
+
+// The DevAddr and 16-bit FCnt of a data frame, to find its keys and full
+// frame counter. Returns whether it's long enough to be one
+bool frame_peek_data( const uint8_t* frame, int len, uint32_t* dev_addr,
+                      uint16_t* fcnt );
+
+// Check and decrypt a data frame, with its full frame counter. Returns
+// whether its MIC is good
+bool frame_open_data( const uint8_t nwk_skey[16], const uint8_t app_skey[16],
+                      const uint8_t* frame, int len, uint32_t fcnt,
+                      frame_data_t* data );
+
+#endif  // SIM_FRAMES_H
@@ -0,0 +1,101 @@
+// =======================================================================
+// LmHandler.h
+// =======================================================================
+// The simulation's stand-in for the parts of LoRaMac-node's LmHandler and
+// LoRaMac APIs that lorawan/lorawan.cpp uses, with the same names and
+// types. host/sim/sim_mac.cpp implements them
+
+#ifndef SIM_LMHANDLER_H
+#define SIM_LMHANDLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  LORAMAC_REGION_AS923,
+  LORAMAC_REGION_AU915,
+  LORAMAC_REGION_CN470,
+  LORAMAC_REGION_CN779,
+  LORAMAC_REGION_EU433,
+  LORAMAC_REGION_EU868,
+  LORAMAC_REGION_KR920,
+  LORAMAC_REGION_IN865,
+  LORAMAC_REGION_US915,
+  LORAMAC_REGION_RU864,
+} LoRaMacRegion_t;
+
+typedef enum {
+  LORAMAC_STATUS_OK,
+  LORAMAC_STATUS_BUSY,
+  LORAMAC_STATUS_SERVICE_UNKNOWN,
+  LORAMAC_STATUS_PARAMETER_INVALID,
+  LORAMAC_STATUS_LENGTH_ERROR,
+  LORAMAC_STATUS_NO_NETWORK_JOINED,
+} LoRaMacStatus_t;
+
+typedef enum {
+  LORAMAC_HANDLER_ERROR   = -1,
+  LORAMAC_HANDLER_SUCCESS = 0,
+} LmHandlerErrorStatus_t;
+
+typedef enum {
+  LORAMAC_HANDLER_UNCONFIRMED_MSG = 0,
+  LORAMAC_HANDLER_CONFIRMED_MSG   = !LORAMAC_HANDLER_UNCONFIRMED_MSG,
+} LmHandlerMsgTypes_t;
+
+typedef struct {
+  uint8_t  Port;
+  uint8_t  BufferSize;
+  uint8_t* Buffer;
+} LmHandlerAppData_t;
+
+LmHandlerErrorStatus_t LmHandlerSend( LmHandlerAppData_t* appData,
+                                      LmHandlerMsgTypes_t isTxConfirmed );
+
+LmHandlerErrorStatus_t LmHandlerLinkCheckReq( void );
+
+// -----------------------------------------------------------------------
+// MIB
+// -----------------------------------------------------------------------
+
+typedef enum {
+  MIB_ADR,
+  MIB_CHANNELS_MASK,
+  MIB_CHANNELS_DEFAULT_MASK,
+  MIB_CHANNELS_DATARATE,
+  MIB_DEV_ADDR,
+} Mib_t;
+
+typedef union {
+  bool      AdrEnable;
+  uint16_t* ChannelsMask;
+  uint16_t* ChannelsDefaultMask;
+  int8_t    ChannelsDatarate;
+  uint32_t  DevAddr;
+} MibParam_t;
+
+typedef struct {
+  Mib_t      Type;
+  MibParam_t Param;
+} MibRequestConfirm_t;
+
+LoRaMacStatus_t LoRaMacMibGetRequestConfirm( MibRequestConfirm_t* mibGet );
+LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t* mibSet );
+
+typedef struct {
+  uint8_t MaxPossibleApplicationDataSize;
+  uint8_t CurrentPossiblePayloadSize;
+} LoRaMacTxInfo_t;
+
+LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t          size,
+                                        LoRaMacTxInfo_t* txInfo );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SIM_LMHANDLER_H
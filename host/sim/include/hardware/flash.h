@@ -0,0 +1,17 @@
+// =======================================================================
+// hardware/flash.h
+// =======================================================================
+// The simulation's stand-in for the Pico SDK's flash geometry (flash is
+// simulated in RAM, see host/sim/sim_flash.cpp)
+
+#ifndef SIM_HARDWARE_FLASH_H
+#define SIM_HARDWARE_FLASH_H
+
+#define FLASH_PAGE_SIZE ( 1u << 8 )
+#define FLASH_SECTOR_SIZE ( 1u << 12 )
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES ( 2 * 1024 * 1024 )
+#endif
+
+#endif  // SIM_HARDWARE_FLASH_H
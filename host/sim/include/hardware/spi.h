@@ -0,0 +1,17 @@
+// =======================================================================
+// hardware/spi.h
+// =======================================================================
+// The simulation's stand-in for the Pico SDK's SPI (the radio is
+// simulated above it, so there's nothing to drive)
+
+#ifndef SIM_HARDWARE_SPI_H
+#define SIM_HARDWARE_SPI_H
+
+typedef struct spi_inst spi_inst_t;
+
+#define PICO_DEFAULT_SPI_INSTANCE() ( (spi_inst_t*) 0 )
+#define PICO_DEFAULT_SPI_TX_PIN 19
+#define PICO_DEFAULT_SPI_RX_PIN 16
+#define PICO_DEFAULT_SPI_SCK_PIN 18
+
+#endif  // SIM_HARDWARE_SPI_H
@@ -0,0 +1,58 @@
+// =======================================================================
+// pico/lorawan.h
+// =======================================================================
+// The simulation's stand-in for the pico-lorawan API, which
+// lorawan/lorawan-library-for-pico.c implements on the Pico W and
+// host/sim/sim_mac.cpp implements here
+
+#ifndef SIM_PICO_LORAWAN_H
+#define SIM_PICO_LORAWAN_H
+
+#include "LmHandler.h"
+#include "hardware/spi.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lorawan_sx1276_settings {
+  struct {
+    spi_inst_t* inst;
+    unsigned    mosi;
+    unsigned    miso;
+    unsigned    sck;
+    unsigned    nss;
+  } spi;
+  unsigned reset;
+  unsigned dio0;
+  unsigned dio1;
+};
+
+struct lorawan_otaa_settings {
+  const char* device_eui;
+  const char* app_eui;
+  const char* app_key;
+  const char* channel_mask;
+};
+
+int lorawan_init_otaa( const struct lorawan_sx1276_settings* sx1276_settings,
+                       LoRaMacRegion_t                       region,
+                       const struct lorawan_otaa_settings*   otaa_settings );
+int lorawan_join( void );
+int lorawan_is_joined( void );
+int lorawan_process( void );
+int lorawan_send_unconfirmed( const void* data, uint8_t data_len,
+                              uint8_t app_port );
+int lorawan_receive( void* data, uint8_t data_len, uint8_t* app_port );
+void lorawan_debug( bool debug );
+int  lorawan_erase_nvm( void );
+
+const char* lorawan_default_dev_eui( char* dev_eui );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SIM_PICO_LORAWAN_H
@@ -0,0 +1,22 @@
+// =======================================================================
+// pico/rand.h
+// =======================================================================
+// The simulation's stand-in for the Pico SDK's random numbers (seeded by
+// the simulator, so runs repeat)
+
+#ifndef SIM_PICO_RAND_H
+#define SIM_PICO_RAND_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t get_rand_32( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SIM_PICO_RAND_H
@@ -0,0 +1,20 @@
+// =======================================================================
+// pico/stdlib.h
+// =======================================================================
+// The simulation's stand-in for the Pico SDK's standard library
+
+#ifndef SIM_PICO_STDLIB_H
+#define SIM_PICO_STDLIB_H
+
+#include "pico/time.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef MIN
+#define MIN( a, b ) ( ( b ) > ( a ) ? ( a ) : ( b ) )
+#endif
+
+typedef unsigned int uint;
+
+#endif  // SIM_PICO_STDLIB_H
@@ -0,0 +1,23 @@
+// =======================================================================
+// pico/time.h
+// =======================================================================
+// The simulation's stand-in for the Pico SDK's clock: simulated time,
+// moved on by the simulator (see host/sim/sim.h)
+
+#ifndef SIM_PICO_TIME_H
+#define SIM_PICO_TIME_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t time_us_64( void );
+uint32_t time_us_32( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SIM_PICO_TIME_H
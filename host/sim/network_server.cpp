@@ -0,0 +1,215 @@
+// =======================================================================
+// network_server.cpp
+// =======================================================================
+// Definitions of our minimal LoRaWAN network server
+
+#include "network_server.h"
+#include "lorawan/datarate.h"
+#include "lorawan/subband.h"
+#include <string.h>
+
+#define NS_NET_ID 0x000013  // TTN's
+#define NS_DEV_ADDR 0x260B0000
+
+// -----------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------
+
+NetworkServer::NetworkServer( const ns_config_t& config,
+                              const char* dev_eui, const char* app_eui,
+                              const char* app_key )
+    : config( config ),
+      joined( false ),
+      dev_addr( 0 ),
+      fcnt_up( 0 ),
+      fcnt_down( 0 ),
+      app_nonce( 0 ),
+      counters()
+{
+  frame_parse_hex( dev_eui, this->dev_eui, 8 );
+  frame_parse_hex( app_eui, this->app_eui, 8 );
+  frame_parse_hex( app_key, this->app_key, 16 );
+}
+
+bool NetworkServer::hears( int channel )
+{
+  if ( channel >= SUBBAND_NUM * 8 ) {
+    return channel - SUBBAND_NUM * 8 == config.subband;  // 500 kHz
+  }
+  return channel / 8 == config.subband;
+}
+
+int NetworkServer::window( uint64_t end_us, uint32_t rx1_delay_ms )
+{
+  uint64_t ready_ms = end_us / 1000 + config.latency_ms;
+  uint64_t rx1_ms   = end_us / 1000 + rx1_delay_ms;
+  if ( ready_ms <= rx1_ms ) {
+    return 1;
+  }
+  if ( ready_ms <= rx1_ms + NS_RX2_AFTER_RX1_MS ) {
+    return 2;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------
+// Uplinks
+// -----------------------------------------------------------------------
+
+bool NetworkServer::on_uplink( const uint8_t* frame, int len,
+                               uint64_t end_us, uint8_t datarate,
+                               int8_t snr, ns_downlink_t* downlink )
+{
+  if ( ( len > 0 ) && ( frame[0] == FRAME_JOIN_REQUEST ) ) {
+    return on_join_request( frame, len, end_us, downlink );
+  }
+  return on_data( frame, len, end_us, datarate, snr, downlink );
+}
+
+bool NetworkServer::on_join_request( const uint8_t* frame, int len,
+                                     uint64_t end_us,
+                                     ns_downlink_t* downlink )
+{
+  counters.join_requests++;
+  frame_join_request_t request;
+  if ( !frame_open_join_request( app_key, frame, len, &request ) ) {
+    counters.bad_mics++;
+    return false;
+  }
+  if ( ( memcmp( request.dev_eui, dev_eui, 8 ) != 0 ) ||
+       ( memcmp( request.app_eui, app_eui, 8 ) != 0 ) ) {
+    return false;
+  }
+  if ( !dev_nonces.insert( request.dev_nonce ).second ) {
+    counters.replayed_nonces++;
+    return false;
+  }
+
+  // The session starts whether or not the accept gets there; the device
+  // just joins again if it doesn't
+  frame_join_accept_t accept = {};
+  accept.app_nonce           = ++app_nonce;
+  accept.net_id              = NS_NET_ID;
+  accept.dev_addr            = NS_DEV_ADDR | ( app_nonce & 0xFFFF );
+  accept.rx_delay_s          = NS_RX1_DELAY_MS / 1000;
+  uint16_t mask[SUBBAND_MASK_LEN];
+  SubbandSelector::mask( config.subband, mask );
+  memcpy( accept.channel_mask, mask, sizeof( accept.channel_mask ) );
+
+  joined    = true;
+  dev_addr  = accept.dev_addr;
+  fcnt_up   = 0;
+  fcnt_down = 0;
+  frame_session_keys( app_key, accept.app_nonce, accept.net_id,
+                      request.dev_nonce, nwk_skey, app_skey );
+  counters.joins++;
+
+  downlink->window = window( end_us, NS_JOIN_RX1_DELAY_MS );
+  counters.replies[downlink->window]++;
+  if ( downlink->window == 0 ) {
+    return false;
+  }
+  downlink->len = frame_join_accept( app_key, &accept, downlink->frame );
+  return true;
+}
+
+bool NetworkServer::on_data( const uint8_t* frame, int len,
+                             uint64_t end_us, uint8_t datarate, int8_t snr,
+                             ns_downlink_t* downlink )
+{
+  uint32_t frame_addr;
+  uint16_t fcnt16;
+  if ( !joined || !frame_peek_data( frame, len, &frame_addr, &fcnt16 ) ||
+       ( frame_addr != dev_addr ) ) {
+    return false;
+  }
+
+  // The full frame counter is the nearest to the next one expected
+  uint16_t ahead     = fcnt16 - (uint16_t) fcnt_up;
+  bool     duplicate = ( ahead >= 0x8000 );
+  uint32_t fcnt =
+      duplicate ? fcnt_up - ( 0x10000 - ahead ) : fcnt_up + ahead;
+
+  frame_data_t data;
+  if ( !frame_open_data( nwk_skey, app_skey, frame, len, fcnt, &data ) ) {
+    counters.bad_mics++;
+    return false;
+  }
+  bool confirmed = ( data.mhdr == FRAME_CONFIRMED_UP );
+  if ( duplicate ) {
+    counters.duplicates++;
+  }
+  else {
+    counters.uplinks++;
+    fcnt_up = fcnt + 1;
+    if ( data.port > 0 ) {
+      received.push_back(
+          { end_us, fcnt, (uint8_t) data.port, confirmed,
+            std::vector<uint8_t>( data.payload,
+                                  data.payload + data.payload_len ) } );
+    }
+  }
+
+  frame_data_t reply = {};
+  reply.mhdr         = FRAME_UNCONFIRMED_DOWN;
+  reply.dev_addr     = dev_addr;
+  reply.port         = -1;
+  if ( confirmed ) {
+    reply.fctrl |= FRAME_FCTRL_ACK;
+  }
+
+  // The margin is how far the uplink's SNR was above the demodulation
+  // floor for its data rate
+  for ( int i = 0; i < data.fopts_len; i++ ) {
+    if ( data.fopts[i] == FRAME_CID_LINK_CHECK ) {
+      int margin = snr - DatarateSelector::snr_floor_qdb( datarate ) / 4;
+      reply.fopts[reply.fopts_len++] = FRAME_CID_LINK_CHECK;
+      reply.fopts[reply.fopts_len++] = ( margin > 0 ) ? margin : 0;
+      reply.fopts[reply.fopts_len++] = 1;  // Gateways
+      counters.link_checks++;
+    }
+  }
+
+  bool has_data = !queued.empty() && !duplicate;
+  if ( !confirmed && ( reply.fopts_len == 0 ) && !has_data ) {
+    return false;
+  }
+  downlink->window = window( end_us, NS_RX1_DELAY_MS );
+  counters.replies[downlink->window]++;
+  if ( downlink->window == 0 ) {
+    return false;
+  }
+  if ( has_data ) {
+    reply.port        = queued.front().port;
+    reply.payload_len = queued.front().data.size();
+    memcpy( reply.payload, queued.front().data.data(), reply.payload_len );
+    queued.pop_front();
+  }
+  reply.fcnt    = fcnt_down++;
+  downlink->len = frame_data( nwk_skey, app_skey, &reply, downlink->frame );
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// Downlinks
+// -----------------------------------------------------------------------
+
+void NetworkServer::queue_downlink( uint8_t port, const uint8_t* data,
+                                    uint8_t len )
+{
+  queued.push_back( { port, std::vector<uint8_t>( data, data + len ) } );
+}
+
+// -----------------------------------------------------------------------
+// Stats
+// -----------------------------------------------------------------------
+
+const std::vector<ns_uplink_t>& NetworkServer::uplinks()
+{
+  return received;
+}
+
+ns_stats_t NetworkServer::stats()
+{
+  return counters;
+}
@@ -0,0 +1,127 @@
+// =======================================================================
+// network_server.h
+// =======================================================================
+// Declarations of a minimal LoRaWAN network server for one device, with
+// its gateway, for the simulated MAC to talk to
+//
+// It accepts joins (checking the MIC and refusing replayed DevNonces),
+// checks the MIC and frame counter of each uplink, and replies in RX1 or
+// RX2 with ACKs, LinkCheckAns and queued downlinks. A reply has to make
+// it back to the gateway before its window opens, so with a slow enough
+// backhaul it goes in RX2, or misses both
+
+#ifndef SIM_NETWORK_SERVER_H
+#define SIM_NETWORK_SERVER_H
+
+#include "frames.h"
+#include <cstdint>
+#include <deque>
+#include <set>
+#include <vector>
+
+// RX window delays (US915), from the end of the uplink
+#define NS_RX1_DELAY_MS 1000
+#define NS_JOIN_RX1_DELAY_MS 5000
+#define NS_RX2_AFTER_RX1_MS 1000
+
+typedef struct {
+  uint32_t latency_ms;  // Gateway to server and back, and processing
+  int      subband;     // The 8 channels the gateway listens on (0-7)
+} ns_config_t;
+
+// A reply, to go out in RX window 1 or 2
+typedef struct {
+  int     window;
+  uint8_t frame[FRAME_MAX_LEN];
+  int     len;
+} ns_downlink_t;
+
+// An application uplink, as received (decrypted)
+typedef struct {
+  uint64_t             end_us;
+  uint32_t             fcnt;
+  uint8_t              port;
+  bool                 confirmed;
+  std::vector<uint8_t> data;
+} ns_uplink_t;
+
+typedef struct {
+  uint32_t join_requests;
+  uint32_t joins;
+  uint32_t replayed_nonces;  // Join requests refused
+  uint32_t uplinks;          // Data frames with a good MIC
+  uint32_t bad_mics;         // Frames of either kind with a bad MIC
+  uint32_t duplicates;       // Data frames with an old frame counter
+  uint32_t link_checks;
+  uint32_t replies[3];       // Missed both windows, in RX1, in RX2
+} ns_stats_t;
+
+// -----------------------------------------------------------------------
+// NetworkServer
+// -----------------------------------------------------------------------
+
+class NetworkServer {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public Accessor Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  // The device's keys are hex strings, as in lorawan_config.h
+  NetworkServer( const ns_config_t& config, const char* dev_eui,
+                 const char* app_eui, const char* app_key );
+
+  // Whether the gateway listens on an uplink channel (0-71)
+  bool hears( int channel );
+
+  // An uplink the gateway heard, ending at end_us, with its data rate
+  // and SNR (dB). Returns whether there's a reply, written to downlink
+  bool on_uplink( const uint8_t* frame, int len, uint64_t end_us,
+                  uint8_t datarate, int8_t snr, ns_downlink_t* downlink );
+
+  // Send data to the device with a later reply
+  void queue_downlink( uint8_t port, const uint8_t* data, uint8_t len );
+
+  const std::vector<ns_uplink_t>& uplinks();
+  ns_stats_t                      stats();
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Private Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ private:
+  bool on_join_request( const uint8_t* frame, int len, uint64_t end_us,
+                        ns_downlink_t* downlink );
+  bool on_data( const uint8_t* frame, int len, uint64_t end_us,
+                uint8_t datarate, int8_t snr, ns_downlink_t* downlink );
+
+  // The first window a reply to an uplink ending at end_us can make (0
+  // for neither)
+  int window( uint64_t end_us, uint32_t rx1_delay_ms );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected Attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  ns_config_t config;
+  uint8_t     dev_eui[8];
+  uint8_t     app_eui[8];
+  uint8_t     app_key[16];
+
+  // The session, once joined
+  bool               joined;
+  uint32_t           dev_addr;
+  uint8_t            nwk_skey[16];
+  uint8_t            app_skey[16];
+  uint32_t           fcnt_up;  // Next expected
+  uint32_t           fcnt_down;
+  uint32_t           app_nonce;
+  std::set<uint16_t> dev_nonces;
+
+  struct queued_t {
+    uint8_t              port;
+    std::vector<uint8_t> data;
+  };
+  std::deque<queued_t>     queued;
+  std::vector<ns_uplink_t> received;
+  ns_stats_t               counters;
+};
+
+#endif  // SIM_NETWORK_SERVER_H
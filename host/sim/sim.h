@@ -0,0 +1,71 @@
+// =======================================================================
+// sim.h
+// =======================================================================
+// Declarations for running lorawan/lorawan.cpp on the host, against a
+// simulated MAC and radio (sim_mac.cpp) and a local network server
+// (network_server.h), in simulated time
+//
+// LoRaMac-node isn't part of this tree (it comes with the
+// lorawan-library-for-pico submodule, and builds only for the Pico), so
+// the simulation stands in for it at the API lorawan.cpp uses: the
+// pico-lorawan calls, the LmHandler and MIB calls, and the hooks our
+// patched library calls back (confirm.h, join_result.h and the rest).
+// It keeps to what the real MAC does there: OTAA with real frames and
+// keys, RX1/RX2 timing, the join duty cycle, MAC commands riding in
+// FOpts, and LmHandlerSend sending an empty frame to flush them when the
+// payload doesn't fit beside them
+
+#ifndef SIM_SIM_H
+#define SIM_SIM_H
+
+#include "network_server.h"
+#include <cstdint>
+
+// -----------------------------------------------------------------------
+// Time, randomness and flash
+// -----------------------------------------------------------------------
+// time_us_64() and get_rand_32() (see include/) read these
+
+void     sim_seed( uint32_t seed );
+double   sim_random();  // Uniform in [0, 1)
+uint64_t sim_now_us();
+void     sim_advance_us( uint64_t us );
+
+// Erase the simulated flash (it otherwise keeps what's written, across
+// a LoRaWAN's lifetime, like a reboot)
+void sim_flash_reset();
+
+// -----------------------------------------------------------------------
+// Radio
+// -----------------------------------------------------------------------
+
+typedef struct {
+  double uplink_loss;    // Chance of losing each uplink (interference)
+  double downlink_loss;  // ... and each downlink
+  double corruption;     // Chance of a flipped bit, so the MIC fails
+  double snr_db;         // Mean SNR, both ways
+  double snr_jitter_db;  // Varying uniformly either side
+  int    rssi_dbm;
+} sim_radio_t;
+
+// -----------------------------------------------------------------------
+// MAC
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint32_t join_requests;
+  uint32_t uplinks;         // Data frames sent
+  uint32_t flushes;         // ... of them empty, to flush MAC commands
+  uint64_t airtime_us;      // Of all frames sent
+  uint32_t unheard;         // Uplinks the gateway missed
+  uint32_t downlinks;       // Received
+  uint32_t lost_downlinks;  // Sent by the server, but not received
+} sim_mac_stats_t;
+
+// Start over with a new device, talking through radio to server (both
+// must outlive it). Call before constructing the LoRaWAN
+void sim_mac_reset( const sim_radio_t* radio, NetworkServer* server );
+
+sim_mac_stats_t sim_mac_stats();
+
+#endif  // SIM_SIM_H
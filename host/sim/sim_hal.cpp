@@ -0,0 +1,99 @@
+// =======================================================================
+// sim_hal.cpp
+// =======================================================================
+// Definitions of the simulation's clock, random numbers and flash, in
+// place of the Pico SDK's
+
+#include "sim.h"
+#include "pico/rand.h"
+#include "pico/time.h"
+#include "utils/flash.h"
+#include <random>
+#include <string.h>
+#include <vector>
+
+static uint64_t     now_us = 0;
+static std::mt19937 rng( 1 );
+
+void sim_seed( uint32_t seed )
+{
+  rng.seed( seed );
+}
+
+double sim_random()
+{
+  return std::uniform_real_distribution<double>( 0, 1 )( rng );
+}
+
+uint64_t sim_now_us()
+{
+  return now_us;
+}
+
+void sim_advance_us( uint64_t us )
+{
+  now_us += us;
+}
+
+uint64_t time_us_64( void )
+{
+  return now_us;
+}
+
+uint32_t time_us_32( void )
+{
+  return (uint32_t) now_us;
+}
+
+uint32_t get_rand_32( void )
+{
+  return rng();
+}
+
+// -----------------------------------------------------------------------
+// Flash
+// -----------------------------------------------------------------------
+// In RAM, erased to 0xFF, and only clearing bits when programmed
+
+static std::vector<uint8_t> flash( PICO_FLASH_SIZE_BYTES, 0xFF );
+
+void sim_flash_reset()
+{
+  std::fill( flash.begin(), flash.end(), 0xFF );
+}
+
+const uint8_t* flash_read( uint32_t offset )
+{
+  return flash.data() + offset;
+}
+
+bool flash_erase_sector( uint32_t offset )
+{
+  if ( ( offset % FLASH_SECTOR_SIZE ) ||
+       ( offset + FLASH_SECTOR_SIZE > flash.size() ) ) {
+    return false;
+  }
+  memset( flash.data() + offset, 0xFF, FLASH_SECTOR_SIZE );
+  return true;
+}
+
+bool flash_program( uint32_t offset, const uint8_t* data, uint32_t len )
+{
+  uint32_t page = offset / FLASH_PAGE_SIZE;
+  if ( ( len == 0 ) || ( ( offset + len - 1 ) / FLASH_PAGE_SIZE != page ) ||
+       ( offset + len > flash.size() ) ) {
+    return false;
+  }
+  for ( uint32_t i = 0; i < len; i++ ) {
+    flash[offset + i] &= data[i];
+  }
+  return true;
+}
+
+bool flash_program_page( uint32_t offset, const uint8_t* data )
+{
+  if ( offset % FLASH_PAGE_SIZE ) {
+    return false;
+  }
+  return flash_program( offset, data, FLASH_PAGE_SIZE );
+}
@@ -0,0 +1,627 @@
+// =======================================================================
+// sim_mac.cpp
+// =======================================================================
+// Definitions of the simulated MAC and radio, in place of
+// lorawan/lorawan-library-for-pico.c and LoRaMac-node (see sim.h)
+//
+// Each uplink is a cycle: it goes out, the gateway hears it (or not) and
+// hands it to the server, then the RX1 and RX2 windows open in turn. The
+// cycle moves on only when lorawan_process() runs, as on the Pico, where
+// the radio's interrupts only flag the MAC to run
+
+#include "sim.h"
+#include "confirm.h"
+#include "join_result.h"
+#include "link_quality.h"
+#include "mac_events.h"
+#include "mac_telemetry.h"
+#include "lorawan/datarate.h"
+#include "lorawan/lorawan_config.h"
+#include "lorawan/radio_io.h"
+#include "lorawan/scheduler.h"
+#include "lorawan/subband.h"
+#include "pico/lorawan.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// The join duty cycle: at most 1% of the time on air, as over the first
+// hour after boot
+#define SIM_JOIN_DUTY_CYCLE 100
+
+#define SIM_NUM_CHANNELS ( SUBBAND_NUM * 9 )  // 64 x 125 kHz, 8 x 500 kHz
+#define SIM_DR_MAX 4
+
+static const sim_radio_t* radio  = nullptr;
+static NetworkServer*     server = nullptr;
+static bool               debug_on = false;
+static sim_mac_stats_t    stats;
+static rx_queue_t         rx_queue;
+
+// Device keys, and the session
+static uint8_t  dev_eui[8];
+static uint8_t  app_eui[8];
+static uint8_t  app_key[16];
+static uint16_t dev_nonce = 0;
+static bool     joined    = false;
+static uint32_t dev_addr  = 0;
+static uint8_t  nwk_skey[16];
+static uint8_t  app_skey[16];
+static uint32_t fcnt_up      = 0;
+static uint32_t fcnt_down    = 0;  // Next expected
+static uint32_t rx1_delay_ms = NS_RX1_DELAY_MS;
+
+// MIB
+static uint16_t channels_mask[SUBBAND_MASK_LEN];
+static uint16_t default_mask[SUBBAND_MASK_LEN];
+static int8_t   datarate   = 0;
+static bool     adr_enable = true;
+
+// Join requests wait for the duty cycle; MAC commands for an uplink
+static bool     join_wanted        = false;
+static uint64_t next_join_us       = 0;
+static bool     link_check_pending = false;
+
+enum cycle_phase_t { CYCLE_NONE, CYCLE_TX, CYCLE_RX1, CYCLE_RX2 };
+
+static struct {
+  cycle_phase_t phase;
+  bool          join;
+  bool          confirmed;
+  bool          has_data;  // Not an empty frame
+  uint64_t      end_us;    // Of the uplink
+  uint32_t      airtime_us;
+  uint8_t       frame[FRAME_MAX_LEN];
+  int           len;
+  uint8_t       datarate;
+  int           channel;
+  bool          replied;
+  ns_downlink_t reply;
+} cycle;
+
+static void sim_debug( const char* format, ... )
+    __attribute__( ( format( printf, 1, 2 ) ) );
+
+// -----------------------------------------------------------------------
+// Setup
+// -----------------------------------------------------------------------
+
+void sim_mac_reset( const sim_radio_t* sim_radio,
+                    NetworkServer*     sim_server )
+{
+  radio              = sim_radio;
+  server             = sim_server;
+  stats              = {};
+  dev_nonce          = 0;
+  joined             = false;
+  fcnt_up            = 0;
+  fcnt_down          = 0;
+  join_wanted        = false;
+  next_join_us       = 0;
+  link_check_pending = false;
+  cycle              = {};
+  rx_queue_init( &rx_queue );
+}
+
+sim_mac_stats_t sim_mac_stats()
+{
+  return stats;
+}
+
+int lorawan_init_otaa( const struct lorawan_sx1276_settings* sx1276_settings,
+                       LoRaMacRegion_t                       region,
+                       const struct lorawan_otaa_settings*   otaa_settings )
+{
+  (void) sx1276_settings;
+  if ( ( radio == nullptr ) || ( region != LORAMAC_REGION_US915 ) ||
+       !frame_parse_hex( otaa_settings->device_eui, dev_eui, 8 ) ||
+       !frame_parse_hex( otaa_settings->app_eui, app_eui, 8 ) ||
+       !frame_parse_hex( otaa_settings->app_key, app_key, 16 ) ) {
+    return -1;
+  }
+  rx_queue_init( &rx_queue );
+  SubbandSelector::mask( SUBBAND_NONE, default_mask );
+  memcpy( channels_mask, default_mask, sizeof( channels_mask ) );
+  datarate   = 0;
+  adr_enable = true;
+  return 0;
+}
+
+int lorawan_is_joined( void )
+{
+  return joined;
+}
+
+void lorawan_debug( bool debug )
+{
+  debug_on = debug;
+}
+
+// Nothing survives a reset, so there's nothing to erase
+int lorawan_erase_nvm( void )
+{
+  return 0;
+}
+
+// The simulated board's unique ID
+const char* lorawan_default_dev_eui( char* dev_eui )
+{
+  strcpy( dev_eui, "E6605481DB3F2A2D" );
+  return dev_eui;
+}
+
+void radio_io_stats( radio_io_stats_t* radio_stats )
+{
+  memset( radio_stats, 0, sizeof( radio_io_stats_t ) );
+}
+
+static void sim_debug( const char* format, ... )
+{
+  if ( !debug_on ) {
+    return;
+  }
+  va_list args;
+  va_start( args, format );
+  printf( "[Sim] %8.3f s: ", sim_now_us() / 1e6 );
+  vprintf( format, args );
+  va_end( args );
+}
+
+// -----------------------------------------------------------------------
+// Radio
+// -----------------------------------------------------------------------
+
+// A random enabled channel for a data rate (-1 if there's none)
+static int pick_channel( uint8_t dr )
+{
+  int first = ( dr == SIM_DR_MAX ) ? SUBBAND_NUM * 8 : 0;
+  int last  = ( dr == SIM_DR_MAX ) ? SIM_NUM_CHANNELS : SUBBAND_NUM * 8;
+  int enabled[SIM_NUM_CHANNELS];
+  int num_enabled = 0;
+  for ( int channel = first; channel < last; channel++ ) {
+    if ( ( channels_mask[channel / 16] >> ( channel % 16 ) ) & 1 ) {
+      enabled[num_enabled++] = channel;
+    }
+  }
+  if ( num_enabled == 0 ) {
+    return -1;
+  }
+  return enabled[(int) ( sim_random() * num_enabled )];
+}
+
+static int8_t link_snr()
+{
+  return radio->snr_db + ( 2 * sim_random() - 1 ) * radio->snr_jitter_db;
+}
+
+static void start_cycle( bool join, bool confirmed, bool has_data,
+                         uint8_t dr, int channel, int payload_len )
+{
+  cycle.phase      = CYCLE_TX;
+  cycle.join       = join;
+  cycle.confirmed  = confirmed;
+  cycle.has_data   = has_data;
+  cycle.datarate   = dr;
+  cycle.channel    = channel;
+  cycle.replied    = false;
+  cycle.airtime_us = UplinkScheduler::time_on_air_us( dr, payload_len );
+  cycle.end_us     = sim_now_us() + cycle.airtime_us;
+  stats.airtime_us += cycle.airtime_us;
+}
+
+// The gateway hears the uplink if it's on one of its channels and above
+// the demodulation floor, and isn't lost
+static void end_uplink()
+{
+  int8_t snr = link_snr();
+  int    floor_qdb = DatarateSelector::snr_floor_qdb( cycle.datarate );
+  bool   heard     = server->hears( cycle.channel ) &&
+                 ( snr * 4 >= floor_qdb ) &&
+                 ( sim_random() >= radio->uplink_loss );
+  if ( !heard ) {
+    stats.unheard++;
+    sim_debug( "uplink on channel %d unheard\n", cycle.channel );
+    return;
+  }
+  if ( sim_random() < radio->corruption ) {
+    cycle.frame[(int) ( sim_random() * cycle.len )] ^=
+        1 << (int) ( sim_random() * 8 );
+  }
+  cycle.replied = server->on_uplink( cycle.frame, cycle.len, cycle.end_us,
+                                     cycle.datarate, snr, &cycle.reply );
+}
+
+// -----------------------------------------------------------------------
+// Join
+// -----------------------------------------------------------------------
+// Join requests go at DR0, on a random channel of the mask
+
+static void start_join()
+{
+  join_wanted = false;
+  int channel = pick_channel( 0 );
+  if ( channel < 0 ) {
+    join_result( false );
+    lorawan_join();
+    return;
+  }
+
+  frame_join_request_t request;
+  memcpy( request.app_eui, app_eui, 8 );
+  memcpy( request.dev_eui, dev_eui, 8 );
+  request.dev_nonce = dev_nonce++;
+  cycle.len         = frame_join_request( app_key, &request, cycle.frame );
+  // Time on air counts the LoRaWAN overhead of a data frame (13 bytes),
+  // so this comes to the join request's 23
+  start_cycle( true, false, false, 0, channel,
+               FRAME_JOIN_REQUEST_LEN - 13 );
+  next_join_us = sim_now_us() + SIM_JOIN_DUTY_CYCLE * cycle.airtime_us;
+  stats.join_requests++;
+  sim_debug( "join request %u on channel %d\n", request.dev_nonce,
+             cycle.channel );
+}
+
+int lorawan_join( void )
+{
+  join_wanted = true;
+  return 0;
+}
+
+static void end_join( const uint8_t* frame, int len )
+{
+  frame_join_accept_t accept;
+  bool ok = ( frame != nullptr ) &&
+            frame_open_join_accept( app_key, frame, len, &accept );
+  if ( ok ) {
+    joined       = true;
+    dev_addr     = accept.dev_addr;
+    fcnt_up      = 0;
+    fcnt_down    = 0;
+    rx1_delay_ms = accept.rx_delay_s ? accept.rx_delay_s * 1000 : 1000;
+    frame_session_keys( app_key, accept.app_nonce, accept.net_id,
+                        dev_nonce - 1, nwk_skey, app_skey );
+    memset( channels_mask, 0, sizeof( channels_mask ) );
+    memcpy( channels_mask, accept.channel_mask,
+            sizeof( accept.channel_mask ) );
+    sim_debug( "joined as %08X\n", (unsigned) dev_addr );
+  }
+
+  // As OnJoinRequest does: report it, then try again if it failed
+  join_result( ok );
+  if ( !ok ) {
+    lorawan_join();
+  }
+}
+
+// -----------------------------------------------------------------------
+// Data
+// -----------------------------------------------------------------------
+
+LoRaMacStatus_t LoRaMacQueryTxPossible( uint8_t          size,
+                                        LoRaMacTxInfo_t* txInfo )
+{
+  int max_len  = UplinkScheduler::max_payload( datarate );
+  int fopts    = link_check_pending ? 1 : 0;
+  int possible = max_len - fopts;
+  txInfo->MaxPossibleApplicationDataSize = max_len;
+  txInfo->CurrentPossiblePayloadSize     = ( possible > 0 ) ? possible : 0;
+  return ( size + fopts <= max_len ) ? LORAMAC_STATUS_OK
+                                     : LORAMAC_STATUS_LENGTH_ERROR;
+}
+
+LmHandlerErrorStatus_t LmHandlerSend( LmHandlerAppData_t* appData,
+                                      LmHandlerMsgTypes_t isTxConfirmed )
+{
+  if ( !joined ) {
+    lorawan_join();
+    return LORAMAC_HANDLER_ERROR;
+  }
+  if ( cycle.phase != CYCLE_NONE ) {
+    return LORAMAC_HANDLER_ERROR;  // Busy
+  }
+
+  // A payload that doesn't fit beside the MAC commands waiting is dropped
+  // for an empty frame, which flushes them (and still counts as sent)
+  LoRaMacTxInfo_t tx_info;
+  LoRaMacStatus_t fits =
+      LoRaMacQueryTxPossible( appData->BufferSize, &tx_info );
+  bool has_data  = ( fits == LORAMAC_STATUS_OK );
+  bool confirmed = has_data && isTxConfirmed;
+  int  channel   = pick_channel( datarate );
+  telemetry_uplink_request( channel >= 0, confirmed );
+  if ( channel < 0 ) {
+    return LORAMAC_HANDLER_ERROR;
+  }
+
+  frame_data_t data = {};
+  data.mhdr     = confirmed ? FRAME_CONFIRMED_UP : FRAME_UNCONFIRMED_UP;
+  data.dev_addr = dev_addr;
+  data.fctrl    = adr_enable ? FRAME_FCTRL_ADR : 0;
+  data.fcnt     = fcnt_up++;
+  if ( link_check_pending ) {
+    data.fopts[data.fopts_len++] = FRAME_CID_LINK_CHECK;
+    link_check_pending           = false;
+  }
+  data.port = -1;
+  if ( has_data ) {
+    data.port        = appData->Port;
+    data.payload_len = appData->BufferSize;
+    memcpy( data.payload, appData->Buffer, appData->BufferSize );
+  }
+  else {
+    stats.flushes++;
+  }
+  cycle.len = frame_data( nwk_skey, app_skey, &data, cycle.frame );
+  start_cycle( false, confirmed, has_data, datarate, channel,
+               data.fopts_len + ( has_data ? data.payload_len : 0 ) );
+  stats.uplinks++;
+  sim_debug( "%s uplink %u, %d bytes at DR%d on channel %d\n",
+             confirmed ? "confirmed" : "unconfirmed", (unsigned) data.fcnt,
+             data.payload_len, datarate, channel );
+  return LORAMAC_HANDLER_SUCCESS;
+}
+
+int lorawan_send_unconfirmed( const void* data, uint8_t data_len,
+                              uint8_t app_port )
+{
+  LmHandlerAppData_t appData;
+
+  appData.Port       = app_port;
+  appData.BufferSize = data_len;
+  appData.Buffer     = (uint8_t*) data;
+
+  if ( LmHandlerSend( &appData, LORAMAC_HANDLER_UNCONFIRMED_MSG ) !=
+       LORAMAC_HANDLER_SUCCESS ) {
+    return -1;
+  }
+  return 0;
+}
+
+LmHandlerErrorStatus_t LmHandlerLinkCheckReq( void )
+{
+  if ( !joined ) {
+    return LORAMAC_HANDLER_ERROR;
+  }
+  link_check_pending = true;
+  telemetry_mac_command( false );
+  return LORAMAC_HANDLER_SUCCESS;
+}
+
+// The same hooks, in the same order, as the library's OnRxData,
+// OnMlmeConfirm and OnTxData
+static void end_data( const uint8_t* frame, int len )
+{
+  frame_data_t data;
+  uint32_t     addr;
+  uint16_t     fcnt16;
+  bool         acked = false;
+  if ( ( frame != nullptr ) &&
+       frame_peek_data( frame, len, &addr, &fcnt16 ) &&
+       ( addr == dev_addr ) ) {
+    uint32_t fcnt = fcnt_down + (uint16_t) ( fcnt16 - (uint16_t) fcnt_down );
+    if ( frame_open_data( nwk_skey, app_skey, frame, len, fcnt, &data ) ) {
+      fcnt_down = fcnt + 1;
+      acked     = ( data.fctrl & FRAME_FCTRL_ACK ) != 0;
+      stats.downlinks++;
+      link_downlink( radio->rssi_dbm, link_snr() );
+
+      // LinkCheckAns is the only MAC command the server sends
+      for ( int i = 0; ( i + 2 < data.fopts_len ) &&
+                       ( data.fopts[i] == FRAME_CID_LINK_CHECK );
+            i += 3 ) {
+        link_check( data.fopts[i + 1], data.fopts[i + 2] );
+        telemetry_mac_command( true );
+      }
+      if ( ( data.port > 0 ) && ( data.payload_len > 0 ) &&
+           rx_queue_push( &rx_queue, data.port, data.payload,
+                          data.payload_len ) ) {
+        mac_rx( data.port, data.payload_len );
+      }
+    }
+  }
+
+  if ( cycle.has_data && cycle.confirmed && acked ) {
+    confirm();
+  }
+  telemetry_uplink_done( cycle.confirmed, acked, 1,
+                         cycle.airtime_us / 1000 );
+  mac_tx_done( acked );
+}
+
+// -----------------------------------------------------------------------
+// Process
+// -----------------------------------------------------------------------
+
+static void end_cycle( const uint8_t* frame, int len )
+{
+  bool join   = cycle.join;
+  cycle.phase = CYCLE_NONE;
+  if ( join ) {
+    end_join( frame, len );
+  }
+  else {
+    end_data( frame, len );
+  }
+}
+
+// Whether the reply (if any) arrives in a window
+static bool receive( int window )
+{
+  if ( !cycle.replied || ( cycle.reply.window != window ) ) {
+    return false;
+  }
+  if ( sim_random() < radio->downlink_loss ) {
+    stats.lost_downlinks++;
+    sim_debug( "downlink in RX%d lost\n", window );
+    return false;
+  }
+  sim_debug( "downlink in RX%d\n", window );
+  return true;
+}
+
+static uint64_t rx1_us()
+{
+  uint32_t delay_ms = cycle.join ? NS_JOIN_RX1_DELAY_MS : rx1_delay_ms;
+  return cycle.end_us + delay_ms * 1000ull;
+}
+
+static uint64_t rx2_us()
+{
+  return rx1_us() + NS_RX2_AFTER_RX1_MS * 1000ull;
+}
+
+int lorawan_process( void )
+{
+  uint64_t now_us = sim_now_us();
+  if ( ( cycle.phase == CYCLE_NONE ) && join_wanted &&
+       ( now_us >= next_join_us ) ) {
+    start_join();
+  }
+  if ( ( cycle.phase == CYCLE_TX ) && ( now_us >= cycle.end_us ) ) {
+    end_uplink();
+    cycle.phase = CYCLE_RX1;
+  }
+  if ( ( cycle.phase == CYCLE_RX1 ) && ( now_us >= rx1_us() ) ) {
+    if ( receive( 1 ) ) {
+      end_cycle( cycle.reply.frame, cycle.reply.len );
+    }
+    else {
+      cycle.phase = CYCLE_RX2;
+    }
+  }
+  if ( ( cycle.phase == CYCLE_RX2 ) && ( now_us >= rx2_us() ) ) {
+    if ( receive( 2 ) ) {
+      end_cycle( cycle.reply.frame, cycle.reply.len );
+    }
+    else {
+      end_cycle( nullptr, 0 );
+    }
+  }
+  return 1;  // Nothing more to do until the next timer
+}
+
+uint32_t lorawan_next_timer_ms( void )
+{
+  uint64_t next_us;
+  switch ( cycle.phase ) {
+    case CYCLE_TX:
+      next_us = cycle.end_us;
+      break;
+    case CYCLE_RX1:
+      next_us = rx1_us();
+      break;
+    case CYCLE_RX2:
+      next_us = rx2_us();
+      break;
+    default:
+      if ( !join_wanted ) {
+        return UINT32_MAX;
+      }
+      next_us = next_join_us;
+      break;
+  }
+  uint64_t now_us = sim_now_us();
+  return ( next_us > now_us ) ? ( next_us - now_us + 999 ) / 1000 : 0;
+}
+
+// -----------------------------------------------------------------------
+// Downlinks
+// -----------------------------------------------------------------------
+
+int lorawan_receive( void* data, uint8_t data_len, uint8_t* app_port )
+{
+  const rx_frame_t* frame = rx_queue_peek( &rx_queue );
+  if ( frame == NULL ) {
+    *app_port = 0;
+    return -1;
+  }
+
+  *app_port          = frame->port;
+  int receive_length = frame->len;
+  if ( data_len < receive_length ) {
+    receive_length = data_len;
+  }
+  memcpy( data, frame->data, receive_length );
+  rx_queue_pop( &rx_queue );
+  return receive_length;
+}
+
+rx_queue_t* lorawan_rx_queue( void )
+{
+  return &rx_queue;
+}
+
+uint32_t lorawan_next_fcnt_up( void )
+{
+  return fcnt_up;
+}
+
+// -----------------------------------------------------------------------
+// MIB
+// -----------------------------------------------------------------------
+
+LoRaMacStatus_t LoRaMacMibGetRequestConfirm( MibRequestConfirm_t* mibGet )
+{
+  switch ( mibGet->Type ) {
+    case MIB_ADR:
+      mibGet->Param.AdrEnable = adr_enable;
+      return LORAMAC_STATUS_OK;
+    case MIB_DEV_ADDR:
+      mibGet->Param.DevAddr = dev_addr;
+      return LORAMAC_STATUS_OK;
+    case MIB_CHANNELS_MASK:
+      mibGet->Param.ChannelsMask = channels_mask;
+      return LORAMAC_STATUS_OK;
+    case MIB_CHANNELS_DEFAULT_MASK:
+      mibGet->Param.ChannelsDefaultMask = default_mask;
+      return LORAMAC_STATUS_OK;
+    case MIB_CHANNELS_DATARATE:
+      mibGet->Param.ChannelsDatarate = datarate;
+      return LORAMAC_STATUS_OK;
+  }
+  return LORAMAC_STATUS_SERVICE_UNKNOWN;
+}
+
+LoRaMacStatus_t LoRaMacMibSetRequestConfirm( MibRequestConfirm_t* mibSet )
+{
+  switch ( mibSet->Type ) {
+    case MIB_ADR:
+      adr_enable = mibSet->Param.AdrEnable;
+      return LORAMAC_STATUS_OK;
+    case MIB_CHANNELS_MASK:
+      memcpy( channels_mask, mibSet->Param.ChannelsMask,
+              sizeof( channels_mask ) );
+      return LORAMAC_STATUS_OK;
+    case MIB_CHANNELS_DEFAULT_MASK:
+      memcpy( default_mask, mibSet->Param.ChannelsDefaultMask,
+              sizeof( default_mask ) );
+      return LORAMAC_STATUS_OK;
+    case MIB_CHANNELS_DATARATE:
+      if ( ( mibSet->Param.ChannelsDatarate < 0 ) ||
+           ( mibSet->Param.ChannelsDatarate > SIM_DR_MAX ) ) {
+        return LORAMAC_STATUS_PARAMETER_INVALID;
+      }
+      datarate = mibSet->Param.ChannelsDatarate;
+      return LORAMAC_STATUS_OK;
+    case MIB_DEV_ADDR:  // Only the join sets it here
+      break;
+  }
+  return LORAMAC_STATUS_SERVICE_UNKNOWN;
+}
+
+// As the library's (declared in link_quality.h)
+int lorawan_set_datarate( int8_t datarate )
+{
+  MibRequestConfirm_t mibReq;
+
+  mibReq.Type            = MIB_ADR;
+  mibReq.Param.AdrEnable = false;
+  LoRaMacMibSetRequestConfirm( &mibReq );
+
+  mibReq.Type                   = MIB_CHANNELS_DATARATE;
+  mibReq.Param.ChannelsDatarate = datarate;
+  if ( LoRaMacMibSetRequestConfirm( &mibReq ) != LORAMAC_STATUS_OK ) {
+    return -1;
+  }
+  return 0;
+}
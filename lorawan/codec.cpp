@@ -0,0 +1,240 @@
+// =======================================================================
+// codec.cpp
+// =======================================================================
+// Definitions of our multi-reading uplink codec
+
+#include "lorawan/codec.h"
+#include <string.h>
+
+// -----------------------------------------------------------------------
+// Bit streams
+// -----------------------------------------------------------------------
+// Most significant bit first, so frames read naturally in hex
+
+class BitWriter {
+ public:
+  BitWriter( uint8_t* buffer, int max_len )
+      : buffer( buffer ), max_bits( max_len * 8 ), num_bits( 0 )
+  {
+    memset( buffer, 0, max_len );
+  }
+
+  void write( uint32_t value, int bits )
+  {
+    for ( int i = bits - 1; i >= 0; i-- ) {
+      if ( num_bits < max_bits && ( ( value >> i ) & 1 ) ) {
+        buffer[num_bits / 8] |= 0x80 >> ( num_bits % 8 );
+      }
+      num_bits++;
+    }
+  }
+
+  void write_varint( uint32_t value )
+  {
+    const uint32_t mask = ( 1u << CODEC_VARINT_GROUP_BITS ) - 1;
+    do {
+      uint32_t group = value & mask;
+      value >>= CODEC_VARINT_GROUP_BITS;
+      write( value != 0, 1 );
+      write( group, CODEC_VARINT_GROUP_BITS );
+    } while ( value != 0 );
+  }
+
+  bool overflowed() { return num_bits > max_bits; }
+  int  length() { return ( num_bits + 7 ) / 8; }
+
+ private:
+  uint8_t* buffer;
+  int      max_bits;
+  int      num_bits;
+};
+
+class BitReader {
+ public:
+  BitReader( const uint8_t* buffer, int len )
+      : buffer( buffer ), max_bits( len * 8 ), num_bits( 0 )
+  {
+  }
+
+  uint32_t read( int bits )
+  {
+    uint32_t value = 0;
+    for ( int i = 0; i < bits; i++ ) {
+      value <<= 1;
+      if ( num_bits < max_bits ) {
+        value |= ( buffer[num_bits / 8] >> ( 7 - num_bits % 8 ) ) & 1;
+      }
+      num_bits++;
+    }
+    return value;
+  }
+
+  uint32_t read_varint()
+  {
+    uint32_t value = 0;
+    int      shift = 0;
+    bool     more  = true;
+    while ( more && ( shift < 32 ) ) {
+      more = read( 1 );
+      value |= read( CODEC_VARINT_GROUP_BITS ) << shift;
+      shift += CODEC_VARINT_GROUP_BITS;
+    }
+    return value;
+  }
+
+  bool overflowed() { return num_bits > max_bits; }
+
+ private:
+  const uint8_t* buffer;
+  int            max_bits;
+  int            num_bits;
+};
+
+// -----------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------
+
+static bool field_in_range( uint16_t value, uint16_t min, int bits )
+{
+  return ( value >= min ) && ( value <= CODEC_FIELD_MAX( min, bits ) );
+}
+
+static uint32_t encode_field( uint16_t value, uint16_t min, int bits )
+{
+  if ( value < min ) {
+    return 0;
+  }
+  if ( value > CODEC_FIELD_MAX( min, bits ) ) {
+    return ( 1u << bits ) - 1;
+  }
+  return value - min + 1;
+}
+
+static uint16_t decode_field( uint32_t code, uint16_t min, int bits )
+{
+  if ( code == 0 ) {
+    return CODEC_BELOW_RANGE;
+  }
+  if ( code == ( 1u << bits ) - 1 ) {
+    return CODEC_ABOVE_RANGE;
+  }
+  return code - 1 + min;
+}
+
+static uint32_t time_since_epoch( uint32_t timestamp )
+{
+  if ( timestamp < CODEC_EPOCH ) {
+    return 0;
+  }
+  return ( timestamp - CODEC_EPOCH ) / CODEC_TIME_UNIT_S;
+}
+
+// Encode the first num_readings readings, returning the frame length (or
+// -1 if they don't fit)
+static int encode_prefix( const codec_reading_t* readings,
+                          int num_readings, uint8_t* buffer, int max_len )
+{
+  // Sort by time (insertion sort - there are only a few readings)
+  const codec_reading_t* sorted[CODEC_MAX_READINGS];
+  for ( int i = 0; i < num_readings; i++ ) {
+    int j = i;
+    while ( ( j > 0 ) && ( time_since_epoch( sorted[j - 1]->timestamp ) >
+                           time_since_epoch( readings[i].timestamp ) ) ) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = &readings[i];
+  }
+
+  BitWriter writer( buffer, max_len );
+  writer.write( CODEC_VERSION, CODEC_VERSION_BITS );
+  writer.write( num_readings, CODEC_COUNT_BITS );
+
+  uint32_t prev_time = time_since_epoch( sorted[0]->timestamp );
+  writer.write_varint( prev_time );
+
+  for ( int i = 0; i < num_readings; i++ ) {
+#define CODEC_WRITE_FIELD( name, min, bits ) \
+  writer.write( encode_field( sorted[i]->name, min, bits ), bits );
+    CODEC_READING_FIELDS( CODEC_WRITE_FIELD )
+#undef CODEC_WRITE_FIELD
+
+    if ( i > 0 ) {
+      uint32_t time = time_since_epoch( sorted[i]->timestamp );
+      writer.write_varint( time - prev_time );
+      prev_time = time;
+    }
+  }
+
+  return writer.overflowed() ? -1 : writer.length();
+}
+
+// -----------------------------------------------------------------------
+// codec_out_of_range
+// -----------------------------------------------------------------------
+
+int codec_out_of_range( const codec_reading_t* reading )
+{
+  int count = 0;
+#define CODEC_CHECK_FIELD( name, min, bits ) \
+  count += !field_in_range( reading->name, min, bits );
+  CODEC_READING_FIELDS( CODEC_CHECK_FIELD )
+#undef CODEC_CHECK_FIELD
+  return count;
+}
+
+// -----------------------------------------------------------------------
+// codec_encode
+// -----------------------------------------------------------------------
+
+int codec_encode( const codec_reading_t* readings, int num_readings,
+                  uint8_t* buffer, int max_len, int* frame_len )
+{
+  if ( num_readings > CODEC_MAX_READINGS ) {
+    num_readings = CODEC_MAX_READINGS;
+  }
+
+  // Find the most readings (oldest first) that fit
+  for ( int n = num_readings; n > 0; n-- ) {
+    int len = encode_prefix( readings, n, buffer, max_len );
+    if ( len >= 0 ) {
+      *frame_len = len;
+      return n;
+    }
+  }
+  *frame_len = 0;
+  return 0;
+}
+
+// -----------------------------------------------------------------------
+// codec_decode
+// -----------------------------------------------------------------------
+
+int codec_decode( const uint8_t* buffer, int len,
+                  codec_reading_t* readings, int max_readings )
+{
+  BitReader reader( buffer, len );
+  if ( reader.read( CODEC_VERSION_BITS ) != CODEC_VERSION ) {
+    return -1;
+  }
+  int num_readings = reader.read( CODEC_COUNT_BITS );
+  if ( num_readings > max_readings ) {
+    return -1;
+  }
+
+  uint32_t time = reader.read_varint();
+  for ( int i = 0; i < num_readings; i++ ) {
+#define CODEC_READ_FIELD( name, min, bits ) \
+  readings[i].name = decode_field( reader.read( bits ), min, bits );
+    CODEC_READING_FIELDS( CODEC_READ_FIELD )
+#undef CODEC_READ_FIELD
+
+    if ( i > 0 ) {
+      time += reader.read_varint();
+    }
+    readings[i].timestamp =
+        ( time == 0 ) ? 0 : time * CODEC_TIME_UNIT_S + CODEC_EPOCH;
+  }
+
+  return reader.overflowed() ? -1 : num_readings;
+}
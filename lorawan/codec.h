@@ -0,0 +1,57 @@
+// =======================================================================
+// codec.h
+// =======================================================================
+// Declarations of our multi-reading uplink codec (see codec_schema.h)
+//
+// This has no Pico dependencies, so the host tools use the same code
+
+#ifndef LORAWAN_CODEC_H
+#define LORAWAN_CODEC_H
+
+#include "lorawan/codec_schema.h"
+#include <cstdint>
+
+// Most readings in one frame
+#define CODEC_MAX_READINGS ( ( 1 << CODEC_COUNT_BITS ) - 1 )
+
+// Largest frame we'll build (the largest US915 application payload)
+#define CODEC_MAX_FRAME 242
+
+// What a field that was out of its range (see codec_schema.h) decodes as
+#define CODEC_BELOW_RANGE 0
+#define CODEC_ABOVE_RANGE 0xffff
+
+// -----------------------------------------------------------------------
+// Readings
+// -----------------------------------------------------------------------
+
+#define CODEC_DECLARE_FIELD( name, min, bits ) uint16_t name;
+
+typedef struct {
+  CODEC_READING_FIELDS( CODEC_DECLARE_FIELD )
+  uint32_t timestamp;  // Unix time (0 if unknown)
+} codec_reading_t;
+
+#undef CODEC_DECLARE_FIELD
+
+// -----------------------------------------------------------------------
+// Encoding and decoding
+// -----------------------------------------------------------------------
+
+// Number of the reading's fields outside their range, which are sent as
+// CODEC_BELOW_RANGE or CODEC_ABOVE_RANGE rather than their values
+int codec_out_of_range( const codec_reading_t* reading );
+
+// Pack as many of the readings as fit in max_len bytes into buffer.
+// Returns the number of readings packed, and sets frame_len to the
+// length of the frame
+int codec_encode( const codec_reading_t* readings, int num_readings,
+                  uint8_t* buffer, int max_len, int* frame_len );
+
+// Unpack up to max_readings readings from a frame (in time order, with
+// timestamps rounded down to CODEC_TIME_UNIT_S). Returns the number of
+// readings, or -1 if the frame isn't valid
+int codec_decode( const uint8_t* buffer, int len,
+                  codec_reading_t* readings, int max_readings );
+
+#endif  // LORAWAN_CODEC_H
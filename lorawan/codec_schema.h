@@ -0,0 +1,54 @@
+// =======================================================================
+// codec_schema.h
+// =======================================================================
+// The one definition of our uplink payload format. The firmware encoder,
+// the host decoder and the TTN payload formatter are all generated from
+// this, so change it here (and bump the version) rather than in any of
+// them
+//
+// Frame layout (bits, most significant first):
+//
+//   version   CODEC_VERSION_BITS
+//   count     CODEC_COUNT_BITS
+//   base time varint, CODEC_TIME_UNIT_S units since CODEC_EPOCH (0 if
+//             unknown)
+//   count x { fields..., time delta varint (after the first) }
+//
+// Readings are sorted by time, so deltas are never negative. Varints
+// are groups of CODEC_VARINT_GROUP_BITS bits, each preceded by a bit
+// saying whether another group follows
+
+#ifndef LORAWAN_CODEC_SCHEMA_H
+#define LORAWAN_CODEC_SCHEMA_H
+
+#define CODEC_VERSION 2
+#define CODEC_VERSION_BITS 3
+#define CODEC_COUNT_BITS 5
+#define CODEC_VARINT_GROUP_BITS 5
+
+// 2024-01-01T00:00:00Z, as a Unix timestamp
+#define CODEC_EPOCH 1704067200u
+
+// Readings are timestamped to the minute. Twice-daily readings then
+// take two varint groups, and a set of repeat readings one
+#define CODEC_TIME_UNIT_S 60
+
+// -----------------------------------------------------------------------
+// Reading fields
+// -----------------------------------------------------------------------
+// X( name, min, bits ): a value from min to CODEC_FIELD_MAX( min, bits )
+// is stored as ( value - min + 1 ) in bits. Code 0 means the value was
+// below that range and the all-ones code that it was above it, so an
+// out-of-range value is never passed off as an in-range one. The ranges
+// cover what the cuff can measure (pressure 60-260 / 40-215 mmHg, pulse
+// 40-180 /min) with room to spare
+
+#define CODEC_READING_FIELDS( X ) \
+  X( sys_pressure, 40, 8 )        \
+  X( dia_pressure, 20, 8 )        \
+  X( bpm, 20, 8 )
+
+// Largest value a field stores (the top code is taken)
+#define CODEC_FIELD_MAX( min, bits ) ( ( min ) + ( 1 << ( bits ) ) - 3 )
+
+#endif  // LORAWAN_CODEC_SCHEMA_H
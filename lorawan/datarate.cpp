@@ -0,0 +1,200 @@
+// =======================================================================
+// datarate.cpp
+// =======================================================================
+// Definitions of our link-quality-driven data rate selection
+
+#include "lorawan/datarate.h"
+#include "lorawan/scheduler.h"
+#include <cinttypes>
+#include <stdio.h>
+
+// SX127x demodulation floors (quarter dB) for US915 DR0-DR4
+const int snr_floors_qdb[SCHED_NUM_DATARATES] = {
+    -60,  // DR0: SF10, -15 dB
+    -50,  // DR1: SF9, -12.5 dB
+    -40,  // DR2: SF8, -10 dB
+    -30,  // DR3: SF7, -7.5 dB
+    -40,  // DR4: SF8, -10 dB
+};
+
+enum { LINK_CHECK_NONE, LINK_CHECK_ASKED, LINK_CHECK_SENT };
+
+// -----------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------
+
+DatarateSelector::DatarateSelector()
+    : num_estimates( 0 ),
+      next_estimate( 0 ),
+      last_estimate_ms( 0 ),
+      lost( 0 ),
+      uplinks_since_estimate( 0 ),
+      link_check_state( LINK_CHECK_NONE ),
+      counters()
+{
+  counters.datarate = DR_MIN;
+  for ( int i = 0; i < DR_WINDOW; i++ ) {
+    estimates[i] = 0;
+  }
+}
+
+int DatarateSelector::snr_floor_qdb( uint8_t datarate )
+{
+  return snr_floors_qdb[( datarate < SCHED_NUM_DATARATES ) ? datarate : 0];
+}
+
+// -----------------------------------------------------------------------
+// choose
+// -----------------------------------------------------------------------
+
+uint8_t DatarateSelector::choose( uint64_t now_ms, uint8_t data_len )
+{
+  if ( ( num_estimates > 0 ) &&
+       ( now_ms - last_estimate_ms >= DR_STALE_MS ) ) {
+    num_estimates = 0;
+  }
+
+  uint8_t datarate = DR_MIN;
+  if ( num_estimates > 0 ) {
+    int worst = estimates[0];
+    for ( int i = 1; i < num_estimates; i++ ) {
+      worst = ( estimates[i] < worst ) ? estimates[i] : worst;
+    }
+    for ( uint8_t dr = DR_MIN; dr <= DR_MAX; dr++ ) {
+      if ( worst - snr_floor_qdb( dr ) >= DR_MARGIN_DB * 4 ) {
+        datarate = dr;
+      }
+    }
+  }
+
+  // Faster than we'd like beats a frame that can't go at all
+  while ( ( datarate < DR_MAX ) &&
+          ( UplinkScheduler::max_payload( datarate ) < data_len ) ) {
+    datarate++;
+  }
+  return datarate;
+}
+
+// -----------------------------------------------------------------------
+// Link checks
+// -----------------------------------------------------------------------
+
+bool DatarateSelector::link_check_due()
+{
+  return ( link_check_state == LINK_CHECK_NONE ) &&
+         ( ( num_estimates == 0 ) ||
+           ( uplinks_since_estimate >= DR_LINK_CHECK_EVERY ) );
+}
+
+void DatarateSelector::on_link_check_requested()
+{
+  link_check_state = LINK_CHECK_ASKED;
+  counters.link_checks++;
+}
+
+void DatarateSelector::on_link_check( uint64_t now_ms, uint8_t margin,
+                                      uint8_t gateways )
+{
+  link_check_state = LINK_CHECK_NONE;
+  if ( gateways == 0 ) {
+    return;
+  }
+  add_estimate( now_ms, snr_floor_qdb( counters.datarate ) + margin * 4 );
+}
+
+// -----------------------------------------------------------------------
+// Uplinks
+// -----------------------------------------------------------------------
+
+void DatarateSelector::on_uplink( uint64_t now_ms, uint8_t datarate,
+                                  uint8_t data_len )
+{
+  (void) now_ms;
+
+  // The answer to a LinkCheckReq comes in the sending uplink's RX
+  // windows, so by the next one it's not coming
+  if ( link_check_state == LINK_CHECK_SENT ) {
+    counters.link_checks_lost++;
+    link_check_state = LINK_CHECK_NONE;
+    on_uplink_lost();
+  }
+  else if ( link_check_state == LINK_CHECK_ASKED ) {
+    link_check_state = LINK_CHECK_SENT;
+  }
+
+  uint32_t airtime_us = UplinkScheduler::time_on_air_us( datarate, data_len );
+  counters.datarate = datarate;
+  counters.uplinks[( datarate <= DR_MAX ) ? datarate : DR_MAX]++;
+  counters.airtime_us += airtime_us;
+  counters.airtime_saved_us +=
+      UplinkScheduler::time_on_air_us( DR_MIN, data_len ) - airtime_us;
+  uplinks_since_estimate++;
+}
+
+void DatarateSelector::on_uplink_lost()
+{
+  if ( ++lost < DR_LOST_LIMIT ) {
+    return;
+  }
+  if ( num_estimates > 0 ) {
+    counters.fallbacks++;
+  }
+  num_estimates = 0;
+  lost          = 0;
+}
+
+void DatarateSelector::on_uplink_delivered()
+{
+  lost = 0;
+}
+
+// -----------------------------------------------------------------------
+// Downlinks
+// -----------------------------------------------------------------------
+
+void DatarateSelector::on_downlink( uint64_t now_ms, int8_t rssi,
+                                    int8_t snr )
+{
+  counters.last_rssi = rssi;
+  counters.last_snr  = snr;
+  lost               = 0;
+  add_estimate( now_ms, ( snr - DR_DOWNLINK_MARGIN_DB ) * 4 );
+}
+
+void DatarateSelector::add_estimate( uint64_t now_ms, int snr_qdb )
+{
+  estimates[next_estimate] = snr_qdb;
+  next_estimate            = ( next_estimate + 1 ) % DR_WINDOW;
+  if ( num_estimates < DR_WINDOW ) {
+    num_estimates++;
+  }
+  last_estimate_ms       = now_ms;
+  uplinks_since_estimate = 0;
+  counters.samples++;
+}
+
+// -----------------------------------------------------------------------
+// stats
+// -----------------------------------------------------------------------
+
+dr_stats_t DatarateSelector::stats()
+{
+  return counters;
+}
+
+void DatarateSelector::print_stats()
+{
+  printf( "[Datarate] DR%d; last downlink %d dBm, SNR %d dB; %" PRIu32
+          " estimates, %" PRIu32 "/%" PRIu32 " link checks lost, %" PRIu32
+          " fallbacks\n",
+          counters.datarate, counters.last_rssi, counters.last_snr,
+          counters.samples, counters.link_checks_lost,
+          counters.link_checks, counters.fallbacks );
+  printf( "[Datarate] Uplinks at DR0-DR%d:", DR_MAX );
+  for ( int dr = DR_MIN; dr <= DR_MAX; dr++ ) {
+    printf( " %" PRIu32, counters.uplinks[dr] );
+  }
+  printf( "; %" PRIu64 " ms airtime, %" PRIu64 " ms saved over DR%d\n",
+          counters.airtime_us / 1000, counters.airtime_saved_us / 1000,
+          DR_MIN );
+}
@@ -0,0 +1,127 @@
+// =======================================================================
+// datarate.h
+// =======================================================================
+// Declarations of our link-quality-driven data rate selection
+//
+// Each data rate needs a minimum SNR at the gateway to be demodulated.
+// We estimate the uplink SNR from LinkCheckAns margins (the gateway's
+// measurement of one of our uplinks) and, less directly, from the SNR of
+// downlinks, and send at the fastest data rate that keeps a safety
+// margin over its floor for the worst of the recent estimates.
+//
+// Uplinks that go unanswered (a resent confirmed uplink, or a
+// LinkCheckReq with no answer) drop the estimates, so after a couple of
+// them we're back at the slowest data rate until fresh ones arrive.
+// Estimates that have gone stale are dropped too.
+//
+// This has no Pico dependencies (times are passed in), so the host tools
+// use the same code
+
+#ifndef LORAWAN_DATARATE_H
+#define LORAWAN_DATARATE_H
+
+#include <cstdint>
+
+// -----------------------------------------------------------------------
+// Policy
+// -----------------------------------------------------------------------
+
+// Data rates we choose between (DR4 is SF8 at 500 kHz, with only one
+// channel per sub-band, so we leave it alone)
+#define DR_MIN 0
+#define DR_MAX 3
+
+// SNR to keep over a data rate's demodulation floor, and extra for
+// estimates from downlinks (sent at a different power and bandwidth)
+#define DR_MARGIN_DB 10
+#define DR_DOWNLINK_MARGIN_DB 3
+
+// Estimates kept, and how long they last
+#define DR_WINDOW 8
+#define DR_STALE_MS ( 24 * 60 * 60 * 1000ull )
+
+// Unanswered uplinks in a row before falling back to DR_MIN
+#define DR_LOST_LIMIT 2
+
+// Uplinks without an estimate before asking for a LinkCheckAns (each
+// answer costs a downlink)
+#define DR_LINK_CHECK_EVERY 16
+
+// -----------------------------------------------------------------------
+// Stats
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint8_t  datarate;             // Data rate of the latest uplink
+  int8_t   last_rssi;            // Of the latest downlink (dBm)
+  int8_t   last_snr;             // Of the latest downlink (dB)
+  uint32_t samples;              // Estimates since boot
+  uint32_t link_checks;          // LinkCheckReqs sent since boot
+  uint32_t link_checks_lost;     // ... that went unanswered
+  uint32_t fallbacks;            // Times we fell back to DR_MIN
+  uint32_t uplinks[DR_MAX + 1];  // Uplinks at each data rate
+  uint64_t airtime_us;           // Uplink airtime since boot
+  uint64_t airtime_saved_us;     // Compared to sending all at DR_MIN
+} dr_stats_t;
+
+// -----------------------------------------------------------------------
+// DatarateSelector
+// -----------------------------------------------------------------------
+
+class DatarateSelector {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public Accessor Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  DatarateSelector();
+
+  // The data rate for a frame of data_len bytes (never one too slow to
+  // carry it, since the frame may already be packed)
+  uint8_t choose( uint64_t now_ms, uint8_t data_len );
+
+  // Whether to ask for a LinkCheckAns on the next uplink
+  bool link_check_due();
+  void on_link_check_requested();
+
+  // Call on each uplink, and with whether a confirmed one was answered
+  void on_uplink( uint64_t now_ms, uint8_t datarate, uint8_t data_len );
+  void on_uplink_lost();
+  void on_uplink_delivered();
+
+  // Call with each downlink's RSSI (dBm) and SNR (dB)
+  void on_downlink( uint64_t now_ms, int8_t rssi, int8_t snr );
+
+  // Call with each LinkCheckAns; margin is in dB over the floor of the
+  // data rate the LinkCheckReq went out at
+  void on_link_check( uint64_t now_ms, uint8_t margin, uint8_t gateways );
+
+  dr_stats_t stats();
+  void       print_stats();
+
+  // Lowest SNR (in quarter dB) to demodulate a data rate at
+  static int snr_floor_qdb( uint8_t datarate );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Private Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ private:
+  void add_estimate( uint64_t now_ms, int snr_qdb );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected Attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  // Recent uplink SNR estimates (quarter dB), less any extra margin
+  int      estimates[DR_WINDOW];
+  int      num_estimates;
+  int      next_estimate;
+  uint64_t last_estimate_ms;
+
+  int      lost;  // Unanswered uplinks in a row
+  uint32_t uplinks_since_estimate;
+  int      link_check_state;  // Not asked, asked, or sent
+
+  dr_stats_t counters;
+};
+
+#endif  // LORAWAN_DATARATE_H
@@ -0,0 +1,161 @@
+// =======================================================================
+// frag.cpp
+// =======================================================================
+// Definitions of our fragmented bulk uplinks
+
+#include "lorawan/frag.h"
+#include <string.h>
+
+// -----------------------------------------------------------------------
+// Header
+// -----------------------------------------------------------------------
+
+void frag_write_header( uint8_t* buffer, const frag_header_t* header )
+{
+  uint32_t bits = ( ( header->session & 0xF ) << 20 ) |
+                  ( ( ( header->num_fragments - 1 ) & 0x3FF ) << 10 ) |
+                  ( header->index & 0x3FF );
+  buffer[0] = ( bits >> 16 ) & 0xFF;
+  buffer[1] = ( bits >> 8 ) & 0xFF;
+  buffer[2] = bits & 0xFF;
+}
+
+void frag_read_header( const uint8_t* buffer, frag_header_t* header )
+{
+  uint32_t bits = ( buffer[0] << 16 ) | ( buffer[1] << 8 ) | buffer[2];
+  header->session       = ( bits >> 20 ) & 0xF;
+  header->num_fragments = ( ( bits >> 10 ) & 0x3FF ) + 1;
+  header->index         = bits & 0x3FF;
+}
+
+int frag_count( uint32_t len, int frag_size )
+{
+  return ( len + FRAG_LENGTH_LEN + frag_size - 1 ) / frag_size;
+}
+
+// -----------------------------------------------------------------------
+// Parity matrix
+// -----------------------------------------------------------------------
+// As in TS004: each row sets M/2 pseudo-random columns (fewer when they
+// repeat), drawn from a 23-bit PRBS seeded by the row number
+
+static uint32_t prbs23( uint32_t x )
+{
+  uint32_t b0 = x & 1;
+  uint32_t b1 = ( x & 32 ) >> 5;
+  return ( x >> 1 ) + ( ( b0 ^ b1 ) << 22 );
+}
+
+void frag_parity_row( int row, int num_fragments, uint8_t* covered )
+{
+  memset( covered, 0, ( num_fragments + 7 ) / 8 );
+
+  // Powers of two draw from one more, so the draws aren't biased
+  int      extra = ( ( num_fragments & ( num_fragments - 1 ) ) == 0 ) ? 1
+                                                                      : 0;
+  uint32_t x     = 1 + 1001 * row;
+  for ( int i = 0; i < num_fragments / 2; i++ ) {
+    int r = num_fragments;
+    while ( r >= num_fragments ) {
+      x = prbs23( x );
+      r = x % ( num_fragments + extra );
+    }
+    covered[r / 8] |= 1 << ( r % 8 );
+  }
+
+  // One fragment alone has nothing to pair with
+  if ( num_fragments == 1 ) {
+    covered[0] = 1;
+  }
+}
+
+// -----------------------------------------------------------------------
+// FragSender
+// -----------------------------------------------------------------------
+
+FragSender::FragSender( uint8_t session, const uint8_t* data, uint32_t len,
+                        int frame_len, int redundancy_pct )
+    : session( session ),
+      data( data ),
+      len( len ),
+      frag_size( frame_len - FRAG_HEADER_LEN ),
+      num_frags( 0 ),
+      end_index( 0 ),
+      next_index( 0 )
+{
+  if ( frag_size <= 0 ) {
+    return;
+  }
+  num_frags = frag_count( len, frag_size );
+  end_index = num_frags + ( num_frags * redundancy_pct + 99 ) / 100;
+  if ( end_index > FRAG_MAX_INDEX + 1 ) {
+    end_index = FRAG_MAX_INDEX + 1;
+  }
+}
+
+bool FragSender::valid()
+{
+  return ( frag_size > 0 ) && ( session <= FRAG_MAX_SESSION ) &&
+         ( len <= UINT16_MAX ) && ( num_frags <= FRAG_MAX_FRAGMENTS );
+}
+
+uint8_t FragSender::block_byte( uint32_t i )
+{
+  if ( i < FRAG_LENGTH_LEN ) {
+    return ( len >> ( 8 * ( FRAG_LENGTH_LEN - 1 - i ) ) ) & 0xFF;
+  }
+  i -= FRAG_LENGTH_LEN;
+  return ( i < len ) ? data[i] : 0;
+}
+
+int FragSender::next( uint8_t* frame )
+{
+  if ( !valid() || ( next_index >= end_index ) ) {
+    return 0;
+  }
+
+  frag_header_t header = { session, (uint16_t) num_frags,
+                           (uint16_t) next_index };
+  frag_write_header( frame, &header );
+  uint8_t* payload = frame + FRAG_HEADER_LEN;
+
+  if ( next_index < num_frags ) {
+    for ( int i = 0; i < frag_size; i++ ) {
+      payload[i] = block_byte( next_index * frag_size + i );
+    }
+  }
+  else {
+    uint8_t covered[FRAG_ROW_BYTES];
+    frag_parity_row( next_index - num_frags + 1, num_frags, covered );
+    memset( payload, 0, frag_size );
+    for ( int n = 0; n < num_frags; n++ ) {
+      if ( !( ( covered[n / 8] >> ( n % 8 ) ) & 1 ) ) {
+        continue;
+      }
+      for ( int i = 0; i < frag_size; i++ ) {
+        payload[i] ^= block_byte( n * frag_size + i );
+      }
+    }
+  }
+
+  next_index++;
+  return FRAG_HEADER_LEN + frag_size;
+}
+
+void FragSender::more( int count )
+{
+  end_index += count;
+  if ( end_index > FRAG_MAX_INDEX + 1 ) {
+    end_index = FRAG_MAX_INDEX + 1;
+  }
+}
+
+int FragSender::num_fragments()
+{
+  return num_frags;
+}
+
+int FragSender::frames_sent()
+{
+  return next_index;
+}
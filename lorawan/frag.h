@@ -0,0 +1,106 @@
+// =======================================================================
+// frag.h
+// =======================================================================
+// Declarations of our fragmented bulk uplinks, for data too big for one
+// frame (backfilled history, diagnostics), in the spirit of the LoRaWAN
+// fragmented data block transport (TS004)
+//
+// The data block (prefixed with its length, and zero-padded) is split
+// into M fragments of equal size. They're sent as they are, followed by
+// parity fragments, each the XOR of a pseudo-random half of them (rows
+// of TS004's parity matrix). A receiver can rebuild the block from any M
+// or so fragments, whichever they are, so a lost frame costs one more
+// parity fragment rather than a full resend.
+//
+// Each frame starts with a 3-byte header (big-endian): a 4-bit session
+// number, M - 1 in 10 bits, and the fragment's index in 10 bits (below M
+// for the data itself, M and up for parity).
+//
+// This has no Pico dependencies, so the host tools use the same code
+
+#ifndef LORAWAN_FRAG_H
+#define LORAWAN_FRAG_H
+
+#include <cstdint>
+
+// Port for fragmented uplinks
+#define FRAG_PORT 4
+
+#define FRAG_HEADER_LEN 3
+#define FRAG_LENGTH_LEN 2  // Length prefix in the data block
+
+// Limits from the header's field widths
+#define FRAG_MAX_SESSION 15
+#define FRAG_MAX_FRAGMENTS 1024  // Data fragments (M)
+#define FRAG_MAX_INDEX 1023      // Data and parity fragments
+
+// -----------------------------------------------------------------------
+// Header
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint8_t  session;
+  uint16_t num_fragments;  // M
+  uint16_t index;
+} frag_header_t;
+
+void frag_write_header( uint8_t* buffer, const frag_header_t* header );
+void frag_read_header( const uint8_t* buffer, frag_header_t* header );
+
+// Fragments needed for len bytes of data, in fragments of frag_size
+int frag_count( uint32_t len, int frag_size );
+
+// Row of TS004's parity matrix: which data fragments parity fragment
+// number row (from 1) covers, as a bitmap (fragment i is bit i % 8 of
+// byte i / 8)
+#define FRAG_ROW_BYTES ( ( FRAG_MAX_FRAGMENTS + 7 ) / 8 )
+void frag_parity_row( int row, int num_fragments, uint8_t* covered );
+
+// -----------------------------------------------------------------------
+// FragSender
+// -----------------------------------------------------------------------
+
+class FragSender {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public Accessor Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  // Send len bytes of data (which must outlive the sender) in frames of
+  // frame_len bytes, with parity fragments adding redundancy_pct percent
+  FragSender( uint8_t session, const uint8_t* data, uint32_t len,
+              int frame_len, int redundancy_pct );
+
+  // Whether the data fits the header's limits
+  bool valid();
+
+  // Write the next frame. Returns its length, or 0 when all have been
+  // written. Parity frames can go on past redundancy_pct with more()
+  int next( uint8_t* frame );
+
+  // Allow count more parity frames (the receiver is still short)
+  void more( int count );
+
+  int num_fragments();  // M
+  int frames_sent();
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Private Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ private:
+  // Byte i of the data block (length prefix, data, then zero padding)
+  uint8_t block_byte( uint32_t i );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected Attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  uint8_t        session;
+  const uint8_t* data;
+  uint32_t       len;
+  int            frag_size;
+  int            num_frags;
+  int            end_index;  // One past the last index to send
+  int            next_index;
+};
+
+#endif  // LORAWAN_FRAG_H
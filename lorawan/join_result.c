@@ -0,0 +1,21 @@
+// =======================================================================
+// join_result.c
+// =======================================================================
+// A thin wrapper to pass the result of each LoRaWAN join request on
+
+#include "join_result.h"
+#include <stddef.h>
+
+static void ( *join_callback )( bool joined ) = NULL;
+
+void on_join_result( void ( *callback )( bool joined ) )
+{
+  join_callback = callback;
+}
+
+void join_result( bool joined )
+{
+  if ( join_callback != NULL ) {
+    join_callback( joined );
+  }
+}
@@ -0,0 +1,22 @@
+// =======================================================================
+// join_result.h
+// =======================================================================
+// A thin wrapper to pass the result of each LoRaWAN join request on
+
+#ifndef LORAWAN_JOIN_RESULT_H
+#define LORAWAN_JOIN_RESULT_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void join_result( bool joined );  // Call after each join request
+void on_join_result( void ( *callback )( bool joined ) );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LORAWAN_JOIN_RESULT_H
@@ -0,0 +1,33 @@
+// =======================================================================
+// link_quality.c
+// =======================================================================
+// A thin wrapper to pass link quality from the LoRaWAN library on
+
+#include "link_quality.h"
+#include <stddef.h>
+
+static void ( *curr_downlink_callback )( int8_t rssi, int8_t snr ) = NULL;
+static void ( *curr_check_callback )( uint8_t margin,
+                                      uint8_t gateways )       = NULL;
+
+void on_link_quality( void ( *downlink_callback )( int8_t rssi, int8_t snr ),
+                      void ( *check_callback )( uint8_t margin,
+                                                uint8_t gateways ) )
+{
+  curr_downlink_callback = downlink_callback;
+  curr_check_callback    = check_callback;
+}
+
+void link_downlink( int8_t rssi, int8_t snr )
+{
+  if ( curr_downlink_callback != NULL ) {
+    curr_downlink_callback( rssi, snr );
+  }
+}
+
+void link_check( uint8_t margin, uint8_t gateways )
+{
+  if ( curr_check_callback != NULL ) {
+    curr_check_callback( margin, gateways );
+  }
+}
@@ -0,0 +1,35 @@
+// =======================================================================
+// link_quality.h
+// =======================================================================
+// A thin wrapper to pass link quality from the LoRaWAN library on, and
+// to let us pick the library's data rate
+
+#ifndef LORAWAN_LINK_QUALITY_H
+#define LORAWAN_LINK_QUALITY_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Call on each downlink, with its RSSI (dBm) and SNR (dB)
+void link_downlink( int8_t rssi, int8_t snr );
+
+// Call on each LinkCheckAns, with the demodulation margin (dB) of our
+// uplink at the best gateway, and how many gateways heard it
+void link_check( uint8_t margin, uint8_t gateways );
+
+void on_link_quality( void ( *downlink_callback )( int8_t rssi, int8_t snr ),
+                      void ( *check_callback )( uint8_t margin,
+                                                uint8_t gateways ) );
+
+// Send at a fixed data rate from now on, rather than the one ADR picks
+// (defined with the library, in lorawan-library-for-pico.c)
+int lorawan_set_datarate( int8_t datarate );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LORAWAN_LINK_QUALITY_H
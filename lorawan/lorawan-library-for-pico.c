@@ -8,7 +8,8 @@
  *            https://github.com/Lora-net/LoRaMac-node/blob/master/src/apps/LoRaMac/periodic-uplink-lpp/B-L072Z-LRWAN1/main.c
  *
  *            Minor changes made from the `lorawan-library-for-pico`
- * implementation to support indications on confirmation
+ * implementation to support indications on confirmation, and to keep the
+ * NVM contexts in our own atomically-written flash store
  *
  * \copyright Revised BSD License, see section \ref LICENSE.
  *
@@ -32,14 +33,25 @@
 #include "LmHandler.h"
 #include "LmHandlerMsgDisplay.h"
 #include "LmhpCompliance.h"
+#include "LoRaMacCrypto.h"
 #include "NvmDataMgmt.h"
 #include "RegionCommon.h"
 #include "board.h"
 #include "confirm.h"
+#include "eeprom-board.h"
+#include "join_result.h"
+#include "link_quality.h"
+#include "mac_events.h"
+#include "mac_telemetry.h"
+#include "radio_io.h"
+#include "rx_queue.h"
 #include "pico/lorawan.h"
 #include "pico/time.h"
 #include "rtc-board.h"
+#include "session_store.h"
 #include "sx1276-board.h"
+#include "utilities.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -178,19 +190,85 @@ static const struct lorawan_abp_settings* AbpSettings = NULL;
 
 static const struct lorawan_otaa_settings* OtaaSettings = NULL;
 
-static uint8_t AppRxDataBuffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
-
-static LmHandlerAppData_t AppRxData = {
-    .Buffer     = AppRxDataBuffer,
-    .BufferSize = 0,
-    .Port       = 0,
-};
+// Downlinks waiting to be received, in order
+static rx_queue_t RxQueue;
 
 static bool Debug = false;
 
+/*!
+ * Image of the NVM contexts, as laid out in the emulated EEPROM
+ */
+static LoRaMacNvmData_t NvmImage;
+
+_Static_assert( sizeof( NvmImage ) <= SESSION_STORE_MAX_LEN,
+                "The NVM contexts must fit in the session store" );
+
 extern void    EepromMcuInit();
 extern uint8_t EepromMcuFlush();
 
+/*!
+ * The parts of the NVM contexts that only change with a join or a MAC
+ * command: the keys, the session, and the channels. When these match the
+ * stored session, only the frame counters need saving. The other groups
+ * (ADR state, duty cycle, the channels left to hop over) change with
+ * every uplink, but it's safe to restore them stale
+ */
+static const struct {
+  uint32_t offset;
+  uint32_t size;
+} SessionGroups[] = {
+    { offsetof( LoRaMacNvmData_t, SecureElement ),
+      sizeof( NvmImage.SecureElement ) },
+    { offsetof( LoRaMacNvmData_t, MacGroup2 ), sizeof( NvmImage.MacGroup2 ) },
+    { offsetof( LoRaMacNvmData_t, RegionGroup2 ),
+      sizeof( NvmImage.RegionGroup2 ) },
+};
+
+#define NUM_SESSION_GROUPS \
+  ( sizeof( SessionGroups ) / sizeof( SessionGroups[0] ) )
+
+static bool SessionChanged( void )
+{
+  for ( size_t i = 0; i < NUM_SESSION_GROUPS; i++ ) {
+    uint32_t offset = SessionGroups[i].offset;
+    if ( !session_store_matches( offset, (const uint8_t*) &NvmImage + offset,
+                                 SessionGroups[i].size ) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool SaveFrameCounters( void )
+{
+  session_counters_t counters = {
+      .fcnt_up     = NvmImage.Crypto.FCntList.FCntUp,
+      .n_fcnt_down = NvmImage.Crypto.FCntList.NFCntDown,
+      .a_fcnt_down = NvmImage.Crypto.FCntList.AFCntDown,
+      .fcnt_down   = NvmImage.Crypto.FCntList.FCntDown,
+  };
+  return session_store_save_counters( &counters );
+}
+
+/*!
+ * Put the newest logged frame counters into the restored session, and
+ * update its crypto group's CRC (which the MAC checks on restore)
+ */
+static void RestoreFrameCounters( void )
+{
+  session_counters_t counters;
+  if ( !session_store_load_counters( &counters ) ) {
+    return;
+  }
+  NvmImage.Crypto.FCntList.FCntUp    = counters.fcnt_up;
+  NvmImage.Crypto.FCntList.NFCntDown = counters.n_fcnt_down;
+  NvmImage.Crypto.FCntList.AFCntDown = counters.a_fcnt_down;
+  NvmImage.Crypto.FCntList.FCntDown  = counters.fcnt_down;
+  NvmImage.Crypto.Crc32 =
+      Crc32( (uint8_t*) &NvmImage.Crypto,
+             sizeof( NvmImage.Crypto ) - sizeof( NvmImage.Crypto.Crc32 ) );
+}
+
 const char* lorawan_default_dev_eui( char* dev_eui )
 {
   uint8_t boardId[8];
@@ -207,14 +285,24 @@ const char* lorawan_default_dev_eui( char* dev_eui )
 int lorawan_init( const struct lorawan_sx1276_settings* sx1276_settings,
                   LoRaMacRegion_t                       region )
 {
+  rx_queue_init( &RxQueue );
   EepromMcuInit();
 
+  // Our stored session takes precedence over the library's EEPROM sector,
+  // which it rewrites in place (and can lose to a power cut)
+  if ( session_store_load( (uint8_t*) &NvmImage, sizeof( NvmImage ) ) ==
+       sizeof( NvmImage ) ) {
+    RestoreFrameCounters();
+    EepromMcuWriteBuffer( 0, (uint8_t*) &NvmImage, sizeof( NvmImage ) );
+  }
+
   RtcInit();
   SpiInit( &SX1276.Spi,
            (SpiId_t) ( ( sx1276_settings->spi.inst == spi0 ) ? 0 : 1 ),
            sx1276_settings->spi.mosi /*MOSI*/,
            sx1276_settings->spi.miso /*MISO*/,
            sx1276_settings->spi.sck /*SCK*/, NC );
+  radio_io_init( sx1276_settings->spi.inst );
 
   SX1276.Spi.Nss.pin = sx1276_settings->spi.nss;
   SX1276.Reset.pin   = sx1276_settings->reset;
@@ -280,10 +368,126 @@ int lorawan_is_joined()
   return ( LmHandlerJoinStatus() == LORAMAC_HANDLER_SET );
 }
 
+int lorawan_set_datarate( int8_t datarate )
+{
+  MibRequestConfirm_t mibReq;
+
+  LmHandlerParams.AdrEnable  = false;
+  LmHandlerParams.TxDatarate = datarate;
+
+  mibReq.Type            = MIB_ADR;
+  mibReq.Param.AdrEnable = false;
+  LoRaMacMibSetRequestConfirm( &mibReq );
+
+  // So the MAC's payload limits are for the data rate we'll send at
+  mibReq.Type                   = MIB_CHANNELS_DATARATE;
+  mibReq.Param.ChannelsDatarate = datarate;
+  if ( LoRaMacMibSetRequestConfirm( &mibReq ) != LORAMAC_STATUS_OK ) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// LmHandler doesn't pass the MAC's LinkCheckAns on, nor how many times
+// an uplink went out, so we wrap the MAC's initialization (linked with
+// --wrap=LoRaMacInitialization) to see its MLME and MCPS confirmations
+// first
+static void ( *LmHandlerMlmeConfirm )( MlmeConfirm_t* mlmeConfirm );
+static void ( *LmHandlerMcpsConfirm )( McpsConfirm_t* mcpsConfirm );
+static LoRaMacPrimitives_t WrappedPrimitives;
+
+// Of the latest uplink, for OnTxData
+static uint8_t     LastNbTrans     = 0;
+static TimerTime_t LastTxTimeOnAir = 0;
+
+static void OnMlmeConfirm( MlmeConfirm_t* mlmeConfirm )
+{
+  if ( ( mlmeConfirm->MlmeRequest == MLME_LINK_CHECK ) &&
+       ( mlmeConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK ) ) {
+    link_check( mlmeConfirm->DemodMargin, mlmeConfirm->NbGateways );
+  }
+  if ( ( mlmeConfirm->MlmeRequest != MLME_JOIN ) &&
+       ( mlmeConfirm->Status == LORAMAC_EVENT_INFO_STATUS_OK ) ) {
+    telemetry_mac_command( true );
+  }
+  LmHandlerMlmeConfirm( mlmeConfirm );
+}
+
+static void OnMcpsConfirm( McpsConfirm_t* mcpsConfirm )
+{
+  LastNbTrans     = mcpsConfirm->NbTrans;
+  LastTxTimeOnAir = mcpsConfirm->TxTimeOnAir;
+  LmHandlerMcpsConfirm( mcpsConfirm );
+}
+
+// Likewise, we wrap the RTC alarm the MAC's timers share (linked with
+// --wrap=RtcSetAlarm,--wrap=RtcStopAlarm) to tell when it's next due.
+// The alarm is set in ticks from the timer context, as RtcSetAlarm takes
+static bool     AlarmSet       = false;
+static uint32_t AlarmTimestamp = 0;
+
+void __real_RtcSetAlarm( uint32_t timeout );
+void __real_RtcStopAlarm( void );
+
+void __wrap_RtcSetAlarm( uint32_t timeout )
+{
+  AlarmSet       = true;
+  AlarmTimestamp = timeout;
+  __real_RtcSetAlarm( timeout );
+}
+
+void __wrap_RtcStopAlarm( void )
+{
+  AlarmSet = false;
+  __real_RtcStopAlarm();
+}
+
+uint32_t lorawan_next_timer_ms( void )
+{
+  uint32_t next_ms = UINT32_MAX;
+
+  CRITICAL_SECTION_BEGIN();
+  if ( AlarmSet ) {
+    uint32_t elapsed = RtcGetTimerElapsedTime();
+    if ( elapsed >= AlarmTimestamp ) {
+      // Report it once; the alarm's interrupt takes it from here
+      AlarmSet = false;
+      next_ms  = 0;
+    }
+    else {
+      next_ms = RtcTick2Ms( AlarmTimestamp - elapsed );
+    }
+  }
+  CRITICAL_SECTION_END();
+
+  return next_ms;
+}
+
+LoRaMacStatus_t __real_LoRaMacInitialization( LoRaMacPrimitives_t* primitives,
+                                              LoRaMacCallback_t*   callbacks,
+                                              LoRaMacRegion_t      region );
+
+LoRaMacStatus_t __wrap_LoRaMacInitialization( LoRaMacPrimitives_t* primitives,
+                                              LoRaMacCallback_t*   callbacks,
+                                              LoRaMacRegion_t      region )
+{
+  WrappedPrimitives                = *primitives;
+  LmHandlerMlmeConfirm             = primitives->MacMlmeConfirm;
+  LmHandlerMcpsConfirm             = primitives->MacMcpsConfirm;
+  WrappedPrimitives.MacMlmeConfirm = OnMlmeConfirm;
+  WrappedPrimitives.MacMcpsConfirm = OnMcpsConfirm;
+
+  return __real_LoRaMacInitialization( &WrappedPrimitives, callbacks,
+                                       region );
+}
+
 int lorawan_process()
 {
   int sleep = 0;
 
+  radio_io_mac_running();
+
   // Processes the LoRaMac events
   LmHandlerProcess();
 
@@ -310,7 +514,7 @@ int lorawan_process_timeout_ms( uint32_t timeout_ms )
   do {
     lorawan_process();
 
-    if ( AppRxData.Port ) {
+    if ( rx_queue_depth( &RxQueue ) > 0 ) {
       return 0;
     }
     else if ( joined != lorawan_is_joined() ) {
@@ -340,23 +544,37 @@ int lorawan_send_unconfirmed( const void* data, uint8_t data_len,
 
 int lorawan_receive( void* data, uint8_t data_len, uint8_t* app_port )
 {
-  *app_port = AppRxData.Port;
-  if ( *app_port == 0 ) {
+  const rx_frame_t* frame = rx_queue_peek( &RxQueue );
+  if ( frame == NULL ) {
+    *app_port = 0;
     return -1;
   }
 
-  int receive_length = AppRxData.BufferSize;
+  *app_port          = frame->port;
+  int receive_length = frame->len;
 
   if ( data_len < receive_length ) {
     receive_length = data_len;
   }
 
-  memcpy( data, AppRxData.Buffer, receive_length );
-  AppRxData.Port = 0;
+  memcpy( data, frame->data, receive_length );
+  rx_queue_pop( &RxQueue );
 
   return receive_length;
 }
 
+rx_queue_t* lorawan_rx_queue( void )
+{
+  return &RxQueue;
+}
+
+uint32_t lorawan_next_fcnt_up( void )
+{
+  uint32_t fcnt_up = 0;
+  LoRaMacCryptoGetFCntUp( &fcnt_up );
+  return fcnt_up;
+}
+
 void lorawan_debug( bool debug )
 {
   Debug = debug;
@@ -369,6 +587,7 @@ int lorawan_erase_nvm()
   }
 
   EepromMcuFlush();
+  session_store_erase();
 
   return 0;
 }
@@ -385,7 +604,19 @@ static void OnNvmDataChange( LmHandlerNvmContextStates_t state,
     DisplayNvmDataChange( state, size );
   }
 
-  EepromMcuFlush();
+  // Every uplink moves the frame counters on, so those are logged on
+  // their own, and the whole image (two sector erases with interrupts
+  // off) is only saved when the rest of the session changes, or the log
+  // fills
+  if ( state == LORAMAC_HANDLER_NVM_STORE ) {
+    EepromMcuReadBuffer( 0, (uint8_t*) &NvmImage, sizeof( NvmImage ) );
+    if ( !SessionChanged() && SaveFrameCounters() ) {
+      return;
+    }
+    if ( !session_store_save( (uint8_t*) &NvmImage, sizeof( NvmImage ) ) ) {
+      printf( "[LoRaWAN] Failed to save the session\n" );
+    }
+  }
 }
 
 static void OnNetworkParametersChange( CommissioningParams_t* params )
@@ -576,6 +807,9 @@ static void OnMacMcpsRequest( LoRaMacStatus_t status, McpsReq_t* mcpsReq,
   if ( Debug ) {
     DisplayMacMcpsRequestUpdate( status, mcpsReq, nextTxIn );
   }
+
+  telemetry_uplink_request( status == LORAMAC_STATUS_OK,
+                            mcpsReq->Type == MCPS_CONFIRMED );
 }
 
 static void OnMacMlmeRequest( LoRaMacStatus_t status, MlmeReq_t* mlmeReq,
@@ -584,6 +818,11 @@ static void OnMacMlmeRequest( LoRaMacStatus_t status, MlmeReq_t* mlmeReq,
   if ( Debug ) {
     DisplayMacMlmeRequestUpdate( status, mlmeReq, nextTxIn );
   }
+
+  // Join requests are counted as their results come in
+  if ( ( status == LORAMAC_STATUS_OK ) && ( mlmeReq->Type != MLME_JOIN ) ) {
+    telemetry_mac_command( false );
+  }
 }
 
 static void OnJoinRequest( LmHandlerJoinParams_t* params )
@@ -592,6 +831,9 @@ static void OnJoinRequest( LmHandlerJoinParams_t* params )
     DisplayJoinRequestUpdate( params );
   }
 
+  // Lets the channel mask change before the next join request
+  join_result( params->Status != LORAMAC_HANDLER_ERROR );
+
   if ( params->Status == LORAMAC_HANDLER_ERROR ) {
     LmHandlerJoin();
   }
@@ -606,14 +848,17 @@ static void OnTxData( LmHandlerTxParams_t* params )
     DisplayTxUpdate( params );
   }
 
-  printf( "Got here - %d %d %d\n", params->AppData.BufferSize,
-          params->MsgType == LORAMAC_HANDLER_CONFIRMED_MSG,
-          params->AckReceived );
-  if ( ( params->AppData.BufferSize != 0 ) &&
-       ( params->MsgType == LORAMAC_HANDLER_CONFIRMED_MSG ) &&
+  bool confirmed = ( params->MsgType == LORAMAC_HANDLER_CONFIRMED_MSG );
+  if ( ( params->AppData.BufferSize != 0 ) && confirmed &&
        ( params->AckReceived != 0 ) ) {
     confirm();
   }
+
+  if ( params->IsMcpsConfirm ) {
+    telemetry_uplink_done( confirmed, params->AckReceived != 0,
+                           LastNbTrans, LastTxTimeOnAir );
+    mac_tx_done( params->AckReceived != 0 );
+  }
 }
 
 static void OnRxData( LmHandlerAppData_t*  appData,
@@ -623,9 +868,16 @@ static void OnRxData( LmHandlerAppData_t*  appData,
     DisplayRxUpdate( appData, params );
   }
 
-  memcpy( AppRxData.Buffer, appData->Buffer, appData->BufferSize );
-  AppRxData.BufferSize = appData->BufferSize;
-  AppRxData.Port       = appData->Port;
+  if ( params->Status == LORAMAC_EVENT_INFO_STATUS_OK ) {
+    link_downlink( params->Rssi, params->Snr );
+  }
+
+  // Port 0 carries only MAC commands, which the MAC has dealt with
+  if ( ( appData->Port != 0 ) && ( appData->BufferSize != 0 ) &&
+       rx_queue_push( &RxQueue, appData->Port, appData->Buffer,
+                      appData->BufferSize ) ) {
+    mac_rx( appData->Port, appData->BufferSize );
+  }
 }
 
 static void OnClassChange( DeviceClass_t deviceClass )
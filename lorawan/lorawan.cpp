@@ -4,8 +4,17 @@
 // Definitions of the LoRaWAN class
 
 #include "confirm.h"
+#include "join_result.h"
+#include "link_quality.h"
+#include "mac_events.h"
+#include "mac_telemetry.h"
 #include "lorawan/lorawan.h"
+#include "lorawan/seq_ack.h"
+#include "pico/rand.h"
 #include "utils/debug.h"
+#include "utils/flash.h"
+#include <cinttypes>
+#include <stdlib.h>
 
 LoRaWAN* curr_lorawan = nullptr;
 
@@ -17,24 +26,266 @@ void lorawan_confirm()
   }
 }
 
+void lorawan_join_result( bool joined )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_join_result( joined );
+  }
+}
+
+void lorawan_link_downlink( int8_t rssi, int8_t snr )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_link_downlink( rssi, snr );
+  }
+}
+
+void lorawan_link_check( uint8_t margin, uint8_t gateways )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_link_check( margin, gateways );
+  }
+}
+
+void lorawan_tx_done( bool acked )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_tx_done( acked );
+  }
+}
+
+void lorawan_rx( uint8_t app_port, uint8_t len )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_rx( app_port, len );
+  }
+}
+
+void lorawan_uplink_request( bool accepted, bool confirmed )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_uplink_request( accepted, confirmed );
+  }
+}
+
+void lorawan_uplink_done( bool confirmed, bool acked,
+                          uint8_t transmissions, uint32_t airtime_ms )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_uplink_done( confirmed, acked, transmissions,
+                                  airtime_ms );
+  }
+}
+
+void lorawan_mac_command( bool answer )
+{
+  if ( curr_lorawan ) {
+    curr_lorawan->on_mac_command( answer );
+  }
+}
+
+// -----------------------------------------------------------------------
+// Learned sub-band
+// -----------------------------------------------------------------------
+// Kept as a log of one-word records in its own sector, so it's only
+// erased once every thousand or so changes. The newest record is the
+// last one before erased flash
+
+#define SUBBAND_RECORD_MAGIC 0x5B5B0000
+#define SUBBAND_RECORD_ERASED 0xFFFFFFFF
+#define SUBBAND_NUM_RECORDS ( FLASH_SECTOR_SIZE / sizeof( uint32_t ) )
+
+static const uint32_t* subband_records()
+{
+  return (const uint32_t*) flash_read( JOIN_SUBBAND_OFFSET );
+}
+
+static uint32_t subband_record( int subband )
+{
+  return SUBBAND_RECORD_MAGIC | ( ( subband & 0xFF ) << 8 ) |
+         ( ~subband & 0xFF );
+}
+
+static int load_subband()
+{
+  const uint32_t* records = subband_records();
+  int             subband = SUBBAND_NONE;
+  for ( uint32_t i = 0; i < SUBBAND_NUM_RECORDS; i++ ) {
+    if ( records[i] == SUBBAND_RECORD_ERASED ) {
+      break;
+    }
+    int candidate = ( records[i] >> 8 ) & 0xFF;
+    if ( records[i] == subband_record( candidate ) ) {
+      subband = candidate;
+    }
+  }
+  return subband;
+}
+
+static void save_subband( int subband )
+{
+  const uint32_t* records = subband_records();
+  uint32_t        next    = 0;
+  while ( ( next < SUBBAND_NUM_RECORDS ) &&
+          ( records[next] != SUBBAND_RECORD_ERASED ) ) {
+    next++;
+  }
+  if ( next == SUBBAND_NUM_RECORDS ) {
+    flash_erase_sector( JOIN_SUBBAND_OFFSET );
+    next = 0;
+  }
+  uint32_t record = subband_record( subband );
+  flash_program( JOIN_SUBBAND_OFFSET + next * sizeof( uint32_t ),
+                 (const uint8_t*) &record, sizeof( record ) );
+}
+
 // -----------------------------------------------------------------------
 // Constructor
 // -----------------------------------------------------------------------
 
-LoRaWAN::LoRaWAN() : join_started( false ), msg_sent( false )
+LoRaWAN::LoRaWAN()
+    : initialized( false ),
+      join_started( false ),
+      joined( false ),
+      msg_sent( false ),
+      msg_confirmed( false ),
+      warm_boot( false ),
+      join_ms( -1 ),
+      first_uplink_ms( -1 ),
+      callback( nullptr ),
+      callback_arg( nullptr ),
+      port_handlers(),
+      num_port_handlers( 0 ),
+      last_init_ms( 0 ),
+      tx_in_progress( false ),
+      phase_start_us( 0 ),
+      busy_us{ 0, 0 },
+      wall_us{ 0, 0 },
+      radio_at_tx_done(),
+      radio_cycles( 0 ),
+      cycle_blocked_us( 0 ),
+      cycle_blocked_max_us( 0 ),
+      cycle_dio_us( 0 ),
+      scheduler( get_rand_32() ),
+      subbands( load_subband() ),
+      datarates(),
+      telemetry()
 {
   curr_lorawan = this;
   on_confirm( lorawan_confirm );
+  ::on_join_result( lorawan_join_result );  // Not the member function
+  on_link_quality( lorawan_link_downlink, lorawan_link_check );
+  on_mac_events( lorawan_tx_done, lorawan_rx );
+  on_mac_telemetry( lorawan_uplink_request, lorawan_uplink_done,
+                    lorawan_mac_command );
+}
+
+void LoRaWAN::set_callback( lorawan_callback_t callback, void* arg )
+{
+  this->callback = callback;
+  callback_arg   = arg;
+}
+
+void LoRaWAN::emit( lorawan_event_t event )
+{
+  if ( callback ) {
+    callback( event, callback_arg );
+  }
+}
+
+// -----------------------------------------------------------------------
+// begin
+// -----------------------------------------------------------------------
+
+bool LoRaWAN::begin()
+{
+  if ( initialized ) {
+    return true;
+  }
   if ( lorawan_init_otaa( &sx1276_settings, CUSTOM_LORAWAN_REGION,
                           &otaa_settings ) < 0 ) {
     debug( "[LoRaWAN] Initialization Failed...\n" );
-    while ( 1 ) {
-      tight_loop_contents();
-    }
+    emit( LORAWAN_INIT_FAILED );
+    return false;
   }
-  else {
-    debug( "[LoRaWAN] Initialization Successful!\n" );
+  debug( "[LoRaWAN] Initialization Successful!\n" );
+  initialized    = true;
+  phase_start_us = time_us_64();
+
+  if ( CUSTOM_LORAWAN_LINK_DATARATE ) {
+    lorawan_set_datarate( DR_MIN );
+  }
+  emit( LORAWAN_INIT_DONE );
+
+  // The MAC restores a stored session as it starts
+  warm_boot = lorawan_is_joined();
+  if ( warm_boot ) {
+    debug( "[LoRaWAN] Resuming the stored session\n" );
+    join_started = true;
+    on_joined();
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// process
+// -----------------------------------------------------------------------
+// Time spent here is charged to whichever phase we're in, idle or
+// transmitting (from handing an uplink to the MAC to its RX windows
+// closing). Radio interrupts run outside of this, and aren't counted
+
+void LoRaWAN::set_tx_in_progress( bool in_progress )
+{
+  uint64_t now_us = time_us_64();
+  wall_us[tx_in_progress] += now_us - phase_start_us;
+  phase_start_us = now_us;
+  tx_in_progress = in_progress;
+}
+
+uint32_t LoRaWAN::process()
+{
+  if ( !initialized ) {
+    return LORAWAN_IDLE_MS;
+  }
+
+  uint64_t start_us = time_us_64();
+  bool     pending  = ( lorawan_process() == 0 );
+  dispatch_downlinks();
+  uint64_t end_us = time_us_64();
+
+  busy_us[tx_in_progress] += end_us - start_us;
+  wall_us[tx_in_progress] += end_us - phase_start_us;
+  phase_start_us = end_us;
+
+  return pending ? 0 : lorawan_next_timer_ms();
+}
+
+// Milliseconds from now until at_ms, or LORAWAN_IDLE_MS if never
+static uint32_t ms_until( uint64_t at_ms, uint64_t now_ms )
+{
+  if ( at_ms == UINT64_MAX ) {
+    return LORAWAN_IDLE_MS;
+  }
+  if ( at_ms <= now_ms ) {
+    return 0;
+  }
+  uint64_t ms = at_ms - now_ms;
+  return ( ms < LORAWAN_IDLE_MS ) ? (uint32_t) ms : LORAWAN_IDLE_MS - 1;
+}
+
+uint32_t LoRaWAN::init_retry_ms()
+{
+  if ( initialized || ( last_init_ms == 0 ) ) {
+    return LORAWAN_IDLE_MS;
   }
+  return ms_until( last_init_ms + LORAWAN_INIT_RETRY_MS,
+                   time_us_64() / 1000 );
+}
+
+uint32_t LoRaWAN::send_retry_ms()
+{
+  uint64_t now_ms = time_us_64() / 1000;
+  return ms_until( scheduler.next_chance_ms( now_ms ), now_ms );
 }
 
 // -----------------------------------------------------------------------
@@ -43,21 +294,88 @@ LoRaWAN::LoRaWAN() : join_started( false ), msg_sent( false )
 
 bool LoRaWAN::try_join()
 {
+  if ( !initialized ) {
+    uint64_t now_ms = time_us_64() / 1000;
+    if ( ( last_init_ms != 0 ) &&
+         ( now_ms - last_init_ms < LORAWAN_INIT_RETRY_MS ) ) {
+      return false;
+    }
+    last_init_ms = now_ms;
+    if ( !begin() ) {
+      return false;
+    }
+  }
+
   if ( !join_started ) {
     debug( "[LoRaWAN] Starting to join...\n" );
+    set_subband( subbands.start_join( time_us_64() / 1000 ) );
     lorawan_join();
     join_started = true;
   }
+  return joined;
+}
 
-  if ( lorawan_is_joined() ) {
-    debug( "[LoRaWAN] Connected!\n" );
-    return true;
+void LoRaWAN::on_joined()
+{
+  debug( "[LoRaWAN] Connected!\n" );
+  joined  = true;
+  join_ms = time_us_64() / 1000;
+
+  // The join accept counts against our downlinks
+  if ( !warm_boot ) {
+    scheduler.on_downlink( join_ms );
   }
-  else {
-    return false;
+  emit( LORAWAN_JOINED );
+}
+
+// -----------------------------------------------------------------------
+// on_join_result
+// -----------------------------------------------------------------------
+// The library sends the next join request as soon as this returns, so
+// a failed one moves the sweep on first
+
+void LoRaWAN::on_join_result( bool joined )
+{
+  telemetry.on_join_result( joined );
+  if ( !joined ) {
+    set_subband( subbands.on_join_failed() );
+    return;
+  }
+
+  on_joined();
+
+  MibRequestConfirm_t mib_req;
+  mib_req.Type = MIB_CHANNELS_MASK;
+  if ( LoRaMacMibGetRequestConfirm( &mib_req ) != LORAMAC_STATUS_OK ) {
+    return;
+  }
+  if ( subbands.on_joined( time_us_64() / 1000,
+                           mib_req.Param.ChannelsMask ) &&
+       CUSTOM_LORAWAN_LEARN_SUBBAND ) {
+    debug( "[LoRaWAN] Learned sub-band %d\n",
+           subbands.stats().learned + 1 );
+    save_subband( subbands.stats().learned );
   }
 }
 
+// The default mask too, since the MAC resets to it for every join
+void LoRaWAN::set_subband( int subband )
+{
+  if ( !CUSTOM_LORAWAN_LEARN_SUBBAND ) {
+    return;
+  }
+  uint16_t mask[SUBBAND_MASK_LEN];
+  SubbandSelector::mask( subband, mask );
+
+  MibRequestConfirm_t mib_req;
+  mib_req.Type                      = MIB_CHANNELS_DEFAULT_MASK;
+  mib_req.Param.ChannelsDefaultMask = mask;
+  LoRaMacMibSetRequestConfirm( &mib_req );
+  mib_req.Type               = MIB_CHANNELS_MASK;
+  mib_req.Param.ChannelsMask = mask;
+  LoRaMacMibSetRequestConfirm( &mib_req );
+}
+
 // -----------------------------------------------------------------------
 // send_confirmed
 // -----------------------------------------------------------------------
@@ -85,38 +403,398 @@ int LoRaWAN::send_confirmed( const void* data, uint8_t data_len,
 // try_send
 // -----------------------------------------------------------------------
 
-uint8_t  receive_port = 0;
-uint8_t  receive_msg[50];
-uint32_t msg_send_time;
+// The scheduler decides when to send and resend; each resend backs off
+// further, and nothing is sent if it would go over our daily budgets
 
 bool LoRaWAN::try_send( const uint8_t* data, uint8_t data_len )
 {
-  if ( !msg_sent ) {
-    msg_confirmed = false;
-    if ( send_confirmed( data, data_len, 2 ) >= 0 ) {
-      msg_sent      = true;
-      msg_send_time = to_ms_since_boot( get_absolute_time() );
-    }
-  }
+  uint64_t now_ms = time_us_64() / 1000;
 
   // Wait for downlink
   if ( msg_confirmed ) {
     debug( "Got a confirmation!\n" );
-    msg_sent = false;
+    scheduler.on_downlink( now_ms );
+    scheduler.on_delivered();
+    datarates.on_uplink_delivered();
+    msg_sent      = false;
+    msg_confirmed = false;
     return true;
   }
 
-  // Send again after 5 seconds
-  if ( to_ms_since_boot( get_absolute_time() ) - msg_send_time > 5000 ) {
-    msg_confirmed = false;
-    if ( send_confirmed( data, data_len, 2 ) >= 0 ) {
-      msg_send_time = to_ms_since_boot( get_absolute_time() );
+  // Send (or send again) when the scheduler lets us
+  uint8_t dr = pick_datarate( now_ms, data_len );
+  if ( scheduler.check( now_ms, dr, data_len, true ) != SCHED_SEND ) {
+    return false;
+  }
+  if ( send_confirmed( data, data_len, CONFIRMED_PORT ) >= 0 ) {
+    if ( msg_sent ) {
+      datarates.on_uplink_lost();
+      telemetry.on_resend();
     }
+    msg_sent = true;
+    on_uplink( now_ms, dr, data_len );
+  }
+  else {
+    scheduler.on_mac_busy( now_ms );
   }
   return false;
 }
 
+// -----------------------------------------------------------------------
+// try_send_unconfirmed
+// -----------------------------------------------------------------------
+// Nothing tells us these arrived, so the backoff only resets when the
+// caller says so (when an application-level ACK shows progress)
+
+bool LoRaWAN::try_send_unconfirmed( const uint8_t* data, uint8_t data_len,
+                                    uint8_t app_port )
+{
+  uint64_t now_ms = time_us_64() / 1000;
+  uint8_t  dr     = pick_datarate( now_ms, data_len );
+  if ( scheduler.check( now_ms, dr, data_len, false ) != SCHED_SEND ) {
+    return false;
+  }
+  if ( lorawan_send_unconfirmed( data, data_len, app_port ) < 0 ) {
+    scheduler.on_mac_busy( now_ms );
+    return false;
+  }
+  on_uplink( now_ms, dr, data_len );
+  return true;
+}
+
+void LoRaWAN::on_uplink( uint64_t now_ms, uint8_t dr,
+                         uint8_t data_len )
+{
+  scheduler.on_uplink( now_ms, dr, data_len );
+  datarates.on_uplink( now_ms, dr, data_len );
+  set_tx_in_progress( true );
+  if ( first_uplink_ms < 0 ) {
+    first_uplink_ms = now_ms;
+    debug( "[LoRaWAN] First uplink %llu ms after a %s boot\n", now_ms,
+           warm_boot ? "warm" : "cold" );
+  }
+}
+
+// -----------------------------------------------------------------------
+// try_send_telemetry
+// -----------------------------------------------------------------------
+// The frame is packed for the data rate the link calls for, rather than
+// pushing it faster; whatever doesn't fit waits for the next frame
+
+bool LoRaWAN::try_send_telemetry()
+{
+  uint64_t now_ms = time_us_64() / 1000;
+  if ( !joined || !telemetry.due( now_ms ) ) {
+    return false;
+  }
+  pick_datarate( now_ms, TELEMETRY_HEADER_LEN );
+
+  uint8_t  frame[TELEMETRY_MAX_FRAME];
+  uint32_t fields;
+  int      max_len = max_payload();
+  if ( max_len > TELEMETRY_MAX_FRAME ) {
+    max_len = TELEMETRY_MAX_FRAME;
+  }
+  int len = telemetry.encode( frame, max_len, &fields );
+  if ( ( len == 0 ) ||
+       !try_send_unconfirmed( frame, len, TELEMETRY_PORT ) ) {
+    return false;
+  }
+  telemetry.on_sent( now_ms, fields );
+  debug( "[LoRaWAN] Sent %d bytes of telemetry\n", len );
+  return true;
+}
+
+void LoRaWAN::reset_backoff()
+{
+  scheduler.on_delivered();
+}
+
+// -----------------------------------------------------------------------
+// pick_datarate
+// -----------------------------------------------------------------------
+// With our own data rate selection, a LinkCheckReq goes out with the next
+// uplink whenever the selector has nothing recent to go on
+
+uint8_t LoRaWAN::pick_datarate( uint64_t now_ms, uint8_t data_len )
+{
+  if ( !CUSTOM_LORAWAN_LINK_DATARATE ) {
+    return datarate();
+  }
+  uint8_t dr = datarates.choose( now_ms, data_len );
+  if ( dr != datarate() ) {
+    debug( "[LoRaWAN] Switching to DR%d\n", dr );
+    lorawan_set_datarate( dr );
+  }
+  if ( datarates.link_check_due() &&
+       ( LmHandlerLinkCheckReq() == LORAMAC_HANDLER_SUCCESS ) ) {
+    datarates.on_link_check_requested();
+  }
+  return dr;
+}
+
+void LoRaWAN::on_link_downlink( int8_t rssi, int8_t snr )
+{
+  datarates.on_downlink( time_us_64() / 1000, rssi, snr );
+  telemetry.on_downlink( rssi, snr );
+}
+
+// A LinkCheckAns after an unconfirmed uplink is a downlink of its own
+// (it may share one with an application ACK, which then counts twice,
+// erring on the side of the budget)
+void LoRaWAN::on_link_check( uint8_t margin, uint8_t gateways )
+{
+  uint64_t now_ms = time_us_64() / 1000;
+  datarates.on_link_check( now_ms, margin, gateways );
+  if ( !msg_sent ) {
+    scheduler.on_downlink( now_ms );
+  }
+}
+
+// -----------------------------------------------------------------------
+// Downlinks
+// -----------------------------------------------------------------------
+
+bool LoRaWAN::on_port( uint8_t app_port, lorawan_port_handler_t handler,
+                       void* arg )
+{
+  for ( int i = 0; i < num_port_handlers; i++ ) {
+    if ( port_handlers[i].port != app_port ) {
+      continue;
+    }
+    if ( handler ) {
+      port_handlers[i].handler = handler;
+      port_handlers[i].arg     = arg;
+    }
+    else {
+      port_handlers[i] = port_handlers[--num_port_handlers];
+    }
+    return true;
+  }
+  if ( !handler ) {
+    return true;
+  }
+  if ( num_port_handlers == LORAWAN_MAX_PORT_HANDLERS ) {
+    return false;
+  }
+  port_handlers[num_port_handlers++] = { app_port, handler, arg, 0 };
+  return true;
+}
+
+// Hand downlinks to their handlers until one has none
+void LoRaWAN::dispatch_downlinks()
+{
+  rx_queue_t*       rx_queue = lorawan_rx_queue();
+  const rx_frame_t* frame;
+  while ( ( frame = rx_queue_peek( rx_queue ) ) != nullptr ) {
+    int i = 0;
+    while ( ( i < num_port_handlers ) &&
+            ( port_handlers[i].port != frame->port ) ) {
+      i++;
+    }
+    if ( i == num_port_handlers ) {
+      return;
+    }
+    port_handlers[i].downlinks++;
+    port_handlers[i].handler( frame->data, frame->len,
+                              port_handlers[i].arg );
+    rx_queue_pop( rx_queue );
+  }
+}
+
+int LoRaWAN::receive( uint8_t* data, uint8_t max_len, uint8_t* app_port )
+{
+  if ( !initialized ) {
+    return -1;
+  }
+  dispatch_downlinks();
+  return lorawan_receive( data, max_len, app_port );
+}
+
+uint32_t LoRaWAN::downlinks()
+{
+  return scheduler.stats( time_us_64() / 1000 ).total_downlinks;
+}
+
 void LoRaWAN::confirm()
 {
   msg_confirmed = true;
-}
\ No newline at end of file
+  emit( LORAWAN_ACK );
+}
+
+// -----------------------------------------------------------------------
+// MAC events
+// -----------------------------------------------------------------------
+
+void LoRaWAN::on_tx_done( bool acked )
+{
+  (void) acked;  // Confirmations come through confirm()
+  set_tx_in_progress( false );
+  count_radio_cycle();
+  emit( LORAWAN_TX_DONE );
+}
+
+void LoRaWAN::on_uplink_request( bool accepted, bool confirmed )
+{
+  telemetry.on_uplink_request( time_us_64() / 1000, accepted, confirmed );
+}
+
+void LoRaWAN::on_uplink_done( bool confirmed, bool acked,
+                              uint8_t transmissions, uint32_t airtime_ms )
+{
+  telemetry.on_uplink_done( time_us_64() / 1000, confirmed, acked,
+                            transmissions, airtime_ms );
+}
+
+void LoRaWAN::on_mac_command( bool answer )
+{
+  telemetry.on_mac_command( answer );
+}
+
+// Each uplink is charged with the radio's work since the end of the one
+// before, which takes in its FIFO load and its RX windows
+void LoRaWAN::count_radio_cycle()
+{
+  radio_io_stats_t radio;
+  radio_io_stats( &radio );
+  uint32_t blocked_us = radio.blocked_us - radio_at_tx_done.blocked_us;
+  radio_cycles++;
+  cycle_blocked_us += blocked_us;
+  if ( blocked_us > cycle_blocked_max_us ) {
+    cycle_blocked_max_us = blocked_us;
+  }
+  cycle_dio_us += radio.dio_handler_us - radio_at_tx_done.dio_handler_us;
+  radio_at_tx_done = radio;
+}
+
+// The MAC runs this as the downlink is queued, so it counts against our
+// budget here, whoever takes it
+void LoRaWAN::on_rx( uint8_t app_port, uint8_t len )
+{
+  (void) app_port;  // Only printed with DEBUG
+  (void) len;
+  debug( "[LoRaWAN] %d byte downlink on port %d\n", len, app_port );
+  scheduler.on_downlink( time_us_64() / 1000 );
+  emit( LORAWAN_RX );
+}
+
+// -----------------------------------------------------------------------
+// max_payload
+// -----------------------------------------------------------------------
+// Leave room for any MAC commands waiting to piggyback on the next frame,
+// unless they'd use it all (then they're sent on their own)
+
+uint8_t LoRaWAN::max_payload()
+{
+  LoRaMacTxInfo_t tx_info;
+  if ( ( LoRaMacQueryTxPossible( 0, &tx_info ) == LORAMAC_STATUS_OK ) &&
+       ( tx_info.CurrentPossiblePayloadSize > 0 ) ) {
+    return tx_info.CurrentPossiblePayloadSize;
+  }
+  return tx_info.MaxPossibleApplicationDataSize;
+}
+
+// -----------------------------------------------------------------------
+// datarate
+// -----------------------------------------------------------------------
+
+uint8_t LoRaWAN::datarate()
+{
+  MibRequestConfirm_t mib_req;
+  mib_req.Type = MIB_CHANNELS_DATARATE;
+  if ( LoRaMacMibGetRequestConfirm( &mib_req ) != LORAMAC_STATUS_OK ) {
+    return 0;
+  }
+  return mib_req.Param.ChannelsDatarate;
+}
+
+// -----------------------------------------------------------------------
+// next_uplink
+// -----------------------------------------------------------------------
+
+void LoRaWAN::next_uplink( uint32_t* dev_addr, uint32_t* fcnt_up )
+{
+  MibRequestConfirm_t mib_req;
+  mib_req.Type = MIB_DEV_ADDR;
+  *dev_addr    = ( LoRaMacMibGetRequestConfirm( &mib_req ) ==
+                LORAMAC_STATUS_OK )
+                     ? mib_req.Param.DevAddr
+                     : 0;
+  *fcnt_up     = lorawan_next_fcnt_up();
+}
+
+// -----------------------------------------------------------------------
+// dev_eui
+// -----------------------------------------------------------------------
+
+uint64_t LoRaWAN::dev_eui()
+{
+  char        default_eui[17];
+  const char* hex = otaa_settings.device_eui;
+  if ( hex == NULL ) {
+    hex = lorawan_default_dev_eui( default_eui );
+  }
+  return strtoull( hex, nullptr, 16 );
+}
+
+// -----------------------------------------------------------------------
+// print_stats
+// -----------------------------------------------------------------------
+
+void LoRaWAN::print_stats()
+{
+  if ( !initialized ) {
+    printf( "[LoRaWAN] Not initialized\n" );
+    return;
+  }
+  printf( "[LoRaWAN] DR%d, %d byte payload, %s\n", datarate(),
+          max_payload(), msg_sent ? "awaiting confirmation" : "idle" );
+  printf( "[LoRaWAN] %s boot: joined at %" PRId64
+          " ms, first uplink at %" PRId64 " ms\n",
+          warm_boot ? "Warm" : "Cold", join_ms, first_uplink_ms );
+  subbands.print_stats();
+  datarates.print_stats();
+
+  rx_queue_t* rx_queue = lorawan_rx_queue();
+  printf( "[LoRaWAN] Downlink queue: %" PRIu32 "/%d waiting, %" PRIu32
+          " at most, %" PRIu32 " dropped, %" PRIu32 " truncated\n",
+          rx_queue_depth( rx_queue ), RX_QUEUE_SLOTS, rx_queue->high_water,
+          rx_queue->drops, rx_queue->truncated );
+  for ( int i = 0; i < num_port_handlers; i++ ) {
+    printf( "[LoRaWAN] Port %d: %" PRIu32 " downlinks handled\n",
+            port_handlers[i].port, port_handlers[i].downlinks );
+  }
+
+  const char* phases[2] = { "idle", "transmitting" };
+  for ( int phase = 0; phase < 2; phase++ ) {
+    printf( "[LoRaWAN] CPU while %s: %.3f%% (%" PRIu64 " us in %" PRIu64
+            " s)\n",
+            phases[phase],
+            wall_us[phase] ? 100.0 * busy_us[phase] / wall_us[phase] : 0.0,
+            busy_us[phase], wall_us[phase] / 1000000 );
+  }
+
+  radio_io_stats_t radio;
+  radio_io_stats( &radio );
+  printf( "[Radio] %" PRIu32 " SPI bursts (%" PRIu32 " by DMA), %" PRIu32
+          " bytes (%" PRIu32 " by DMA), %" PRIu64 " us blocked\n",
+          radio.bursts, radio.dma_bursts, radio.bytes, radio.dma_bytes,
+          radio.blocked_us );
+  printf( "[Radio] %" PRIu32 " DIO interrupts: %" PRIu64
+          " us to the handler on average (%" PRIu32 " at most), %" PRIu64
+          " us in handlers\n",
+          radio.dio_irqs,
+          radio.dio_irqs ? radio.dio_latency_us / radio.dio_irqs : 0,
+          radio.dio_latency_max_us, radio.dio_handler_us );
+  printf( "[Radio] MAC ran %" PRIu64 " us after a DIO handler on average (%"
+          PRIu32 " at most)\n",
+          radio.mac_runs ? radio.mac_delay_us / radio.mac_runs : 0,
+          radio.mac_delay_max_us );
+  printf( "[Radio] Per uplink: %" PRIu64 " us blocked on SPI on average (%"
+          PRIu32 " at most), %" PRIu64 " us in DIO handlers\n",
+          radio_cycles ? cycle_blocked_us / radio_cycles : 0,
+          cycle_blocked_max_us,
+          radio_cycles ? cycle_dio_us / radio_cycles : 0 );
+  scheduler.print_stats( time_us_64() / 1000 );
+  telemetry.print_stats();
+}
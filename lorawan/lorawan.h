@@ -2,22 +2,85 @@
 // lorawan.h
 // =======================================================================
 // Declarations of our LoRaWAN interface
+//
+// Nothing blocks: begin() starts the radio and MAC (and can be retried
+// if it fails), and process() runs the MAC, returning how long until it
+// next needs to run so the caller can sleep in between. Results arrive
+// as events, through a callback run from begin() or process().
+//
+// The try_* functions poll for the same results, for callers that would
+// rather not use events. try_join() calls begin() itself
 
 #ifndef LORAWAN_LORAWAN_H
 #define LORAWAN_LORAWAN_H
 
 #include "LmHandler.h"
+#include "lorawan/datarate.h"
 #include "lorawan/lorawan_config.h"
+#include "lorawan/radio_io.h"
+#include "lorawan/rx_queue.h"
+#include "lorawan/scheduler.h"
+#include "lorawan/subband.h"
+#include "lorawan/telemetry.h"
 #include <cstdint>
 
 void confirm();  // Called to confirm a message
 
+// -----------------------------------------------------------------------
+// Events
+// -----------------------------------------------------------------------
+
+enum lorawan_event_t {
+  LORAWAN_INIT_DONE = 0,  // begin() succeeded
+  LORAWAN_INIT_FAILED,    // begin() failed (the radio didn't answer)
+  LORAWAN_JOINED,         // Joined, or resumed a stored session
+  LORAWAN_TX_DONE,        // An uplink's RX windows are over
+  LORAWAN_ACK,            // A confirmed uplink was acknowledged
+  LORAWAN_RX,             // A downlink with data is ready to receive()
+  NUM_LORAWAN_EVENTS
+};
+
+typedef void ( *lorawan_callback_t )( lorawan_event_t event, void* arg );
+
+// Called with each downlink on a port (see LoRaWAN::on_port)
+typedef void ( *lorawan_port_handler_t )( const uint8_t* data, uint8_t len,
+                                          void* arg );
+
+#define LORAWAN_MAX_PORT_HANDLERS 4
+
+// How long process() may return when the MAC has no timer running
+#define LORAWAN_IDLE_MS UINT32_MAX
+
+// How often try_join() retries a failed begin()
+#define LORAWAN_INIT_RETRY_MS 5000
+
 class LoRaWAN {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Public Accessor Functions
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  public:
-  LoRaWAN();
+  LoRaWAN();  // Doesn't touch the radio; see begin()
+
+  // Called with each event, along with arg
+  void set_callback( lorawan_callback_t callback, void* arg );
+
+  // Start the radio and MAC. Returns whether that worked (and reports it
+  // as an event); it may be called again after a failure
+  bool begin();
+
+  // Run the MAC. Returns the milliseconds until it next needs to run
+  // (0 if straight away), or LORAWAN_IDLE_MS if only an interrupt will
+  // need it
+  uint32_t process();
+
+  // Milliseconds until try_join() will start the radio again after a
+  // failed begin(), or LORAWAN_IDLE_MS if it isn't waiting to
+  uint32_t init_retry_ms();
+
+  // Milliseconds until a frame the scheduler held back from the last
+  // try_send*() could go out (0 if it could now), or LORAWAN_IDLE_MS if
+  // only a change of data rate will let it
+  uint32_t send_retry_ms();
 
   // Return whether joining is successful
   bool try_join();
@@ -25,23 +88,140 @@ class LoRaWAN {
   // Return whether sending the message is successful
   bool try_send( const uint8_t* data, uint8_t data_len );
 
+  // Return whether the unconfirmed message was handed to the MAC (the
+  // scheduler may hold it back)
+  bool try_send_unconfirmed( const uint8_t* data, uint8_t data_len,
+                             uint8_t app_port );
+
+  // Call handler (from process() or receive()) with each downlink on
+  // app_port, in the order they arrived. A null handler unregisters the
+  // port. Returns false if there are already LORAWAN_MAX_PORT_HANDLERS
+  bool on_port( uint8_t app_port, lorawan_port_handler_t handler,
+                void* arg );
+
+  // Get the oldest downlink on a port with no handler, if it's next in
+  // line. Returns its length, or -1. Such downlinks hold up the ones
+  // behind them until they're received
+  int receive( uint8_t* data, uint8_t max_len, uint8_t* app_port );
+
+  // Send our telemetry (on TELEMETRY_PORT) if it's due and the scheduler
+  // allows. Returns whether it went out
+  bool try_send_telemetry();
+
+  // Call when unconfirmed messages are getting through, so the next one
+  // doesn't wait out a backoff
+  void reset_backoff();
+
   // Call to confirm a message has been sent
   void confirm();
 
+  // Call with the result of each join request
+  void on_join_result( bool joined );
+
+  // Call with the link quality of each downlink, and each LinkCheckAns
+  void on_link_downlink( int8_t rssi, int8_t snr );
+  void on_link_check( uint8_t margin, uint8_t gateways );
+
+  // Call at the end of each uplink, and with each downlink with data
+  void on_tx_done( bool acked );
+  void on_rx( uint8_t app_port, uint8_t len );
+
+  // Call with what the MAC does with each uplink, and each MAC command
+  void on_uplink_request( bool accepted, bool confirmed );
+  void on_uplink_done( bool confirmed, bool acked, uint8_t transmissions,
+                       uint32_t airtime_ms );
+  void on_mac_command( bool answer );
+
+  // Downlinks received since boot
+  uint32_t downlinks();
+
+  // Largest payload we can send at the current data rate
+  uint8_t max_payload();
+
+  // Current uplink data rate
+  uint8_t datarate();
+
+  // The DevAddr and frame counter the next new uplink goes out with
+  void next_uplink( uint32_t* dev_addr, uint32_t* fcnt_up );
+
+  // Our DevEUI: CUSTOM_LORAWAN_DEVICE_EUI, or else the board's unique ID.
+  // Known before begin()
+  uint64_t dev_eui();
+
+  void print_stats();
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Private Functions
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  private:
   int send_confirmed( const void* data, uint8_t data_len,
                       uint8_t app_port );
+  void on_uplink( uint64_t now_ms, uint8_t dr, uint8_t data_len );
+  void set_subband( int subband );
+  void emit( lorawan_event_t event );
+  void dispatch_downlinks();
+  void on_joined();
+  void set_tx_in_progress( bool in_progress );
+  void count_radio_cycle();
+
+  // The data rate to send a frame at, as the MAC's data rate
+  uint8_t pick_datarate( uint64_t now_ms, uint8_t data_len );
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Protected Attributes
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  protected:
+  bool initialized;
   bool join_started;
+  bool joined;
   bool msg_sent;
   bool msg_confirmed;
+
+  // Whether we resumed a stored session at boot (no join needed), and
+  // how long after boot we joined and first sent (-1 if not yet)
+  bool    warm_boot;
+  int64_t join_ms;
+  int64_t first_uplink_ms;
+
+  lorawan_callback_t callback;
+  void*              callback_arg;
+
+  struct {
+    uint8_t                port;
+    lorawan_port_handler_t handler;
+    void*                  arg;
+    uint32_t               downlinks;
+  } port_handlers[LORAWAN_MAX_PORT_HANDLERS];
+  int      num_port_handlers;
+  uint64_t last_init_ms;  // Of the latest begin() from try_join()
+
+  // CPU time spent in process(), and the time it covered, while idle and
+  // while an uplink is under way
+  bool     tx_in_progress;
+  uint64_t phase_start_us;
+  uint64_t busy_us[2];
+  uint64_t wall_us[2];
+
+  // Radio counters at the end of the latest uplink, and the CPU time each
+  // uplink (since the end of the one before) spent on the radio's SPI and
+  // in its DIO handlers
+  radio_io_stats_t radio_at_tx_done;
+  uint32_t         radio_cycles;
+  uint64_t         cycle_blocked_us;
+  uint32_t         cycle_blocked_max_us;
+  uint64_t         cycle_dio_us;
+
+  // Decides when we may (re)send, within our airtime and downlink budgets
+  UplinkScheduler scheduler;
+
+  // Picks the sub-band for each join request, and learns from joins
+  SubbandSelector subbands;
+
+  // Picks the fastest data rate the link can take
+  DatarateSelector datarates;
+
+  // Counts what the MAC and radio get up to, to send home now and then
+  Telemetry telemetry;
 };
 
 #endif  // LORAWAN_LORAWAN_H
\ No newline at end of file
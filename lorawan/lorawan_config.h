@@ -49,6 +49,19 @@ const struct lorawan_sx1276_settings sx1276_settings = {
 // for the region
 #define CUSTOM_LORAWAN_CHANNEL_MASK NULL
 
+// Whether to join on one US915 sub-band at a time, starting from the one
+// that last worked (see subband.h). Set to false with a channel mask
+#define CUSTOM_LORAWAN_LEARN_SUBBAND true
+
+// Whether to pick our own uplink data rate from link quality (see
+// datarate.h), rather than leaving it to the network with ADR
+#define CUSTOM_LORAWAN_LINK_DATARATE true
+
+// Whether to send readings as unconfirmed uplinks that the application
+// server acknowledges in batches (see seq_ack.h), rather than spending a
+// downlink on every confirmed uplink
+#define CUSTOM_LORAWAN_CUMULATIVE_ACKS false
+
 const struct lorawan_otaa_settings otaa_settings = {
     .device_eui   = CUSTOM_LORAWAN_DEVICE_EUI,
     .app_eui      = CUSTOM_LORAWAN_APP_EUI,
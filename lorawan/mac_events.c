@@ -0,0 +1,33 @@
+// =======================================================================
+// mac_events.c
+// =======================================================================
+// A thin wrapper to pass MAC events from the LoRaWAN library on
+
+#include "mac_events.h"
+#include <stddef.h>
+
+static void ( *curr_tx_done_callback )( bool acked ) = NULL;
+static void ( *curr_rx_callback )( uint8_t app_port,
+                                   uint8_t len )     = NULL;
+
+void on_mac_events( void ( *tx_done_callback )( bool acked ),
+                    void ( *rx_callback )( uint8_t app_port,
+                                           uint8_t len ) )
+{
+  curr_tx_done_callback = tx_done_callback;
+  curr_rx_callback      = rx_callback;
+}
+
+void mac_tx_done( bool acked )
+{
+  if ( curr_tx_done_callback != NULL ) {
+    curr_tx_done_callback( acked );
+  }
+}
+
+void mac_rx( uint8_t app_port, uint8_t len )
+{
+  if ( curr_rx_callback != NULL ) {
+    curr_rx_callback( app_port, len );
+  }
+}
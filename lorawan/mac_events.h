@@ -0,0 +1,47 @@
+// =======================================================================
+// mac_events.h
+// =======================================================================
+// A thin wrapper to pass the end of each uplink, and each downlink with
+// data, on from the LoRaWAN library, and to tell when the MAC next needs
+// to run
+
+#ifndef LORAWAN_MAC_EVENTS_H
+#define LORAWAN_MAC_EVENTS_H
+
+#include "rx_queue.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Call when an uplink's exchange (including its RX windows) is over
+void mac_tx_done( bool acked );
+
+// Call when a downlink with data has arrived (after lorawan_receive can
+// return it)
+void mac_rx( uint8_t app_port, uint8_t len );
+
+void on_mac_events( void ( *tx_done_callback )( bool acked ),
+                    void ( *rx_callback )( uint8_t app_port,
+                                           uint8_t len ) );
+
+// Milliseconds until the MAC's next timer expires (0 if it's due), or
+// UINT32_MAX if none is running. Radio interrupts can still need the MAC
+// sooner (defined with the library, in lorawan-library-for-pico.c)
+uint32_t lorawan_next_timer_ms( void );
+
+// The frame counter the next new uplink goes out with (defined with the
+// library, too)
+uint32_t lorawan_next_fcnt_up( void );
+
+// The queue lorawan_receive takes downlinks from, for consumers that want
+// to look before they take (defined with the library, too)
+rx_queue_t* lorawan_rx_queue( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LORAWAN_MAC_EVENTS_H
@@ -0,0 +1,49 @@
+// =======================================================================
+// mac_telemetry.c
+// =======================================================================
+// A thin wrapper to pass telemetry from the LoRaWAN library on
+
+#include "mac_telemetry.h"
+#include <stddef.h>
+
+static void ( *curr_uplink_request_callback )( bool accepted,
+                                               bool confirmed ) = NULL;
+static void ( *curr_uplink_done_callback )( bool confirmed, bool acked,
+                                            uint8_t  transmissions,
+                                            uint32_t airtime_ms ) = NULL;
+static void ( *curr_mac_command_callback )( bool answer )       = NULL;
+
+void on_mac_telemetry(
+    void ( *uplink_request_callback )( bool accepted, bool confirmed ),
+    void ( *uplink_done_callback )( bool confirmed, bool acked,
+                                    uint8_t  transmissions,
+                                    uint32_t airtime_ms ),
+    void ( *mac_command_callback )( bool answer ) )
+{
+  curr_uplink_request_callback = uplink_request_callback;
+  curr_uplink_done_callback    = uplink_done_callback;
+  curr_mac_command_callback    = mac_command_callback;
+}
+
+void telemetry_uplink_request( bool accepted, bool confirmed )
+{
+  if ( curr_uplink_request_callback != NULL ) {
+    curr_uplink_request_callback( accepted, confirmed );
+  }
+}
+
+void telemetry_uplink_done( bool confirmed, bool acked,
+                            uint8_t transmissions, uint32_t airtime_ms )
+{
+  if ( curr_uplink_done_callback != NULL ) {
+    curr_uplink_done_callback( confirmed, acked, transmissions,
+                               airtime_ms );
+  }
+}
+
+void telemetry_mac_command( bool answer )
+{
+  if ( curr_mac_command_callback != NULL ) {
+    curr_mac_command_callback( answer );
+  }
+}
@@ -0,0 +1,41 @@
+// =======================================================================
+// mac_telemetry.h
+// =======================================================================
+// A thin wrapper to pass what our telemetry counts (see telemetry.h) on
+// from the LoRaWAN library. Join results and downlinks come through
+// join_result.h and link_quality.h
+
+#ifndef LORAWAN_MAC_TELEMETRY_H
+#define LORAWAN_MAC_TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Call with each uplink request, whether the MAC took it, and whether
+// it's confirmed
+void telemetry_uplink_request( bool accepted, bool confirmed );
+
+// Call at the end of each uplink, with how many times it went out and
+// its time on air (ms)
+void telemetry_uplink_done( bool confirmed, bool acked,
+                            uint8_t transmissions, uint32_t airtime_ms );
+
+// Call with each MAC command we send (joins aside), and each answer
+void telemetry_mac_command( bool answer );
+
+void on_mac_telemetry(
+    void ( *uplink_request_callback )( bool accepted, bool confirmed ),
+    void ( *uplink_done_callback )( bool confirmed, bool acked,
+                                    uint8_t  transmissions,
+                                    uint32_t airtime_ms ),
+    void ( *mac_command_callback )( bool answer ) );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LORAWAN_MAC_TELEMETRY_H
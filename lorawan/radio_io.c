@@ -0,0 +1,323 @@
+// =======================================================================
+// radio_io.c
+// =======================================================================
+// DMA for the SX1276's SPI bursts, and timing of its SPI transfers and
+// DIO interrupts
+//
+// The library's radio driver talks to the SX1276 a byte at a time through
+// SpiInOut, between setting its NSS pin low and high again, and that's
+// all of it we can reach from outside (calls within the driver can't be
+// wrapped). So we wrap SpiInOut and GpioWrite (linked with --wrap): the
+// bytes of a write burst (a FIFO load, mostly) are gathered while NSS is
+// low, and go out by DMA when it's raised. NSS is raised for real from
+// the DMA's interrupt once they're out, and the CPU carries on in the
+// meantime; the next access to the radio waits for the DMA first. Reads
+// need each byte back as they go, so they stay a byte at a time.
+//
+// We also wrap SX1276IoIrqInit to time the driver's DIO handlers: from
+// the GPIO interrupt (a shared handler that runs before the SDK's
+// callback calls the driver) to the handler, how long the handler takes,
+// and from its end to the MAC next running, which is what acts on it. An
+// edge that waits on masked interrupts waits before we see it, too.
+
+#include "radio_io.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+#include "sx1276-board.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bursts with less data than this go out by the CPU (register writes
+// cost less than setting up the DMA)
+#define RADIO_DMA_MIN_LEN 8
+
+// Largest write burst we gather (the SX1276's whole FIFO)
+#define RADIO_BURST_MAX_LEN 256
+
+// DIO handlers the driver passes, and how many of them we time (only
+// DIO0 and DIO1 are wired)
+#define RADIO_NUM_DIO_HANDLERS 6
+#define RADIO_NUM_TIMED_DIO 2
+
+void     __real_GpioWrite( Gpio_t* obj, uint32_t value );
+uint16_t __real_SpiInOut( Spi_t* obj, uint16_t outData );
+void     __real_SX1276IoIrqInit( DioIrqHandler** irqHandlers );
+
+static spi_inst_t* RadioSpi = NULL;
+static int         DmaTx    = -1;
+static int         DmaRx    = -1;
+
+// The burst under way, and the write data gathered for it
+static bool     InBurst        = false;
+static bool     BurstAddressed = false;
+static bool     BurstWrite     = false;
+static uint32_t BurstStartUs   = 0;
+static uint16_t BurstLen       = 0;
+static uint8_t  BurstData[RADIO_BURST_MAX_LEN];
+
+// Whether a burst's data is still going out by DMA (with NSS low)
+static volatile bool DmaPending = false;
+static uint8_t       DmaDiscard;
+
+static DioIrqHandler*    DioHandlers[RADIO_NUM_TIMED_DIO];
+static volatile uint32_t DioEdgeUs[RADIO_NUM_TIMED_DIO];
+static volatile uint32_t DioDoneUs  = 0;
+static volatile bool     DioWaiting = false;  // For the MAC to run
+
+static radio_io_stats_t Stats;
+
+// -----------------------------------------------------------------------
+// DMA
+// -----------------------------------------------------------------------
+
+// Wait for the DMA to finish (if it hasn't), then end its burst. Runs
+// from the DMA's interrupt, and before anything else touches the radio
+static void FinishDma( void )
+{
+  uint32_t irq = save_and_disable_interrupts();
+  if ( DmaPending ) {
+    uint32_t start_us = time_us_32();
+    // The receive channel finishes once the last byte is clocked out
+    dma_channel_wait_for_finish_blocking( DmaRx );
+    __real_GpioWrite( &SX1276.Spi.Nss, 1 );
+    DmaPending = false;
+    Stats.blocked_us += time_us_32() - start_us;
+  }
+  restore_interrupts( irq );
+}
+
+static void OnDmaIrq( void )
+{
+  if ( dma_channel_get_irq1_status( DmaRx ) ) {
+    dma_channel_acknowledge_irq1( DmaRx );
+    FinishDma();
+  }
+}
+
+static void StartDma( void )
+{
+  io_rw_32* data_reg = &spi_get_hw( RadioSpi )->dr;
+
+  dma_channel_config config = dma_channel_get_default_config( DmaTx );
+  channel_config_set_transfer_data_size( &config, DMA_SIZE_8 );
+  channel_config_set_dreq( &config, spi_get_dreq( RadioSpi, true ) );
+  dma_channel_configure( DmaTx, &config, data_reg, BurstData, BurstLen,
+                         false );
+
+  // What comes back is discarded, but it has to be read for the SPI to
+  // keep going
+  config = dma_channel_get_default_config( DmaRx );
+  channel_config_set_transfer_data_size( &config, DMA_SIZE_8 );
+  channel_config_set_dreq( &config, spi_get_dreq( RadioSpi, false ) );
+  channel_config_set_read_increment( &config, false );
+  channel_config_set_write_increment( &config, false );
+  dma_channel_configure( DmaRx, &config, &DmaDiscard, data_reg, BurstLen,
+                         false );
+
+  DmaPending = true;
+  dma_start_channel_mask( ( 1u << DmaTx ) | ( 1u << DmaRx ) );
+}
+
+void radio_io_init( spi_inst_t* spi )
+{
+  RadioSpi = spi;
+  if ( DmaTx >= 0 ) {
+    return;  // Already set up by an earlier lorawan_init
+  }
+
+  // Without two channels, everything goes out by the CPU
+  int tx = dma_claim_unused_channel( false );
+  int rx = dma_claim_unused_channel( false );
+  if ( ( tx < 0 ) || ( rx < 0 ) ) {
+    if ( tx >= 0 ) {
+      dma_channel_unclaim( tx );
+    }
+    if ( rx >= 0 ) {
+      dma_channel_unclaim( rx );
+    }
+    return;
+  }
+  DmaTx = tx;
+  DmaRx = rx;
+
+  dma_channel_set_irq1_enabled( DmaRx, true );
+  irq_add_shared_handler( DMA_IRQ_1, OnDmaIrq,
+                          PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY );
+  irq_set_enabled( DMA_IRQ_1, true );
+}
+
+// -----------------------------------------------------------------------
+// SPI
+// -----------------------------------------------------------------------
+// The driver doesn't guard against its interrupt handlers interrupting a
+// burst, and neither do we
+
+static void EndBurst( void )
+{
+  bool by_dma = ( DmaTx >= 0 ) && ( BurstLen >= RADIO_DMA_MIN_LEN );
+  if ( by_dma ) {
+    Stats.dma_bursts++;
+    Stats.dma_bytes += BurstLen;
+    StartDma();
+  }
+  else {
+    if ( BurstLen > 0 ) {
+      spi_write_blocking( RadioSpi, BurstData, BurstLen );
+    }
+    __real_GpioWrite( &SX1276.Spi.Nss, 1 );
+  }
+  InBurst = false;
+
+  uint32_t irq = save_and_disable_interrupts();
+  Stats.bursts++;
+  Stats.blocked_us += time_us_32() - BurstStartUs;
+  restore_interrupts( irq );
+}
+
+void __wrap_GpioWrite( Gpio_t* obj, uint32_t value )
+{
+  if ( obj != &SX1276.Spi.Nss ) {
+    __real_GpioWrite( obj, value );
+    return;
+  }
+
+  if ( value != 0 ) {
+    if ( InBurst ) {
+      EndBurst();
+    }
+    else {
+      __real_GpioWrite( obj, value );
+    }
+    return;
+  }
+  FinishDma();
+  InBurst        = true;
+  BurstAddressed = false;
+  BurstWrite     = false;
+  BurstLen       = 0;
+  BurstStartUs   = time_us_32();
+  __real_GpioWrite( obj, value );
+}
+
+uint16_t __wrap_SpiInOut( Spi_t* obj, uint16_t outData )
+{
+  if ( ( obj != &SX1276.Spi ) || !InBurst || ( RadioSpi == NULL ) ) {
+    return __real_SpiInOut( obj, outData );
+  }
+  Stats.bytes++;
+
+  // The address byte says which way the burst goes
+  if ( !BurstAddressed ) {
+    BurstAddressed = true;
+    BurstWrite     = ( outData & 0x80 ) != 0;
+    return __real_SpiInOut( obj, outData );
+  }
+  if ( !BurstWrite ) {
+    return __real_SpiInOut( obj, outData );
+  }
+
+  // The driver ignores what comes back while writing
+  if ( BurstLen == RADIO_BURST_MAX_LEN ) {
+    spi_write_blocking( RadioSpi, BurstData, BurstLen );
+    BurstLen = 0;
+  }
+  BurstData[BurstLen++] = outData;
+  return 0;
+}
+
+// -----------------------------------------------------------------------
+// DIO interrupts
+// -----------------------------------------------------------------------
+
+// Runs first on each GPIO interrupt, to timestamp the DIO edges. It's
+// not a raw handler: the DIO pins stay out of the raw mask, so the SDK's
+// callback still acknowledges their edges and calls the driver
+static void OnGpioIrq( void )
+{
+  uint32_t now_us = time_us_32();
+  uint32_t pins[RADIO_NUM_TIMED_DIO] = { SX1276.DIO0.pin, SX1276.DIO1.pin };
+  for ( int dio = 0; dio < RADIO_NUM_TIMED_DIO; dio++ ) {
+    if ( gpio_get_irq_event_mask( pins[dio] ) & GPIO_IRQ_EDGE_RISE ) {
+      DioEdgeUs[dio] = now_us;
+    }
+  }
+}
+
+static void OnDio( int dio, void* context )
+{
+  uint32_t start_us = time_us_32();
+  DioHandlers[dio]( context );
+  uint32_t end_us = time_us_32();
+
+  uint32_t latency_us = start_us - DioEdgeUs[dio];
+  Stats.dio_irqs++;
+  Stats.dio_latency_us += latency_us;
+  if ( latency_us > Stats.dio_latency_max_us ) {
+    Stats.dio_latency_max_us = latency_us;
+  }
+  Stats.dio_handler_us += end_us - start_us;
+  DioDoneUs  = end_us;
+  DioWaiting = true;
+}
+
+static void OnDio0( void* context )
+{
+  OnDio( 0, context );
+}
+
+static void OnDio1( void* context )
+{
+  OnDio( 1, context );
+}
+
+void __wrap_SX1276IoIrqInit( DioIrqHandler** irqHandlers )
+{
+  static DioIrqHandler* wrapped[RADIO_NUM_DIO_HANDLERS];
+  static bool           gpio_irq_added = false;
+  DioIrqHandler*        timed[RADIO_NUM_TIMED_DIO] = { OnDio0, OnDio1 };
+
+  for ( int i = 0; i < RADIO_NUM_DIO_HANDLERS; i++ ) {
+    wrapped[i] = irqHandlers[i];
+    if ( ( i < RADIO_NUM_TIMED_DIO ) && ( irqHandlers[i] != NULL ) ) {
+      DioHandlers[i] = irqHandlers[i];
+      wrapped[i]     = timed[i];
+    }
+  }
+  __real_SX1276IoIrqInit( wrapped );
+
+  if ( !gpio_irq_added ) {
+    gpio_irq_added = true;
+    irq_add_shared_handler( IO_IRQ_BANK0, OnGpioIrq,
+                            PICO_SHARED_IRQ_HANDLER_HIGHEST_ORDER_PRIORITY );
+    irq_set_enabled( IO_IRQ_BANK0, true );
+  }
+}
+
+void radio_io_mac_running( void )
+{
+  uint32_t irq = save_and_disable_interrupts();
+  if ( DioWaiting ) {
+    uint32_t delay_us = time_us_32() - DioDoneUs;
+    DioWaiting        = false;
+    Stats.mac_runs++;
+    Stats.mac_delay_us += delay_us;
+    if ( delay_us > Stats.mac_delay_max_us ) {
+      Stats.mac_delay_max_us = delay_us;
+    }
+  }
+  restore_interrupts( irq );
+}
+
+// -----------------------------------------------------------------------
+// Stats
+// -----------------------------------------------------------------------
+
+void radio_io_stats( radio_io_stats_t* stats )
+{
+  uint32_t irq = save_and_disable_interrupts();
+  *stats       = Stats;
+  restore_interrupts( irq );
+}
@@ -0,0 +1,46 @@
+// =======================================================================
+// radio_io.h
+// =======================================================================
+// DMA for the SX1276's SPI bursts, and timing of its SPI transfers and
+// DIO interrupts, underneath the LoRaWAN library's radio driver (see
+// radio_io.c)
+
+#ifndef LORAWAN_RADIO_IO_H
+#define LORAWAN_RADIO_IO_H
+
+#include "hardware/spi.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint32_t bursts;              // Register or FIFO accesses (NSS low)
+  uint32_t dma_bursts;          // ... whose data went out by DMA
+  uint32_t bytes;               // Over SPI, address bytes included
+  uint32_t dma_bytes;           // ... of them by DMA
+  uint64_t blocked_us;          // CPU time spent on SPI transfers
+  uint32_t dio_irqs;            // DIO handlers run
+  uint64_t dio_latency_us;      // From the GPIO interrupt to the handler
+  uint32_t dio_latency_max_us;  // ... at worst
+  uint64_t dio_handler_us;      // Time in DIO handlers (SPI included)
+  uint32_t mac_runs;            // MAC runs after a DIO handler
+  uint64_t mac_delay_us;        // From a DIO handler to the MAC running
+  uint32_t mac_delay_max_us;    // ... at worst
+} radio_io_stats_t;
+
+// Call once the radio's SPI is set up, with its instance
+void radio_io_init( spi_inst_t* spi );
+
+// Call as the MAC starts to run, to time how long DIO events waited
+void radio_io_mac_running( void );
+
+// Counters since boot
+void radio_io_stats( radio_io_stats_t* stats );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LORAWAN_RADIO_IO_H
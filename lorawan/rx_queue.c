@@ -0,0 +1,80 @@
+// =======================================================================
+// rx_queue.c
+// =======================================================================
+// Definitions of our downlink receive queue
+
+#include "rx_queue.h"
+#include <string.h>
+
+// Head and tail only ever increase; their difference is the depth, and
+// wraps correctly since the slot count divides 2^32
+#define SLOT( index ) ( ( index ) & ( RX_QUEUE_SLOTS - 1 ) )
+
+_Static_assert( ( RX_QUEUE_SLOTS & ( RX_QUEUE_SLOTS - 1 ) ) == 0,
+                "RX_QUEUE_SLOTS must be a power of two" );
+
+void rx_queue_init( rx_queue_t* queue )
+{
+  memset( queue, 0, sizeof( *queue ) );
+}
+
+// -----------------------------------------------------------------------
+// Producer
+// -----------------------------------------------------------------------
+
+bool rx_queue_push( rx_queue_t* queue, uint8_t port, const uint8_t* data,
+                    uint8_t len )
+{
+  uint32_t head = queue->head;
+  uint32_t tail = __atomic_load_n( &queue->tail, __ATOMIC_ACQUIRE );
+  if ( head - tail == RX_QUEUE_SLOTS ) {
+    queue->drops++;
+    return false;
+  }
+
+  if ( len > RX_QUEUE_MAX_LEN ) {
+    len = RX_QUEUE_MAX_LEN;
+    queue->truncated++;
+  }
+  rx_frame_t* frame = &queue->slots[SLOT( head )];
+  frame->port       = port;
+  frame->len        = len;
+  memcpy( frame->data, data, len );
+
+  __atomic_store_n( &queue->head, head + 1, __ATOMIC_RELEASE );
+
+  if ( head + 1 - tail > queue->high_water ) {
+    queue->high_water = head + 1 - tail;
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// Consumer
+// -----------------------------------------------------------------------
+
+const rx_frame_t* rx_queue_peek( rx_queue_t* queue )
+{
+  uint32_t tail = queue->tail;
+  uint32_t head = __atomic_load_n( &queue->head, __ATOMIC_ACQUIRE );
+  if ( head == tail ) {
+    return NULL;
+  }
+  return &queue->slots[SLOT( tail )];
+}
+
+void rx_queue_pop( rx_queue_t* queue )
+{
+  uint32_t tail = queue->tail;
+  if ( __atomic_load_n( &queue->head, __ATOMIC_ACQUIRE ) == tail ) {
+    return;
+  }
+  __atomic_store_n( &queue->tail, tail + 1, __ATOMIC_RELEASE );
+}
+
+uint32_t rx_queue_depth( const rx_queue_t* queue )
+{
+  uint32_t tail = __atomic_load_n( &queue->tail, __ATOMIC_ACQUIRE );
+  uint32_t head = __atomic_load_n( &queue->head, __ATOMIC_ACQUIRE );
+  return head - tail;
+}
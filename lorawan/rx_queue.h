@@ -0,0 +1,66 @@
+// =======================================================================
+// rx_queue.h
+// =======================================================================
+// Declarations of our downlink receive queue, a single-producer,
+// single-consumer ring of frames
+//
+// The LoRaWAN library pushes each downlink with data as it arrives, and
+// we pop them in order, so a second downlink no longer overwrites the
+// first before it's read. Neither side takes a lock: the producer only
+// writes the head and the consumer only writes the tail, each published
+// with a release store after its slot is written or read. When the ring
+// is full, new frames are dropped (and counted), rather than overwriting
+// ones not yet read.
+//
+// This has no Pico dependencies, so the host tools use the same code
+
+#ifndef LORAWAN_RX_QUEUE_H
+#define LORAWAN_RX_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames held (a power of two), and the largest US915 downlink payload
+#define RX_QUEUE_SLOTS 4
+#define RX_QUEUE_MAX_LEN 242
+
+typedef struct {
+  uint8_t port;
+  uint8_t len;
+  uint8_t data[RX_QUEUE_MAX_LEN];
+} rx_frame_t;
+
+typedef struct {
+  rx_frame_t slots[RX_QUEUE_SLOTS];
+  uint32_t   head;  // Frames pushed (written by the producer only)
+  uint32_t   tail;  // Frames popped (written by the consumer only)
+
+  // Written by the producer only
+  uint32_t drops;       // Frames lost to a full queue
+  uint32_t truncated;   // Frames cut to RX_QUEUE_MAX_LEN
+  uint32_t high_water;  // Most frames ever held at once
+} rx_queue_t;
+
+void rx_queue_init( rx_queue_t* queue );
+
+// Producer: copy a frame in. Returns false (and counts a drop) if full
+bool rx_queue_push( rx_queue_t* queue, uint8_t port, const uint8_t* data,
+                    uint8_t len );
+
+// Consumer: the oldest frame (NULL if empty), which stays put until
+// rx_queue_pop
+const rx_frame_t* rx_queue_peek( rx_queue_t* queue );
+void              rx_queue_pop( rx_queue_t* queue );
+
+// Frames waiting (either side)
+uint32_t rx_queue_depth( const rx_queue_t* queue );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LORAWAN_RX_QUEUE_H
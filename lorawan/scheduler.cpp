@@ -0,0 +1,321 @@
+// =======================================================================
+// scheduler.cpp
+// =======================================================================
+// Definitions of our uplink scheduler
+
+#include "lorawan/scheduler.h"
+#include <cinttypes>
+#include <stdio.h>
+
+// LoRaWAN overhead per frame (MHDR, FHDR without options, FPort, MIC)
+#define LORAWAN_OVERHEAD 13
+
+// LoRa modem settings for LoRaWAN uplinks
+#define PREAMBLE_SYMBOLS 8
+#define CODING_RATE 1  // 4/5
+#define LDRO_SYMBOL_US 16000
+
+// -----------------------------------------------------------------------
+// US915 data rates
+// -----------------------------------------------------------------------
+// Regional payload limits are for a 400 ms dwell time
+
+typedef struct {
+  uint8_t  spreading_factor;
+  uint16_t bandwidth_khz;
+  uint8_t  max_payload;
+} datarate_t;
+
+const datarate_t datarates[SCHED_NUM_DATARATES] = {
+    { 10, 125, 11 },   // DR0
+    { 9, 125, 53 },    // DR1
+    { 8, 125, 125 },   // DR2
+    { 7, 125, 242 },   // DR3
+    { 8, 500, 242 },   // DR4
+};
+
+// -----------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------
+
+UplinkScheduler::UplinkScheduler( uint32_t seed )
+    : attempts( 0 ),
+      next_attempt_ms( 0 ),
+      last_decision( SCHED_SEND ),
+      num_uplinks( 0 ),
+      num_downlinks( 0 ),
+      num_mac_busy( 0 ),
+      rng_state( seed ? seed : 1 )
+{
+  for ( int i = 0; i < SCHED_NUM_BUCKETS; i++ ) {
+    bucket_hour[i]       = UINT64_MAX;
+    bucket_airtime_ms[i] = 0;
+    bucket_downlinks[i]  = 0;
+  }
+  for ( int i = 0; i < NUM_SCHED_DECISIONS; i++ ) {
+    deferrals[i] = 0;
+  }
+}
+
+// -----------------------------------------------------------------------
+// time_on_air_us
+// -----------------------------------------------------------------------
+// From the SX127x datasheet (explicit header, CRC on), with low data rate
+// optimization whenever a symbol takes 16 ms or more
+
+uint32_t UplinkScheduler::time_on_air_us( uint8_t datarate,
+                                          uint8_t payload_len )
+{
+  // Unknown data rates are treated as the slowest
+  const datarate_t& dr =
+      datarates[( datarate < SCHED_NUM_DATARATES ) ? datarate : 0];
+
+  int      sf     = dr.spreading_factor;
+  uint32_t sym_us = ( 1000u << sf ) / dr.bandwidth_khz;
+  int      ldro   = ( sym_us >= LDRO_SYMBOL_US ) ? 1 : 0;
+
+  int phy_len = payload_len + LORAWAN_OVERHEAD;
+  int num     = 8 * phy_len - 4 * sf + 28 + 16;
+  int den     = 4 * ( sf - 2 * ldro );
+  int blocks  = ( num > 0 ) ? ( num + den - 1 ) / den : 0;
+
+  uint32_t payload_symbols  = 8 + blocks * ( CODING_RATE + 4 );
+  uint32_t preamble_quarter = ( PREAMBLE_SYMBOLS * 4 + 17 ) * sym_us;
+
+  return preamble_quarter / 4 + payload_symbols * sym_us;
+}
+
+// -----------------------------------------------------------------------
+// max_payload
+// -----------------------------------------------------------------------
+
+uint8_t UplinkScheduler::max_payload( uint8_t datarate )
+{
+  if ( datarate >= SCHED_NUM_DATARATES ) {
+    datarate = 0;
+  }
+  uint8_t len = datarates[datarate].max_payload;
+  while ( ( len > 0 ) && ( time_on_air_us( datarate, len ) >
+                           SCHED_DWELL_LIMIT_MS * 1000u ) ) {
+    len--;
+  }
+  return len;
+}
+
+// -----------------------------------------------------------------------
+// Budget buckets
+// -----------------------------------------------------------------------
+
+int UplinkScheduler::bucket( uint64_t now_ms )
+{
+  uint64_t hour = now_ms / SCHED_BUCKET_MS;
+  int      idx  = hour % SCHED_NUM_BUCKETS;
+  if ( bucket_hour[idx] != hour ) {
+    bucket_hour[idx]       = hour;
+    bucket_airtime_ms[idx] = 0;
+    bucket_downlinks[idx]  = 0;
+  }
+  return idx;
+}
+
+// Whether a bucket is within the last 24 hours
+static bool in_window( uint64_t bucket_hour, uint64_t now_ms )
+{
+  uint64_t hour = now_ms / SCHED_BUCKET_MS;
+  return ( bucket_hour <= hour ) &&
+         ( hour - bucket_hour < SCHED_NUM_BUCKETS );
+}
+
+uint32_t UplinkScheduler::airtime_ms( uint64_t now_ms )
+{
+  uint32_t total = 0;
+  for ( int i = 0; i < SCHED_NUM_BUCKETS; i++ ) {
+    if ( in_window( bucket_hour[i], now_ms ) ) {
+      total += bucket_airtime_ms[i];
+    }
+  }
+  return total;
+}
+
+uint32_t UplinkScheduler::downlinks( uint64_t now_ms )
+{
+  uint32_t total = 0;
+  for ( int i = 0; i < SCHED_NUM_BUCKETS; i++ ) {
+    if ( in_window( bucket_hour[i], now_ms ) ) {
+      total += bucket_downlinks[i];
+    }
+  }
+  return total;
+}
+
+// When the oldest use in the window rolls out of it
+uint64_t UplinkScheduler::budget_frees_ms( uint64_t now_ms )
+{
+  uint64_t oldest = UINT64_MAX;
+  for ( int i = 0; i < SCHED_NUM_BUCKETS; i++ ) {
+    if ( in_window( bucket_hour[i], now_ms ) &&
+         ( bucket_airtime_ms[i] || bucket_downlinks[i] ) &&
+         ( bucket_hour[i] < oldest ) ) {
+      oldest = bucket_hour[i];
+    }
+  }
+  if ( oldest == UINT64_MAX ) {
+    return now_ms;
+  }
+  return ( oldest + SCHED_NUM_BUCKETS ) * SCHED_BUCKET_MS;
+}
+
+// -----------------------------------------------------------------------
+// random
+// -----------------------------------------------------------------------
+// xorshift32 - only used for jitter
+
+uint32_t UplinkScheduler::random()
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// -----------------------------------------------------------------------
+// check
+// -----------------------------------------------------------------------
+
+sched_decision_t UplinkScheduler::decide( uint64_t now_ms, uint8_t datarate,
+                                          uint8_t payload_len,
+                                          bool    confirmed )
+{
+  if ( now_ms < next_attempt_ms ) {
+    return SCHED_WAIT;
+  }
+  if ( payload_len > max_payload( datarate ) ) {
+    return SCHED_DEFER_DWELL;
+  }
+  uint32_t toa_ms = ( time_on_air_us( datarate, payload_len ) + 999 ) / 1000;
+  if ( airtime_ms( now_ms ) + toa_ms > SCHED_AIRTIME_BUDGET_MS ) {
+    return SCHED_DEFER_AIRTIME;
+  }
+  if ( confirmed && ( downlinks( now_ms ) >= SCHED_DOWNLINK_BUDGET ) ) {
+    return SCHED_DEFER_DOWNLINK;
+  }
+  return SCHED_SEND;
+}
+
+sched_decision_t UplinkScheduler::check( uint64_t now_ms, uint8_t datarate,
+                                         uint8_t payload_len,
+                                         bool    confirmed )
+{
+  sched_decision_t decision =
+      decide( now_ms, datarate, payload_len, confirmed );
+
+  // Count each deferral once, not every time we're polled
+  if ( ( decision != SCHED_SEND ) && ( decision != last_decision ) ) {
+    deferrals[decision]++;
+  }
+  last_decision = decision;
+  return decision;
+}
+
+// -----------------------------------------------------------------------
+// Events
+// -----------------------------------------------------------------------
+
+void UplinkScheduler::on_uplink( uint64_t now_ms, uint8_t datarate,
+                                 uint8_t payload_len )
+{
+  uint32_t toa_ms = ( time_on_air_us( datarate, payload_len ) + 999 ) / 1000;
+  bucket_airtime_ms[bucket( now_ms )] += toa_ms;
+  num_uplinks++;
+
+  // Full jitter: anywhere up to an exponentially growing window
+  uint32_t shift  = ( attempts < 20 ) ? attempts : 20;
+  uint64_t window = (uint64_t) SCHED_BACKOFF_BASE_MS << shift;
+  if ( window > SCHED_BACKOFF_CAP_MS ) {
+    window = SCHED_BACKOFF_CAP_MS;
+  }
+  attempts++;
+
+  next_attempt_ms =
+      now_ms + toa_ms + SCHED_RETRY_MIN_MS + random() % ( window + 1 );
+}
+
+void UplinkScheduler::on_downlink( uint64_t now_ms )
+{
+  bucket_downlinks[bucket( now_ms )]++;
+  num_downlinks++;
+}
+
+void UplinkScheduler::on_delivered()
+{
+  attempts        = 0;
+  next_attempt_ms = 0;
+}
+
+void UplinkScheduler::on_mac_busy( uint64_t now_ms )
+{
+  num_mac_busy++;
+  next_attempt_ms = now_ms + SCHED_MAC_BUSY_MS;
+}
+
+uint64_t UplinkScheduler::next_chance_ms( uint64_t now_ms )
+{
+  switch ( last_decision ) {
+    case SCHED_DEFER_DWELL:
+      return UINT64_MAX;
+    case SCHED_DEFER_AIRTIME:
+    case SCHED_DEFER_DOWNLINK:
+      return budget_frees_ms( now_ms );
+    default:
+      return ( next_attempt_ms > now_ms ) ? next_attempt_ms : now_ms;
+  }
+}
+
+// -----------------------------------------------------------------------
+// Statistics
+// -----------------------------------------------------------------------
+
+sched_stats_t UplinkScheduler::stats( uint64_t now_ms )
+{
+  sched_stats_t s;
+  s.airtime_ms      = airtime_ms( now_ms );
+  s.downlinks       = downlinks( now_ms );
+  s.attempts        = attempts;
+  s.next_attempt_ms = next_attempt_ms;
+  s.last            = last_decision;
+  for ( int i = 0; i < NUM_SCHED_DECISIONS; i++ ) {
+    s.deferrals[i] = deferrals[i];
+  }
+  s.uplinks         = num_uplinks;
+  s.total_downlinks = num_downlinks;
+  s.mac_busy        = num_mac_busy;
+  return s;
+}
+
+static const char* const decision_names[NUM_SCHED_DECISIONS] = {
+    "send", "backoff", "dwell", "airtime", "downlink" };
+
+void UplinkScheduler::print_stats( uint64_t now_ms )
+{
+  sched_stats_t s = stats( now_ms );
+  printf( "[Scheduler] Last 24 h: %" PRIu32 "/%d ms airtime, %" PRIu32
+          "/%d downlinks\n",
+          s.airtime_ms, SCHED_AIRTIME_BUDGET_MS, s.downlinks,
+          SCHED_DOWNLINK_BUDGET );
+  if ( s.last == SCHED_DEFER_AIRTIME || s.last == SCHED_DEFER_DOWNLINK ) {
+    printf( "[Scheduler] Deferred (%s) for %" PRIu64 " min\n",
+            decision_names[s.last],
+            ( budget_frees_ms( now_ms ) - now_ms ) / 60000 );
+  }
+  else if ( s.next_attempt_ms > now_ms ) {
+    printf( "[Scheduler] Attempt %" PRIu32 ", next in %" PRIu64 " s\n",
+            s.attempts + 1, ( s.next_attempt_ms - now_ms ) / 1000 );
+  }
+  printf( "[Scheduler] Since boot: %" PRIu32 " uplinks, %" PRIu32
+          " downlinks, %" PRIu32 " MAC busy; deferrals:",
+          s.uplinks, s.total_downlinks, s.mac_busy );
+  for ( int i = SCHED_WAIT; i < NUM_SCHED_DECISIONS; i++ ) {
+    printf( " %s %" PRIu32, decision_names[i], s.deferrals[i] );
+  }
+  printf( "\n" );
+}
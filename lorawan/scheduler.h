@@ -0,0 +1,143 @@
+// =======================================================================
+// scheduler.h
+// =======================================================================
+// Declarations of our uplink scheduler, which decides when frames may be
+// sent given their time-on-air, the US915 dwell-time limit and TTN's
+// fair-use policy (a daily budget of uplink airtime and downlinks)
+//
+// Budgets are tracked over a rolling 24 hours in hourly buckets. Retries
+// back off exponentially with full jitter, so a fleet that lost its
+// gateway doesn't retry in lockstep when it comes back.
+//
+// This has no Pico dependencies (times are passed in), so the host tools
+// use the same code
+
+#ifndef LORAWAN_SCHEDULER_H
+#define LORAWAN_SCHEDULER_H
+
+#include <cstdint>
+
+// -----------------------------------------------------------------------
+// Limits
+// -----------------------------------------------------------------------
+
+// TTN fair-use policy, per device per day
+#define SCHED_AIRTIME_BUDGET_MS 30000
+#define SCHED_DOWNLINK_BUDGET 10
+
+// FCC dwell time limit for US915 uplinks
+#define SCHED_DWELL_LIMIT_MS 400
+
+// US915 uplink data rates (DR0-DR4)
+#define SCHED_NUM_DATARATES 5
+
+// Retry backoff: wait at least SCHED_RETRY_MIN_MS (past the RX windows),
+// plus a random delay of up to SCHED_BACKOFF_BASE_MS * 2^attempt
+#define SCHED_RETRY_MIN_MS 3000
+#define SCHED_BACKOFF_BASE_MS 10000
+#define SCHED_BACKOFF_CAP_MS ( 60 * 60 * 1000 )
+
+// How long to wait before retrying when the MAC won't take a frame
+#define SCHED_MAC_BUSY_MS 1000
+
+// Rolling budget window
+#define SCHED_BUCKET_MS ( 60 * 60 * 1000 )
+#define SCHED_NUM_BUCKETS 24
+
+// -----------------------------------------------------------------------
+// Decisions
+// -----------------------------------------------------------------------
+
+enum sched_decision_t {
+  SCHED_SEND = 0,        // Send now
+  SCHED_WAIT,            // Waiting out a retry backoff
+  SCHED_DEFER_DWELL,     // Frame is too long for the data rate
+  SCHED_DEFER_AIRTIME,   // Would exceed the daily airtime budget
+  SCHED_DEFER_DOWNLINK,  // Daily downlink budget is used up
+  NUM_SCHED_DECISIONS
+};
+
+// -----------------------------------------------------------------------
+// Budget state
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint32_t airtime_ms;         // Uplink airtime in the last 24 hours
+  uint32_t downlinks;          // Downlinks in the last 24 hours
+  uint32_t attempts;           // Attempts at the current frame
+  uint64_t next_attempt_ms;    // Earliest time for the next attempt
+  sched_decision_t last;       // Most recent decision
+  uint32_t deferrals[NUM_SCHED_DECISIONS];  // Times each deferral began
+  uint32_t uplinks;            // Uplinks since boot
+  uint32_t total_downlinks;    // Downlinks since boot
+  uint32_t mac_busy;           // Sends the MAC refused since boot
+} sched_stats_t;
+
+// -----------------------------------------------------------------------
+// UplinkScheduler
+// -----------------------------------------------------------------------
+
+class UplinkScheduler {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public accessor functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  UplinkScheduler( uint32_t seed );
+
+  // Time-on-air of an uplink with the given application payload
+  static uint32_t time_on_air_us( uint8_t datarate, uint8_t payload_len );
+
+  // Largest application payload at a data rate (regional limit and
+  // dwell time)
+  static uint8_t max_payload( uint8_t datarate );
+
+  // Whether a frame may be sent now
+  sched_decision_t check( uint64_t now_ms, uint8_t datarate,
+                          uint8_t payload_len, bool confirmed );
+
+  // Record what happened
+  void on_uplink( uint64_t now_ms, uint8_t datarate, uint8_t payload_len );
+  void on_downlink( uint64_t now_ms );
+  void on_delivered();  // Current frame is done; reset the backoff
+  void on_mac_busy( uint64_t now_ms );
+
+  // When a frame the last check() held back could next go out: once the
+  // backoff (or the busy MAC) is waited out, or the budget frees up.
+  // UINT64_MAX if only a lower data rate will let it
+  uint64_t next_chance_ms( uint64_t now_ms );
+
+  sched_stats_t stats( uint64_t now_ms );
+  void          print_stats( uint64_t now_ms );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  // Rolling budget buckets, tagged with the hour they cover
+  uint64_t bucket_hour[SCHED_NUM_BUCKETS];
+  uint32_t bucket_airtime_ms[SCHED_NUM_BUCKETS];
+  uint32_t bucket_downlinks[SCHED_NUM_BUCKETS];
+
+  uint32_t         attempts;
+  uint64_t         next_attempt_ms;
+  sched_decision_t last_decision;
+  uint32_t         deferrals[NUM_SCHED_DECISIONS];
+  uint32_t         num_uplinks;
+  uint32_t         num_downlinks;
+  uint32_t         num_mac_busy;
+  uint32_t         rng_state;
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  int      bucket( uint64_t now_ms );
+  uint32_t airtime_ms( uint64_t now_ms );
+  uint32_t downlinks( uint64_t now_ms );
+  uint64_t budget_frees_ms( uint64_t now_ms );
+  uint32_t random();
+  sched_decision_t decide( uint64_t now_ms, uint8_t datarate,
+                           uint8_t payload_len, bool confirmed );
+};
+
+#endif  // LORAWAN_SCHEDULER_H
@@ -0,0 +1,74 @@
+// =======================================================================
+// seq_ack.cpp
+// =======================================================================
+// Definitions of our application-level acknowledgements
+
+#include "lorawan/seq_ack.h"
+#include <string.h>
+
+// -----------------------------------------------------------------------
+// Uplink header
+// -----------------------------------------------------------------------
+
+void seq_ack_write_header( uint8_t* buffer, uint32_t seq )
+{
+  buffer[0] = ( seq >> 8 ) & 0xFF;
+  buffer[1] = seq & 0xFF;
+}
+
+uint16_t seq_ack_read_header( const uint8_t* buffer )
+{
+  return ( buffer[0] << 8 ) | buffer[1];
+}
+
+uint32_t seq_ack_expand( uint16_t seq, uint32_t ref )
+{
+  int16_t diff = (int16_t) ( seq - (uint16_t) ref );
+  return ref + diff;
+}
+
+// -----------------------------------------------------------------------
+// Cumulative ACKs
+// -----------------------------------------------------------------------
+
+int seq_ack_encode( const seq_ack_t* ack, uint8_t* buffer )
+{
+  seq_ack_write_header( buffer, ack->next_expected );
+  memcpy( buffer + SEQ_ACK_HEADER_LEN, ack->bitmap, ack->bitmap_len );
+  return SEQ_ACK_HEADER_LEN + ack->bitmap_len;
+}
+
+int seq_ack_decode( const uint8_t* buffer, int len, seq_ack_t* ack )
+{
+  if ( ( len < SEQ_ACK_HEADER_LEN ) ||
+       ( len > SEQ_ACK_HEADER_LEN + SEQ_ACK_MAX_BITMAP ) ) {
+    return -1;
+  }
+  ack->next_expected = seq_ack_read_header( buffer );
+  ack->bitmap_len    = len - SEQ_ACK_HEADER_LEN;
+  memcpy( ack->bitmap, buffer + SEQ_ACK_HEADER_LEN, ack->bitmap_len );
+  return 0;
+}
+
+bool seq_ack_covers( const seq_ack_t* ack, uint32_t seq )
+{
+  int16_t diff = (int16_t) ( (uint16_t) seq - ack->next_expected );
+  if ( diff < 0 ) {
+    return true;
+  }
+  int bit = diff - 1;
+  if ( ( bit < 0 ) || ( bit >= ack->bitmap_len * 8 ) ) {
+    return false;
+  }
+  return ( ack->bitmap[bit / 8] >> ( 7 - bit % 8 ) ) & 1;
+}
+
+uint16_t seq_ack_horizon( const seq_ack_t* ack )
+{
+  for ( int bit = ack->bitmap_len * 8 - 1; bit >= 0; bit-- ) {
+    if ( ( ack->bitmap[bit / 8] >> ( 7 - bit % 8 ) ) & 1 ) {
+      return ack->next_expected + bit + 2;
+    }
+  }
+  return ack->next_expected;
+}
@@ -0,0 +1,66 @@
+// =======================================================================
+// seq_ack.h
+// =======================================================================
+// Declarations of our application-level acknowledgements, an alternative
+// to confirmed uplinks that doesn't spend a downlink on every frame
+//
+// Uplinks on SEQ_ACK_PORT are unconfirmed, and start with the sequence
+// number of their first reading (the low 16 bits, big-endian). A frame
+// only carries readings with consecutive sequence numbers, so the rest
+// follow from the reading count.
+//
+// Now and then the application server sends a downlink on the same port
+// with a cumulative ACK: the lowest sequence number it's still missing,
+// then a bitmap (most significant bit first) of which of the following
+// sequence numbers it has anyway. The device only resends the gaps.
+//
+// This has no Pico dependencies, so the host tools use the same code
+
+#ifndef LORAWAN_SEQ_ACK_H
+#define LORAWAN_SEQ_ACK_H
+
+#include <cstdint>
+
+// Port for sequence-numbered uplinks and their ACKs
+#define SEQ_ACK_PORT 3
+
+// Port for confirmed uplinks of readings (with no header)
+#define CONFIRMED_PORT 2
+
+#define SEQ_ACK_HEADER_LEN 2
+#define SEQ_ACK_MAX_BITMAP 8
+
+// -----------------------------------------------------------------------
+// Uplink header
+// -----------------------------------------------------------------------
+
+void     seq_ack_write_header( uint8_t* buffer, uint32_t seq );
+uint16_t seq_ack_read_header( const uint8_t* buffer );
+
+// The full sequence number closest to ref with the given low 16 bits
+uint32_t seq_ack_expand( uint16_t seq, uint32_t ref );
+
+// -----------------------------------------------------------------------
+// Cumulative ACKs
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint16_t next_expected;  // Everything before this was received
+  uint8_t  bitmap_len;     // Bytes of bitmap
+  uint8_t  bitmap[SEQ_ACK_MAX_BITMAP];
+} seq_ack_t;
+
+// Returns the length of the downlink
+int seq_ack_encode( const seq_ack_t* ack, uint8_t* buffer );
+
+// Returns 0, or -1 if the downlink isn't a valid ACK
+int seq_ack_decode( const uint8_t* buffer, int len, seq_ack_t* ack );
+
+// Whether the ACK covers a sequence number
+bool seq_ack_covers( const seq_ack_t* ack, uint32_t seq );
+
+// One past the highest sequence number the ACK covers; anything missing
+// below this is a gap
+uint16_t seq_ack_horizon( const seq_ack_t* ack );
+
+#endif  // LORAWAN_SEQ_ACK_H
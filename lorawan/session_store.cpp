@@ -0,0 +1,299 @@
+// =======================================================================
+// session_store.cpp
+// =======================================================================
+// Definitions of our A/B flash store for the LoRaWAN session
+
+#include "lorawan/session_store.h"
+#include "utils/debug.h"
+#include "utils/flash.h"
+#include <stddef.h>
+#include <string.h>
+
+#define SESSION_MAGIC 0x4C575353  // "SSWL"
+#define SESSION_COPY_SIZE \
+  ( LORAWAN_SESSION_COPY_SECTORS * FLASH_SECTOR_SIZE )
+
+static_assert( SESSION_STORE_MAX_LEN == SESSION_COPY_SIZE - FLASH_PAGE_SIZE,
+               "Session store size must match its flash region" );
+
+// -----------------------------------------------------------------------
+// Copies
+// -----------------------------------------------------------------------
+// The header takes the first page of a copy, and the data follows
+
+typedef struct {
+  uint32_t magic;
+  uint32_t generation;  // Increases with every save
+  uint32_t length;
+  uint32_t crc;
+} session_header_t;
+
+static void erase_counters();  // See the counter log below
+
+static uint32_t copy_offset( int copy )
+{
+  return LORAWAN_SESSION_OFFSET + copy * SESSION_COPY_SIZE;
+}
+
+static const session_header_t* read_header( int copy )
+{
+  return (const session_header_t*) flash_read( copy_offset( copy ) );
+}
+
+static const uint8_t* read_data( int copy )
+{
+  return flash_read( copy_offset( copy ) + FLASH_PAGE_SIZE );
+}
+
+// CRC-32 (IEEE)
+static uint32_t crc32( const uint8_t* data, uint32_t len )
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for ( uint32_t i = 0; i < len; i++ ) {
+    crc ^= data[i];
+    for ( int bit = 0; bit < 8; bit++ ) {
+      crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xEDB88320 : ( crc >> 1 );
+    }
+  }
+  return ~crc;
+}
+
+static bool copy_valid( int copy )
+{
+  const session_header_t* header = read_header( copy );
+  return ( header->magic == SESSION_MAGIC ) &&
+         ( header->length <= SESSION_STORE_MAX_LEN ) &&
+         ( header->crc == crc32( read_data( copy ), header->length ) );
+}
+
+// The newest valid copy, or -1 if neither is valid
+static int newest_copy()
+{
+  bool valid_0 = copy_valid( 0 );
+  bool valid_1 = copy_valid( 1 );
+  if ( valid_0 && valid_1 ) {
+    return ( read_header( 1 )->generation > read_header( 0 )->generation )
+               ? 1
+               : 0;
+  }
+  return valid_0 ? 0 : ( valid_1 ? 1 : -1 );
+}
+
+// -----------------------------------------------------------------------
+// session_store_load
+// -----------------------------------------------------------------------
+
+int session_store_load( uint8_t* buffer, uint32_t max_len )
+{
+  int copy = newest_copy();
+  if ( copy < 0 ) {
+    return -1;
+  }
+  const session_header_t* header = read_header( copy );
+  if ( header->length > max_len ) {
+    return -1;
+  }
+  memcpy( buffer, read_data( copy ), header->length );
+  debug( "[Session] Restored %lu bytes (generation %lu)\n", header->length,
+         header->generation );
+  return header->length;
+}
+
+// -----------------------------------------------------------------------
+// session_store_save
+// -----------------------------------------------------------------------
+
+bool session_store_save( const uint8_t* data, uint32_t len )
+{
+  if ( len > SESSION_STORE_MAX_LEN ) {
+    return false;
+  }
+
+  int      newest     = newest_copy();
+  uint32_t generation = 0;
+  if ( newest >= 0 ) {
+    const session_header_t* header = read_header( newest );
+    if ( ( header->length == len ) &&
+         ( memcmp( read_data( newest ), data, len ) == 0 ) ) {
+      return true;  // Nothing changed
+    }
+    generation = header->generation + 1;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Write the data into the other copy, then its header
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  int      copy   = ( newest == 0 ) ? 1 : 0;
+  uint32_t offset = copy_offset( copy );
+
+  for ( int i = 0; i < LORAWAN_SESSION_COPY_SECTORS; i++ ) {
+    if ( !flash_erase_sector( offset + i * FLASH_SECTOR_SIZE ) ) {
+      return false;
+    }
+  }
+
+  uint8_t page[FLASH_PAGE_SIZE];
+  for ( uint32_t done = 0; done < len; done += FLASH_PAGE_SIZE ) {
+    uint32_t chunk =
+        ( len - done < FLASH_PAGE_SIZE ) ? len - done : FLASH_PAGE_SIZE;
+    memset( page, 0xFF, FLASH_PAGE_SIZE );
+    memcpy( page, data + done, chunk );
+    if ( !flash_program_page( offset + FLASH_PAGE_SIZE + done, page ) ) {
+      return false;
+    }
+  }
+
+  session_header_t header;
+  header.magic      = SESSION_MAGIC;
+  header.generation = generation;
+  header.length     = len;
+  header.crc        = crc32( data, len );
+  if ( !flash_program( offset, (const uint8_t*) &header,
+                       sizeof( header ) ) ||
+       !copy_valid( copy ) ) {
+    return false;
+  }
+
+  // The new copy has the newest counters
+  erase_counters();
+  return true;
+}
+
+bool session_store_matches( uint32_t offset, const uint8_t* data,
+                            uint32_t len )
+{
+  int copy = newest_copy();
+  if ( copy < 0 ) {
+    return false;
+  }
+  const session_header_t* header = read_header( copy );
+  return ( offset + len <= header->length ) &&
+         ( memcmp( read_data( copy ) + offset, data, len ) == 0 );
+}
+
+// -----------------------------------------------------------------------
+// Counter log
+// -----------------------------------------------------------------------
+// Records are appended in order, each tagged with the generation of the
+// copy it applies to, so records for an older copy are ignored. The log
+// is erased after a copy is written, so a power loss in between leaves
+// the records for the copy before
+
+#define COUNTER_MAGIC 0x544E4346  // "FCNT"
+
+typedef struct {
+  uint32_t           magic;
+  uint32_t           generation;
+  session_counters_t counters;
+  uint32_t           reserved;  // Left erased
+  uint32_t           crc;       // Over everything before it
+} counter_record_t;
+
+#define COUNTER_NUM_RECORDS ( FLASH_SECTOR_SIZE / sizeof( counter_record_t ) )
+
+static_assert( FLASH_PAGE_SIZE % sizeof( counter_record_t ) == 0,
+               "Counter records can't straddle flash pages" );
+
+static const counter_record_t* counter_records()
+{
+  return (const counter_record_t*) flash_read( LORAWAN_COUNTER_LOG_OFFSET );
+}
+
+static bool record_erased( const counter_record_t* record )
+{
+  const uint8_t* bytes = (const uint8_t*) record;
+  for ( uint32_t i = 0; i < sizeof( counter_record_t ); i++ ) {
+    if ( bytes[i] != 0xFF ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool record_valid( const counter_record_t* record )
+{
+  return ( record->magic == COUNTER_MAGIC ) &&
+         ( record->crc ==
+           crc32( (const uint8_t*) record,
+                  offsetof( counter_record_t, crc ) ) );
+}
+
+// The first erased record (COUNTER_NUM_RECORDS if it's full)
+static uint32_t next_record()
+{
+  const counter_record_t* records = counter_records();
+  uint32_t                next    = 0;
+  while ( ( next < COUNTER_NUM_RECORDS ) &&
+          !record_erased( &records[next] ) ) {
+    next++;
+  }
+  return next;
+}
+
+static void erase_counters()
+{
+  if ( !record_erased( &counter_records()[0] ) ) {
+    flash_erase_sector( LORAWAN_COUNTER_LOG_OFFSET );
+  }
+}
+
+bool session_store_save_counters( const session_counters_t* counters )
+{
+  int      copy = newest_copy();
+  uint32_t next = next_record();
+  if ( ( copy < 0 ) || ( next == COUNTER_NUM_RECORDS ) ) {
+    return false;
+  }
+
+  counter_record_t record;
+  memset( &record, 0xFF, sizeof( record ) );
+  record.magic      = COUNTER_MAGIC;
+  record.generation = read_header( copy )->generation;
+  record.counters   = *counters;
+  record.crc        = crc32( (const uint8_t*) &record,
+                             offsetof( counter_record_t, crc ) );
+  return flash_program( LORAWAN_COUNTER_LOG_OFFSET +
+                            next * sizeof( counter_record_t ),
+                        (const uint8_t*) &record, sizeof( record ) ) &&
+         record_valid( &counter_records()[next] );
+}
+
+bool session_store_load_counters( session_counters_t* counters )
+{
+  int copy = newest_copy();
+  if ( copy < 0 ) {
+    return false;
+  }
+  uint32_t generation = read_header( copy )->generation;
+
+  const counter_record_t* records = counter_records();
+  bool                    found   = false;
+  for ( uint32_t i = 0; i < COUNTER_NUM_RECORDS; i++ ) {
+    if ( record_erased( &records[i] ) ) {
+      break;
+    }
+    if ( record_valid( &records[i] ) &&
+         ( records[i].generation == generation ) ) {
+      *counters = records[i].counters;
+      found     = true;
+    }
+  }
+  if ( found ) {
+    debug( "[Session] Restored frame counters (FCntUp %lu)\n",
+           counters->fcnt_up );
+  }
+  return found;
+}
+
+// -----------------------------------------------------------------------
+// session_store_erase
+// -----------------------------------------------------------------------
+
+void session_store_erase( void )
+{
+  for ( int i = 0; i < LORAWAN_SESSION_SECTORS; i++ ) {
+    flash_erase_sector( LORAWAN_SESSION_OFFSET + i * FLASH_SECTOR_SIZE );
+  }
+  erase_counters();
+}
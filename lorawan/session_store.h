@@ -0,0 +1,65 @@
+// =======================================================================
+// session_store.h
+// =======================================================================
+// A thin wrapper to keep the LoRaWAN MAC's NVM contexts (session keys,
+// frame counters, channels) in flash, so a warm boot can resume the
+// session without joining again
+//
+// There are two copies, written alternately. A copy's header is written
+// last, after its data, so a power loss mid-write leaves the other copy
+// intact and the newest valid copy is always restored
+//
+// The frame counters change with every uplink, but the rest of the
+// session rarely does, so the counters are logged apart, as small
+// records against the newest copy, in a sector of their own. A copy is
+// only rewritten when the rest changes or the log fills (every 128
+// updates), which also starts the log over
+
+#ifndef LORAWAN_SESSION_STORE_H
+#define LORAWAN_SESSION_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest session we can store (one copy, less a page for the header)
+#define SESSION_STORE_MAX_LEN ( 2 * 4096 - 256 )
+
+// The frame counters, as in the MAC's FCntList
+typedef struct {
+  uint32_t fcnt_up;
+  uint32_t n_fcnt_down;
+  uint32_t a_fcnt_down;
+  uint32_t fcnt_down;
+} session_counters_t;
+
+// Copy the newest valid session into buffer. Returns its length, or -1
+// if there isn't one (or it doesn't fit)
+int session_store_load( uint8_t* buffer, uint32_t max_len );
+
+// Write a session over the older copy. Returns whether it was written
+bool session_store_save( const uint8_t* data, uint32_t len );
+
+// Whether len bytes at offset into the newest stored session match data
+bool session_store_matches( uint32_t offset, const uint8_t* data,
+                            uint32_t len );
+
+// Log counters against the newest stored session. Returns false if there
+// isn't one, or the log is full, so the whole session should be saved
+bool session_store_save_counters( const session_counters_t* counters );
+
+// Get the newest counters logged against the newest stored session.
+// Returns false if there are none
+bool session_store_load_counters( session_counters_t* counters );
+
+// Forget any stored session
+void session_store_erase( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LORAWAN_SESSION_STORE_H
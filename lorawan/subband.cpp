@@ -0,0 +1,143 @@
+// =======================================================================
+// subband.cpp
+// =======================================================================
+// Definitions of our US915 sub-band selection
+
+#include "lorawan/subband.h"
+#include <cinttypes>
+#include <stdio.h>
+
+// -----------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------
+
+SubbandSelector::SubbandSelector( int learned )
+    : learned( ( learned >= 0 && learned < SUBBAND_NUM ) ? learned
+                                                          : SUBBAND_NONE ),
+      step( 0 ),
+      step_attempts( 0 ),
+      join_start_ms( 0 ),
+      counters()
+{
+  counters.last_latency_ms = -1;
+  counters.current         = SUBBAND_NONE;
+  counters.learned         = this->learned;
+}
+
+// -----------------------------------------------------------------------
+// Channel masks
+// -----------------------------------------------------------------------
+// Sub-band n is 125 kHz channels 8n to 8n+7 (bits of words 0-3) and
+// 500 kHz channel 64+n (bit n of word 4)
+
+void SubbandSelector::mask( int subband, uint16_t* mask )
+{
+  for ( int i = 0; i < SUBBAND_MASK_LEN; i++ ) {
+    mask[i] = 0;
+  }
+  if ( subband == SUBBAND_NONE ) {
+    for ( int i = 0; i < 4; i++ ) {
+      mask[i] = 0xFFFF;
+    }
+    mask[4] = 0x00FF;
+    return;
+  }
+  mask[subband / 2] = 0x00FF << ( 8 * ( subband % 2 ) );
+  mask[4]           = 1 << subband;
+}
+
+int SubbandSelector::subband_of( const uint16_t* mask )
+{
+  int subband = SUBBAND_NONE;
+  for ( int n = 0; n < SUBBAND_NUM; n++ ) {
+    if ( ( mask[n / 2] >> ( 8 * ( n % 2 ) ) ) & 0xFF ) {
+      if ( subband != SUBBAND_NONE ) {
+        return SUBBAND_NONE;
+      }
+      subband = n;
+    }
+  }
+  return subband;
+}
+
+// -----------------------------------------------------------------------
+// Sweep
+// -----------------------------------------------------------------------
+// Each sub-band in turn, starting from the learned one, then every
+// channel at once, then around again
+
+int SubbandSelector::at_step( int step )
+{
+  if ( step == SUBBAND_NUM ) {
+    return SUBBAND_NONE;
+  }
+  int first = ( learned != SUBBAND_NONE ) ? learned : SUBBAND_DEFAULT;
+  return ( first + step ) % SUBBAND_NUM;
+}
+
+int SubbandSelector::start_join( uint64_t now_ms )
+{
+  join_start_ms            = now_ms;
+  step                     = 0;
+  step_attempts            = 1;
+  counters.last_attempts   = 1;
+  counters.last_latency_ms = -1;
+  counters.attempts++;
+  counters.current = at_step( step );
+  return counters.current;
+}
+
+int SubbandSelector::on_join_failed()
+{
+  if ( step_attempts >= SUBBAND_JOIN_ATTEMPTS ) {
+    step          = ( step + 1 ) % ( SUBBAND_NUM + 1 );
+    step_attempts = 0;
+  }
+  step_attempts++;
+  counters.last_attempts++;
+  counters.attempts++;
+  counters.current = at_step( step );
+  return counters.current;
+}
+
+// The mask is the one we joined on, unless the network changed it in the
+// join accept. Either way, if it's one sub-band, that's the one to learn
+bool SubbandSelector::on_joined( uint64_t now_ms, const uint16_t* mask )
+{
+  counters.joins++;
+  counters.last_latency_ms = now_ms - join_start_ms;
+
+  int joined_on = subband_of( mask );
+  if ( ( joined_on == SUBBAND_NONE ) || ( joined_on == learned ) ) {
+    return false;
+  }
+  learned          = joined_on;
+  counters.learned = learned;
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// stats
+// -----------------------------------------------------------------------
+
+subband_stats_t SubbandSelector::stats()
+{
+  return counters;
+}
+
+void SubbandSelector::print_stats()
+{
+  printf( "[Join] %" PRIu32 " joins in %" PRIu32
+          " attempts since boot; latest took %" PRIu32
+          " attempts, %" PRId64 " ms\n",
+          counters.joins, counters.attempts, counters.last_attempts,
+          counters.last_latency_ms );
+  if ( counters.learned == SUBBAND_NONE ) {
+    printf( "[Join] No sub-band learned yet\n" );
+  }
+  else {
+    printf( "[Join] Learned sub-band %d (channels %d-%d, %d)\n",
+            counters.learned + 1, counters.learned * 8,
+            counters.learned * 8 + 7, 64 + counters.learned );
+  }
+}
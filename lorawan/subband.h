@@ -0,0 +1,91 @@
+// =======================================================================
+// subband.h
+// =======================================================================
+// Declarations of our US915 sub-band selection for OTAA joins
+//
+// US915 has 64 125 kHz uplink channels (plus 8 at 500 kHz), split into 8
+// sub-bands of 8 channels, but most gateways only listen on one of them.
+// Joining with every channel enabled wastes most join requests on
+// channels nobody hears, so we join on one sub-band at a time: the one
+// that last worked first, then a sweep through the rest, then every
+// channel at once (in case the network spans sub-bands). The sub-band we
+// joined on is learned for next time.
+//
+// This has no Pico dependencies (the caller applies the masks and stores
+// what's learned), so the host tools use the same code
+
+#ifndef LORAWAN_SUBBAND_H
+#define LORAWAN_SUBBAND_H
+
+#include <cstdint>
+
+#define SUBBAND_NUM 8
+#define SUBBAND_MASK_LEN 6  // 16-bit words in a US915 channel mask
+
+// Not one sub-band (every channel enabled, or nothing learned)
+#define SUBBAND_NONE -1
+
+// Join attempts on a sub-band before moving on to the next
+#define SUBBAND_JOIN_ATTEMPTS 2
+
+// Where the sweep starts with nothing learned (sub-band 2, counting from
+// 1, is what TTN and most US915 gateways use)
+#define SUBBAND_DEFAULT 1
+
+typedef struct {
+  uint32_t attempts;         // Join requests, over all joins since boot
+  uint32_t joins;            // Successful joins since boot
+  uint32_t last_attempts;    // Join requests for the latest join
+  int64_t  last_latency_ms;  // From starting the latest join to joining
+  int      current;          // Sub-band being tried, or SUBBAND_NONE
+  int      learned;          // Sub-band that last worked, or SUBBAND_NONE
+} subband_stats_t;
+
+class SubbandSelector {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public Accessor Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  // Starts from the sub-band learned before (or SUBBAND_NONE)
+  SubbandSelector( int learned );
+
+  // Call when starting to join; returns the sub-band to try first
+  int start_join( uint64_t now_ms );
+
+  // Call when a join request went unanswered; returns the sub-band to
+  // try next
+  int on_join_failed();
+
+  // Call once joined, with the channel mask the network left us with.
+  // Returns whether the learned sub-band changed (and should be stored)
+  bool on_joined( uint64_t now_ms, const uint16_t* mask );
+
+  subband_stats_t stats();
+  void            print_stats();
+
+  // The channel mask for a sub-band (every channel for SUBBAND_NONE)
+  static void mask( int subband, uint16_t* mask );
+
+  // The sub-band a channel mask enables, or SUBBAND_NONE if it enables
+  // 125 kHz channels in more than one
+  static int subband_of( const uint16_t* mask );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Private Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ private:
+  // The sub-band for a step of the sweep
+  int at_step( int step );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected Attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  int             learned;
+  int             step;           // Position in the sweep
+  int             step_attempts;  // Join requests at this step
+  uint64_t        join_start_ms;
+  subband_stats_t counters;
+};
+
+#endif  // LORAWAN_SUBBAND_H
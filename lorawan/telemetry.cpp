@@ -0,0 +1,253 @@
+// =======================================================================
+// telemetry.cpp
+// =======================================================================
+// Definitions of our MAC and radio telemetry
+
+#include "lorawan/telemetry.h"
+#include <cinttypes>
+#include <stdio.h>
+#include <string.h>
+
+#define TELEMETRY_LABEL( name, label ) label,
+
+const char* const telemetry_labels[TELEMETRY_NUM_FIELDS] = {
+    TELEMETRY_FIELDS( TELEMETRY_LABEL ) };
+
+#undef TELEMETRY_LABEL
+
+static const int rssi_edges[] = TELEMETRY_RSSI_EDGES;
+static const int snr_edges[]  = TELEMETRY_SNR_EDGES;
+
+// -----------------------------------------------------------------------
+// Varints
+// -----------------------------------------------------------------------
+// LEB128: seven bits at a time, least significant first, with the top
+// bit set on every byte but the last
+
+static int varint_len( uint32_t value )
+{
+  int len = 1;
+  while ( value >= 0x80 ) {
+    value >>= 7;
+    len++;
+  }
+  return len;
+}
+
+static int write_varint( uint8_t* buffer, uint32_t value )
+{
+  int len = 0;
+  while ( value >= 0x80 ) {
+    buffer[len++] = ( value & 0x7F ) | 0x80;
+    value >>= 7;
+  }
+  buffer[len++] = value;
+  return len;
+}
+
+// Returns the bytes read, or -1 if the varint runs off the end (or past
+// 32 bits)
+static int read_varint( const uint8_t* buffer, int len, uint32_t* value )
+{
+  *value = 0;
+  for ( int i = 0; ( i < len ) && ( i < 5 ); i++ ) {
+    *value |= (uint32_t) ( buffer[i] & 0x7F ) << ( 7 * i );
+    if ( !( buffer[i] & 0x80 ) ) {
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+// -----------------------------------------------------------------------
+// Decoding
+// -----------------------------------------------------------------------
+
+int telemetry_decode( const uint8_t* buffer, int len,
+                      telemetry_frame_t* frame )
+{
+  memset( frame, 0, sizeof( telemetry_frame_t ) );
+  if ( len < TELEMETRY_HEADER_LEN ) {
+    return -1;
+  }
+  frame->version  = buffer[0] >> 4;
+  frame->sequence = buffer[0] & 0xF;
+  frame->present  = buffer[1] | ( buffer[2] << 8 ) | ( buffer[3] << 16 );
+  if ( ( frame->version != TELEMETRY_VERSION ) ||
+       ( frame->present >> TELEMETRY_NUM_FIELDS ) ) {
+    return -1;
+  }
+
+  int pos = TELEMETRY_HEADER_LEN;
+  for ( int field = 0; field < TELEMETRY_NUM_FIELDS; field++ ) {
+    if ( !( ( frame->present >> field ) & 1 ) ) {
+      continue;
+    }
+    int field_len =
+        read_varint( buffer + pos, len - pos, &frame->values[field] );
+    if ( field_len < 0 ) {
+      return -1;
+    }
+    pos += field_len;
+  }
+  return ( pos == len ) ? 0 : -1;
+}
+
+// -----------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------
+
+Telemetry::Telemetry()
+    : pending(),
+      totals(),
+      request_ms( 0 ),
+      last_sent_ms( 0 ),
+      sequence( 0 ),
+      frames_sent( 0 )
+{
+}
+
+// -----------------------------------------------------------------------
+// Events
+// -----------------------------------------------------------------------
+
+void Telemetry::add( telemetry_field_t field, uint32_t value )
+{
+  if ( field == TELEMETRY_ACK_LATENCY_MAX_MS ) {
+    if ( value > pending[field] ) {
+      pending[field] = value;
+    }
+    if ( value > totals[field] ) {
+      totals[field] = value;
+    }
+    return;
+  }
+  pending[field] += value;
+  totals[field] += value;
+}
+
+void Telemetry::on_join_result( bool joined )
+{
+  add( TELEMETRY_JOIN_REQUESTS, 1 );
+  if ( joined ) {
+    add( TELEMETRY_JOINS, 1 );
+  }
+}
+
+void Telemetry::on_uplink_request( uint64_t now_ms, bool accepted,
+                                   bool confirmed )
+{
+  if ( !accepted ) {
+    add( TELEMETRY_REFUSED, 1 );
+    return;
+  }
+  add( TELEMETRY_UPLINKS, 1 );
+  if ( confirmed ) {
+    add( TELEMETRY_CONFIRMED, 1 );
+  }
+  request_ms = now_ms;
+}
+
+void Telemetry::on_resend()
+{
+  add( TELEMETRY_RESENDS, 1 );
+}
+
+void Telemetry::on_uplink_done( uint64_t now_ms, bool confirmed,
+                                bool acked, uint8_t transmissions,
+                                uint32_t airtime_ms )
+{
+  if ( transmissions > 1 ) {
+    add( TELEMETRY_RETRANSMISSIONS, transmissions - 1 );
+  }
+  add( TELEMETRY_AIRTIME_MS, transmissions * airtime_ms );
+  if ( confirmed && acked ) {
+    uint32_t latency_ms = now_ms - request_ms;
+    add( TELEMETRY_ACKS, 1 );
+    add( TELEMETRY_ACK_LATENCY_MS, latency_ms );
+    add( TELEMETRY_ACK_LATENCY_MAX_MS, latency_ms );
+  }
+}
+
+void Telemetry::on_downlink( int8_t rssi, int8_t snr )
+{
+  int rssi_bucket = 0;
+  while ( ( rssi_bucket < TELEMETRY_HIST_BUCKETS - 1 ) &&
+          ( rssi >= rssi_edges[rssi_bucket] ) ) {
+    rssi_bucket++;
+  }
+  int snr_bucket = 0;
+  while ( ( snr_bucket < TELEMETRY_HIST_BUCKETS - 1 ) &&
+          ( snr >= snr_edges[snr_bucket] ) ) {
+    snr_bucket++;
+  }
+  add( TELEMETRY_DOWNLINKS, 1 );
+  add( (telemetry_field_t) ( TELEMETRY_RSSI_0 + rssi_bucket ), 1 );
+  add( (telemetry_field_t) ( TELEMETRY_SNR_0 + snr_bucket ), 1 );
+}
+
+void Telemetry::on_mac_command( bool answer )
+{
+  add( answer ? TELEMETRY_MAC_ANSWERS : TELEMETRY_MAC_REQUESTS, 1 );
+}
+
+// -----------------------------------------------------------------------
+// Sending
+// -----------------------------------------------------------------------
+
+bool Telemetry::due( uint64_t now_ms )
+{
+  return now_ms - last_sent_ms >= TELEMETRY_PERIOD_MS;
+}
+
+int Telemetry::encode( uint8_t* buffer, int max_len, uint32_t* fields )
+{
+  *fields = 0;
+  if ( max_len < TELEMETRY_HEADER_LEN ) {
+    return 0;
+  }
+
+  int pos = TELEMETRY_HEADER_LEN;
+  for ( int field = 0; field < TELEMETRY_NUM_FIELDS; field++ ) {
+    uint32_t value = pending[field];
+    if ( ( value == 0 ) || ( pos + varint_len( value ) > max_len ) ) {
+      continue;
+    }
+    pos += write_varint( buffer + pos, value );
+    *fields |= 1ul << field;
+  }
+
+  buffer[0] = ( TELEMETRY_VERSION << 4 ) | ( sequence & 0xF );
+  buffer[1] = *fields & 0xFF;
+  buffer[2] = ( *fields >> 8 ) & 0xFF;
+  buffer[3] = ( *fields >> 16 ) & 0xFF;
+  return pos;
+}
+
+void Telemetry::on_sent( uint64_t now_ms, uint32_t fields )
+{
+  for ( int field = 0; field < TELEMETRY_NUM_FIELDS; field++ ) {
+    if ( ( fields >> field ) & 1 ) {
+      pending[field] = 0;
+    }
+  }
+  sequence++;
+  frames_sent++;
+  last_sent_ms = now_ms;
+}
+
+// -----------------------------------------------------------------------
+// stats
+// -----------------------------------------------------------------------
+
+void Telemetry::print_stats()
+{
+  printf( "[Telemetry] %" PRIu32 " frames sent; since boot:\n",
+          frames_sent );
+  for ( int field = 0; field < TELEMETRY_NUM_FIELDS; field++ ) {
+    if ( totals[field] != 0 ) {
+      printf( "[Telemetry]   %s: %" PRIu32 "\n", telemetry_labels[field],
+              totals[field] );
+    }
+  }
+}
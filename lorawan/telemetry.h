@@ -0,0 +1,157 @@
+// =======================================================================
+// telemetry.h
+// =======================================================================
+// Declarations of our MAC and radio telemetry, sent now and then as an
+// unconfirmed uplink on TELEMETRY_PORT
+//
+// Counters accumulate until they're sent. A frame carries those that
+// fit, and the rest wait for the next one, so a frame fits even at DR0.
+// Frame layout:
+//
+//   byte 0     TELEMETRY_VERSION (high nibble), sequence number (low
+//              nibble, so the server can see lost frames)
+//   bytes 1-3  bitmap of the fields present (field n is bit n % 8 of
+//              byte 1 + n / 8)
+//   ...        each field present, in order, as a LEB128 varint
+//
+// Fields are counts since the previous frame, except for the maxima,
+// which are over the same period.
+//
+// This has no Pico dependencies (times are passed in), so the host tools
+// use the same code
+
+#ifndef LORAWAN_TELEMETRY_H
+#define LORAWAN_TELEMETRY_H
+
+#include <cstdint>
+
+#define TELEMETRY_PORT 5
+#define TELEMETRY_VERSION 1
+
+// How often to send, once joined
+#define TELEMETRY_PERIOD_MS ( 6 * 60 * 60 * 1000ull )
+
+#define TELEMETRY_HEADER_LEN 4
+#define TELEMETRY_MAX_FRAME 128
+
+// Upper edges of the RSSI (dBm) and SNR (dB) histograms' buckets; the
+// last bucket takes everything above
+#define TELEMETRY_RSSI_EDGES { -120, -110, -100, -90 }
+#define TELEMETRY_SNR_EDGES { -12, -6, 0, 6 }
+#define TELEMETRY_HIST_BUCKETS 5
+
+// -----------------------------------------------------------------------
+// Fields
+// -----------------------------------------------------------------------
+// X( name, label ), in the order they're sent (and kept when a frame is
+// short of room)
+
+#define TELEMETRY_FIELDS( X )                      \
+  X( UPLINKS, "uplinks" )                          \
+  X( CONFIRMED, "confirmed uplinks" )              \
+  X( ACKS, "ACKs" )                                \
+  X( ACK_LATENCY_MS, "ACK latency, total (ms)" )   \
+  X( ACK_LATENCY_MAX_MS, "ACK latency, max (ms)" ) \
+  X( RETRANSMISSIONS, "MAC retransmissions" )      \
+  X( RESENDS, "unacknowledged uplinks resent" )    \
+  X( AIRTIME_MS, "airtime (ms)" )                  \
+  X( JOIN_REQUESTS, "join requests" )              \
+  X( JOINS, "joins" )                              \
+  X( REFUSED, "uplinks the MAC refused" )          \
+  X( DOWNLINKS, "downlinks" )                      \
+  X( MAC_REQUESTS, "MAC commands sent" )           \
+  X( MAC_ANSWERS, "MAC command answers" )          \
+  X( RSSI_0, "RSSI < -120 dBm" )                   \
+  X( RSSI_1, "RSSI -120 to -110 dBm" )             \
+  X( RSSI_2, "RSSI -110 to -100 dBm" )             \
+  X( RSSI_3, "RSSI -100 to -90 dBm" )              \
+  X( RSSI_4, "RSSI >= -90 dBm" )                   \
+  X( SNR_0, "SNR < -12 dB" )                       \
+  X( SNR_1, "SNR -12 to -6 dB" )                   \
+  X( SNR_2, "SNR -6 to 0 dB" )                     \
+  X( SNR_3, "SNR 0 to 6 dB" )                      \
+  X( SNR_4, "SNR >= 6 dB" )
+
+#define TELEMETRY_DECLARE_FIELD( name, label ) TELEMETRY_##name,
+
+enum telemetry_field_t {
+  TELEMETRY_FIELDS( TELEMETRY_DECLARE_FIELD ) TELEMETRY_NUM_FIELDS
+};
+
+#undef TELEMETRY_DECLARE_FIELD
+
+// Labels of the fields, for printing
+extern const char* const telemetry_labels[TELEMETRY_NUM_FIELDS];
+
+typedef struct {
+  uint8_t  version;
+  uint8_t  sequence;
+  uint32_t present;  // Bitmap of the fields in the frame
+  uint32_t values[TELEMETRY_NUM_FIELDS];
+} telemetry_frame_t;
+
+// Unpack a frame. Returns 0, or -1 if it isn't valid
+int telemetry_decode( const uint8_t* buffer, int len,
+                      telemetry_frame_t* frame );
+
+// -----------------------------------------------------------------------
+// Telemetry
+// -----------------------------------------------------------------------
+
+class Telemetry {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public Accessor Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  Telemetry();
+
+  // Call with each join request's result
+  void on_join_result( bool joined );
+
+  // Call with each uplink handed to the MAC, whether it took it, and
+  // with each unacknowledged uplink resent
+  void on_uplink_request( uint64_t now_ms, bool accepted, bool confirmed );
+  void on_resend();
+
+  // Call at the end of each uplink, with how many times the MAC sent it
+  // and its time on air (each time)
+  void on_uplink_done( uint64_t now_ms, bool confirmed, bool acked,
+                       uint8_t transmissions, uint32_t airtime_ms );
+
+  // Call with each downlink's RSSI (dBm) and SNR (dB)
+  void on_downlink( int8_t rssi, int8_t snr );
+
+  // Call with each MAC command we send, and each answer
+  void on_mac_command( bool answer );
+
+  // Whether a frame is due
+  bool due( uint64_t now_ms );
+
+  // Pack what fits of the counters into max_len bytes, setting fields to
+  // the ones packed. Returns the frame's length
+  int encode( uint8_t* buffer, int max_len, uint32_t* fields );
+
+  // Call once a frame is sent, with the fields it carried
+  void on_sent( uint64_t now_ms, uint32_t fields );
+
+  void print_stats();
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Private Functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ private:
+  void add( telemetry_field_t field, uint32_t value );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected Attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  uint32_t pending[TELEMETRY_NUM_FIELDS];  // Not sent yet
+  uint32_t totals[TELEMETRY_NUM_FIELDS];   // Since boot
+  uint64_t request_ms;                     // Of the latest uplink
+  uint64_t last_sent_ms;
+  uint8_t  sequence;
+  uint32_t frames_sent;
+};
+
+#endif  // LORAWAN_TELEMETRY_H
@@ -0,0 +1,489 @@
+// =======================================================================
+// uplink_queue.cpp
+// =======================================================================
+// Definitions of our persistent store-and-forward uplink queue
+
+#include "lorawan/uplink_queue.h"
+#include "pico/stdlib.h"
+#include "utils/debug.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------
+// Slot layout
+// -----------------------------------------------------------------------
+// Status bits start erased (1) and are cleared as the slot advances
+
+#define SLOT_ERASED 0xFF
+#define SLOT_WRITTEN_BIT 0x01
+#define SLOT_ACKED_BIT 0x02
+
+typedef struct __attribute__( ( packed ) ) {
+  uint8_t  status;
+  uint8_t  length;
+  uint16_t crc;  // Over everything but the status and CRC
+  uint32_t seq;
+  uint32_t time_s;
+  uint8_t  data[UPLINK_QUEUE_MAX_DATA];
+} queue_slot_t;
+
+static_assert( sizeof( queue_slot_t ) == UPLINK_QUEUE_SLOT_SIZE,
+               "Queue slots must fill their fixed size" );
+static_assert( FLASH_PAGE_SIZE % UPLINK_QUEUE_SLOT_SIZE == 0,
+               "Queue slots can't straddle flash pages" );
+
+// CRC-16/CCITT-FALSE
+static uint16_t crc16( uint16_t crc, const uint8_t* data, uint32_t len )
+{
+  for ( uint32_t i = 0; i < len; i++ ) {
+    crc ^= (uint16_t) data[i] << 8;
+    for ( int bit = 0; bit < 8; bit++ ) {
+      crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : ( crc << 1 );
+    }
+  }
+  return crc;
+}
+
+static uint16_t slot_crc( const queue_slot_t* slot )
+{
+  uint16_t crc = crc16( 0xFFFF, &slot->length, 1 );
+  return crc16( crc, (const uint8_t*) &slot->seq,
+                sizeof( queue_slot_t ) - offsetof( queue_slot_t, seq ) );
+}
+
+static bool slot_valid( const queue_slot_t* slot )
+{
+  return ( ( slot->status & SLOT_WRITTEN_BIT ) == 0 ) &&
+         ( slot->length <= UPLINK_QUEUE_MAX_DATA ) &&
+         ( slot->crc == slot_crc( slot ) );
+}
+
+static bool slot_acked( const queue_slot_t* slot )
+{
+  return ( slot->status & SLOT_ACKED_BIT ) == 0;
+}
+
+// -----------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------
+
+UplinkQueue::UplinkQueue()
+    : num_in_flight( 0 ),
+      num_enqueued( 0 ),
+      num_acked( 0 ),
+      num_dropped( 0 ),
+      data_bytes( 0 ),
+      pages_written( 0 ),
+      sectors_erased( 0 )
+{
+  rebuild();
+}
+
+// -----------------------------------------------------------------------
+// Slot helpers
+// -----------------------------------------------------------------------
+
+uint32_t UplinkQueue::next_slot( uint32_t slot )
+{
+  return ( slot + 1 ) % UPLINK_QUEUE_NUM_SLOTS;
+}
+
+uint32_t UplinkQueue::slot_offset( uint32_t slot )
+{
+  return UPLINK_QUEUE_OFFSET + slot * UPLINK_QUEUE_SLOT_SIZE;
+}
+
+static const queue_slot_t* read_slot( uint32_t offset )
+{
+  return (const queue_slot_t*) flash_read( offset );
+}
+
+uint32_t UplinkQueue::slot_seq( uint32_t slot )
+{
+  return read_slot( slot_offset( slot ) )->seq;
+}
+
+// Check a slot in flash, for its state in RAM
+void UplinkQueue::read_state( uint32_t slot )
+{
+  const uint8_t*      bytes = flash_read( slot_offset( slot ) );
+  const queue_slot_t* s     = (const queue_slot_t*) bytes;
+
+  uplink_slot_state_t state = SLOT_STATE_ERASED;
+  for ( int i = 0; i < UPLINK_QUEUE_SLOT_SIZE; i++ ) {
+    if ( bytes[i] != 0xFF ) {
+      state = SLOT_STATE_USED;
+      break;
+    }
+  }
+  if ( ( state == SLOT_STATE_USED ) && slot_valid( s ) ) {
+    state = slot_acked( s ) ? SLOT_STATE_ACKED : SLOT_STATE_PENDING;
+  }
+  slot_states[slot] = state;
+}
+
+bool UplinkQueue::is_erased( uint32_t slot )
+{
+  return slot_states[slot] == SLOT_STATE_ERASED;
+}
+
+bool UplinkQueue::is_pending( uint32_t slot )
+{
+  return slot_states[slot] == SLOT_STATE_PENDING;
+}
+
+bool UplinkQueue::sector_is_erased( uint32_t sector )
+{
+  uint32_t first = sector * UPLINK_QUEUE_SLOTS_PER_SECTOR;
+  for ( uint32_t i = 0; i < UPLINK_QUEUE_SLOTS_PER_SECTOR; i++ ) {
+    if ( !is_erased( first + i ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// rebuild
+// -----------------------------------------------------------------------
+// Recover the pointers from the slots' status bits after a reboot
+
+void UplinkQueue::rebuild()
+{
+  bool     found_newest = false;
+  uint32_t newest_slot  = 0;
+  uint32_t newest_seq   = 0;
+  bool     found_oldest = false;
+  uint32_t oldest_slot  = 0;
+  uint32_t oldest_seq   = 0;
+
+  num_pending = 0;
+  boot_time_s = 0;
+
+  for ( uint32_t slot = 0; slot < UPLINK_QUEUE_NUM_SLOTS; slot++ ) {
+    read_state( slot );
+    if ( ( slot_states[slot] != SLOT_STATE_PENDING ) &&
+         ( slot_states[slot] != SLOT_STATE_ACKED ) ) {
+      continue;
+    }
+    const queue_slot_t* s = read_slot( slot_offset( slot ) );
+
+    if ( !found_newest || ( s->seq > newest_seq ) ) {
+      found_newest = true;
+      newest_slot  = slot;
+      newest_seq   = s->seq;
+    }
+    if ( s->time_s > boot_time_s ) {
+      boot_time_s = s->time_s;
+    }
+
+    if ( slot_states[slot] == SLOT_STATE_ACKED ) {
+      continue;
+    }
+    num_pending++;
+    if ( !found_oldest || ( s->seq < oldest_seq ) ) {
+      found_oldest = true;
+      oldest_slot  = slot;
+      oldest_seq   = s->seq;
+    }
+  }
+
+  // Write after the newest entry, skipping any slots left partly written
+  // by a power loss (the next sector is erased when we reach it)
+  head     = found_newest ? next_slot( newest_slot ) : 0;
+  next_seq = found_newest ? newest_seq + 1 : 0;
+  while ( ( head % UPLINK_QUEUE_SLOTS_PER_SECTOR != 0 ) &&
+          !is_erased( head ) ) {
+    head = next_slot( head );
+  }
+  tail = found_oldest ? oldest_slot : head;
+
+  debug( "[Queue] Recovered %lu pending entries (next seq %lu)\n",
+         num_pending, next_seq );
+}
+
+// -----------------------------------------------------------------------
+// erase_sector
+// -----------------------------------------------------------------------
+// Called when the head wraps into a used sector. Anything still pending
+// there is the oldest data we have, and is lost
+
+void UplinkQueue::erase_sector( uint32_t sector )
+{
+  uint32_t first = sector * UPLINK_QUEUE_SLOTS_PER_SECTOR;
+  uint32_t last  = first + UPLINK_QUEUE_SLOTS_PER_SECTOR;
+
+  for ( uint32_t slot = first; slot < last; slot++ ) {
+    if ( is_pending( slot ) ) {
+      num_pending--;
+      num_dropped++;
+    }
+  }
+
+  // Forget any in-flight entries we're about to erase
+  int kept = 0;
+  for ( int i = 0; i < num_in_flight; i++ ) {
+    if ( ( in_flight_slots[i] < first ) || ( in_flight_slots[i] >= last ) ) {
+      in_flight_slots[kept] = in_flight_slots[i];
+      in_flight_seqs[kept]  = in_flight_seqs[i];
+      kept++;
+    }
+  }
+  num_in_flight = kept;
+
+  flash_erase_sector( slot_offset( first ) );
+  sectors_erased++;
+  for ( uint32_t slot = first; slot < last; slot++ ) {
+    read_state( slot );
+  }
+
+  if ( ( tail >= first ) && ( tail < last ) ) {
+    tail = last % UPLINK_QUEUE_NUM_SLOTS;
+    advance_tail();
+  }
+}
+
+void UplinkQueue::advance_tail()
+{
+  if ( num_pending == 0 ) {
+    tail = head;
+    return;
+  }
+  while ( ( tail != head ) && !is_pending( tail ) ) {
+    tail = next_slot( tail );
+  }
+}
+
+// -----------------------------------------------------------------------
+// enqueue
+// -----------------------------------------------------------------------
+
+int64_t UplinkQueue::enqueue( const uint8_t* data, uint8_t length )
+{
+  if ( length > UPLINK_QUEUE_MAX_DATA ) {
+    return -1;
+  }
+
+  // Find a free slot, erasing the next sector when we move into it
+  for ( uint32_t i = 0; i <= UPLINK_QUEUE_NUM_SLOTS; i++ ) {
+    if ( ( head % UPLINK_QUEUE_SLOTS_PER_SECTOR == 0 ) &&
+         !sector_is_erased( head / UPLINK_QUEUE_SLOTS_PER_SECTOR ) ) {
+      erase_sector( head / UPLINK_QUEUE_SLOTS_PER_SECTOR );
+    }
+    if ( is_erased( head ) ) {
+      break;
+    }
+    head = next_slot( head );
+  }
+  if ( !is_erased( head ) ) {
+    debug( "[Queue] No free slot to write to\n" );
+    return -1;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Write the entry (marked as written in the same operation)
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  queue_slot_t slot;
+  memset( &slot, 0xFF, sizeof( slot ) );
+  slot.status = SLOT_ERASED & ~SLOT_WRITTEN_BIT;
+  slot.length = length;
+  slot.seq    = next_seq;
+  slot.time_s = now_s();
+  memcpy( slot.data, data, length );
+  slot.crc = slot_crc( &slot );
+
+  pages_written++;
+  bool written = flash_program( slot_offset( head ),
+                                (const uint8_t*) &slot, sizeof( slot ) );
+  read_state( head );
+  if ( !written || !is_pending( head ) ) {
+    debug( "[Queue] Failed to write entry %lu\n", next_seq );
+    return -1;
+  }
+
+  if ( num_pending == 0 ) {
+    tail = head;
+  }
+  head = next_slot( head );
+  num_pending++;
+  num_enqueued++;
+  data_bytes += length;
+  debug( "[Queue] Enqueued entry %lu (%lu pending)\n", next_seq,
+         num_pending );
+  return next_seq++;
+}
+
+// -----------------------------------------------------------------------
+// Sending
+// -----------------------------------------------------------------------
+
+int UplinkQueue::peek( uplink_entry_t* entries, int max_entries,
+                       uint32_t min_seq )
+{
+  // Collect the oldest entries, unless some are already in flight
+  if ( num_in_flight == 0 ) {
+    uint32_t slot = tail;
+    while ( ( num_pending > 0 ) && ( num_in_flight < max_entries ) &&
+            ( num_in_flight < UPLINK_QUEUE_MAX_IN_FLIGHT ) ) {
+      if ( is_pending( slot ) && ( slot_seq( slot ) >= min_seq ) ) {
+        in_flight_slots[num_in_flight] = slot;
+        in_flight_seqs[num_in_flight]  = slot_seq( slot );
+        num_in_flight++;
+      }
+      slot = next_slot( slot );
+      if ( slot == head ) {
+        break;
+      }
+    }
+  }
+
+  int num_entries = 0;
+  for ( int i = 0; ( i < num_in_flight ) && ( i < max_entries ); i++ ) {
+    const queue_slot_t* s = read_slot( slot_offset( in_flight_slots[i] ) );
+    entries[i].seq        = s->seq;
+    entries[i].time_s     = s->time_s;
+    entries[i].length     = s->length;
+    memcpy( entries[i].data, s->data, s->length );
+    num_entries++;
+  }
+  return num_entries;
+}
+
+// Mark a slot as acknowledged, making sure it wasn't reused since we
+// sent it
+
+bool UplinkQueue::ack_slot( uint32_t slot, uint32_t seq )
+{
+  if ( !is_pending( slot ) || ( slot_seq( slot ) != seq ) ) {
+    return false;
+  }
+
+  uint32_t offset = slot_offset( slot );
+  uint8_t  status = read_slot( offset )->status & ~SLOT_ACKED_BIT;
+  pages_written++;
+  bool programmed = flash_program( offset, &status, 1 );
+  read_state( slot );
+  if ( !programmed || ( slot_states[slot] != SLOT_STATE_ACKED ) ) {
+    return false;
+  }
+  num_pending--;
+  num_acked++;
+  return true;
+}
+
+void UplinkQueue::ack()
+{
+  for ( int i = 0; i < num_in_flight; i++ ) {
+    ack_slot( in_flight_slots[i], in_flight_seqs[i] );
+  }
+  num_in_flight = 0;
+  advance_tail();
+}
+
+int UplinkQueue::ack_matching( bool ( *matches )( uint32_t  seq,
+                                                  const void* arg ),
+                               const void* arg )
+{
+  int num_matched = 0;
+  if ( num_pending == 0 ) {
+    return 0;
+  }
+  for ( uint32_t slot = tail; slot != head; slot = next_slot( slot ) ) {
+    if ( is_pending( slot ) && matches( slot_seq( slot ), arg ) &&
+         ack_slot( slot, slot_seq( slot ) ) ) {
+      num_matched++;
+    }
+  }
+
+  // Acknowledged entries don't stay in flight
+  int kept = 0;
+  for ( int i = 0; i < num_in_flight; i++ ) {
+    if ( is_pending( in_flight_slots[i] ) ) {
+      in_flight_slots[kept] = in_flight_slots[i];
+      in_flight_seqs[kept]  = in_flight_seqs[i];
+      kept++;
+    }
+  }
+  num_in_flight = kept;
+  advance_tail();
+  return num_matched;
+}
+
+void UplinkQueue::release()
+{
+  num_in_flight = 0;
+}
+
+bool UplinkQueue::done( uint32_t seq )
+{
+  if ( seq >= next_seq ) {
+    return false;
+  }
+  if ( num_pending == 0 ) {
+    return true;
+  }
+  for ( uint32_t slot = tail; slot != head; slot = next_slot( slot ) ) {
+    if ( is_pending( slot ) && ( slot_seq( slot ) == seq ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------
+// Statistics
+// -----------------------------------------------------------------------
+
+uint32_t UplinkQueue::depth()
+{
+  return num_pending;
+}
+
+uint32_t UplinkQueue::in_flight()
+{
+  return num_in_flight;
+}
+
+uint32_t UplinkQueue::now_s()
+{
+  return boot_time_s + to_ms_since_boot( get_absolute_time() ) / 1000;
+}
+
+uplink_queue_stats_t UplinkQueue::stats()
+{
+  uplink_queue_stats_t stats;
+  stats.depth          = num_pending;
+  stats.oldest_age_s   = 0;
+  stats.enqueued       = num_enqueued;
+  stats.acked          = num_acked;
+  stats.dropped        = num_dropped;
+  stats.data_bytes     = data_bytes;
+  stats.pages_written  = pages_written;
+  stats.bytes_written  = pages_written * FLASH_PAGE_SIZE;
+  stats.sectors_erased = sectors_erased;
+
+  if ( num_pending > 0 ) {
+    stats.oldest_age_s = now_s() - read_slot( slot_offset( tail ) )->time_s;
+  }
+
+  uint32_t flash_bytes =
+      stats.bytes_written + sectors_erased * FLASH_SECTOR_SIZE;
+  stats.write_amplification =
+      ( data_bytes > 0 ) ? (float) flash_bytes / data_bytes : 0.0f;
+  return stats;
+}
+
+void UplinkQueue::print_stats()
+{
+  uplink_queue_stats_t s = stats();
+  printf( "[Queue] Depth %lu (oldest %lu s), %d in flight\n", s.depth,
+          s.oldest_age_s, num_in_flight );
+  printf( "[Queue] Since boot: %lu enqueued, %lu acked, %lu dropped\n",
+          s.enqueued, s.acked, s.dropped );
+  printf( "[Queue] Flash: %lu bytes in %lu pages, %lu erases for %lu "
+          "bytes of data (write amplification %.1fx)\n",
+          s.bytes_written, s.pages_written, s.sectors_erased, s.data_bytes,
+          s.write_amplification );
+}
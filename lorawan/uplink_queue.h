@@ -0,0 +1,172 @@
+// =======================================================================
+// uplink_queue.h
+// =======================================================================
+// Declarations of our persistent store-and-forward queue of encoded
+// readings waiting to be sent over LoRaWAN
+//
+// Entries live in fixed-size slots in a ring of flash sectors. A slot's
+// status bits are cleared one at a time as it advances (written, then
+// acknowledged), so every transition is a single program operation and
+// the queue can be rebuilt from flash after a power loss. A sector is
+// only erased when the enqueue pointer wraps around into it.
+//
+// Each slot's state is also kept in RAM, checked against its CRC once at
+// boot and then updated as we write, so looking an entry up doesn't
+// re-check slots in flash.
+//
+// Users should only ever construct ONE queue, as it owns its flash region
+
+#ifndef LORAWAN_UPLINK_QUEUE_H
+#define LORAWAN_UPLINK_QUEUE_H
+
+#include "utils/flash.h"
+#include <cstdint>
+
+// Size of one slot, and the encoded data it can hold
+#define UPLINK_QUEUE_SLOT_SIZE 32
+#define UPLINK_QUEUE_MAX_DATA 20
+
+#define UPLINK_QUEUE_SLOTS_PER_SECTOR \
+  ( FLASH_SECTOR_SIZE / UPLINK_QUEUE_SLOT_SIZE )
+#define UPLINK_QUEUE_NUM_SLOTS \
+  ( UPLINK_QUEUE_SECTORS * UPLINK_QUEUE_SLOTS_PER_SECTOR )
+
+// Most entries that can be in flight at once
+#define UPLINK_QUEUE_MAX_IN_FLIGHT 32
+
+// -----------------------------------------------------------------------
+// Queue entries
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint32_t seq;     // Sequence number, increasing across reboots
+  uint32_t time_s;  // Device time when enqueued
+  uint8_t  length;
+  uint8_t  data[UPLINK_QUEUE_MAX_DATA];
+} uplink_entry_t;
+
+// -----------------------------------------------------------------------
+// Statistics
+// -----------------------------------------------------------------------
+// Write amplification is the flash programmed and erased per byte of
+// data enqueued since boot. The flash programs a whole page at a time,
+// even to clear one status bit, so we count whole pages
+
+typedef struct {
+  uint32_t depth;          // Entries not yet acknowledged
+  uint32_t oldest_age_s;   // Age of the oldest unacknowledged entry
+  uint32_t enqueued;       // Entries enqueued since boot
+  uint32_t acked;          // Entries acknowledged since boot
+  uint32_t dropped;        // Unsent entries overwritten when full
+  uint32_t data_bytes;     // Data bytes enqueued since boot
+  uint32_t pages_written;  // Page program operations since boot
+  uint32_t bytes_written;  // Pages programmed since boot, in bytes
+  uint32_t sectors_erased;
+  float    write_amplification;
+} uplink_queue_stats_t;
+
+// -----------------------------------------------------------------------
+// Slot states
+// -----------------------------------------------------------------------
+
+enum uplink_slot_state_t : uint8_t {
+  SLOT_STATE_ERASED,   // Free to write
+  SLOT_STATE_PENDING,  // Holds an unacknowledged entry
+  SLOT_STATE_ACKED,    // Holds an acknowledged entry
+  SLOT_STATE_USED      // Not erased, but no valid entry (a power loss)
+};
+
+// -----------------------------------------------------------------------
+// UplinkQueue
+// -----------------------------------------------------------------------
+
+class UplinkQueue {
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public accessor functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  // Rebuilds the queue from flash
+  UplinkQueue();
+
+  // Add encoded data to the queue. Returns the entry's sequence number,
+  // or -1 if it couldn't be stored
+  int64_t enqueue( const uint8_t* data, uint8_t length );
+
+  // Get up to max_entries of the oldest unacknowledged entries (from
+  // min_seq on), and mark them as in flight. Returns the number of
+  // entries
+  int peek( uplink_entry_t* entries, int max_entries,
+            uint32_t min_seq = 0 );
+
+  // Acknowledge all in-flight entries
+  void ack();
+
+  // Acknowledge every unacknowledged entry whose sequence number matches.
+  // Returns the number of entries acknowledged
+  int ack_matching( bool ( *matches )( uint32_t seq, const void* arg ),
+                    const void* arg );
+
+  // Release in-flight entries without acknowledging them (to resend)
+  void release();
+
+  // Whether the entry with the given sequence number was acknowledged
+  // (or is otherwise no longer waiting)
+  bool done( uint32_t seq );
+
+  uint32_t depth();
+  uint32_t in_flight();
+
+  // Device time in seconds. There's no RTC, so this continues from the
+  // newest entry found at boot; ages across a power loss are a lower
+  // bound
+  uint32_t now_s();
+
+  uplink_queue_stats_t stats();
+  void                 print_stats();
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  // Pointers (slot indices)
+  uint32_t head;  // Next slot to write
+  uint32_t tail;  // Oldest unacknowledged entry (or head if empty)
+
+  // In-flight entries (not persisted - they're resent after a reboot)
+  uint32_t in_flight_slots[UPLINK_QUEUE_MAX_IN_FLIGHT];
+  uint32_t in_flight_seqs[UPLINK_QUEUE_MAX_IN_FLIGHT];
+  int      num_in_flight;
+
+  // Every slot's state, as in flash
+  uplink_slot_state_t slot_states[UPLINK_QUEUE_NUM_SLOTS];
+
+  uint32_t next_seq;
+  uint32_t num_pending;
+  uint32_t boot_time_s;
+
+  // Statistics since boot
+  uint32_t num_enqueued;
+  uint32_t num_acked;
+  uint32_t num_dropped;
+  uint32_t data_bytes;
+  uint32_t pages_written;
+  uint32_t sectors_erased;
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ protected:
+  void     rebuild();
+  uint32_t next_slot( uint32_t slot );
+  uint32_t slot_offset( uint32_t slot );
+  uint32_t slot_seq( uint32_t slot );
+  void     read_state( uint32_t slot );
+  bool     is_erased( uint32_t slot );
+  bool     is_pending( uint32_t slot );
+  bool     sector_is_erased( uint32_t sector );
+  void     erase_sector( uint32_t sector );
+  void     advance_tail();
+  bool     ack_slot( uint32_t slot, uint32_t seq );
+};
+
+#endif  // LORAWAN_UPLINK_QUEUE_H
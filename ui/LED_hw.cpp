@@ -3,16 +3,88 @@
 // =======================================================================
 // Implementation of LED controls
 
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "led.pio.h"
 #include "pico/stdlib.h"
 #include "ui/LED_hw.h"
 #include "utils/debug.h"
+#include <math.h>
 #include <stdio.h>
 
+// A breath is BREATHE_STEPS levels, one per PWM period, out of
+// BREATHE_LEVELS. The table is a DMA read ring, so its size in bytes is
+// 1 << BREATHE_RING_BITS and it's aligned to that
+#define BREATHE_STEPS 512
+#define BREATHE_RING_BITS 11
+#define BREATHE_LEVELS 256
+
+// Cycles per PWM period, and per blink half period before the count
+#define PWM_CYCLES ( 3 + 3 * BREATHE_LEVELS )
+#define BLINK_CYCLES 3
+
+static_assert( BREATHE_STEPS * 4 == ( 1 << BREATHE_RING_BITS ),
+               "The breath table has to fill the DMA ring" );
+
+// -----------------------------------------------------------------------
+// Shared PIO programs
+// -----------------------------------------------------------------------
+
+static PIO  led_pio = nullptr;
+static uint blink_offset;
+static uint pwm_offset;
+
+static uint32_t breathe_levels[BREATHE_STEPS]
+    __attribute__( ( aligned( 1 << BREATHE_RING_BITS ) ) );
+
+// Load both programs into whichever PIO has room (the CYW43 driver takes
+// some of one), and fill the breath table, the first time
+static bool load_programs()
+{
+  if ( led_pio != nullptr ) {
+    return true;
+  }
+
+  PIO pios[] = { pio0, pio1 };
+  for ( PIO pio : pios ) {
+    if ( !pio_can_add_program( pio, &led_blink_program ) ) {
+      continue;
+    }
+    uint blink = pio_add_program( pio, &led_blink_program );
+    if ( !pio_can_add_program( pio, &led_pwm_program ) ) {
+      pio_remove_program( pio, &led_blink_program, blink );
+      continue;
+    }
+    led_pio      = pio;
+    blink_offset = blink;
+    pwm_offset   = pio_add_program( pio, &led_pwm_program );
+    break;
+  }
+  if ( led_pio == nullptr ) {
+    debug( "[LED] No room for the LED programs\n" );
+    return false;
+  }
+
+  // A raised cosine, squared so it looks even to the eye
+  for ( int i = 0; i < BREATHE_STEPS; i++ ) {
+    float phase = 2.0f * (float) M_PI * i / BREATHE_STEPS;
+    float level = ( 1.0f - cosf( phase ) ) / 2.0f;
+    breathe_levels[i] =
+        (uint32_t) ( level * level * ( BREATHE_LEVELS - 1 ) + 0.5f );
+  }
+  return true;
+}
+
 // -----------------------------------------------------------------------
 // Constructor
 // -----------------------------------------------------------------------
 
-LED_hw::LED_hw( int gpio_num ) : gpio_num( gpio_num ), blinking( false )
+LED_hw::LED_hw( int gpio_num )
+    : gpio_num( gpio_num ),
+      curr_pattern( LED_OFF ),
+      curr_period_ms( 0 ),
+      sm( -1 ),
+      dma{ -1, -1 }
 {
   debug( "[LED] Initializing LED with GPIO %d...\n", gpio_num );
 
@@ -27,35 +99,151 @@ LED_hw::LED_hw( int gpio_num ) : gpio_num( gpio_num ), blinking( false )
 
 void LED_hw::on()
 {
-  blinking = false;
-  state    = true;
-  gpio_put( gpio_num, 1 );  // Turn on the LED
+  set_pattern( LED_SOLID, 0 );
 }
 
 void LED_hw::off()
 {
-  blinking = false;
-  state    = false;
-  gpio_put( gpio_num, 0 );  // Turn off the LED
+  set_pattern( LED_OFF, 0 );
 }
 
 void LED_hw::blink( int duration_ms )
 {
-  if ( !blinking ) {
-    // Just started
-    last_blink_toggle = to_ms_since_boot( get_absolute_time() );
-    blinking          = true;
+  set_pattern( LED_BLINK, duration_ms );
+}
+
+void LED_hw::breathe( int period_ms )
+{
+  set_pattern( LED_BREATHE, period_ms );
+}
+
+bool LED_hw::is_on()
+{
+  return gpio_get( gpio_num );
+}
+
+// -----------------------------------------------------------------------
+// Patterns
+// -----------------------------------------------------------------------
+
+void LED_hw::set_pattern( led_pattern_t pattern, int period_ms )
+{
+  if ( ( pattern == curr_pattern ) && ( period_ms == curr_period_ms ) ) {
+    return;
   }
+  stop();
+  curr_pattern   = pattern;
+  curr_period_ms = period_ms;
 
-  uint32_t curr_time = to_ms_since_boot( get_absolute_time() );
-  if ( curr_time - last_blink_toggle >= duration_ms ) {
-    last_blink_toggle = curr_time;
-    state             = !state;
+  switch ( pattern ) {
+    case LED_BLINK:
+      if ( claim_sm() ) {
+        start_blink( period_ms );
+        return;
+      }
+      break;
+    case LED_BREATHE:
+      if ( claim_sm() && claim_dma() ) {
+        start_breathe( period_ms );
+        return;
+      }
+      break;
+    default:
+      break;
   }
-  gpio_put( gpio_num, (int) state );
+
+  // Solid, off, or a pattern we had nothing to run on
+  gpio_set_function( gpio_num, GPIO_FUNC_SIO );
+  gpio_put( gpio_num, pattern != LED_OFF );
 }
 
-bool LED_hw::is_on()
+// Stop whatever's running, and give the pin back to SIO. The state
+// machine and DMA channels stay ours for next time
+void LED_hw::stop()
+{
+  if ( curr_pattern == LED_BREATHE && dma[0] >= 0 ) {
+    // Clear both enables before aborting, so neither can chain to the
+    // other while it's aborted (RP2040-E13)
+    for ( int ch : dma ) {
+      hw_clear_bits( &dma_hw->ch[ch].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS );
+    }
+    dma_channel_abort( dma[0] );
+    dma_channel_abort( dma[1] );
+  }
+  if ( sm >= 0 ) {
+    pio_sm_set_enabled( led_pio, sm, false );
+  }
+  gpio_set_function( gpio_num, GPIO_FUNC_SIO );
+}
+
+bool LED_hw::claim_sm()
+{
+  if ( sm < 0 && load_programs() ) {
+    sm = pio_claim_unused_sm( led_pio, false );
+    if ( sm < 0 ) {
+      debug( "[LED] No state machine left for GPIO %d\n", gpio_num );
+    }
+  }
+  return sm >= 0;
+}
+
+bool LED_hw::claim_dma()
 {
-  return state;
+  if ( dma[0] < 0 ) {
+    int a = dma_claim_unused_channel( false );
+    int b = dma_claim_unused_channel( false );
+    if ( a < 0 || b < 0 ) {
+      if ( a >= 0 ) {
+        dma_channel_unclaim( a );
+      }
+      if ( b >= 0 ) {
+        dma_channel_unclaim( b );
+      }
+      debug( "[LED] No DMA channels left for GPIO %d\n", gpio_num );
+      return false;
+    }
+    dma[0] = a;
+    dma[1] = b;
+  }
+  return true;
+}
+
+// The half period, in cycles at the system clock, is loaded once
+void LED_hw::start_blink( int duration_ms )
+{
+  uint64_t cycles = (uint64_t) clock_get_hz( clk_sys ) * duration_ms / 1000;
+  cycles          = MIN( MAX( cycles, BLINK_CYCLES ), UINT32_MAX );
+
+  led_blink_program_init( led_pio, sm, blink_offset, gpio_num );
+  pio_sm_put( led_pio, sm, (uint32_t) cycles - BLINK_CYCLES );
+  pio_sm_set_enabled( led_pio, sm, true );
+}
+
+// The state machine's clock is slowed so a pass through the table takes
+// period_ms, and two DMA channels take turns feeding it the table, each
+// chaining to the other when it's done, so it runs with no interrupts
+void LED_hw::start_breathe( int period_ms )
+{
+  float div = (float) clock_get_hz( clk_sys ) * period_ms /
+              ( 1000.0f * BREATHE_STEPS * PWM_CYCLES );
+  div       = MIN( MAX( div, 1.0f ), 65535.0f );
+
+  led_pwm_program_init( led_pio, sm, pwm_offset, gpio_num,
+                        BREATHE_LEVELS - 1 );
+  pio_sm_set_clkdiv( led_pio, sm, div );
+
+  for ( int i = 0; i < 2; i++ ) {
+    dma_channel_config config = dma_channel_get_default_config( dma[i] );
+    channel_config_set_transfer_data_size( &config, DMA_SIZE_32 );
+    channel_config_set_read_increment( &config, true );
+    channel_config_set_write_increment( &config, false );
+    channel_config_set_ring( &config, false, BREATHE_RING_BITS );
+    channel_config_set_dreq( &config, pio_get_dreq( led_pio, sm, true ) );
+    channel_config_set_chain_to( &config, dma[1 - i] );
+    dma_channel_configure( dma[i], &config, &led_pio->txf[sm],
+                           breathe_levels, BREATHE_STEPS, false );
+  }
+
+  pio_sm_set_enabled( led_pio, sm, true );
+  dma_channel_start( dma[0] );
 }
@@ -1,13 +1,32 @@
 // =======================================================================
 // LED.h
 // =======================================================================
-// Declaration of the button utilities
+// Declaration of the LED utilities
+//
+// A pattern is set up once, when it changes, and then runs on its own,
+// so it holds while the CPU sleeps and doesn't need update() calls to
+// keep time. Solid and off drive the pin directly. Blinking runs on a
+// PIO state machine (see led.pio), and breathing runs a PIO PWM fed its
+// levels by two chained DMA channels. Setting the pattern that's running
+// again does nothing, so callers can set it every tick.
+//
+// The LEDs share one PIO's programs and take a state machine each (and
+// two DMA channels to breathe) the first time they need them. If none
+// are left, the LED stays on instead
 
 #ifndef UI_LED_HW_H
 #define UI_LED_HW_H
 
+#include "hardware/pio.h"
 #include <cstdint>
 
+enum led_pattern_t {
+  LED_OFF,
+  LED_SOLID,
+  LED_BLINK,
+  LED_BREATHE
+};
+
 class LED_hw {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Public accessor functions
@@ -16,17 +35,38 @@ class LED_hw {
   LED_hw( int gpio_num );
   void on();
   void off();
+
+  // On for duration_ms, then off for duration_ms, and so on
   void blink( int duration_ms );
+
+  // Fade up and back down over period_ms, and so on
+  void breathe( int period_ms );
+
+  // Whether the pin's high right now
   bool is_on();
 
+  led_pattern_t pattern() const
+  {
+    return curr_pattern;
+  }
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Protected attributes
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  private:
-  int      gpio_num;  // GPIO pin number for the button
-  uint32_t last_blink_toggle;
-  bool     blinking;
-  bool     state;  // Whether we're on or off
+  int           gpio_num;  // GPIO pin number for the LED
+  led_pattern_t curr_pattern;
+  int           curr_period_ms;
+
+  int sm;      // Our PIO state machine, or -1 until we need one
+  int dma[2];  // Our DMA channels, or -1 until we need them
+
+  void set_pattern( led_pattern_t pattern, int period_ms );
+  void stop();
+  bool claim_sm();
+  bool claim_dma();
+  void start_blink( int duration_ms );
+  void start_breathe( int period_ms );
 };
 
-#endif  // UI_LED_hw_H
\ No newline at end of file
+#endif  // UI_LED_HW_H
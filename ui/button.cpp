@@ -5,6 +5,7 @@
 
 #include "pico/stdlib.h"
 #include "ui/button.h"
+#include "ui/gpio_edges.h"
 #include "utils/debug.h"
 #include <stdio.h>
 
@@ -12,37 +13,13 @@
 // Constructor
 // -----------------------------------------------------------------------
 
-Button::Button( int gpio_num )
-    : gpio_num( gpio_num ), curr_state( NotPressed )
+Button::Button( int gpio_num ) : gpio_num( gpio_num )
 {
   debug( "[Button] Initializing button with gpio %d...\n", gpio_num );
   gpio_init( gpio_num );
   gpio_set_dir( gpio_num, GPIO_IN );
   gpio_pull_up( gpio_num );  // Enable internal pull-up resistor
-}
-
-// -----------------------------------------------------------------------
-// State Transitions
-// -----------------------------------------------------------------------
-
-button_state_t next_state( button_state_t curr_state, bool is_pressed )
-{
-  switch ( curr_state ) {
-    case NotPressed:
-      return is_pressed ? MaybePressed : NotPressed;
-
-    case MaybePressed:
-      return is_pressed ? Pressed : NotPressed;
-
-    case Pressed:
-      return is_pressed ? Pressed : MaybeNotPressed;
-
-    case MaybeNotPressed:
-      return is_pressed ? Pressed : NotPressed;
-
-    default:
-      return NotPressed;
-  }
+  gpio_edges_attach( gpio_num, &debouncer );
 }
 
 // -----------------------------------------------------------------------
@@ -51,31 +28,35 @@ button_state_t next_state( button_state_t curr_state, bool is_pressed )
 
 void Button::update()
 {
-  bool           physical_pressed = gpio_get( gpio_num ) == 0;
-  button_state_t next = next_state( curr_state, physical_pressed );
-
-  justPressed  = ( ( curr_state == MaybePressed ) && next == Pressed );
-  justReleased = ( ( curr_state == Pressed ) && next == MaybeNotPressed );
-
-  curr_state = next;
+  debouncer.update( time_us_32() );
 }
 
 bool Button::is_pressed() const
 {
-  return curr_state == Pressed;
+  return !debouncer.level();
 }
 
 bool Button::just_pressed() const
 {
-  return justPressed;
+  return debouncer.fell();
 }
 
 bool Button::just_released() const
 {
-  return justReleased;
+  return debouncer.rose();
 }
 
 bool Button::is_released() const
 {
-  return curr_state == NotPressed;
-}
\ No newline at end of file
+  return debouncer.level();
+}
+
+uint32_t Button::last_change_us() const
+{
+  return debouncer.last_change_us();
+}
+
+uint32_t Button::pending_us() const
+{
+  return debouncer.pending_us( time_us_32() );
+}
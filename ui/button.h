@@ -2,16 +2,14 @@
 // button.h
 // =======================================================================
 // Declaration of the button utilities
+//
+// The button's edges come in by interrupt and are debounced by time (see
+// debounce.h), so update() only has to run when we want to know
 
 #ifndef UI_BUTTON_H
 #define UI_BUTTON_H
 
-enum button_state_t {
-  NotPressed,
-  MaybePressed,
-  Pressed,
-  MaybeNotPressed,
-};
+#include "ui/debounce.h"
 
 class Button {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -21,22 +19,23 @@ class Button {
   Button( int gpio_num );
   void update();
   bool is_pressed() const;
-  bool just_pressed() const;
+  bool just_pressed() const;  // Since the last update
   bool just_released() const;
   bool is_released() const;
 
+  // When the latest press or release began (time_us_32)
+  uint32_t last_change_us() const;
+
+  // Microseconds until a press or release under way counts, or 0 if
+  // none is, so the main loop can sleep until then
+  uint32_t pending_us() const;
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Protected attributes
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-  // int            gpio_num;
-  // button_state_t curr_state;
  private:
-  int gpio_num;  // GPIO pin number for the button
-  button_state_t curr_state = NotPressed;
-  bool prev_physical = false;
-  bool justPressed = false;
-  bool justReleased = false;
+  int           gpio_num;   // GPIO pin number for the button
+  GpioDebouncer debouncer;  // Of the pin's level; low is pressed
 };
 
-#endif  // UI_BUTTON_H
\ No newline at end of file
+#endif  // UI_BUTTON_H
@@ -0,0 +1,215 @@
+// =======================================================================
+// debounce.h
+// =======================================================================
+// Declarations of our time-based debouncer, which Button and Switch share
+//
+// A GPIO edge interrupt (see gpio_edges.h) stamps each edge with its time
+// and the level the pin read after it. A level counts once the pin has
+// held it for debounce_us, judged from those times rather than from how
+// often update() runs, so contact bounce and glitches shorter than that
+// are ignored however slow the main loop is, and a press between two
+// updates isn't missed.
+//
+// The interrupt does the sorting: when an edge ends a level that held
+// long enough, and that differs from the last such level, it pushes the
+// level (and when it began) into a single-producer, single-consumer ring
+// for update() to take. Bounce never reaches the ring, so each entry is
+// a real change. The latest edge, whose level may not have held long
+// enough yet, is published apart under a sequence lock, and update()
+// checks it against the time. As in rx_queue.h, neither side takes a
+// lock: the producer only writes the head and the consumer only writes
+// the tail. If the ring fills, which takes RING_LEN changes between two
+// updates, new changes are dropped (and counted).
+//
+// This has no Pico dependencies, so the host tools use the same code
+
+#ifndef UI_DEBOUNCE_H
+#define UI_DEBOUNCE_H
+
+#include <cstdint>
+
+// Edges held (a power of two), and how long a level has to hold
+#define DEBOUNCE_RING_LEN 16
+#define DEBOUNCE_DEFAULT_US 20000
+
+typedef struct {
+  uint32_t time_us;
+  bool     level;  // The pin's level just after the edge
+} gpio_edge_t;
+
+template <int RING_LEN>
+class Debouncer {
+  static_assert( ( RING_LEN & ( RING_LEN - 1 ) ) == 0,
+                 "RING_LEN must be a power of two" );
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Public accessor functions
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ public:
+  Debouncer( uint32_t debounce_us = DEBOUNCE_DEFAULT_US )
+      : debounce_us( debounce_us ),
+        head( 0 ),
+        tail( 0 ),
+        drops( 0 ),
+        latest_seq( 0 ),
+        latest( { 0, false } ),
+        pushed( false ),
+        stable( false ),
+        changed_us( 0 ),
+        rose_( false ),
+        fell_( false )
+  {
+  }
+
+  // Start from level, with nothing pending (before the interrupt is
+  // enabled, so both sides' state is ours)
+  void reset( bool level, uint32_t now_us )
+  {
+    tail       = head;
+    latest     = { now_us, level };
+    pushed     = level;
+    stable     = level;
+    changed_us = now_us;
+    rose_      = false;
+    fell_      = false;
+  }
+
+  // Producer (the interrupt): an edge at time_us, after which the pin
+  // read level. Returns false (and counts a drop) if it ended a change
+  // the ring had no room for
+  bool push( uint32_t time_us, bool level )
+  {
+    bool ok = true;
+    if ( ( latest.level != pushed ) &&
+         ( time_us - latest.time_us >= debounce_us ) ) {
+      uint32_t h = head;
+      if ( h - __atomic_load_n( &tail, __ATOMIC_ACQUIRE ) == RING_LEN ) {
+        drops++;
+        ok = false;
+      }
+      else {
+        changes[h & ( RING_LEN - 1 )] = latest;
+        __atomic_store_n( &head, h + 1, __ATOMIC_RELEASE );
+        pushed = latest.level;
+      }
+    }
+
+    // Odd while it's being written
+    __atomic_store_n( &latest_seq, latest_seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    latest = { time_us, level };
+    __atomic_store_n( &latest_seq, latest_seq + 1, __ATOMIC_RELEASE );
+    return ok;
+  }
+
+  // Consumer: take the changes so far. Sets rose() and fell() if the
+  // debounced level went that way since the last update (both, for a
+  // press and release in between)
+  void update( uint32_t now_us )
+  {
+    rose_ = false;
+    fell_ = false;
+
+    uint32_t t = tail;
+    uint32_t h = __atomic_load_n( &head, __ATOMIC_ACQUIRE );
+    for ( ; t != h; t++ ) {
+      change( changes[t & ( RING_LEN - 1 )] );
+    }
+    __atomic_store_n( &tail, t, __ATOMIC_RELEASE );
+
+    // The latest level, if it's held long enough. The interrupt pushes
+    // it too once the next edge comes, which is then no change. It may
+    // have come after now_us
+    gpio_edge_t edge = latest_edge();
+    if ( (int32_t) ( now_us - edge.time_us ) >= (int32_t) debounce_us ) {
+      change( edge );
+    }
+  }
+
+  bool level() const
+  {
+    return stable;
+  }
+  bool rose() const
+  {
+    return rose_;
+  }
+  bool fell() const
+  {
+    return fell_;
+  }
+
+  // When the debounced level's last change began: the edge after which
+  // the pin held it
+  uint32_t last_change_us() const
+  {
+    return changed_us;
+  }
+
+  // Microseconds from now_us until a level the pin's holding counts, or
+  // 0 if none is pending
+  uint32_t pending_us( uint32_t now_us ) const
+  {
+    gpio_edge_t edge = latest_edge();
+    int32_t     held = now_us - edge.time_us;
+    if ( ( edge.level == stable ) || ( held >= (int32_t) debounce_us ) ) {
+      return 0;
+    }
+    return debounce_us - ( ( held > 0 ) ? held : 0 );
+  }
+
+  // Changes lost to a full ring (written by the producer only)
+  uint32_t dropped() const
+  {
+    return drops;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  // Protected attributes
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ private:
+  uint32_t debounce_us;
+
+  gpio_edge_t changes[RING_LEN];
+  uint32_t    head;   // Changes pushed (written by the producer only)
+  uint32_t    tail;   // Changes taken (written by the consumer only)
+  uint32_t    drops;  // Written by the producer only
+
+  // Written by the producer only
+  uint32_t    latest_seq;
+  gpio_edge_t latest;
+  bool        pushed;  // The last level pushed
+
+  bool     stable;  // The debounced level
+  uint32_t changed_us;
+  bool     rose_;
+  bool     fell_;
+
+  gpio_edge_t latest_edge() const
+  {
+    uint32_t    seq;
+    gpio_edge_t edge;
+    do {
+      seq  = __atomic_load_n( &latest_seq, __ATOMIC_ACQUIRE );
+      edge = latest;
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    } while ( ( seq & 1 ) ||
+              ( seq != __atomic_load_n( &latest_seq, __ATOMIC_RELAXED ) ) );
+    return edge;
+  }
+
+  void change( const gpio_edge_t& edge )
+  {
+    if ( edge.level != stable ) {
+      stable     = edge.level;
+      changed_us = edge.time_us;
+      rose_ |= stable;
+      fell_ |= !stable;
+    }
+  }
+};
+
+// What Button and Switch use, and the GPIO interrupt fills
+typedef Debouncer<DEBOUNCE_RING_LEN> GpioDebouncer;
+
+#endif  // UI_DEBOUNCE_H
@@ -0,0 +1,54 @@
+// =======================================================================
+// gpio_edges.cpp
+// =======================================================================
+// Definitions of our GPIO edge interrupts
+
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+#include "ui/gpio_edges.h"
+
+#define EDGES ( GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL )
+
+static GpioDebouncer* debouncers[NUM_BANK0_GPIOS];
+static uint32_t       attached_mask = 0;
+
+// Shared by every attached pin. The level is read here, rather than
+// taken from the edge's direction, so edges that come too close together
+// to tell apart still leave the right level
+static void gpio_edges_irq()
+{
+  uint32_t now_us = time_us_32();
+  for ( int gpio = 0; gpio < NUM_BANK0_GPIOS; gpio++ ) {
+    if ( !( attached_mask & ( 1u << gpio ) ) ) {
+      continue;
+    }
+    uint32_t events = gpio_get_irq_event_mask( gpio ) & EDGES;
+    if ( events ) {
+      gpio_acknowledge_irq( gpio, events );
+      debouncers[gpio]->push( now_us, gpio_get( gpio ) );
+    }
+  }
+}
+
+void gpio_edges_attach( int gpio, GpioDebouncer* debouncer )
+{
+  debouncer->reset( gpio_get( gpio ), time_us_32() );
+  debouncers[gpio] = debouncer;
+
+  // The raw mask is fixed when the handler's added, and the SDK's
+  // callback only leaves the pins in it alone, so add the handler again
+  // with every pin attached so far. Interrupts wait, so no edge comes in
+  // while it's gone
+  uint32_t status = save_and_disable_interrupts();
+  if ( attached_mask != 0 ) {
+    gpio_remove_raw_irq_handler_masked( attached_mask, gpio_edges_irq );
+  }
+  attached_mask |= 1u << gpio;
+  gpio_add_raw_irq_handler_masked( attached_mask, gpio_edges_irq );
+  restore_interrupts( status );
+
+  gpio_set_irq_enabled( gpio, EDGES, true );
+  irq_set_enabled( IO_IRQ_BANK0, true );
+}
@@ -0,0 +1,21 @@
+// =======================================================================
+// gpio_edges.h
+// =======================================================================
+// Declarations of our GPIO edge interrupts, which timestamp each edge on
+// an input pin and push it to the pin's debouncer (see debounce.h)
+//
+// One raw handler serves every attached pin. It's a shared handler beside
+// the SDK's default GPIO callback (which the radio's DIO pins use), and
+// runs before it, so it takes its pins' edges first. Its raw mask covers
+// every attached pin, so the default callback leaves them all alone
+
+#ifndef UI_GPIO_EDGES_H
+#define UI_GPIO_EDGES_H
+
+#include "ui/debounce.h"
+
+// Send gpio's edges to debouncer, from its current level on. The
+// debouncer has to outlive the interrupt
+void gpio_edges_attach( int gpio, GpioDebouncer* debouncer );
+
+#endif  // UI_GPIO_EDGES_H
@@ -2,12 +2,15 @@
 // state_machine.cpp
 // =======================================================================
 
+#include "ble/ble_lock.h"
 #include "encryption/encryption.h"
 #include "encryption/key.h"
 #include "pico/stdlib.h"
 #include "ui/state_machine.h"
 #include "utils/debug.h"
+#include <cinttypes>
 #include <stdio.h>
+#include <string.h>
 
 // -----------------------------------------------------------------------
 // Constructor
@@ -19,70 +22,128 @@ FSM::FSM( int button_gpio, int status_led_gpio, int error_led_gpio,
       status_led( status_led_gpio ),
       error_led( error_led_gpio ),
       power_led( power_led_gpio ),
+      cipher( readings_key ),
       curr_state( IDLE ),
-      time_since_start( 0 ),
-      last_transition_ms( 0 )
+      starting( true ),
+      start_ms( 0 ),
+      state_changed( false ),
+      last_transition_ms( 0 ),
+      omron_was_connected( false ),
+      curr_seq( -1 ),
+      uplink_frame_len( 0 ),
+      uplink_frame_seq( 0 ),
+      uplink_frame_count( 0 ),
+      uplink_frame_resend( false ),
+      uplink_header_len( 0 ),
+      uplink_sealed_len( 0 ),
+      uplink_sealed_fcnt( 0 ),
+      cumulative_acks( CUSTOM_LORAWAN_CUMULATIVE_ACKS ),
+      next_unsent( 0 ),
+      resend_from( 0 ),
+      resend_end( 0 ),
+      ack_wait_start_ms( 0 )
 {
   debug( "FSM start\n" );
 
+  // Our key was derived for one DevEUI (see key.h). Under any other, the
+  // server can't decrypt our readings
+  if ( lorawan.dev_eui() != READINGS_KEY_DEV_EUI ) {
+    printf( "[FSM] The readings key is for DevEUI %016" PRIx64
+            ", not ours (%016" PRIx64 "); provision this device\n",
+            (uint64_t) READINGS_KEY_DEV_EUI, lorawan.dev_eui() );
+  }
+
   power_led.on();
+
+  // Keep advertising our readings for a local sync between measurements,
+  // and pick up the cuff as soon as it advertises a new measurement
+  omron.keep_radio_on( true );
+  omron.start_background_sync();
+  server.start();
+
+  if ( cumulative_acks ) {
+    lorawan.on_port( SEQ_ACK_PORT, on_ack, this );
+  }
 }
 
 // -----------------------------------------------------------------------
 // State Transitions
 // -----------------------------------------------------------------------
 
+// Readings stay queued if we give up waiting, and are sent once we can
+#define TRANSMIT_TIMEOUT_MS 60000
+
+// When the error LED comes on, if we're still waiting
+#define MEASURE_ERROR_MS 15000
+#define TRANSMIT_ERROR_MS 20000
+
 fsm_state_t next_state( fsm_state_t curr_state, bool button_pressed,
-                        bool omron_done, bool lorawan_joined,
-                        bool lorawan_sent )
+                        bool omron_lost, bool omron_done,
+                        bool lorawan_joined, bool lorawan_sent,
+                        bool transmit_timeout )
 {
   // debug( "[FSM] Current State: %d (%d, %d, %d, %d)\n", curr_state,
   //        button_pressed, omron_done, lorawan_joined, lorawan_sent );
   switch ( curr_state ) {
     case IDLE:
-      return button_pressed ? START_MEASURE : IDLE;
+      // The background scan may have already brought new records in
+      if ( button_pressed ) {
+        return START_MEASURE;
+      }
+      return omron_done ? START_TRANSMIT : IDLE;
     case START_MEASURE:
-      return WAIT_MEASURE;
-    case WAIT_MEASURE:
       return omron_done ? START_TRANSMIT : WAIT_MEASURE;
+    case WAIT_MEASURE:
+      if ( omron_done ) {
+        return START_TRANSMIT;
+      }
+      return omron_lost ? IDLE : WAIT_MEASURE;
     case START_TRANSMIT:
+      if ( transmit_timeout ) {
+        return DONE;
+      }
       return lorawan_joined ? WAIT_TRANSMIT : START_TRANSMIT;
     case WAIT_TRANSMIT:
-      return lorawan_sent ? DONE : WAIT_TRANSMIT;
+      return ( lorawan_sent || transmit_timeout ) ? DONE : WAIT_TRANSMIT;
     case DONE:
-      return IDLE;
+      return omron_done ? START_TRANSMIT : IDLE;
     default:
       return IDLE;
   }
 }
 
 // -----------------------------------------------------------------------
-// pack_data
+// Queued readings
 // -----------------------------------------------------------------------
-// Packs our blood pressure data into an array of bytes
+// Readings are queued as codec_reading_t, and packed into frames as
+// they're sent
 
-uint8_t get_byte( uint16_t data, bool high )
-{
-  if ( high ) {
-    data = data >> 8;
-  }
-  return data & 0xFF;
-}
+static_assert( sizeof( codec_reading_t ) <= UPLINK_QUEUE_MAX_DATA,
+               "Queued readings must fit in a queue slot" );
 
-void pack_data( omron_data_t* unpacked_data, uint8_t packed_data[6] )
+codec_reading_t to_codec_reading( const omron_data_t& data )
 {
-  packed_data[0] = get_byte( unpacked_data->sys_pressure, true );
-  packed_data[1] = get_byte( unpacked_data->sys_pressure, false );
-  packed_data[2] = get_byte( unpacked_data->dia_pressure, true );
-  packed_data[3] = get_byte( unpacked_data->dia_pressure, false );
-  packed_data[4] = get_byte( unpacked_data->bpm, true );
-  packed_data[5] = get_byte( unpacked_data->bpm, false );
+  codec_reading_t reading;
+  reading.sys_pressure = data.sys_pressure;
+  reading.dia_pressure = data.dia_pressure;
+  reading.bpm          = data.bpm;
+  reading.timestamp    = data.timestamp;
+
+  // Sent flagged as out of range rather than as the nearest bound
+  if ( codec_out_of_range( &reading ) > 0 ) {
+    printf( "[FSM] Reading %d/%d, pulse %d is out of the codec's range\n",
+            data.sys_pressure, data.dia_pressure, data.bpm );
+  }
+  return reading;
 }
 
 // -----------------------------------------------------------------------
 // update
 // -----------------------------------------------------------------------
 
+// How long the button is ignored for after the first update
+#define FSM_STARTUP_MS 600
+
 void FSM::update()
 {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -92,69 +153,109 @@ void FSM::update()
   button.update();
   bool button_pressed = button.just_pressed();
 
-  if ( time_since_start < 300 ) {
-    time_since_start += 5;
-    return;  // Let start without a phantom button press
-             // from getting setup
+  // Let start without a phantom button press from getting setup
+  uint32_t curr_time = to_ms_since_boot( get_absolute_time() );
+  if ( starting ) {
+    if ( start_ms == 0 ) {
+      start_ms = curr_time;
+    }
+    if ( curr_time - start_ms < FSM_STARTUP_MS ) {
+      return;
+    }
+    starting = false;
   }
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Get Omron updates
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  bool omron_done = omron.omron_ready();
+  // BTstack runs in the background, so hold its lock while we use it,
+  // and only then: the queue's flash writes and the radio below would
+  // hold BTstack's events up. The background scan connects whenever the
+  // cuff advertises, so records can come in any state; take them all
+  omron_data_t records[OMRON_MAX_RECORDS];
+  int          num_records = 0;
+  bool         omron_connected;
+  {
+    BleLock ble_lock;
+
+    while ( ( num_records < OMRON_MAX_RECORDS ) &&
+            omron.omron_take_record( &records[num_records] ) ) {
+      server.add_reading( records[num_records] );
+      num_records++;
+    }
+    omron_connected = omron.discovered();
+
+    switch ( curr_state ) {
+      case START_MEASURE:
+        omron.connect_to_server();
+        break;
+      case DONE:
+        // After the records above, so none held are lost
+        omron.omron_reset();
+        break;
+      default:
+        break;
+    }
+  }
+
+  // A link that was up while we waited for a reading dropped without one
+  bool omron_done = ( num_records > 0 );
+  bool omron_lost = ( curr_state == WAIT_MEASURE ) && omron_was_connected &&
+                    !omron_connected && !omron_done;
+  omron_was_connected = omron_connected;
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Get LoRaWAN updates
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  bool lorawan_joined;
-  bool lorawan_sent;
+  bool lorawan_joined = false;
+  bool lorawan_sent    = false;
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Take action based on state
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  uint8_t ciphertext[16];
-  uint8_t packed_data[6];
-  pack_data( &curr_data, packed_data );
+  // Store each record until it's been sent, whatever the state
+  for ( int i = 0; i < num_records; i++ ) {
+    codec_reading_t reading = to_codec_reading( records[i] );
+    curr_seq = queue.enqueue( (const uint8_t*) &reading, sizeof( reading ) );
+  }
 
   switch ( curr_state ) {
-    case START_MEASURE:
-      omron.connect_to_server();
-      break;
-    case WAIT_MEASURE:
-      if ( omron_done ) {
-        curr_data = omron.curr_data;
-      }
-      break;
     case START_TRANSMIT:
       lorawan_joined = lorawan.try_join();
       break;
-    case WAIT_TRANSMIT:
-      aes128_encrypt_6byte_msg( lorawan_key, packed_data, ciphertext );
-      lorawan_sent = lorawan.try_send( packed_data, 6 );
-      break;
-    case DONE:
-      omron.omron_reset();
-      break;
     default:
       break;
   }
 
+  drain_queue();
+
+  // After draining, so we see a reading go out in the pass that sent it
+  // (no interrupt would wake us for another). Unconfirmed readings are
+  // acknowledged long after they're sent
+  if ( curr_state == WAIT_TRANSMIT ) {
+    lorawan_sent = ( curr_seq < 0 ) || queue.done( curr_seq ) ||
+                   ( cumulative_acks && ( curr_seq < next_unsent ) );
+  }
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Update LEDs
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  uint32_t curr_time     = to_ms_since_boot( get_absolute_time() );
   uint32_t time_in_state = curr_time - last_transition_ms;
 
+  // Each pattern is only set up when it changes (see LED_hw.h), and then
+  // runs on its own while we sleep
   switch ( curr_state ) {
     case START_MEASURE:
     case WAIT_MEASURE:
       status_led.on();
+      break;
     case START_TRANSMIT:
       status_led.blink( 250 );
+      break;
     case WAIT_TRANSMIT:
       status_led.blink( 750 );
       break;
@@ -165,7 +266,7 @@ void FSM::update()
 
   switch ( curr_state ) {
     case WAIT_MEASURE:
-      if ( ( time_in_state > 15000 ) & !omron.discovered() ) {
+      if ( ( time_in_state > MEASURE_ERROR_MS ) & !omron_connected ) {
         error_led.on();
       }
       else {
@@ -173,7 +274,7 @@ void FSM::update()
       }
       break;
     case WAIT_TRANSMIT:
-      if ( time_in_state > 20000 ) {
+      if ( time_in_state > TRANSMIT_ERROR_MS ) {
         error_led.blink( 500 );
       }
       else {
@@ -190,10 +291,365 @@ void FSM::update()
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
   fsm_state_t old_state = curr_state;
-  curr_state = next_state( curr_state, button_pressed, omron_done,
-                           lorawan_joined, lorawan_sent );
+  bool transmit_timeout = time_in_state > TRANSMIT_TIMEOUT_MS;
+  curr_state = next_state( curr_state, button_pressed, omron_lost,
+                           omron_done, lorawan_joined, lorawan_sent,
+                           transmit_timeout );
 
-  if ( old_state != curr_state ) {
+  state_changed = ( old_state != curr_state );
+  if ( state_changed ) {
     last_transition_ms = curr_time;
   }
 }
+
+// -----------------------------------------------------------------------
+// update_due_ms
+// -----------------------------------------------------------------------
+// Button edges, BTstack events and the radio all come with an interrupt
+// that wakes us, so only these deadlines need a timer. The telemetry
+// period and ACK_TIMEOUT_MS are hours long, so they're just checked at
+// least every FSM_MAX_SLEEP_MS
+
+#define FSM_MAX_SLEEP_MS 60000
+
+// Milliseconds until time_in_state passes limit_ms, or FSM_MAX_SLEEP_MS
+// once it has
+static uint32_t ms_until_past( uint32_t time_in_state, uint32_t limit_ms )
+{
+  if ( time_in_state > limit_ms ) {
+    return FSM_MAX_SLEEP_MS;
+  }
+  return MIN( limit_ms - time_in_state + 1, FSM_MAX_SLEEP_MS );
+}
+
+uint32_t FSM::update_due_ms()
+{
+  uint32_t curr_time = to_ms_since_boot( get_absolute_time() );
+  if ( starting ) {
+    uint32_t elapsed_ms = curr_time - start_ms;
+    return ( elapsed_ms < FSM_STARTUP_MS ) ? FSM_STARTUP_MS - elapsed_ms : 0;
+  }
+
+  // A new state does its first pass straight away
+  if ( state_changed ) {
+    return 0;
+  }
+
+  uint32_t time_in_state = curr_time - last_transition_ms;
+  uint32_t due_ms        = FSM_MAX_SLEEP_MS;
+  switch ( curr_state ) {
+    case WAIT_MEASURE:
+      due_ms = ms_until_past( time_in_state, MEASURE_ERROR_MS );
+      break;
+    case START_TRANSMIT:
+      due_ms = ms_until_past( time_in_state, TRANSMIT_TIMEOUT_MS );
+      break;
+    case WAIT_TRANSMIT:
+      due_ms = MIN( ms_until_past( time_in_state, TRANSMIT_ERROR_MS ),
+                    ms_until_past( time_in_state, TRANSMIT_TIMEOUT_MS ) );
+      break;
+    default:
+      break;
+  }
+
+  // LoRaWAN starting again after a failure, and a frame the scheduler
+  // held back
+  due_ms = MIN( due_ms, lorawan.init_retry_ms() );
+  if ( uplink_frame_len > 0 ) {
+    due_ms = MIN( due_ms, lorawan.send_retry_ms() );
+  }
+  return due_ms;
+}
+
+// -----------------------------------------------------------------------
+// drain_queue
+// -----------------------------------------------------------------------
+// Keep joining in the background, so readings left from a reboot, a
+// failed join or an outage go out as soon as we can send them
+
+void FSM::drain_queue()
+{
+  if ( !lorawan.try_join() ) {
+    return;
+  }
+
+  // ACKs go to their handler; take anything else, so it doesn't hold
+  // them up
+  uint8_t downlink[RX_QUEUE_MAX_LEN];
+  uint8_t port;
+  int     len = lorawan.receive( downlink, sizeof( downlink ), &port );
+  if ( len >= 0 ) {
+    debug( "[FSM] Ignoring a %d byte downlink on port %d\n", len, port );
+  }
+
+  if ( cumulative_acks ) {
+    drain_unconfirmed();
+  }
+  else {
+    drain_confirmed();
+  }
+
+  // Telemetry only goes out when readings aren't waiting
+  if ( uplink_frame_len == 0 ) {
+    lorawan.try_send_telemetry();
+  }
+}
+
+// -----------------------------------------------------------------------
+// pack_frame
+// -----------------------------------------------------------------------
+// Pack as many of the oldest readings (from min_seq, and before end_seq)
+// as fit into the next frame. With a header, they must have consecutive
+// sequence numbers so the header can describe them all. Returns the
+// number of readings packed
+
+int FSM::pack_frame( uint32_t min_seq, uint32_t end_seq, bool with_header )
+{
+  uplink_entry_t  entries[CODEC_MAX_READINGS];
+  codec_reading_t readings[CODEC_MAX_READINGS];
+
+  int header_len = with_header ? SEQ_ACK_HEADER_LEN : 0;
+  int max_len    = lorawan.max_payload() - header_len;
+
+  // Leave room for what encryption adds (see seal_frame)
+  if ( ENCRYPT_READINGS == ENCRYPT_ECB ) {
+    max_len = max_len / AES_BLOCK_LEN * AES_BLOCK_LEN;
+  }
+  else if ( ENCRYPT_READINGS == ENCRYPT_CCM ) {
+    max_len -= AES_CCM_MIC_LEN;
+  }
+
+  uplink_frame_len = 0;
+  queue.release();
+  int num_entries = queue.peek( entries, CODEC_MAX_READINGS, min_seq );
+
+  int num_usable = 0;
+  while ( ( num_usable < num_entries ) &&
+          ( entries[num_usable].seq < end_seq ) &&
+          ( !with_header ||
+            ( entries[num_usable].seq == entries[0].seq + num_usable ) ) ) {
+    memset( &readings[num_usable], 0, sizeof( codec_reading_t ) );
+    memcpy( &readings[num_usable], entries[num_usable].data,
+            entries[num_usable].length );
+    num_usable++;
+  }
+
+  int frame_len  = 0;
+  int num_packed = 0;
+  if ( ( num_usable > 0 ) && ( max_len > 0 ) ) {
+    num_packed = codec_encode( readings, num_usable,
+                               uplink_frame + header_len, max_len,
+                               &frame_len );
+  }
+
+  // If not even one reading fits with the encryption overhead, send one
+  // anyway, and the data rate goes up to carry it
+  if ( ( num_usable > 0 ) && ( num_packed == 0 ) &&
+       ( ENCRYPT_READINGS != ENCRYPT_NONE ) ) {
+    num_packed = codec_encode( readings, 1, uplink_frame + header_len,
+                               CODEC_MAX_FRAME - header_len, &frame_len );
+  }
+
+  // Only the packed readings are in flight; the rest wait their turn
+  if ( num_packed < num_entries ) {
+    queue.release();
+    queue.peek( entries, num_packed, min_seq );
+  }
+  if ( num_packed == 0 ) {
+    return 0;
+  }
+
+  if ( with_header ) {
+    seq_ack_write_header( uplink_frame, entries[0].seq );
+  }
+  uplink_frame_len   = header_len + frame_len;
+  uplink_header_len  = header_len;
+  uplink_sealed_len  = 0;
+  uplink_frame_seq   = entries[0].seq;
+  uplink_frame_count = num_packed;
+  debug( "[FSM] Sending %d of %lu queued readings in %d bytes\n",
+         num_packed, queue.depth(), uplink_frame_len );
+  return num_packed;
+}
+
+// -----------------------------------------------------------------------
+// seal_frame
+// -----------------------------------------------------------------------
+// Encrypt the packed frame for the uplink it goes out in (see
+// encryption.h), and return its length. The header stays in the clear
+// for the server, but under the MIC. With CCM*, the nonce is the
+// uplink's frame counter, so the frame is only sealed again when that
+// moves on (for a resend), not on every tick
+
+int FSM::seal_frame()
+{
+  uint32_t dev_addr = 0;
+  uint32_t fcnt_up  = 0;
+  if ( ENCRYPT_READINGS == ENCRYPT_CCM ) {
+    lorawan.next_uplink( &dev_addr, &fcnt_up );
+  }
+  if ( ( uplink_sealed_len > 0 ) && ( fcnt_up == uplink_sealed_fcnt ) ) {
+    return uplink_sealed_len;
+  }
+
+  int      data_len = uplink_frame_len - uplink_header_len;
+  uint8_t* data     = uplink_sealed + uplink_header_len;
+  memcpy( uplink_sealed, uplink_frame, uplink_frame_len );
+  if ( ENCRYPT_READINGS == ENCRYPT_ECB ) {
+    data_len = cipher.encrypt( data, data_len );
+  }
+  else if ( ENCRYPT_READINGS == ENCRYPT_CCM ) {
+    data_len = cipher.seal( dev_addr, fcnt_up, uplink_sealed,
+                            uplink_header_len, data, data_len );
+  }
+  uplink_sealed_len  = uplink_header_len + data_len;
+  uplink_sealed_fcnt = fcnt_up;
+  return uplink_sealed_len;
+}
+
+// -----------------------------------------------------------------------
+// drain_confirmed
+// -----------------------------------------------------------------------
+
+void FSM::drain_confirmed()
+{
+  if ( ( uplink_frame_len == 0 ) &&
+       ( pack_frame( 0, UINT32_MAX, false ) == 0 ) ) {
+    return;
+  }
+
+  if ( lorawan.try_send( uplink_sealed, seal_frame() ) ) {
+    queue.ack();
+    uplink_frame_len = 0;
+  }
+}
+
+// -----------------------------------------------------------------------
+// drain_unconfirmed
+// -----------------------------------------------------------------------
+// New readings go out as soon as the scheduler allows, and the gaps an
+// ACK reports are resent. If we've heard nothing for ACK_TIMEOUT_MS since
+// the last new reading, we resend the oldest outstanding readings; the
+// server answers a duplicate with an ACK, which tells us any other gaps
+
+#define ACK_TIMEOUT_MS ( 6 * 60 * 60 * 1000 )
+
+void FSM::drain_unconfirmed()
+{
+  uint32_t now_ms = to_ms_since_boot( get_absolute_time() );
+
+  if ( uplink_frame_len == 0 ) {
+    uplink_frame_resend = true;
+    if ( pack_frame( resend_from, resend_end, true ) == 0 ) {
+      uplink_frame_resend = false;
+      if ( pack_frame( next_unsent, UINT32_MAX, true ) == 0 ) {
+        // Everything's been sent; wait for an ACK before probing
+        if ( ( queue.depth() == 0 ) ||
+             ( now_ms - ack_wait_start_ms < ACK_TIMEOUT_MS ) ) {
+          return;
+        }
+        debug( "[FSM] No ACK for %lu readings; resending\n",
+               queue.depth() );
+        ack_wait_start_ms   = now_ms;
+        uplink_frame_resend = true;
+        if ( pack_frame( 0, next_unsent, true ) == 0 ) {
+          return;
+        }
+      }
+    }
+  }
+
+  if ( !lorawan.try_send_unconfirmed( uplink_sealed, seal_frame(),
+                                      SEQ_ACK_PORT ) ) {
+    return;
+  }
+
+  uint32_t after = uplink_frame_seq + uplink_frame_count;
+  if ( uplink_frame_resend ) {
+    resend_from = after;
+  }
+  else {
+    // New readings don't back off; only resends do
+    next_unsent       = after;
+    ack_wait_start_ms = now_ms;
+    lorawan.reset_backoff();
+  }
+  queue.release();
+  uplink_frame_len = 0;
+}
+
+// -----------------------------------------------------------------------
+// apply_ack
+// -----------------------------------------------------------------------
+
+static bool ack_covers( uint32_t seq, const void* ack )
+{
+  return seq_ack_covers( (const seq_ack_t*) ack, seq );
+}
+
+void FSM::on_ack( const uint8_t* data, uint8_t len, void* fsm )
+{
+  ( (FSM*) fsm )->apply_ack( data, len );
+}
+
+void FSM::apply_ack( const uint8_t* downlink, int len )
+{
+  seq_ack_t ack;
+  if ( seq_ack_decode( downlink, len, &ack ) < 0 ) {
+    debug( "[FSM] Ignoring an invalid ACK (%d bytes)\n", len );
+    return;
+  }
+
+  int num_acked = queue.ack_matching( ack_covers, &ack );
+
+  // Resend whatever the server is missing below the newest reading it has
+  resend_from = 0;
+  resend_end  = seq_ack_expand( seq_ack_horizon( &ack ), next_unsent );
+  if ( resend_end > next_unsent ) {
+    resend_end = next_unsent;
+  }
+
+  if ( num_acked > 0 ) {
+    lorawan.reset_backoff();
+  }
+  ack_wait_start_ms = to_ms_since_boot( get_absolute_time() );
+
+  // The frame we were about to send may be out of date
+  queue.release();
+  uplink_frame_len = 0;
+
+  debug( "[FSM] ACK up to %u: %d readings acknowledged, %lu pending\n",
+         ack.next_expected, num_acked, queue.depth() );
+}
+
+// -----------------------------------------------------------------------
+// process_lorawan
+// -----------------------------------------------------------------------
+
+uint32_t FSM::process_lorawan()
+{
+  return lorawan.process();
+}
+
+// -----------------------------------------------------------------------
+// input_pending_ms
+// -----------------------------------------------------------------------
+
+uint32_t FSM::input_pending_ms() const
+{
+  return ( button.pending_us() + 999 ) / 1000;
+}
+
+void FSM::print_stats()
+{
+  queue.print_stats();
+  lorawan.print_stats();
+
+  uint32_t delivered = queue.stats().acked;
+  uint32_t downlinks = lorawan.downlinks();
+  printf( "[FSM] %s: %lu downlinks for %lu readings delivered (%.2f per "
+          "reading)\n",
+          cumulative_acks ? "Cumulative ACKs" : "Confirmed uplinks",
+          downlinks, delivered,
+          delivered ? (float) downlinks / delivered : 0.0f );
+}
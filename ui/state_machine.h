@@ -7,7 +7,11 @@
 #define UI_STATE_MACHINE_H
 
 #include "ble/omron.h"
+#include "ble/server.h"
+#include "lorawan/codec.h"
 #include "lorawan/lorawan.h"
+#include "lorawan/seq_ack.h"
+#include "lorawan/uplink_queue.h"
 #include "ui/LED_hw.h"
 #include "ui/button.h"
 #include "ui/switch.h"
@@ -37,22 +41,73 @@ class FSM {
        int power_led_gpio );
   void update();
 
+  // Run the LoRaWAN MAC. Returns the milliseconds until it next needs to
+  // run (see LoRaWAN::process)
+  uint32_t process_lorawan();
+
+  // Milliseconds until a button press under way counts, so update()
+  // sees it then, or 0 if none is
+  uint32_t input_pending_ms() const;
+
+  // Milliseconds until update() has something to do that no interrupt
+  // will wake us for: a timeout, an LED to change, or a LoRaWAN retry
+  uint32_t update_due_ms();
+
+  // Print the state of the uplink queue
+  void print_stats();
+
  private:
-  Button      button;      // GPIO pin number for the button
-  LED_hw      status_led;  // GPIO pin number for the first LED
-  LED_hw      error_led;   // GPIO pin number for the second LED
-  LED_hw      power_led;   // GPIO pin number for the power LED
-  Omron       omron;       // Omron device for blood pressure measurement
-  LoRaWAN     lorawan;     // LoRaWAN device for data transmission
-  fsm_state_t curr_state = IDLE;
+  Button        button;      // GPIO pin number for the button
+  LED_hw        status_led;  // GPIO pin number for the first LED
+  LED_hw        error_led;   // GPIO pin number for the second LED
+  LED_hw        power_led;   // GPIO pin number for the power LED
+  Omron         omron;       // Omron device for blood pressure measurement
+  ReadingServer server;      // GATT server for local sync of readings
+  LoRaWAN       lorawan;     // LoRaWAN device for data transmission
+  UplinkQueue   queue;       // Readings waiting to be sent over LoRaWAN
+  AesContext    cipher;      // Encrypts readings with the device's key
+  fsm_state_t   curr_state = IDLE;
+
+  // Send queued readings whenever we're joined
+  void drain_queue();
+  void drain_confirmed();
+  void drain_unconfirmed();
+  int  pack_frame( uint32_t min_seq, uint32_t end_seq, bool with_header );
+  int  seal_frame();
+  void apply_ack( const uint8_t* downlink, int len );
+  static void on_ack( const uint8_t* data, uint8_t len, void* fsm );
 
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Protected attributes
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  int          time_since_start;
-  uint32_t     last_transition_ms;
-  omron_data_t curr_data;
+  bool     starting;             // Ignoring the button while it settles
+  uint32_t start_ms;             // From our first update()
+  bool     state_changed;        // In the last update()
+  uint32_t last_transition_ms;
+  bool     omron_was_connected;  // In the last update()
+  int64_t  curr_seq;             // Queue entry for the newest reading
+
+  // Frame of queued readings being sent (empty if none)
+  uint8_t  uplink_frame[CODEC_MAX_FRAME];
+  int      uplink_frame_len;
+  uint32_t uplink_frame_seq;     // Sequence number of its first reading
+  int      uplink_frame_count;   // Readings in it
+  bool     uplink_frame_resend;  // Whether it's been sent before
+  int      uplink_header_len;    // Cumulative ACK header, if any
+
+  // The frame as it goes out: encrypted, for the frame counter it was
+  // sealed for (empty if it needs sealing)
+  uint8_t  uplink_sealed[CODEC_MAX_FRAME + AES_BLOCK_LEN];
+  int      uplink_sealed_len;
+  uint32_t uplink_sealed_fcnt;
+
+  // Unconfirmed uplinks with cumulative ACKs (see seq_ack.h)
+  bool     cumulative_acks;
+  uint32_t next_unsent;        // Readings from here on haven't been sent
+  uint32_t resend_from;        // Readings to resend (the gaps in an ACK)
+  uint32_t resend_end;
+  uint32_t ack_wait_start_ms;  // When we started waiting for an ACK
 };
 
 #endif  // UI_STATE_MACHINE_H
\ No newline at end of file
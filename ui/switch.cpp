@@ -5,76 +5,48 @@
 
 #include "ui/switch.h"
 #include "pico/stdlib.h"
-#include <stdio.h>
+#include "ui/gpio_edges.h"
 #include "utils/debug.h"
+#include <stdio.h>
 
 // -----------------------------------------------------------------------
 // Constructor
 // -----------------------------------------------------------------------
 
-Switch::Switch(int gpio_num) : gpio_num(gpio_num), curr_state(NotFlipped)
+Switch::Switch( int gpio_num ) : gpio_num( gpio_num )
 {
-    debug("Switch start\n");
-    stdio_init_all();
-    printf("Switch GPIO %d\n", gpio_num);
-
-    gpio_init(gpio_num);
-    gpio_set_dir(gpio_num, GPIO_IN);
-    gpio_pull_up(gpio_num); // Enable internal pull-up resistor
-    debug("Switch end\n");
+  debug( "[Switch] Initializing switch with gpio %d...\n", gpio_num );
+  gpio_init( gpio_num );
+  gpio_set_dir( gpio_num, GPIO_IN );
+  gpio_pull_up( gpio_num );  // Enable internal pull-up resistor
+  gpio_edges_attach( gpio_num, &debouncer );
 }
 
 // -----------------------------------------------------------------------
-// State Transitions
-// -----------------------------------------------------------------------
-
-switch_state_t next_state(switch_state_t curr_state, bool is_flipped)
-{
-    switch (curr_state)
-    {
-    case NotFlipped:
-        return is_flipped ? MaybeFlipped : NotFlipped;
-
-    case MaybeFlipped:
-        return is_flipped ? Flipped : NotFlipped;
-
-    case Flipped:
-        return is_flipped ? Flipped : MaybeNotFlipped;
-
-    case MaybeNotFlipped:
-        return is_flipped ? Flipped : NotFlipped;
-
-    default:
-        return NotFlipped;
-    }
-}
-
-// -----------------------------------------------------------------------
-// Pressing
+// Flipping
 // -----------------------------------------------------------------------
 
 void Switch::update()
 {
-  bool physical_flipped = gpio_get(gpio_num) == 0;
-  switch_state_t next = next_state(curr_state, physical_flipped);
-
-  justFlipped = ((curr_state == MaybeFlipped) && next == Flipped);
-  justUnflipped = ((curr_state == Flipped) && next == MaybeNotFlipped);
-
-  curr_state = next;
+  debouncer.update( time_us_32() );
 }
 
 bool Switch::is_flipped() const
 {
-  return curr_state == Flipped;
+  return !debouncer.level();
 }
 
 bool Switch::just_flipped() const
 {
-  return justFlipped;
+  return debouncer.fell();
 }
 
 bool Switch::just_unflipped() const
 {
-  return justUnflipped;
-}
\ No newline at end of file
+  return debouncer.rose();
+}
+
+uint32_t Switch::last_change_us() const
+{
+  return debouncer.last_change_us();
+}
@@ -2,16 +2,14 @@
 // switch.h
 // =======================================================================
 // Declaration of the switch utilities
+//
+// Like Button, the switch's edges come in by interrupt and are debounced
+// by time (see debounce.h)
 
 #ifndef UI_SWITCH_H
 #define UI_SWITCH_H
 
-enum switch_state_t {
-  NotFlipped,
-  MaybeFlipped,
-  Flipped,
-  MaybeNotFlipped,
-};
+#include "ui/debounce.h"
 
 class Switch {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -21,19 +19,18 @@ class Switch {
   Switch( int gpio_num );
   void update();
   bool is_flipped() const;
-  bool just_flipped() const;
+  bool just_flipped() const;  // Since the last update
   bool just_unflipped() const;
 
+  // When the latest flip began (time_us_32)
+  uint32_t last_change_us() const;
+
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   // Protected attributes
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
  private:
-  int gpio_num;  // GPIO pin number for the switch
-  switch_state_t curr_state = NotFlipped;
-  bool prev_physical = false;
-  bool justFlipped = false;
-  bool justUnflipped = false;
+  int           gpio_num;   // GPIO pin number for the switch
+  GpioDebouncer debouncer;  // Of the pin's level; low is flipped
 };
 
-#endif  // UI_SWITCH_H
\ No newline at end of file
+#endif  // UI_SWITCH_H
@@ -0,0 +1,86 @@
+// =======================================================================
+// flash.cpp
+// =======================================================================
+// Definitions of helpers for storing our own data in on-board flash
+
+#include "utils/flash.h"
+#include "hardware/regs/addressmap.h"
+#include "pico/flash.h"
+#include "pico/stdlib.h"
+#include <string.h>
+
+// End of the program in flash, from the linker script
+extern char __flash_binary_end;
+
+// -----------------------------------------------------------------------
+// Operations run with flash access locked out
+// -----------------------------------------------------------------------
+
+typedef struct {
+  uint32_t       offset;
+  const uint8_t* data;
+} flash_op_t;
+
+static void do_erase( void* param )
+{
+  flash_op_t* op = (flash_op_t*) param;
+  flash_range_erase( op->offset, FLASH_SECTOR_SIZE );
+}
+
+static void do_program( void* param )
+{
+  flash_op_t* op = (flash_op_t*) param;
+  flash_range_program( op->offset, op->data, FLASH_PAGE_SIZE );
+}
+
+// -----------------------------------------------------------------------
+// Layout check
+// -----------------------------------------------------------------------
+// With BTstack and the CYW43 firmware linked in, the program can grow
+// into our regions, and writing them would then corrupt its code
+
+static void check_layout()
+{
+  uint32_t binary_end = (uint32_t) &__flash_binary_end - XIP_BASE;
+  if ( binary_end > FLASH_REGIONS_START ) {
+    panic( "Program (ends at 0x%lx) overlaps our flash regions (from "
+           "0x%lx)",
+           (unsigned long) binary_end, (unsigned long) FLASH_REGIONS_START );
+  }
+}
+
+// -----------------------------------------------------------------------
+// Access
+// -----------------------------------------------------------------------
+
+const uint8_t* flash_read( uint32_t offset )
+{
+  return (const uint8_t*) ( XIP_BASE + offset );
+}
+
+bool flash_erase_sector( uint32_t offset )
+{
+  check_layout();
+  flash_op_t op = { offset, nullptr };
+  return flash_safe_execute( do_erase, &op, UINT32_MAX ) == PICO_OK;
+}
+
+bool flash_program_page( uint32_t offset, const uint8_t* data )
+{
+  check_layout();
+  flash_op_t op = { offset, data };
+  return flash_safe_execute( do_program, &op, UINT32_MAX ) == PICO_OK;
+}
+
+bool flash_program( uint32_t offset, const uint8_t* data, uint32_t len )
+{
+  uint32_t page_offset = offset % FLASH_PAGE_SIZE;
+  if ( page_offset + len > FLASH_PAGE_SIZE ) {
+    return false;
+  }
+
+  uint8_t page[FLASH_PAGE_SIZE];
+  memset( page, 0xFF, FLASH_PAGE_SIZE );
+  memcpy( page + page_offset, data, len );
+  return flash_program_page( offset - page_offset, page );
+}
@@ -0,0 +1,81 @@
+// =======================================================================
+// flash.h
+// =======================================================================
+// Declarations of helpers for storing our own data in on-board flash
+//
+// The top of flash already belongs to other libraries, so our regions
+// are carved out below them:
+//
+//   | ... program ... | our regions | BTstack bonds | LoRaWAN NVM |
+//                                    (2 sectors)     (1 sector)
+//
+// The LoRaWAN library's NVM sector is rewritten in place, so we keep our
+// own copy of the session (see lorawan/session_store.h) and only fall
+// back to the library's if ours is missing
+
+#ifndef UTILS_FLASH_H
+#define UTILS_FLASH_H
+
+#include "hardware/flash.h"
+#include <cstdint>
+
+// -----------------------------------------------------------------------
+// Flash layout
+// -----------------------------------------------------------------------
+
+// Sectors at the top of flash used by BTstack and the LoRaWAN library
+#define FLASH_RESERVED_TOP_SECTORS 3
+
+// End of the regions we own
+#define FLASH_REGIONS_END \
+  ( PICO_FLASH_SIZE_BYTES - FLASH_RESERVED_TOP_SECTORS * FLASH_SECTOR_SIZE )
+
+// Store-and-forward uplink queue
+#define UPLINK_QUEUE_SECTORS 16
+#define UPLINK_QUEUE_OFFSET \
+  ( FLASH_REGIONS_END - UPLINK_QUEUE_SECTORS * FLASH_SECTOR_SIZE )
+
+// LoRaWAN session (two copies, written alternately)
+#define LORAWAN_SESSION_COPY_SECTORS 2
+#define LORAWAN_SESSION_SECTORS ( 2 * LORAWAN_SESSION_COPY_SECTORS )
+#define LORAWAN_SESSION_OFFSET \
+  ( UPLINK_QUEUE_OFFSET - LORAWAN_SESSION_SECTORS * FLASH_SECTOR_SIZE )
+
+// US915 sub-band learned from the last join (a log of small records)
+#define JOIN_SUBBAND_SECTORS 1
+#define JOIN_SUBBAND_OFFSET \
+  ( LORAWAN_SESSION_OFFSET - JOIN_SUBBAND_SECTORS * FLASH_SECTOR_SIZE )
+
+// LoRaWAN frame counters, logged against the stored session between
+// rewrites of it (a log of small records)
+#define LORAWAN_COUNTER_LOG_SECTORS 1
+#define LORAWAN_COUNTER_LOG_OFFSET \
+  ( JOIN_SUBBAND_OFFSET - LORAWAN_COUNTER_LOG_SECTORS * FLASH_SECTOR_SIZE )
+
+// Start of the regions we own (the lowest). The program has to end
+// below it, which the writes below check, as the link doesn't
+#define FLASH_REGIONS_START LORAWAN_COUNTER_LOG_OFFSET
+
+// -----------------------------------------------------------------------
+// Access
+// -----------------------------------------------------------------------
+// All offsets are from the start of flash. Writes are made safely with
+// respect to interrupts (and the other core, if it's running), and
+// return whether they succeeded. They panic if the program runs into our
+// regions, rather than overwrite it
+
+// Read-only pointer to flash contents (through XIP)
+const uint8_t* flash_read( uint32_t offset );
+
+// Erase the sector starting at offset (sector-aligned)
+bool flash_erase_sector( uint32_t offset );
+
+// Program the page starting at offset (page-aligned, FLASH_PAGE_SIZE
+// bytes). Bits can only be cleared, so 0xFF bytes leave flash unchanged
+bool flash_program_page( uint32_t offset, const uint8_t* data );
+
+// Program len bytes at offset, which must all lie within one page. The
+// rest of the page is left unchanged
+bool flash_program( uint32_t offset, const uint8_t* data, uint32_t len );
+
+#endif  // UTILS_FLASH_H